@@ -6,6 +6,7 @@
  * - JSON serialization
  * - Object manipulation
  * - JSON patching
+ * - Chunked (incremental) parsing
  *
  * Copyright (C) 2025 Mehran Toosi
  * Licensed under GPL-2.0
@@ -254,13 +255,13 @@ static void test_array_handling(void)
     if (json->type == JSONK_VALUE_OBJECT) {
         struct jsonk_member *items_member = jsonk_object_find_member(&json->u.object, "items", 5);
         if (items_member && items_member->value->type == JSONK_VALUE_ARRAY) {
-            printk(KERN_INFO "Found items array with %zu elements\n", 
+            printk(KERN_INFO "Found items array with %u elements\n", 
                    items_member->value->u.array.size);
         }
         
         struct jsonk_member *names_member = jsonk_object_find_member(&json->u.object, "names", 5);
         if (names_member && names_member->value->type == JSONK_VALUE_ARRAY) {
-            printk(KERN_INFO "Found names array with %zu elements\n", 
+            printk(KERN_INFO "Found names array with %u elements\n", 
                    names_member->value->u.array.size);
         }
     }
@@ -275,6 +276,45 @@ static void test_array_handling(void)
     printk(KERN_INFO "Array handling test completed\n\n");
 }
 
+static void test_chunked_parsing(void)
+{
+    /* The document arrives split mid-key, mid-string and mid-number */
+    const char *chunks[] = { "{\"na", "me\":\"Meh", "ran\",\"age\":3", "0,\"tags\":[tr", "ue]}" };
+    struct jsonk_parser parser;
+    struct jsonk_value *json;
+    char buffer[256];
+    size_t written;
+    size_t i;
+    
+    printk(KERN_INFO "=== Testing Chunked Parsing ===\n");
+    
+    if (jsonk_parser_start(&parser, 0) < 0) {
+        printk(KERN_ERR "Failed to start chunked parse\n");
+        return;
+    }
+    
+    for (i = 0; i < ARRAY_SIZE(chunks); i++) {
+        if (jsonk_parser_feed(&parser, chunks[i], strlen(chunks[i])) < 0) {
+            printk(KERN_ERR "Chunk %zu rejected\n", i);
+            break;
+        }
+    }
+    
+    // Finish also cleans up after a failed feed
+    json = jsonk_parser_finish(&parser);
+    if (!json) {
+        printk(KERN_ERR "Failed to parse chunked JSON\n");
+        return;
+    }
+    
+    if (jsonk_serialize(json, buffer, sizeof(buffer), &written) == 0) {
+        printk(KERN_INFO "Reassembled: %.*s\n", (int)written, buffer);
+    }
+    
+    jsonk_value_put(json);
+    printk(KERN_INFO "Chunked parsing test completed\n\n");
+}
+
 static void test_path_based_access(void)
 {
     const char *json_str = "{\"user\":{\"profile\":{\"name\":\"Mehran\",\"age\":30},\"settings\":{\"theme\":\"dark\"}}}";
@@ -429,6 +469,7 @@ static int __init jsonk_example_init(void)
     test_json_patching();
     test_removal_patching();
     test_array_handling();
+    test_chunked_parsing();
     test_path_based_access();
     test_removal_verification();
     test_multithreading_example();
@@ -19,19 +19,33 @@
 #include <linux/types.h>
 #include <linux/list.h>
 #include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu-refcount.h>
 #include <linux/atomic.h>
 #include <linux/vmalloc.h>
 #include <linux/bitmap.h>
+#include <linux/stringhash.h>
 
-/* Maximum nesting depth for JSON structures */
+/* Default maximum nesting depth, changed at runtime with the max_depth module parameter */
 #define JSONK_MAX_DEPTH 32
+#define JSONK_DEPTH_LIMIT 1024                     /* Highest max_depth accepted */
+#define JSONK_NEST_INLINE 8                        /* Levels a tree walk keeps on the kernel stack */
 
-/* Security limits to prevent DoS attacks */
+/* Security limits to prevent DoS attacks, defaults for struct jsonk_parse_opts */
 #define JSONK_MAX_STRING_LENGTH (1024 * 1024)      /* 1MB max string */
 #define JSONK_MAX_ARRAY_SIZE 10000                 /* Max array elements */
 #define JSONK_MAX_OBJECT_MEMBERS 1000              /* Max object members */
+#define JSONK_MAX_STRINGS 10000                    /* Max string values per parse */
 #define JSONK_MAX_TOTAL_MEMORY (64 * 1024 * 1024)  /* 64MB total memory per parse */
 #define JSONK_MAX_KEY_LENGTH 256                   /* Max object key length */
+#define JSONK_NUMBER_BUF 21                        /* Longest 64-bit integer text, with sign */
+
+/* Objects with at least this many members get a hash index */
+#define JSONK_OBJECT_INDEX_THRESHOLD 8
+
+/* Documents this large are parsed through a structural index first */
+#define JSONK_INDEX_PARSE_THRESHOLD (64 * 1024)
 
 /* Maximum length of a JSON path representation */
 #define JSONK_MAX_PATH_LEN 256
@@ -39,6 +53,51 @@
 /* Size threshold for using vmalloc instead of kmalloc */
 #define JSONK_LARGE_ALLOC_THRESHOLD (2 * 1024 * 1024) // 2MB
 
+/* Arena chunk geometry for arena-backed documents */
+#define JSONK_ARENA_CHUNK_ORDER 0      /* Page-sized chunks */
+#define JSONK_ARENA_CHUNK_SIZE (PAGE_SIZE << JSONK_ARENA_CHUNK_ORDER)
+#define JSONK_ARENA_LARGE_THRESHOLD (JSONK_ARENA_CHUNK_SIZE / 4) /* Bigger blocks are allocated separately */
+
+/* Chunks kept per CPU for JSONK_PARSE_POOL, default of the pool_chunks module parameter */
+#define JSONK_POOL_CHUNKS 16
+
+/* Keys shared through JSONK_PARSE_INTERN, default of the intern_keys module parameter */
+#define JSONK_INTERN_KEYS 4096
+
+/*
+ * Input bytes each worker of jsonk_parse_batch() or JSONK_PARSE_PARALLEL
+ * should have; smaller inputs are parsed by the caller alone
+ */
+#define JSONK_BATCH_WORKER_BYTES (16 * 1024)
+
+/* Value flags */
+#define JSONK_VALUE_F_ARENA 0x01     /* Node lives in a document arena */
+#define JSONK_VALUE_F_BORROWED 0x02  /* String or decimal text points into the parsed input */
+#define JSONK_VALUE_F_INLINE 0x04    /* String or decimal text is stored inside the node */
+
+/* Short keys are stored inside the member itself */
+#define JSONK_MEMBER_INLINE_KEY 16
+
+/* Member flags */
+#define JSONK_MEMBER_F_BORROWED 0x01 /* Key points into the parsed input */
+#define JSONK_MEMBER_F_INTERNED 0x02 /* Key is shared from the interned key table */
+
+/* Parse flags for jsonk_parse_flags() */
+#define JSONK_PARSE_ARENA  0x01  /* Allocate the document from an arena */
+#define JSONK_PARSE_BORROW 0x02  /* Reference unescaped strings and keys in the input */
+#define JSONK_PARSE_POOL   0x04  /* Arena drawn only from the per-CPU chunk pools, never sleeps */
+#define JSONK_PARSE_PARALLEL 0x08 /* Parse the elements of a large root array on several CPUs */
+#define JSONK_PARSE_INTERN 0x10  /* Share keys with other documents through the interned key table */
+
+/* Limits a parse has to check; inputs too short to reach a limit skip it */
+#define JSONK_CHECK_MEMORY 0x01  /* max_memory */
+#define JSONK_CHECK_COUNTS 0x02  /* max_array_size, max_object_members, max_strings */
+#define JSONK_CHECK_LENGTH 0x04  /* max_string_length */
+#define JSONK_CHECK_ALL    0x07
+
+/* Upper bound on bytes a parse allocates per input byte, with margin */
+#define JSONK_PARSE_EXPANSION 64
+
 /* Token types for JSON parser */
 enum jsonk_token_type {
     JSONK_TOKEN_NONE,
@@ -63,6 +122,52 @@ struct jsonk_token {
     size_t len;            /* Length of the token */
 };
 
+/* Returned by a jsonk_sax_ops callback to end the walk early */
+#define JSONK_SAX_STOP 1
+
+/*
+ * Callbacks for jsonk_sax_parse(); any of them may be NULL. Each returns
+ * 0 to continue, JSONK_SAX_STOP (or any positive value) to stop early, or
+ * a negative error code to abort. Keys and string values are reported
+ * raw, between the quotes and with escapes still in place.
+ */
+struct jsonk_sax_ops {
+    int (*on_object_start)(void *ctx);
+    int (*on_object_end)(void *ctx);
+    int (*on_array_start)(void *ctx);
+    int (*on_array_end)(void *ctx);
+    int (*on_key)(void *ctx, const char *key, size_t key_len);
+    int (*on_value)(void *ctx, const struct jsonk_token *token); /* Strings, numbers, literals */
+};
+
+/* Opaque per-document bump allocator (see jsonk_parse_arena) */
+struct jsonk_arena;
+
+/* Opaque incremental parse state (see jsonk_parser_start) */
+struct jsonk_stream;
+
+/* Opaque limits shared by the ranges of a JSONK_PARSE_PARALLEL parse */
+struct jsonk_split_budget;
+
+/*
+ * Per-parse options for jsonk_parse_ex() and jsonk_parser_start_ex().
+ * Zero fields take the defaults, so only the fields that matter need to
+ * be set. Edits made to the tree after the parse are held to the
+ * default limits.
+ */
+struct jsonk_parse_opts {
+    unsigned int flags;         /* JSONK_PARSE_*, JSONK_PARSE_ARENA picks the arena over slab */
+    gfp_t gfp;                  /* Allocation flags, GFP_KERNEL if 0 */
+    unsigned int max_depth;     /* Nesting levels, the max_depth module parameter if 0 */
+    u32 max_array_size;         /* Elements per array, JSONK_MAX_ARRAY_SIZE if 0 */
+    u32 max_object_members;     /* Members per object, JSONK_MAX_OBJECT_MEMBERS if 0 */
+    u32 max_strings;            /* String values, JSONK_MAX_STRINGS if 0 */
+    size_t max_string_length;   /* Bytes per string or number, JSONK_MAX_STRING_LENGTH if 0 */
+    size_t max_memory;          /* Bytes per document, JSONK_MAX_TOTAL_MEMORY if 0 */
+    unsigned int max_workers;   /* Parallel parses for jsonk_parse_batch() and
+                                   JSONK_PARSE_PARALLEL, online CPUs if 0 */
+};
+
 /* Parser context structure */
 struct jsonk_parser {
     const char *buffer;    /* Input buffer */
@@ -73,10 +178,32 @@ struct jsonk_parser {
     size_t path_len;       /* Current path length */
     
     /* Security tracking */
-    size_t total_memory_used;  /* Total memory allocated during parsing */
+    size_t total_memory_used;  /* Memory allocated, counted under JSONK_CHECK_MEMORY */
     size_t string_count;       /* Number of strings parsed */
     size_t array_count;        /* Number of arrays parsed */
     size_t object_count;       /* Number of objects parsed */
+    size_t node_count;         /* Value nodes allocated, for the statistics */
+    
+    struct jsonk_arena *arena; /* Arena to allocate from, NULL for slab */
+    unsigned int flags;        /* JSONK_PARSE_* */
+    struct jsonk_stream *stream; /* Incremental parse state, NULL otherwise */
+    struct jsonk_split_budget *budget; /* Where a parallel range leases its limits, NULL otherwise */
+    
+    /* Limits in force, resolved from struct jsonk_parse_opts */
+    size_t max_memory;
+    size_t max_string_length;
+    u32 max_array_size;
+    u32 max_object_members;
+    u32 max_strings;
+    unsigned int max_depth;    /* 0 for the max_depth module parameter */
+    unsigned int checks;       /* JSONK_CHECK_*, memory is only counted under JSONK_CHECK_MEMORY */
+    unsigned int max_workers;  /* For JSONK_PARSE_PARALLEL, 0 for all online CPUs */
+    gfp_t gfp;
+    
+    /* Scratch stack collecting array elements until their array closes */
+    struct jsonk_value **stack;
+    size_t stack_len;
+    size_t stack_cap;
 };
 
 /* JSON value types for in-memory representation */
@@ -89,6 +216,13 @@ enum jsonk_value_type {
     JSONK_VALUE_OBJECT
 };
 
+/* How a number value is stored */
+enum jsonk_number_kind {
+    JSONK_NUMBER_INT,       /* Exact value in integer */
+    JSONK_NUMBER_UINT,      /* Exact value above S64_MAX in uinteger */
+    JSONK_NUMBER_DECIMAL    /* Fractions, exponents, wider integers and -0, kept as written */
+};
+
 /* Forward declarations for the in-memory structures */
 struct jsonk_value;
 struct jsonk_object;
@@ -97,40 +231,53 @@ struct jsonk_array;
 /* Key-value pair for JSON objects */
 struct jsonk_member {
     struct list_head list;    /* Linked list for members */
-    char *key;                /* Member key (allocated) */
-    size_t key_len;           /* Length of key */
+    char *key;                /* Member key: inline_key, the input, an interned key or an allocation */
     struct jsonk_value *value; /* Member value */
+    struct jsonk_member *hash_next; /* Next member in the same index bucket */
+    u32 hash;                 /* Key hash, valid while the object is indexed or the key interned */
+    u16 key_len;              /* Length of key, at most JSONK_MAX_KEY_LENGTH */
+    u16 flags;                /* JSONK_MEMBER_F_* */
+    char inline_key[JSONK_MEMBER_INLINE_KEY]; /* Keys shorter than this, absent for
+                                                 borrowed and interned keys */
 };
 
-/* Structure for arrays, stores values in a list */
+/* Structure for arrays, stores values in a contiguous vector */
 struct jsonk_array {
-    struct list_head elements; /* List of jsonk_array_element */
-    size_t size;               /* Number of elements */
-};
-
-/* Array element wrapper */
-struct jsonk_array_element {
-    struct list_head list;      /* Linked list for array elements */
-    struct jsonk_value *value;   /* Element value */
+    struct jsonk_value **items; /* Element values */
+    u32 size;                   /* Number of elements */
+    u32 capacity;               /* Allocated slots in items */
 };
 
 /* Structure for objects, stores key-value pairs */
 struct jsonk_object {
-    struct list_head members;   /* List of jsonk_member */
-    size_t size;                /* Number of members */
+    struct list_head members;   /* List of jsonk_member, in insertion order */
+    struct jsonk_member **index; /* Hash buckets, NULL below JSONK_OBJECT_INDEX_THRESHOLD */
+    u32 size;                   /* Number of members */
+    u32 index_size;             /* Number of buckets (power of two) */
 };
 
-/* Unified structure for any JSON value */
+/*
+ * Unified structure for any JSON value. Containers, and strings or decimals
+ * with inline text, use the full structure; other scalars are allocated
+ * only up to the end of the string arm of the union, so the node layout
+ * must keep those arms small. Inline text runs on over the hash field,
+ * which only containers use.
+ */
 struct jsonk_value {
-    atomic_t refcount;          /* Reference count for memory safety */
-    enum jsonk_value_type type;
+    atomic_t refcount;          /* Reference count for memory safety (unused for arena nodes) */
+    u8 type;                    /* enum jsonk_value_type */
+    u8 flags;                   /* JSONK_VALUE_F_* */
     union {
         bool boolean;           /* For JSONK_VALUE_BOOLEAN */
         struct {                /* For JSONK_VALUE_NUMBER */
-            s64 integer;        /* Integer part */
-            u32 fraction;       /* Fraction part (if needed) */
-            bool is_negative;   /* Sign indicator */
-            bool is_integer;    /* True if pure integer, false if has fraction */
+            union {
+                s64 integer;        /* JSONK_NUMBER_INT */
+                u64 uinteger;       /* JSONK_NUMBER_UINT */
+                const char *lexeme; /* JSONK_NUMBER_DECIMAL, NUL-terminated unless
+                                       JSONK_VALUE_F_BORROWED; use len */
+            };
+            u32 len;            /* Length of lexeme */
+            u8 kind;            /* enum jsonk_number_kind */
         } number;
         struct {                /* For JSONK_VALUE_STRING */
             char *data;
@@ -138,7 +285,12 @@ struct jsonk_value {
         } string;
         struct jsonk_array array;     /* For JSONK_VALUE_ARRAY */
         struct jsonk_object object;   /* For JSONK_VALUE_OBJECT */
+        struct {                /* Container whose last reference is gone */
+            struct list_head members;
+            struct jsonk_value *next;   /* Over the object index, past the array arm */
+        } dying;
     } u;
+    u64 hash;                   /* Cached content hash of a container, 0 until computed */
 };
 
 /* Patch operation result codes */
@@ -149,7 +301,28 @@ enum jsonk_patch_result {
     JSONK_PATCH_ERROR_TYPE,        /* Type mismatch in update */
     JSONK_PATCH_ERROR_MEMORY,      /* Memory allocation error */
     JSONK_PATCH_ERROR_OVERFLOW,    /* Buffer overflow */
-    JSONK_PATCH_NO_CHANGE          /* No change needed */
+    JSONK_PATCH_NO_CHANGE,         /* No change needed */
+    JSONK_PATCH_ERROR_TEST         /* An RFC 6902 "test" operation did not match */
+};
+
+/* RFC 6902 operations */
+enum jsonk_patch_op_type {
+    JSONK_PATCH_OP_ADD,
+    JSONK_PATCH_OP_REMOVE,
+    JSONK_PATCH_OP_REPLACE,
+    JSONK_PATCH_OP_MOVE,
+    JSONK_PATCH_OP_COPY,
+    JSONK_PATCH_OP_TEST,
+};
+
+/* One RFC 6902 operation; pointers are RFC 6901 JSON Pointers */
+struct jsonk_patch_op {
+    enum jsonk_patch_op_type op;
+    const char *path;
+    size_t path_len;
+    const char *from;               /* Source of move and copy */
+    size_t from_len;
+    struct jsonk_value *value;      /* Operand of add, replace and test, not consumed */
 };
 
 
@@ -172,7 +345,26 @@ static inline void *jsonk_memory_alloc(size_t size)
 }
 
 /**
- * Free memory allocated with jsonk_memory_alloc
+ * Allocate memory like jsonk_memory_alloc() with the given GFP flags
+ * 
+ * vmalloc() may sleep, so sizes above JSONK_LARGE_ALLOC_THRESHOLD fail
+ * under flags that do not allow blocking.
+ * 
+ * @param size Size to allocate
+ * @param gfp Allocation flags
+ * @return Pointer to allocated memory or NULL
+ */
+static inline void *jsonk_memory_alloc_gfp(size_t size, gfp_t gfp)
+{
+    if (size <= JSONK_LARGE_ALLOC_THRESHOLD)
+        return kmalloc(size, gfp);
+    if (!gfpflags_allow_blocking(gfp))
+        return NULL;
+    return __vmalloc(size, gfp);
+}
+
+/**
+ * Free memory allocated with jsonk_memory_alloc or jsonk_memory_alloc_gfp
  * @param ptr Pointer to memory
  * @param size Size of allocation
  */
@@ -208,20 +400,26 @@ static inline void jsonk_parser_init(struct jsonk_parser *parser, const char *bu
     parser->string_count = 0;
     parser->array_count = 0;
     parser->object_count = 0;
-}
-
-/**
- * Skip whitespace in the input buffer
- * @param parser Parser context
- */
-static inline void jsonk_skip_whitespace(struct jsonk_parser *parser)
-{
-    while (parser->pos < parser->buffer_len) {
-        char c = parser->buffer[parser->pos];
-        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
-            break;
-        parser->pos++;
-    }
+    parser->node_count = 0;
+    
+    parser->arena = NULL;
+    parser->flags = 0;
+    parser->stream = NULL;
+    parser->budget = NULL;
+    
+    parser->max_memory = JSONK_MAX_TOTAL_MEMORY;
+    parser->max_string_length = JSONK_MAX_STRING_LENGTH;
+    parser->max_array_size = JSONK_MAX_ARRAY_SIZE;
+    parser->max_object_members = JSONK_MAX_OBJECT_MEMBERS;
+    parser->max_strings = JSONK_MAX_STRINGS;
+    parser->max_depth = 0;
+    parser->checks = JSONK_CHECK_ALL;
+    parser->max_workers = 0;
+    parser->gfp = GFP_KERNEL;
+    
+    parser->stack = NULL;
+    parser->stack_len = 0;
+    parser->stack_cap = 0;
 }
 
 /**
@@ -234,6 +432,42 @@ static inline bool jsonk_is_whitespace(char c)
     return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
 }
 
+/**
+ * Find the end of a whitespace run
+ * @param buf Input buffer
+ * @param pos Offset to start scanning at
+ * @param len Buffer length
+ * @return Offset of the first non-whitespace byte, or len
+ *
+ * Scans a machine word at a time and switches to vector instructions
+ * for long runs where the CPU supports them.
+ */
+size_t jsonk_scan_whitespace(const char *buf, size_t pos, size_t len);
+
+/**
+ * Find the next byte that ends a plain run inside a JSON string
+ * @param buf Input buffer
+ * @param pos Offset to start scanning at
+ * @param len Buffer length
+ * @return Offset of the first '"', '\\' or control byte (< 0x20), or len
+ *
+ * Bytes >= 0x80 are treated as ordinary string content.
+ */
+size_t jsonk_scan_string(const char *buf, size_t pos, size_t len);
+
+/**
+ * Skip whitespace in the input buffer
+ * @param parser Parser context
+ */
+static inline void jsonk_skip_whitespace(struct jsonk_parser *parser)
+{
+    /* Most tokens are not preceded by whitespace at all */
+    if (parser->pos < parser->buffer_len &&
+        jsonk_is_whitespace(parser->buffer[parser->pos]))
+        parser->pos = jsonk_scan_whitespace(parser->buffer, parser->pos,
+                                            parser->buffer_len);
+}
+
 /**
  * Check if character is a JSON structural character
  * @param c Character to check
@@ -285,17 +519,274 @@ static inline char jsonk_next_char(struct jsonk_parser *parser)
  */
 struct jsonk_value *jsonk_parse(const char *json_str, size_t json_len);
 
+/**
+ * Parse a JSON string into an arena-backed in-memory structure
+ * 
+ * All nodes, keys and strings are bump-allocated from a few page-sized
+ * chunks owned by the document. References taken on any node of the
+ * document pin the whole arena; the final jsonk_value_put() releases it
+ * in O(chunks) without walking the tree. Memory limits are enforced
+ * exactly as for jsonk_parse().
+ * 
+ * Arena documents may still be modified. Replaced or removed nodes are
+ * only reclaimed when the document is released, so this mode is meant for
+ * read-mostly documents.
+ * 
+ * @param json_str JSON string to parse
+ * @param json_len Length of JSON string
+ * @return Pointer to parsed JSON root or NULL on error
+ */
+struct jsonk_value *jsonk_parse_arena(const char *json_str, size_t json_len);
+
+/**
+ * Parse a JSON string with JSONK_PARSE_* flags
+ * 
+ * JSONK_PARSE_ARENA behaves like jsonk_parse_arena(), JSONK_PARSE_POOL like
+ * jsonk_parse_atomic().
+ * 
+ * With JSONK_PARSE_BORROW, string values without escape sequences and all
+ * keys (keys are always stored verbatim) reference the input buffer
+ * instead of being copied; escaped strings are still unescaped into
+ * their own allocation. Such values carry JSONK_VALUE_F_BORROWED and
+ * such members JSONK_MEMBER_F_BORROWED. Borrowed data is not
+ * NUL-terminated, and the input buffer must stay unmodified for as long
+ * as the tree exists. Deep copies always own their data.
+ * 
+ * With JSONK_PARSE_INTERN, keys are taken from a table shared by all
+ * documents, which holds each distinct key once, with its hash, for as
+ * long as a member uses it. Such members carry JSONK_MEMBER_F_INTERNED and
+ * have no inline key storage, merge patches match interned keys by
+ * address, and copies of the document share the keys. Arena documents
+ * keep their own keys. Beyond JSONK_INTERN_KEYS distinct keys (the
+ * intern_keys module parameter) members get keys of their own again.
+ * Interning takes precedence over JSONK_PARSE_BORROW for keys.
+ * 
+ * @param json_str JSON string to parse
+ * @param json_len Length of JSON string
+ * @param flags Combination of JSONK_PARSE_* flags
+ * @return Pointer to parsed JSON root or NULL on error
+ */
+struct jsonk_value *jsonk_parse_flags(const char *json_str, size_t json_len, unsigned int flags);
+
+/**
+ * Parse a JSON string with per-parse limits and allocation flags
+ * 
+ * opts->flags behave as for jsonk_parse_flags(), and JSONK_PARSE_POOL as
+ * for jsonk_parse_atomic(), which ignores gfp. A gfp without
+ * __GFP_DIRECT_RECLAIM, such as GFP_ATOMIC, makes the whole parse
+ * non-sleeping; single allocations are then capped at
+ * JSONK_LARGE_ALLOC_THRESHOLD since vmalloc() may sleep.
+ * 
+ * A limit is only checked when the input is long enough to reach it, so
+ * small documents skip the per-node accounting.
+ * 
+ * With JSONK_PARSE_PARALLEL, a root array of at least two times
+ * JSONK_BATCH_WORKER_BYTES is split at element boundaries found by a
+ * quick pre-scan of brackets and strings. Up to opts->max_workers ranges
+ * of elements (all online CPUs if 0) are then parsed at once on the
+ * unbound workqueue and spliced into the root array. The result and the
+ * limits are the same as for a serial parse: the ranges lease max_memory
+ * and max_strings in slices from what the document has left, and a
+ * document that runs them dry is parsed again serially, which then
+ * decides. In arena mode each range
+ * gets an arena of its own, which the document keeps alive. Other
+ * roots, and parses under a non-blocking gfp mask, are parsed serially.
+ * 
+ * @param json_str JSON string to parse
+ * @param json_len Length of JSON string
+ * @param opts Options, NULL for the defaults of jsonk_parse()
+ * @return Pointer to parsed JSON root or NULL on error, including a
+ *         max_depth above JSONK_DEPTH_LIMIT or counts above INT_MAX
+ */
+struct jsonk_value *jsonk_parse_ex(const char *json_str, size_t json_len,
+                                   const struct jsonk_parse_opts *opts);
+
+/**
+ * Parse a JSON string in atomic context
+ * 
+ * Same as jsonk_parse_flags() with JSONK_PARSE_POOL: the document is an
+ * arena whose chunks come only from the current CPU's pool, so the parse
+ * never enters the page allocator or sleeps and may run in softirq,
+ * under a spinlock or in a tracepoint handler. When the pool runs dry,
+ * the parse fails at once and a refill is queued for process context.
+ * 
+ * Pool parses allow at most JSONK_MAX_DEPTH levels whatever the
+ * max_depth module parameter says, no string larger than a chunk and at
+ * most one chunk of array elements still waiting for their array to
+ * close; nesting past JSONK_NEST_INLINE levels takes one more chunk for
+ * the frames. Later edits to the document also draw from the pool, and its
+ * chunks return to the pool when it is released.
+ * 
+ * @param json_str JSON string to parse
+ * @param json_len Length of JSON string
+ * @return Pointer to parsed JSON root or NULL on error or an empty pool
+ */
+struct jsonk_value *jsonk_parse_atomic(const char *json_str, size_t json_len);
+
+/**
+ * Parse a batch of independent documents in parallel
+ * 
+ * The documents are spread over work items on the unbound workqueue,
+ * with the caller parsing alongside them until all are done. Each
+ * document is parsed by jsonk_parse_ex() with opts, so limits apply per
+ * document and every result is an independent tree. Workers claim
+ * documents one at a time, so uneven sizes balance out. Slab parses use
+ * the allocating CPU's slab caches and arena parses get one arena per
+ * document, so the workers do not share allocator state.
+ * 
+ * At most opts->max_workers parses (all online CPUs if 0) run at once,
+ * and every one of them has at least JSONK_BATCH_WORKER_BYTES of input.
+ * Batches too small for a second worker are parsed by the caller alone.
+ * May sleep.
+ * 
+ * @param bufs Documents to parse
+ * @param lens Length of each document
+ * @param n Number of documents
+ * @param out Filled with a root for each document, NULL where parsing
+ *            failed; the caller releases every root with jsonk_value_put()
+ * @param opts Options as for jsonk_parse_ex(), NULL for the defaults
+ * @return Number of documents parsed, or -EINVAL for NULL arrays, more
+ *         than INT_MAX documents or JSONK_PARSE_POOL
+ */
+int jsonk_parse_batch(const char *const bufs[], const size_t lens[], size_t n,
+                      struct jsonk_value *out[], const struct jsonk_parse_opts *opts);
+
+/**
+ * Top up every CPU's chunk pool to the pool_chunks module parameter
+ * 
+ * Pools are filled when the module loads and refilled in the background
+ * once one runs low. Call this from process context ahead of a burst of
+ * jsonk_parse_atomic() calls to start it with full pools.
+ * 
+ * @return 0 on success, -ENOMEM if a pool could not be filled
+ */
+int jsonk_pool_refill(void);
+
+/**
+ * Walk a JSON string through callbacks without building a tree
+ * 
+ * Enforces the same grammar and limits as jsonk_parse() and allocates
+ * nothing, except nesting frames for documents more than JSONK_NEST_INLINE
+ * deep. Unlike jsonk_parse(), content after the root value is an error.
+ * 
+ * @param json_str JSON string to walk
+ * @param json_len Length of JSON string
+ * @param ops Callbacks, may be NULL
+ * @param ctx Passed to every callback
+ * @return 0 once the whole document was walked, the positive value a
+ *         callback stopped with, or a negative error code (a callback's,
+ *         -EINVAL for invalid JSON, -ENOSPC for exceeded limits, -ENOMEM)
+ */
+int jsonk_sax_parse(const char *json_str, size_t json_len,
+                    const struct jsonk_sax_ops *ops, void *ctx);
+
+/**
+ * Check that a buffer holds exactly one valid JSON document
+ * @param json_str JSON string to check
+ * @param json_len Length of JSON string
+ * @return 0 if valid, -EINVAL for invalid JSON, -ENOSPC if a limit is exceeded,
+ *         -ENOMEM if no nesting frames could be allocated
+ */
+int jsonk_validate(const char *json_str, size_t json_len);
+
+/**
+ * Start parsing a document that arrives in chunks
+ * 
+ * The tokenizer state and the partially built tree live in the parser
+ * between calls, so chunks may split the document anywhere, including in
+ * the middle of a string, number or literal. Chunks are only read during
+ * jsonk_parser_feed() and can be reused or freed as soon as it returns.
+ * Limits are enforced as for jsonk_parse(), across the whole document.
+ * 
+ * Every successful start must be followed by jsonk_parser_finish() or
+ * jsonk_parser_abort().
+ * 
+ * @param parser Parser context to set up
+ * @param flags JSONK_PARSE_* flags; JSONK_PARSE_BORROW and JSONK_PARSE_POOL
+ *              are not supported
+ * @return 0 on success, negative error code on failure
+ */
+int jsonk_parser_start(struct jsonk_parser *parser, unsigned int flags);
+
+/**
+ * Start an incremental parse with per-parse options
+ * 
+ * Like jsonk_parser_start(), with limits and allocation flags as for
+ * jsonk_parse_ex(). The total length is unknown, so every limit is
+ * checked.
+ * 
+ * @param parser Parser to set up
+ * @param opts Options, NULL for the defaults
+ * @return 0 on success, -EINVAL for JSONK_PARSE_BORROW, JSONK_PARSE_POOL
+ *         or out of range limits, -ENOMEM on allocation failure
+ */
+int jsonk_parser_start_ex(struct jsonk_parser *parser, const struct jsonk_parse_opts *opts);
+
+/**
+ * Feed the next chunk of a document
+ * @param parser Parser set up with jsonk_parser_start()
+ * @param chunk Next bytes of the document
+ * @param len Length of chunk
+ * @return 0 on success, negative error code on failure
+ * 
+ * Errors are sticky: later feeds return the same error and
+ * jsonk_parser_finish() returns NULL. Content after the root value is
+ * ignored, as with jsonk_parse().
+ */
+int jsonk_parser_feed(struct jsonk_parser *parser, const char *chunk, size_t len);
+
+/**
+ * Complete a chunked parse
+ * @param parser Parser set up with jsonk_parser_start()
+ * @return Parsed JSON root, or NULL if the document was invalid or incomplete
+ */
+struct jsonk_value *jsonk_parser_finish(struct jsonk_parser *parser);
+
+/**
+ * Abandon a chunked parse and free everything built so far
+ * @param parser Parser set up with jsonk_parser_start()
+ */
+void jsonk_parser_abort(struct jsonk_parser *parser);
+
 /**
  * Serialize a JSON value structure to a string
  * 
+ * Safe under rcu_read_lock(): trees more than JSONK_NEST_INLINE deep get
+ * their nesting frames from a non-sleeping allocation.
+ * 
  * @param value JSON value to serialize
  * @param buffer Output buffer
  * @param buffer_size Size of output buffer
  * @param written Pointer to store actual bytes written
- * @return 0 on success, negative error code on failure
+ * @return 0 on success, -EOVERFLOW if buffer is too small, -EINVAL for
+ *         NULL values in the tree, -ENOMEM if frames could not be allocated
  */
 int jsonk_serialize(struct jsonk_value *value, char *buffer, size_t buffer_size, size_t *written);
 
+/**
+ * Compute the length jsonk_serialize() will produce for a value
+ * 
+ * Walks the tree once without writing anything. jsonk_serialize() needs
+ * a buffer one byte larger than this.
+ * 
+ * @param value JSON value to measure
+ * @return Serialized length in bytes, 0 if value is NULL or frames for a
+ *         very deep tree could not be allocated
+ */
+size_t jsonk_serialized_size(struct jsonk_value *value);
+
+/**
+ * Serialize a JSON value into a buffer allocated to fit
+ * 
+ * The buffer is NUL-terminated and must be released with
+ * jsonk_memory_free(buffer, *len + 1).
+ * 
+ * @param value JSON value to serialize
+ * @param len Pointer to store the serialized length
+ * @return Serialized text or NULL on error
+ */
+char *jsonk_serialize_alloc(struct jsonk_value *value, size_t *len);
+
 /**
  * Get a reference to a JSON value (increment reference count)
  */
@@ -306,6 +797,20 @@ struct jsonk_value *jsonk_value_get(struct jsonk_value *value);
  */
 void jsonk_value_put(struct jsonk_value *value);
 
+/**
+ * Count the memory held by a tree
+ * 
+ * Adds up nodes, members, keys, string data, array vectors and object
+ * indexes as allocated, leaving out borrowed data and keys or strings
+ * stored inside their node. Slab and arena rounding are not included.
+ * 
+ * @param value Root of the tree
+ * @param nodes If not NULL, incremented by the number of values counted
+ * @return Bytes held by the tree, 0 if frames for a very deep tree could
+ *         not be allocated
+ */
+size_t jsonk_value_footprint(struct jsonk_value *value, size_t *nodes);
+
 /**
  * Apply a JSON patch to a target buffer
  * 
@@ -326,6 +831,168 @@ int jsonk_apply_patch(const char *target, size_t target_len,
                       const char *patch, size_t patch_len,
                       char *result, size_t result_max_len, size_t *result_len);
 
+/**
+ * Apply a JSON patch to a target buffer into a buffer allocated to fit
+ * 
+ * Same merge rules and all-or-nothing guarantee as jsonk_apply_patch().
+ * On success and on JSONK_PATCH_NO_CHANGE *result holds a NUL-terminated
+ * buffer to be released with jsonk_memory_free(*result, *result_len + 1);
+ * on error it is set to NULL.
+ * 
+ * @param target Original JSON buffer
+ * @param target_len Length of original buffer
+ * @param patch Patch JSON buffer
+ * @param patch_len Length of patch buffer
+ * @param result Pointer to store the allocated result
+ * @param result_len Pointer to store the result length
+ * @return JSONK_PATCH_SUCCESS on success, error code on failure
+ */
+int jsonk_apply_patch_alloc(const char *target, size_t target_len,
+                            const char *patch, size_t patch_len,
+                            char **result, size_t *result_len);
+
+/**
+ * Apply a JSON patch to a parsed target in place
+ * 
+ * Same merge rules and all-or-nothing guarantee as jsonk_apply_patch(),
+ * without parsing, copying or serializing the target. Each change is
+ * recorded in an undo log and rolled back if a later one fails, so the
+ * cost follows the size of the patch, not of the target. Removed members
+ * and replaced values are released once the whole patch has applied.
+ * 
+ * The caller must hold off other users of the target for the duration.
+ * 
+ * @param target Target object, modified in place
+ * @param patch Patch object (not consumed; values are copied)
+ * @return JSONK_PATCH_SUCCESS, JSONK_PATCH_NO_CHANGE, JSONK_PATCH_ERROR_TYPE
+ *         if either is not an object, JSONK_PATCH_ERROR_MEMORY on failure
+ */
+int jsonk_apply_patch_tree(struct jsonk_value *target, struct jsonk_value *patch);
+
+/**
+ * Apply an RFC 7386 merge patch to a parsed target in place
+ * 
+ * Unlike jsonk_apply_patch(), only null removes a member, empty strings,
+ * arrays and objects are ordinary values, and an object merged into a
+ * missing member or a non-object is applied as if to an empty object,
+ * its own nulls dropped. A patch that is not an object, or an object
+ * patch on a target that is not one, replaces the whole document: *target
+ * then points to the new root and the caller's reference on the old one
+ * is dropped. All or nothing, as jsonk_apply_patch_tree().
+ * 
+ * @param target In/out: target document, modified in place
+ * @param patch Merge patch (not consumed; values are copied)
+ * @return JSONK_PATCH_SUCCESS, JSONK_PATCH_NO_CHANGE, or JSONK_PATCH_ERROR_MEMORY
+ */
+int jsonk_apply_merge_patch(struct jsonk_value **target, struct jsonk_value *patch);
+
+/**
+ * Apply an RFC 6902 JSON Patch to a parsed target in place
+ * 
+ * Runs the operations of the patch array in order in one pass over the
+ * tree, each resolving its JSON Pointers against the result of the ones
+ * before. Every change goes into one undo log, so if any operation fails,
+ * including a "test", all of them are rolled back; displaced values are
+ * released once the whole list has applied. Array indexes shift as
+ * elements are added and removed, "-" appends, and operations on the
+ * pointer "" replace the whole document, as for jsonk_apply_merge_patch().
+ * Numbers compare equal in "test" if they are the same integer or have
+ * the same text.
+ * 
+ * The caller must hold off other users of the target for the duration.
+ * 
+ * @param target In/out: target document, modified in place
+ * @param patch Array of operation objects (not consumed; values are copied)
+ * @return JSONK_PATCH_SUCCESS, JSONK_PATCH_NO_CHANGE for lists without
+ *         changes, JSONK_PATCH_ERROR_TYPE for malformed operations or
+ *         pointers, JSONK_PATCH_ERROR_PATH if a pointer does not resolve,
+ *         JSONK_PATCH_ERROR_TEST, or JSONK_PATCH_ERROR_MEMORY
+ */
+int jsonk_apply_json_patch(struct jsonk_value **target, struct jsonk_value *patch);
+
+/**
+ * Apply RFC 6902 operations given as structures, without a patch document
+ * 
+ * Same as jsonk_apply_json_patch() for callers that build their
+ * operations in C.
+ * 
+ * @param target In/out: target document, modified in place
+ * @param ops Operations, applied in order
+ * @param count Number of operations
+ * @return As for jsonk_apply_json_patch()
+ */
+int jsonk_apply_json_patch_ops(struct jsonk_value **target, const struct jsonk_patch_op *ops, size_t count);
+
+/**
+ * Content hash of a value, cached on every container it covers
+ * 
+ * Equal values hash the same: members count in any order, and numbers
+ * as jsonk_value_equal() compares them. The hash is keyed with a secret
+ * chosen at module load, so it is stable until the module is reloaded
+ * but cannot be steered towards collisions by the documents' authors.
+ * 
+ * Containers keep their hash until they change. The patch, path and
+ * copy-on-write functions clear it on every container along the path to
+ * a change, so rehashing after an update only visits that path. The
+ * jsonk_object_* and jsonk_array_* functions only know the container
+ * they change: after changing a nested one directly, call
+ * jsonk_value_hash_reset() on each of its ancestors.
+ * 
+ * Readers may hash a document nobody modifies at the same time, such as a
+ * pinned RCU version: they only ever store the same values. Documents
+ * nested deeper than JSONK_NEST_INLINE allocate, so not under rcu_read_lock().
+ * 
+ * @param value Value to hash
+ * @return The hash, never 0 unless value is NULL or a frame stack for a
+ *         deep document could not be allocated
+ */
+u64 jsonk_value_hash(struct jsonk_value *value);
+
+/**
+ * Forget the cached hash of a container that was changed from outside
+ * 
+ * @param value Container whose subtree changed
+ */
+void jsonk_value_hash_reset(struct jsonk_value *value);
+
+/**
+ * Compare two values for equality of content
+ * 
+ * Members are matched by key in any order; numbers are compared by
+ * value, so 1, 1.0 and 1e0 are equal, and so are 0 and -0. Shared
+ * subtrees are not walked, and containers whose cached hashes differ
+ * are known to differ at once.
+ * 
+ * @param a First value
+ * @param b Second value
+ * @return 1 if equal, 0 if not, -ENOMEM if no frames could be allocated
+ */
+int jsonk_value_equal(struct jsonk_value *a, struct jsonk_value *b);
+
+/**
+ * Build the RFC 6902 patch that turns one document into another
+ * 
+ * Subtrees that are the same node or have the same hash are skipped
+ * without being walked, so once the hashes of both documents are cached
+ * the cost follows the differences rather than the document sizes.
+ * Objects produce one operation per removed, added or changed member.
+ * Arrays lose their common prefix and suffix first, so a run of added or
+ * removed elements is one operation per element; the pairs left over are
+ * diffed in place. A value whose type changed is replaced whole.
+ * 
+ * Applying the result to from with jsonk_apply_json_patch() yields a
+ * document equal to to. Values are copied into the patch, and paths
+ * name keys by their unescaped content, as RFC 6901 wants.
+ * 
+ * @param from Old document
+ * @param to New document
+ * @return Array of operation objects, empty if the documents are equal,
+ *         or NULL on allocation failure, past JSONK_MAX_ARRAY_SIZE
+ *         operations or for a key with an invalid escape (caller must
+ *         call jsonk_value_put())
+ */
+struct jsonk_value *jsonk_diff(struct jsonk_value *from, struct jsonk_value *to);
+
 
 
 /* ========================================================================
@@ -358,6 +1025,46 @@ struct jsonk_value *jsonk_value_create_string(const char *str, size_t len);
  */
 struct jsonk_value *jsonk_value_create_number(const char *str, size_t len);
 
+/**
+ * Create a JSON number value from a signed integer
+ * 
+ * @param val Integer value
+ * @return Pointer to new number value or NULL on error
+ */
+struct jsonk_value *jsonk_value_create_s64(s64 val);
+
+/**
+ * Create a JSON number value from an unsigned integer
+ * 
+ * @param val Integer value
+ * @return Pointer to new number value or NULL on error
+ */
+struct jsonk_value *jsonk_value_create_u64(u64 val);
+
+/**
+ * Read a number value as a signed integer
+ * 
+ * Only integers are converted; decimals, which are stored as written,
+ * and integers outside the s64 range are refused rather than rounded.
+ * -0, stored as a decimal to keep its sign, reads as 0.
+ * 
+ * @param value Number value
+ * @param out Where to store the integer
+ * @return 0 on success, -EINVAL if value is not a number, -ERANGE if it
+ *         is not an integer that fits
+ */
+int jsonk_number_get_s64(const struct jsonk_value *value, s64 *out);
+
+/**
+ * Read a number value as an unsigned integer
+ * 
+ * @param value Number value
+ * @param out Where to store the integer
+ * @return 0 on success, -EINVAL if value is not a number, -ERANGE if it
+ *         is negative, a decimal other than -0 or too large
+ */
+int jsonk_number_get_u64(const struct jsonk_value *value, u64 *out);
+
 /**
  * Create a JSON boolean value
  * 
@@ -376,12 +1083,506 @@ struct jsonk_value *jsonk_value_create_null(void);
 /**
  * Deep copy a JSON value
  * 
+ * The copy fails as a whole rather than leaving out parts of the tree.
+ * 
  * @param source Source value to copy
- * @param current_depth Current recursion depth (for safety)
+ * @param current_depth Depth of source in its document; values nested more
+ *                      than max_depth deep counting from there are refused
  * @return Pointer to copied value or NULL on error
  */
 struct jsonk_value *jsonk_value_deep_copy(struct jsonk_value *source, int current_depth);
 
+/**
+ * Take a copy-on-write snapshot of a tree
+ * 
+ * The snapshot is another reference to the same nodes, taken in O(1).
+ * From then on the tree must only be modified through
+ * jsonk_cow_set_value_by_path() and jsonk_cow_apply_patch(), which copy
+ * every node referenced more than once on the way down to the change, so
+ * each holder keeps seeing its own version. The other modifying
+ * functions work in place and would change all versions at once.
+ * 
+ * @param value Root of the tree
+ * @return value, with a new reference to be released with jsonk_value_put()
+ */
+struct jsonk_value *jsonk_value_snapshot(struct jsonk_value *value);
+
+/**
+ * Set a value by path without disturbing snapshots
+ * 
+ * Shared containers from the root down to the change are copied one
+ * level deep, sharing everything off the path, so the cost is O(depth)
+ * nodes rather than O(document). *root is replaced by the copy if the
+ * root itself was shared; the reference on the old root is dropped.
+ * 
+ * @param root In/out: root of the caller's version
+ * @param path Path as for jsonk_set_value_by_path()
+ * @param path_len Length of path
+ * @param value Value to set (deep copied)
+ * @return 0 on success, negative error code on failure
+ */
+int jsonk_cow_set_value_by_path(struct jsonk_value **root, const char *path, size_t path_len,
+                                struct jsonk_value *value);
+
+/**
+ * Apply a JSON patch as a new version of a tree
+ * 
+ * Uses the jsonk_apply_patch() merge rules. Only the objects the patch
+ * reaches are copied; the rest is shared with the previous version. On
+ * success *root is replaced by the new version and the reference on the
+ * old one dropped; on failure *root is left untouched.
+ * 
+ * @param root In/out: root of the caller's version
+ * @param patch Patch object (not consumed)
+ * @return JSONK_PATCH_SUCCESS, JSONK_PATCH_NO_CHANGE, or an error code
+ *         from enum jsonk_patch_result
+ */
+int jsonk_cow_apply_patch(struct jsonk_value **root, struct jsonk_value *patch);
+
+/* ========================================================================
+ * Streaming Serialization
+ * ======================================================================== */
+
+struct seq_file;
+struct iov_iter;
+
+/* An object or array a jsonk_writer is inside of */
+struct jsonk_writer_frame {
+    struct jsonk_value *value;
+    struct jsonk_member *member;    /* Next member of an object, NULL at the end */
+    u32 index;                      /* Next element of an array */
+    u8 phase;                       /* Progress through the current member or element */
+};
+
+/*
+ * Resumable serializer
+ * 
+ * Produces the same text as jsonk_serialize() a piece at a time, so a
+ * document can be copied out page by page across several reads without
+ * a buffer for the whole of it. The tree must stay unchanged and
+ * referenced until the writer is done with it; a snapshot taken with
+ * jsonk_value_snapshot() stays unchanged under the jsonk_cow_* updates.
+ * Errors are sticky: once a read fails, later reads fail the same way.
+ * Trees deeper than frames[] move the frames to the heap; a writer given
+ * up on before it is done must then be passed to jsonk_writer_release().
+ */
+struct jsonk_writer {
+    struct jsonk_value *root;
+    const char *piece;              /* Unwritten rest of the current piece */
+    size_t piece_len;
+    const char *str;                /* String body being written, or NULL */
+    size_t str_len;
+    size_t str_pos;
+    unsigned int depth;             /* Number of open frames */
+    int error;                      /* Sticky error */
+    bool started;
+    char digits[JSONK_NUMBER_BUF];  /* Text of the current integer or escape */
+    struct jsonk_writer_frame *heap_frames; /* All frames once deeper than frames[] */
+    unsigned int heap_cap;
+    struct jsonk_writer_frame frames[JSONK_NEST_INLINE + 1];
+};
+
+/**
+ * Start writing a value
+ * @param writer Writer to set up
+ * @param value Tree to serialize
+ */
+void jsonk_writer_init(struct jsonk_writer *writer, struct jsonk_value *value);
+
+/**
+ * Free the frames a writer took for a very deep tree
+ * 
+ * Only needed when a writer is abandoned before its reads returned 0 or
+ * an error; safe to call on any initialized writer.
+ * 
+ * @param writer Writer set up with jsonk_writer_init()
+ */
+void jsonk_writer_release(struct jsonk_writer *writer);
+
+/**
+ * Copy the next part of the serialized text into a buffer
+ * @param writer Writer set up with jsonk_writer_init()
+ * @param buf Output buffer
+ * @param len Size of buf
+ * @return Bytes copied, 0 once all text has been produced, -EINVAL for
+ *         trees holding NULL values, or -ENOMEM if no frames could be
+ *         allocated for a very deep tree
+ */
+ssize_t jsonk_writer_read(struct jsonk_writer *writer, char *buf, size_t len);
+
+/**
+ * Copy the next part of the serialized text into an iov_iter
+ * 
+ * For read_iter() handlers and other iov_iter consumers, such as pages
+ * attached to an skb. Fills the iterator as far as the text allows.
+ * 
+ * @param writer Writer set up with jsonk_writer_init()
+ * @param to Destination
+ * @return Bytes copied, 0 once all text has been produced, -EFAULT if
+ *         nothing could be copied, or -EINVAL as for jsonk_writer_read()
+ */
+ssize_t jsonk_writer_read_iter(struct jsonk_writer *writer, struct iov_iter *to);
+
+/**
+ * Serialize a JSON value through a callback
+ * 
+ * write() is called with consecutive pieces of the text, none longer
+ * than the longest string or key in the tree. Nothing is allocated.
+ * 
+ * @param value JSON value to serialize
+ * @param write Sink; returns 0 to continue or a negative error to stop
+ * @param ctx Passed to write()
+ * @return 0 on success, the sink's error, or -EINVAL as for jsonk_writer_read()
+ */
+int jsonk_serialize_to(struct jsonk_value *value,
+                       int (*write)(void *ctx, const char *data, size_t len), void *ctx);
+
+/**
+ * Serialize a JSON value into a seq_file from its show() handler
+ * 
+ * When the seq_file buffer fills up, this stops and returns 0 so that
+ * seq_file retries with a larger buffer, as it does for other show()
+ * handlers. For documents larger than a few pages, a read_iter() handler
+ * built on jsonk_writer_read_iter() avoids the growing buffer.
+ * 
+ * @param m seq_file passed to show()
+ * @param value JSON value to serialize
+ * @return 0 on success or when the buffer overflowed, -EINVAL as for jsonk_writer_read()
+ */
+int jsonk_seq_serialize(struct seq_file *m, struct jsonk_value *value);
+
+/* ========================================================================
+ * Binary Encoding
+ * ======================================================================== */
+
+/*
+ * Compact encoding of a value tree
+ * 
+ * For passing documents between the kernel and userspace without
+ * formatting and re-parsing text on every hop. All fields are little
+ * endian and unaligned. A buffer starts with a 12-byte header:
+ * 
+ *   le32 magic "JSNK", le16 version, le16 reserved (0), le32 total size
+ * 
+ * followed by the root value. Every value starts with a one-byte tag:
+ * 
+ *   NULL, FALSE, TRUE      tag only
+ *   INT8 ... INT64         tag, signed integer of that width
+ *   UINT64                 tag, le64, only for integers above S64_MAX
+ *   DECIMAL, STRING        tag, le32 length, text (unescaped)
+ *   ARRAY                  tag, le32 size, le32 count, le32 offset[count],
+ *                          elements
+ *   OBJECT                 tag, le32 size, le32 count, le32 buckets,
+ *                          le32 head[buckets], entry[count], members
+ * 
+ * Sizes cover the whole container from its tag, and offsets are relative
+ * to that tag. An object member is {le16 key length, key, value}, and
+ * entries and members are in document order. Objects of fewer than
+ * JSONK_OBJECT_INDEX_THRESHOLD members have no buckets, entries of just
+ * {le32 offset} and are searched in order. Larger ones have a power of
+ * two of buckets and entries of {le32 offset, le32 hash, le32 next}:
+ * hash is the 32-bit FNV-1a hash of the key, taken modulo buckets to
+ * pick a head[], and head[] and next hold entry index + 1, 0 ending the
+ * chain.
+ */
+#define JSONK_BIN_MAGIC 0x4b4e534a          /* "JSNK" */
+#define JSONK_BIN_VERSION 1
+#define JSONK_BIN_HEADER_SIZE 12
+
+enum jsonk_bin_tag {
+    JSONK_BIN_NULL,
+    JSONK_BIN_FALSE,
+    JSONK_BIN_TRUE,
+    JSONK_BIN_INT8,
+    JSONK_BIN_INT16,
+    JSONK_BIN_INT32,
+    JSONK_BIN_INT64,
+    JSONK_BIN_UINT64,
+    JSONK_BIN_DECIMAL,
+    JSONK_BIN_STRING,
+    JSONK_BIN_ARRAY,
+    JSONK_BIN_OBJECT,
+};
+
+/* A value inside an encoded buffer */
+struct jsonk_bin_value {
+    const u8 *data;             /* Its tag */
+    size_t len;                 /* Bytes it covers */
+};
+
+/**
+ * Get the size of the binary encoding of a value
+ * @param value JSON value to measure
+ * @return Bytes jsonk_encode_binary() writes, or 0 if the tree cannot be
+ *         encoded (NULL values, or 4 GiB or more)
+ */
+size_t jsonk_binary_size(struct jsonk_value *value);
+
+/**
+ * Encode a value tree
+ * @param value JSON value to encode
+ * @param buf Output buffer
+ * @param size Size of buf
+ * @param written Out: bytes written
+ * @return 0 on success, -EOVERFLOW if buf is too small, -EINVAL for trees
+ *         holding NULL values, -E2BIG past 4 GiB, or -ENOMEM if no frames
+ *         could be allocated for a very deep tree
+ */
+int jsonk_encode_binary(struct jsonk_value *value, void *buf, size_t size, size_t *written);
+
+/**
+ * Decode a binary encoding into a value tree
+ * 
+ * Copies values out of the buffer, which may be freed afterwards unless
+ * opts asks for JSONK_PARSE_BORROW; borrowed strings are then not
+ * NUL-terminated. The same limits and flags as for jsonk_parse_ex()
+ * apply, except JSONK_PARSE_PARALLEL. Containers must be laid out as
+ * jsonk_encode_binary() does, each child right after the previous one,
+ * so every byte is decoded once; anything else is rejected.
+ * 
+ * @param buf Encoded buffer
+ * @param len Size of buf, at least the size in its header
+ * @param opts Limits and flags, or NULL for the defaults
+ * @return Decoded tree or NULL on invalid input or allocation failure
+ */
+struct jsonk_value *jsonk_decode_binary(const void *buf, size_t len, const struct jsonk_parse_opts *opts);
+
+/*
+ * In-place accessors
+ * 
+ * Walk an encoded buffer without decoding it, for example one that is
+ * mmapped or shared through a relay buffer. Nothing is allocated and
+ * the buffer is never validated as a whole: every field is checked as
+ * it is read, so a corrupt or concurrently changed buffer gives -EINVAL
+ * or wrong values but never an access outside it. Lookups in indexed
+ * objects take one hash probe; others scan the members in order. Strings
+ * point into the buffer and are not NUL-terminated.
+ */
+
+/**
+ * Get the root value of an encoded buffer
+ * @return 0 on success or -EINVAL if the header or root is invalid
+ */
+int jsonk_bin_root(const void *buf, size_t len, struct jsonk_bin_value *root);
+
+/**
+ * Get the type of an encoded value
+ */
+enum jsonk_value_type jsonk_bin_type(const struct jsonk_bin_value *value);
+
+/**
+ * Get the number of elements or members of an encoded container
+ * @return The count, or 0 for scalars and invalid containers
+ */
+size_t jsonk_bin_count(const struct jsonk_bin_value *value);
+
+/**
+ * Get an element of an encoded array
+ * @return 0 on success, -ENOENT past the end, or -EINVAL for invalid input
+ */
+int jsonk_bin_index(const struct jsonk_bin_value *array, size_t idx, struct jsonk_bin_value *out);
+
+/**
+ * Find a member of an encoded object by key
+ * 
+ * Objects with duplicate keys give the first member, as jsonk_object_find_member() does.
+ * 
+ * @return 0 on success, -ENOENT if there is no such member, or -EINVAL for invalid input
+ */
+int jsonk_bin_member(const struct jsonk_bin_value *object, const char *key, size_t key_len,
+                     struct jsonk_bin_value *out);
+
+/**
+ * Get a member of an encoded object by position, for iterating over it
+ * @param key Out: the key, pointing into the buffer
+ * @param key_len Out: length of the key
+ * @return 0 on success, -ENOENT past the end, or -EINVAL for invalid input
+ */
+int jsonk_bin_member_at(const struct jsonk_bin_value *object, size_t idx,
+                        const char **key, size_t *key_len, struct jsonk_bin_value *out);
+
+/**
+ * Look up a path in an encoded value, as jsonk_get_value_by_path() does
+ * @return 0 on success, -ENOENT if the path does not exist, or -EINVAL
+ *         for malformed paths and invalid input
+ */
+int jsonk_bin_get_path(const struct jsonk_bin_value *root, const char *path, size_t path_len,
+                       struct jsonk_bin_value *out);
+
+/**
+ * Get the text of an encoded string
+ * @return 0 on success or -EINVAL if the value is not a string
+ */
+int jsonk_bin_get_string(const struct jsonk_bin_value *value, const char **str, size_t *len);
+
+/**
+ * Get an encoded boolean
+ * @return 0 on success or -EINVAL if the value is not a boolean
+ */
+int jsonk_bin_get_bool(const struct jsonk_bin_value *value, bool *out);
+
+/**
+ * Get an encoded number as a signed integer, as jsonk_number_get_s64() does
+ * @return 0 on success, -EINVAL if the value is not a number, or -ERANGE
+ *         if it is not an integer that fits
+ */
+int jsonk_bin_get_s64(const struct jsonk_bin_value *value, s64 *out);
+
+/**
+ * Get an encoded number as an unsigned integer, as jsonk_number_get_u64() does
+ * @return 0 on success, -EINVAL if the value is not a number, or -ERANGE
+ *         if it is not an integer that fits
+ */
+int jsonk_bin_get_u64(const struct jsonk_bin_value *value, u64 *out);
+
+/* ========================================================================
+ * RCU Documents
+ * ======================================================================== */
+
+/*
+ * A published document that readers walk without locks
+ * 
+ * Readers enter rcu_read_lock(), fetch the current version with
+ * jsonk_doc_deref() and use only the read-only calls listed below until
+ * rcu_read_unlock(). Writers are serialized by the document's mutex and
+ * never change a published version: they build the next one with the
+ * copy-on-write functions, swap it in, and the old version is put
+ * after a grace period.
+ * 
+ * Safe on a version obtained under rcu_read_lock() (none of them sleep):
+ *   jsonk_get_value_by_path(), jsonk_path_get(), jsonk_object_find_member(),
+ *   jsonk_array_get(), jsonk_serialize(), and jsonk_value_get() to keep a
+ *   value past rcu_read_unlock() (release it with jsonk_value_put()).
+ * 
+ * Not safe on it: everything that modifies a tree (the set, add, remove
+ * and patch functions other than the jsonk_doc_* writers), and anything
+ * that allocates with GFP_KERNEL, such as jsonk_value_deep_copy(). Pin
+ * the version with jsonk_doc_pin() first for those.
+ * 
+ * Each version is held through a percpu_ref: pinning and unpinning touch
+ * only a per-CPU counter, and no node inside the tree, so readers that
+ * keep a version across a sleep do not bounce a shared cacheline either.
+ */
+struct jsonk_doc_version {
+    struct percpu_ref ref;      /* Pins; the initial reference is the document's */
+    struct jsonk_value *root;
+};
+
+struct jsonk_doc {
+    struct jsonk_doc_version __rcu *current_version;
+    struct mutex lock;          /* Serializes writers */
+};
+
+/**
+ * Initialize a document holder
+ * 
+ * @param doc Document holder
+ * @param root Initial version (reference taken over, also on failure),
+ *             may be NULL
+ * @return 0 on success, -ENOMEM (the document is then left empty)
+ */
+int jsonk_doc_init(struct jsonk_doc *doc, struct jsonk_value *root);
+
+/**
+ * Release the current version of a document
+ * 
+ * The version is put after a grace period. The caller must make sure no
+ * writers remain and that doc itself outlives any readers still inside
+ * an RCU read-side section.
+ * 
+ * @param doc Document holder
+ */
+void jsonk_doc_destroy(struct jsonk_doc *doc);
+
+/**
+ * Get the current version of a document
+ * 
+ * Must be called under rcu_read_lock(); the result is only valid until
+ * the matching rcu_read_unlock().
+ * 
+ * @param doc Document holder
+ * @return Current root, or NULL if none was published
+ */
+static inline struct jsonk_value *jsonk_doc_deref(struct jsonk_doc *doc)
+{
+    struct jsonk_doc_version *version = rcu_dereference(doc->current_version);
+    
+    return version ? version->root : NULL;
+}
+
+/**
+ * Pin the current version of a document
+ * 
+ * For readers that need to sleep while using the tree. The version's
+ * root stays valid and unchanged until jsonk_doc_unpin(), and is read
+ * with the same calls as under RCU. The pin costs a per-CPU increment.
+ * 
+ * @param doc Document holder
+ * @return Pinned version (use ->root), or NULL if nothing is published
+ */
+struct jsonk_doc_version *jsonk_doc_pin(struct jsonk_doc *doc);
+
+/**
+ * Release a version pinned with jsonk_doc_pin()
+ * 
+ * @param version Pinned version
+ */
+void jsonk_doc_unpin(struct jsonk_doc_version *version);
+
+/**
+ * Take a reference on the root of the current version of a document
+ * 
+ * Unlike a pin, this is an ordinary reference on the root node, which
+ * can be handed to any function taking a jsonk_value reference. It is an
+ * atomic on a cacheline shared by every caller; prefer jsonk_doc_pin()
+ * on hot paths.
+ * 
+ * @param doc Document holder
+ * @return Current root with a new reference, or NULL
+ */
+struct jsonk_value *jsonk_doc_get(struct jsonk_doc *doc);
+
+/**
+ * Publish a new version of a document
+ * 
+ * The tree must not be modified afterwards except through the jsonk_doc_*
+ * writers.
+ * 
+ * @param doc Document holder
+ * @param root New version (reference taken over, also on failure)
+ * @return 0 on success, -ENOMEM (the current version stays published)
+ */
+int jsonk_doc_publish(struct jsonk_doc *doc, struct jsonk_value *root);
+
+/**
+ * Publish a version of a document with one value changed
+ * 
+ * Copies only the nodes along the path, as jsonk_cow_set_value_by_path().
+ * May sleep.
+ * 
+ * @param doc Document holder
+ * @param path Path as for jsonk_set_value_by_path()
+ * @param path_len Length of path
+ * @param value Value to set (deep copied)
+ * @return 0 on success, -ENOENT if nothing is published, negative error
+ *         code on failure (the current version stays published)
+ */
+int jsonk_doc_set_value_by_path(struct jsonk_doc *doc, const char *path, size_t path_len,
+                                struct jsonk_value *value);
+
+/**
+ * Publish a patched version of a document
+ * 
+ * Builds the new version with jsonk_cow_apply_patch() and swaps it in if
+ * the patch changed anything. May sleep.
+ * 
+ * @param doc Document holder
+ * @param patch Patch object (not consumed)
+ * @return JSONK_PATCH_SUCCESS, JSONK_PATCH_NO_CHANGE, or an error code
+ *         from enum jsonk_patch_result
+ */
+int jsonk_doc_apply_patch(struct jsonk_doc *doc, struct jsonk_value *patch);
+
 /* ========================================================================
  * Object Manipulation Functions
  * ======================================================================== */
@@ -400,6 +1601,10 @@ int jsonk_object_add_member(struct jsonk_object *obj, const char *key, size_t ke
 /**
  * Find a member in a JSON object
  * 
+ * Objects of JSONK_OBJECT_INDEX_THRESHOLD members or more are looked up
+ * through their hash index in O(1); smaller ones are scanned. Lookups
+ * never modify the object.
+ * 
  * @param obj Object to search
  * @param key Key to find
  * @param key_len Length of key
@@ -430,15 +1635,32 @@ int jsonk_object_remove_member(struct jsonk_object *obj, const char *key, size_t
  */
 int jsonk_array_add_element(struct jsonk_array *arr, struct jsonk_value *value);
 
+/**
+ * Get an element of a JSON array by index in O(1)
+ * 
+ * @param arr Array to index
+ * @param idx Zero-based element index
+ * @return Element value (no reference taken) or NULL if out of range
+ */
+static inline struct jsonk_value *jsonk_array_get(struct jsonk_array *arr, size_t idx)
+{
+    if (idx >= arr->size)
+        return NULL;
+    return arr->items[idx];
+}
+
 /* ========================================================================
  * Path-based Access Functions
  * ======================================================================== */
 
 /**
- * Get a value from a JSON object using a dot-separated path
+ * Get a value from a JSON structure using a path
+ * 
+ * Paths are dot-separated keys with optional array indexes in brackets,
+ * e.g. "user.profile.name" or "items[3].id".
  * 
- * @param root Root JSON value (must be an object)
- * @param path Dot-separated path (e.g., "user.profile.name")
+ * @param root Root JSON value (object, or array if the path starts with an index)
+ * @param path Path (e.g., "user.profile.name")
  * @param path_len Length of path string
  * @return Pointer to found value or NULL if not found
  */
@@ -446,6 +1668,10 @@ struct jsonk_value *jsonk_get_value_by_path(struct jsonk_value *root, const char
 
 /**
  * Set a value at the specified path in a JSON structure
+ * 
+ * Missing intermediate objects and arrays are created. An index may name
+ * an existing element or be equal to the array size to append.
+ * 
  * @param root Root JSON value
  * @param path JSON path (e.g., "user.name" or "items[0].id")
  * @param path_len Length of path
@@ -454,5 +1680,177 @@ struct jsonk_value *jsonk_get_value_by_path(struct jsonk_value *root, const char
  */
 int jsonk_set_value_by_path(struct jsonk_value *root, const char *path, size_t path_len, struct jsonk_value *value);
 
+/**
+ * Find the value at a path in an unparsed JSON buffer
+ * 
+ * Walks the raw text instead of building a tree. Subtrees that are not on
+ * the path are skipped by bracket matching only, so errors inside them go
+ * unnoticed. Keys are compared verbatim and the first duplicate wins, as
+ * with jsonk_get_value_by_path().
+ * 
+ * Objects and arrays come back as JSONK_TOKEN_OBJECT_START/ARRAY_START
+ * tokens spanning the whole container. For strings the token covers the
+ * raw contents between the quotes, escapes left as they are. The token
+ * points into json_str.
+ * 
+ * @param json_str JSON document
+ * @param json_len Length of the document
+ * @param path Path as for jsonk_get_value_by_path(); empty for the root
+ * @param path_len Length of path
+ * @param token Receives the value found
+ * @return 0 on success, -ENOENT if the path does not exist, -EINVAL on
+ *         malformed input
+ */
+int jsonk_get_raw_by_path(const char *json_str, size_t json_len, const char *path, size_t path_len,
+                          struct jsonk_token *token);
+
+/**
+ * Parse only the value at a path in an unparsed JSON buffer
+ * 
+ * The document is walked as by jsonk_get_raw_by_path() and only the value
+ * found is materialized.
+ * 
+ * @param json_str JSON document
+ * @param json_len Length of the document
+ * @param path Path as for jsonk_get_value_by_path()
+ * @param path_len Length of path
+ * @return Parsed value, to be released with jsonk_value_put(), or NULL
+ */
+struct jsonk_value *jsonk_parse_by_path(const char *json_str, size_t json_len,
+                                        const char *path, size_t path_len);
+
+/* Path split once by jsonk_path_compile(), opaque to callers */
+struct jsonk_path;
+
+/**
+ * Compile a path for repeated lookups
+ * 
+ * The path is split into components once, with key lengths and hashes
+ * computed up front, so lookups through the handle only walk the tree.
+ * The handle keeps its own copy of the keys.
+ * 
+ * @param path Path as for jsonk_get_value_by_path()
+ * @param path_len Length of path
+ * @return Compiled path, to be released with jsonk_path_free(), or NULL on
+ *         bad syntax or allocation failure
+ */
+struct jsonk_path *jsonk_path_compile(const char *path, size_t path_len);
+
+/**
+ * Release a compiled path
+ * 
+ * @param path Compiled path (may be NULL)
+ */
+void jsonk_path_free(struct jsonk_path *path);
+
+/**
+ * Get a value using a compiled path
+ * 
+ * @param root Root JSON value
+ * @param path Compiled path
+ * @return Pointer to found value or NULL if not found
+ */
+struct jsonk_value *jsonk_path_get(struct jsonk_value *root, const struct jsonk_path *path);
+
+/**
+ * Set a value using a compiled path, as jsonk_set_value_by_path() does
+ * 
+ * @param root Root JSON value
+ * @param path Compiled path
+ * @param value New value to set (deep copied)
+ * @return 0 on success, negative error code on failure
+ */
+int jsonk_path_set(struct jsonk_value *root, const struct jsonk_path *path, struct jsonk_value *value);
+
+/**
+ * Merge a patch object into the object at a compiled path
+ * 
+ * Uses the same merge rules as jsonk_apply_patch(), applied in place as
+ * by jsonk_apply_patch_tree().
+ * 
+ * @param root Root JSON value
+ * @param path Compiled path naming an object
+ * @param patch Patch object (not consumed)
+ * @return JSONK_PATCH_SUCCESS, JSONK_PATCH_NO_CHANGE, or an error code
+ *         from enum jsonk_patch_result
+ */
+int jsonk_path_patch(struct jsonk_value *root, const struct jsonk_path *path, struct jsonk_value *patch);
+
+/* ========================================================================
+ * Statistics
+ * ======================================================================== */
+
+/* Parse limits, counted in struct jsonk_stats when they reject input */
+enum jsonk_limit {
+    JSONK_LIMIT_MEMORY,            /* max_memory */
+    JSONK_LIMIT_DEPTH,             /* max_depth */
+    JSONK_LIMIT_STRING_LENGTH,     /* max_string_length, for strings and numbers */
+    JSONK_LIMIT_KEY_LENGTH,        /* JSONK_MAX_KEY_LENGTH */
+    JSONK_LIMIT_ARRAY_SIZE,        /* max_array_size */
+    JSONK_LIMIT_OBJECT_MEMBERS,    /* max_object_members */
+    JSONK_LIMIT_STRINGS,           /* max_strings */
+    JSONK_LIMIT_COUNT
+};
+
+/* Calls timed in the latency histograms of struct jsonk_stats */
+enum jsonk_stat_op {
+    JSONK_STAT_PARSE,
+    JSONK_STAT_SERIALIZE,
+    JSONK_STAT_PATCH,
+    JSONK_STAT_OP_COUNT
+};
+
+#define JSONK_PATCH_RESULT_COUNT (JSONK_PATCH_ERROR_TEST + 1)
+#define JSONK_LATENCY_BUCKETS 32
+#define JSONK_LATENCY_SAMPLE 16        /* One call in this many is timed */
+
+/**
+ * Counters kept per CPU since the module loaded or the last reset
+ * 
+ * Parses are the jsonk_parse*() family, incremental parses, SAX parses
+ * and jsonk_validate(). Serializations are jsonk_serialize() and
+ * jsonk_serialize_to(), along with the functions built on them. Patches
+ * are the jsonk_apply_*(), path, copy-on-write and RCU document patch
+ * functions. Latency histograms sample one call in JSONK_LATENCY_SAMPLE
+ * on each CPU: bucket i counts sampled calls that took at least 2^(i-1)
+ * and less than 2^i nanoseconds, the last one also counts everything
+ * slower. Incremental parses are counted but not timed. Allocations
+ * count every slab object, buffer and arena chunk the library allocates,
+ * whoever called it. Nothing is counted while the stats module
+ * parameter is 0.
+ */
+struct jsonk_stats {
+    u64 parses;                            /* Parses, including failed ones */
+    u64 parse_errors;                      /* Parses that failed */
+    u64 parse_bytes;                       /* Input bytes of all parses */
+    u64 nodes;                             /* Value nodes allocated by parses */
+    u64 limits[JSONK_LIMIT_COUNT];         /* Input rejected by each limit */
+    u64 serializes;
+    u64 serialize_errors;
+    u64 serialize_bytes;                   /* Bytes written by serializations */
+    u64 patches[JSONK_PATCH_RESULT_COUNT]; /* Patch calls by enum jsonk_patch_result */
+    u64 allocs;                            /* Allocations made by the library */
+    u64 latency[JSONK_STAT_OP_COUNT][JSONK_LATENCY_BUCKETS];
+};
+
+/**
+ * Read the counters summed over all CPUs
+ * 
+ * Also shown in /sys/kernel/debug/jsonk/stats. Counters are read without
+ * stopping the CPUs updating them, so totals taken while calls run may
+ * be slightly inconsistent with each other.
+ * 
+ * @param stats Filled with the totals
+ */
+void jsonk_stats_read(struct jsonk_stats *stats);
+
+/**
+ * Reset all counters to zero
+ * 
+ * Also done by writing to /sys/kernel/debug/jsonk/stats. Calls running
+ * at the same time may be counted or lost.
+ */
+void jsonk_stats_reset(void);
+
 
 #endif /* JSONK_H */ 
\ No newline at end of file
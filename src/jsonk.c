@@ -15,11 +15,42 @@
 #include <linux/slab.h>
 #include <linux/bug.h>
 #include <linux/vmalloc.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
 #include <linux/spinlock.h>
 #include <linux/atomic.h>
 #include <linux/bitmap.h>
+#include <linux/stringhash.h>
+#include <linux/overflow.h>
+#include <linux/ctype.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+#include <linux/uio.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/cpumask.h>
+#include <linux/unaligned.h>
+#include <linux/siphash.h>
+#include <linux/random.h>
+#include <linux/ratelimit.h>
+#include <linux/debugfs.h>
+#include <linux/sched/clock.h>
+#include <linux/jump_label.h>
 #include "../include/jsonk.h"
+#ifdef JSONK_HAVE_SIMD
+#include <linux/fpu.h>
+#include <asm/simd.h>
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#endif
+#include "jsonk_simd.h"
+#endif
+
+#define CREATE_TRACE_POINTS
+#include "jsonk_trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Mehran Toosi");
@@ -29,1614 +60,9315 @@ MODULE_VERSION("1.0.0");
 /* Kernel slab caches for different object types */
 static struct kmem_cache *jsonk_value_cache = NULL;
 static struct kmem_cache *jsonk_member_cache = NULL;
-static struct kmem_cache *jsonk_element_cache = NULL;
+static struct kmem_cache *jsonk_member_ref_cache = NULL;
+static struct kmem_cache *jsonk_scalar_cache = NULL;
+
+/*
+ * Value node size classes. Containers and strings stored inline take the
+ * whole structure; every other scalar ends after the string arm.
+ */
+#define JSONK_SCALAR_NODE_SIZE \
+    (offsetof(struct jsonk_value, u) + sizeof_field(struct jsonk_value, u.string))
+#define JSONK_INLINE_STRING_MAX (sizeof(struct jsonk_value) - JSONK_SCALAR_NODE_SIZE - 1)
+
+/* Members whose key is stored elsewhere, borrowed or interned, end before inline_key */
+#define JSONK_MEMBER_F_KEY_REF (JSONK_MEMBER_F_BORROWED | JSONK_MEMBER_F_INTERNED)
+#define JSONK_MEMBER_REF_SIZE offsetof(struct jsonk_member, inline_key)
 
 /* ========================================================================
- * Memory Management
+ * Statistics
  * ======================================================================== */
 
-static void *jsonk_tracked_alloc(struct jsonk_parser *parser, size_t size)
+/*
+ * Counters are only added to on the local CPU, with this_cpu operations
+ * that are safe against interrupts, and summed over all CPUs when read.
+ * Reading the clock costs more than all the counters of a small call, so
+ * only one call in JSONK_LATENCY_SAMPLE on each CPU is timed, with
+ * local_clock(). The stats parameter switches counting and timing off
+ * behind a static key, leaving only the tracepoints, which have their own.
+ * 
+ * Warnings are driven by input, so they share one rate limit: a flood of
+ * bad documents costs a few lines every interval and is still counted.
+ */
+static DEFINE_PER_CPU(struct jsonk_stats, jsonk_cpu_stats);
+static DEFINE_PER_CPU(unsigned int, jsonk_stats_tick);
+static DEFINE_STATIC_KEY_TRUE(jsonk_stats_key);
+static DEFINE_RATELIMIT_STATE(jsonk_warn_rs, DEFAULT_RATELIMIT_INTERVAL, DEFAULT_RATELIMIT_BURST);
+static struct dentry *jsonk_debugfs_dir;
+
+static bool jsonk_stats_enabled = true;
+
+static int jsonk_stats_enabled_set(const char *val, const struct kernel_param *kp)
 {
-    void *ptr;
+    int ret = param_set_bool(val, kp);
     
-    if (parser && parser->total_memory_used + size > JSONK_MAX_TOTAL_MEMORY) {
-        printk(KERN_WARNING "JSONK: Memory limit exceeded (%zu + %zu > %d)\n",
-               parser->total_memory_used, size, JSONK_MAX_TOTAL_MEMORY);
-        return NULL;
-    }
+    if (ret < 0)
+        return ret;
+    if (READ_ONCE(jsonk_stats_enabled))
+        static_branch_enable(&jsonk_stats_key);
+    else
+        static_branch_disable(&jsonk_stats_key);
+    return 0;
+}
+
+static const struct kernel_param_ops jsonk_stats_enabled_ops = {
+    .set = jsonk_stats_enabled_set,
+    .get = param_get_bool,
+};
+
+module_param_cb(stats, &jsonk_stats_enabled_ops, &jsonk_stats_enabled, 0644);
+MODULE_PARM_DESC(stats, "Count and time parses, serializations and patches");
+
+static __printf(1, 2) void jsonk_warn(const char *fmt, ...)
+{
+    struct va_format vaf;
+    va_list args;
     
-    if (size <= JSONK_LARGE_ALLOC_THRESHOLD) {
-        ptr = kmalloc(size, GFP_KERNEL);
-    } else {
-        ptr = vmalloc(size);
-    }
+    if (!__ratelimit(&jsonk_warn_rs))
+        return;
     
-    if (ptr && parser) {
-        parser->total_memory_used += size;
-    }
+    va_start(args, fmt);
+    vaf.fmt = fmt;
+    vaf.va = &args;
+    printk(KERN_WARNING "JSONK: %pV", &vaf);
+    va_end(args);
+}
+
+/**
+ * Count input rejected by a limit and warn about it
+ */
+static __printf(2, 3) void jsonk_reject(enum jsonk_limit limit, const char *fmt, ...)
+{
+    struct va_format vaf;
+    va_list args;
+    
+    if (static_branch_likely(&jsonk_stats_key))
+        this_cpu_inc(jsonk_cpu_stats.limits[limit]);
+    if (!__ratelimit(&jsonk_warn_rs))
+        return;
+    
+    va_start(args, fmt);
+    vaf.fmt = fmt;
+    vaf.va = &args;
+    printk(KERN_WARNING "JSONK: %pV", &vaf);
+    va_end(args);
+}
+
+/* Start time of a call, 0 if it is not timed */
+static inline u64 jsonk_stats_clock(void)
+{
+    if (!static_branch_likely(&jsonk_stats_key) ||
+        this_cpu_inc_return(jsonk_stats_tick) % JSONK_LATENCY_SAMPLE)
+        return 0;
+    return local_clock();
+}
+
+/* Bucket i holds durations of at least 2^(i-1) and under 2^i ns */
+static inline void jsonk_stats_latency(enum jsonk_stat_op op, u64 start)
+{
+    unsigned int bucket;
     
+    if (!start)
+        return;
+    bucket = min(fls64(local_clock() - start), JSONK_LATENCY_BUCKETS - 1);
+    this_cpu_inc(jsonk_cpu_stats.latency[op][bucket]);
+}
+
+/**
+ * Count an allocation made for a caller, passing the result through
+ * @return ptr
+ */
+static inline void *jsonk_counted(void *ptr)
+{
+    if (ptr && static_branch_likely(&jsonk_stats_key))
+        this_cpu_inc(jsonk_cpu_stats.allocs);
     return ptr;
 }
 
-static void jsonk_tracked_free(void *ptr, size_t size)
+static inline u64 jsonk_parse_begin(const struct jsonk_parser *parser)
 {
-    if (!ptr)
+    trace_jsonk_parse_start(parser->buffer_len, parser->flags);
+    return jsonk_stats_clock();
+}
+
+/**
+ * Count a finished parse of len bytes
+ * @param start Time from jsonk_parse_begin(), 0 for an untimed parse
+ */
+static void jsonk_parse_end(const struct jsonk_parser *parser, size_t len, bool ok, u64 start)
+{
+    trace_jsonk_parse_end(len, parser->node_count, ok);
+    if (!static_branch_likely(&jsonk_stats_key))
         return;
-        
-    if (size <= JSONK_LARGE_ALLOC_THRESHOLD)
-        kfree(ptr);
-    else
-        vfree(ptr);
+    
+    this_cpu_inc(jsonk_cpu_stats.parses);
+    this_cpu_add(jsonk_cpu_stats.parse_bytes, len);
+    this_cpu_add(jsonk_cpu_stats.nodes, parser->node_count);
+    if (!ok)
+        this_cpu_inc(jsonk_cpu_stats.parse_errors);
+    jsonk_stats_latency(JSONK_STAT_PARSE, start);
 }
 
-static struct jsonk_value *jsonk_value_create_tracked(enum jsonk_value_type type, struct jsonk_parser *parser)
+static inline u64 jsonk_serialize_begin(const struct jsonk_value *value)
 {
-    struct jsonk_value *value;
+    trace_jsonk_serialize_start(value);
+    return jsonk_stats_clock();
+}
+
+static void jsonk_serialize_end(int ret, size_t len, u64 start)
+{
+    trace_jsonk_serialize_end(len, ret);
+    if (!static_branch_likely(&jsonk_stats_key))
+        return;
     
-    if (!jsonk_value_cache) {
-        printk(KERN_ERR "JSONK: Value cache not initialized\n");
-        return NULL;
-    }
+    this_cpu_inc(jsonk_cpu_stats.serializes);
+    this_cpu_add(jsonk_cpu_stats.serialize_bytes, len);
+    if (ret < 0)
+        this_cpu_inc(jsonk_cpu_stats.serialize_errors);
+    jsonk_stats_latency(JSONK_STAT_SERIALIZE, start);
+}
+
+static inline u64 jsonk_patch_begin(enum jsonk_patch_kind kind)
+{
+    trace_jsonk_patch_start(kind);
+    return jsonk_stats_clock();
+}
+
+/**
+ * Count a finished patch call
+ * @return ret, for the caller to return
+ */
+static int jsonk_patch_end(enum jsonk_patch_kind kind, u64 start, int ret)
+{
+    trace_jsonk_patch_end(kind, ret);
+    if (!static_branch_likely(&jsonk_stats_key))
+        return ret;
     
-    if (parser && parser->total_memory_used + sizeof(struct jsonk_value) > JSONK_MAX_TOTAL_MEMORY) {
-        printk(KERN_WARNING "JSONK: Memory limit exceeded for value creation\n");
-        return NULL;
+    if (ret >= 0 && ret < JSONK_PATCH_RESULT_COUNT)
+        this_cpu_inc(jsonk_cpu_stats.patches[ret]);
+    jsonk_stats_latency(JSONK_STAT_PATCH, start);
+    return ret;
+}
+
+/**
+ * Read the counters summed over all CPUs
+ */
+void jsonk_stats_read(struct jsonk_stats *stats)
+{
+    u64 *total = (u64 *)stats;
+    const u64 *counts;
+    size_t i;
+    int cpu;
+    
+    /* The structure is nothing but u64 counters */
+    BUILD_BUG_ON(sizeof(*stats) % sizeof(u64));
+    
+    memset(stats, 0, sizeof(*stats));
+    for_each_possible_cpu(cpu) {
+        counts = (const u64 *)per_cpu_ptr(&jsonk_cpu_stats, cpu);
+        for (i = 0; i < sizeof(*stats) / sizeof(u64); i++)
+            total[i] += READ_ONCE(counts[i]);
     }
+}
+
+/**
+ * Reset all counters to zero
+ */
+void jsonk_stats_reset(void)
+{
+    int cpu;
     
-    value = kmem_cache_alloc(jsonk_value_cache, GFP_KERNEL);
-    if (!value)
-        return NULL;
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(&jsonk_cpu_stats, cpu), 0, sizeof(struct jsonk_stats));
+}
+
+static const char *const jsonk_limit_names[] = {
+    [JSONK_LIMIT_MEMORY] = "memory",
+    [JSONK_LIMIT_DEPTH] = "depth",
+    [JSONK_LIMIT_STRING_LENGTH] = "string_length",
+    [JSONK_LIMIT_KEY_LENGTH] = "key_length",
+    [JSONK_LIMIT_ARRAY_SIZE] = "array_size",
+    [JSONK_LIMIT_OBJECT_MEMBERS] = "object_members",
+    [JSONK_LIMIT_STRINGS] = "strings",
+};
+
+static const char *const jsonk_patch_result_names[] = {
+    [JSONK_PATCH_SUCCESS] = "success",
+    [JSONK_PATCH_ERROR_PARSE] = "error_parse",
+    [JSONK_PATCH_ERROR_PATH] = "error_path",
+    [JSONK_PATCH_ERROR_TYPE] = "error_type",
+    [JSONK_PATCH_ERROR_MEMORY] = "error_memory",
+    [JSONK_PATCH_ERROR_OVERFLOW] = "error_overflow",
+    [JSONK_PATCH_NO_CHANGE] = "no_change",
+    [JSONK_PATCH_ERROR_TEST] = "error_test",
+};
+
+static const char *const jsonk_stat_op_names[] = {
+    [JSONK_STAT_PARSE] = "parse",
+    [JSONK_STAT_SERIALIZE] = "serialize",
+    [JSONK_STAT_PATCH] = "patch",
+};
+
+/*
+ * One "name value" pair per line. Histograms list their non-empty
+ * buckets as "<op>_latency_ns <from>-<to> <count>", the bounds in ns.
+ */
+static int jsonk_stats_show(struct seq_file *m, void *unused)
+{
+    struct jsonk_stats *stats;
+    unsigned int op, i;
     
-    memset(value, 0, sizeof(struct jsonk_value));
-    atomic_set(&value->refcount, 1);
-    value->type = type;
+    stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+    if (!stats)
+        return -ENOMEM;
+    jsonk_stats_read(stats);
     
-    if (parser) {
-        parser->total_memory_used += sizeof(struct jsonk_value);
-    }
+    seq_printf(m, "parses %llu\n", stats->parses);
+    seq_printf(m, "parse_errors %llu\n", stats->parse_errors);
+    seq_printf(m, "parse_bytes %llu\n", stats->parse_bytes);
+    seq_printf(m, "nodes %llu\n", stats->nodes);
+    for (i = 0; i < JSONK_LIMIT_COUNT; i++)
+        seq_printf(m, "limit_%s %llu\n", jsonk_limit_names[i], stats->limits[i]);
+    seq_printf(m, "serializes %llu\n", stats->serializes);
+    seq_printf(m, "serialize_errors %llu\n", stats->serialize_errors);
+    seq_printf(m, "serialize_bytes %llu\n", stats->serialize_bytes);
+    for (i = 0; i < JSONK_PATCH_RESULT_COUNT; i++)
+        seq_printf(m, "patch_%s %llu\n", jsonk_patch_result_names[i], stats->patches[i]);
+    seq_printf(m, "allocs %llu\n", stats->allocs);
     
-    if (type == JSONK_VALUE_OBJECT) {
-        INIT_LIST_HEAD(&value->u.object.members);
-        value->u.object.size = 0;
-        if (parser) {
-            parser->object_count++;
-        }
-    } else if (type == JSONK_VALUE_ARRAY) {
-        INIT_LIST_HEAD(&value->u.array.elements);
-        value->u.array.size = 0;
-        if (parser) {
-            parser->array_count++;
+    for (op = 0; op < JSONK_STAT_OP_COUNT; op++) {
+        for (i = 0; i < JSONK_LATENCY_BUCKETS; i++) {
+            if (!stats->latency[op][i])
+                continue;
+            if (i + 1 < JSONK_LATENCY_BUCKETS)
+                seq_printf(m, "%s_latency_ns %llu-%llu %llu\n", jsonk_stat_op_names[op],
+                           i ? 1ULL << (i - 1) : 0, (1ULL << i) - 1, stats->latency[op][i]);
+            else
+                seq_printf(m, "%s_latency_ns %llu- %llu\n", jsonk_stat_op_names[op],
+                           1ULL << (i - 1), stats->latency[op][i]);
         }
     }
     
-    return value;
+    kfree(stats);
+    return 0;
+}
+
+static int jsonk_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, jsonk_stats_show, NULL);
+}
+
+/* Any write resets the counters */
+static ssize_t jsonk_stats_write(struct file *file, const char __user *buf, size_t len, loff_t *ppos)
+{
+    jsonk_stats_reset();
+    return len;
+}
+
+static const struct file_operations jsonk_stats_fops = {
+    .owner = THIS_MODULE,
+    .open = jsonk_stats_open,
+    .read = seq_read,
+    .write = jsonk_stats_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+/* debugfs is optional, failures only leave the file missing */
+static void jsonk_stats_init(void)
+{
+    jsonk_debugfs_dir = debugfs_create_dir("jsonk", NULL);
+    debugfs_create_file("stats", 0600, jsonk_debugfs_dir, NULL, &jsonk_stats_fops);
+}
+
+static void jsonk_stats_exit(void)
+{
+    debugfs_remove_recursive(jsonk_debugfs_dir);
+    jsonk_debugfs_dir = NULL;
 }
 
 /* ========================================================================
- * Internal Helper Functions
+ * Per-CPU Chunk Pools
  * ======================================================================== */
 
-static int jsonk_parse_string(struct jsonk_parser *parser, struct jsonk_token *token)
+/*
+ * Pages set aside for JSONK_PARSE_POOL arenas, which must not enter the
+ * page allocator. Taking or returning a chunk touches only the current
+ * CPU's list; the lock is there for refills running on other CPUs. A
+ * list that drops below half of pool_chunks queues a refill, which runs
+ * in process context and allocates with GFP_KERNEL.
+ */
+struct jsonk_pool_page {
+    struct jsonk_pool_page *next;
+};
+
+struct jsonk_pool {
+    spinlock_t lock;
+    struct jsonk_pool_page *pages;
+    unsigned int count;
+};
+
+static DEFINE_PER_CPU(struct jsonk_pool, jsonk_pools);
+
+static unsigned int jsonk_pool_chunks = JSONK_POOL_CHUNKS;
+module_param_named(pool_chunks, jsonk_pool_chunks, uint, 0644);
+MODULE_PARM_DESC(pool_chunks, "Chunks kept per CPU for atomic-context parses");
+
+static void jsonk_pool_refill_work(struct work_struct *work);
+static DECLARE_WORK(jsonk_pool_work, jsonk_pool_refill_work);
+
+/**
+ * Take a chunk from the current CPU's pool, NULL if it is empty
+ */
+static void *jsonk_pool_take(void)
 {
-    size_t start_pos;
-    char c;
+    struct jsonk_pool *pool = raw_cpu_ptr(&jsonk_pools);
+    struct jsonk_pool_page *page;
+    unsigned long flags;
+    bool low;
     
-    /* Skip the opening quote */
-    parser->pos++;
-    start_pos = parser->pos;
+    spin_lock_irqsave(&pool->lock, flags);
+    page = pool->pages;
+    if (page) {
+        pool->pages = page->next;
+        pool->count--;
+    }
+    low = pool->count < READ_ONCE(jsonk_pool_chunks) / 2;
+    spin_unlock_irqrestore(&pool->lock, flags);
     
-    /* Find the closing quote, handling escapes */
-    while (parser->pos < parser->buffer_len) {
-        c = parser->buffer[parser->pos];
-        
-        if (c == '"') {
-            /* Found closing quote */
-            token->type = JSONK_TOKEN_STRING;
-            token->start = &parser->buffer[start_pos];
-            token->len = parser->pos - start_pos;
-            parser->pos++; /* Skip closing quote */
-            return 0;
-        } else if (c == '\\') {
-            /* Handle escape sequence */
-            parser->pos++; /* Skip backslash */
-            if (parser->pos >= parser->buffer_len) {
-                return -EINVAL; /* Incomplete escape */
-            }
-            
-            c = parser->buffer[parser->pos];
-            switch (c) {
-            case '"':
-            case '\\':
-            case '/':
-            case 'b':
-            case 'f':
-            case 'n':
-            case 'r':
-            case 't':
-                parser->pos++; /* Valid escape */
-                break;
-            case 'u':
-                /* Unicode escape: \uXXXX */
-                parser->pos++; /* Skip 'u' */
-                for (int i = 0; i < 4; i++) {
-                    if (parser->pos >= parser->buffer_len) {
-                        return -EINVAL;
-                    }
-                    c = parser->buffer[parser->pos];
-                    if (!((c >= '0' && c <= '9') || 
-                          (c >= 'a' && c <= 'f') || 
-                          (c >= 'A' && c <= 'F'))) {
-                        return -EINVAL; /* Invalid hex digit */
-                    }
-                    parser->pos++;
-                }
-                break;
-            default:
-                return -EINVAL; /* Invalid escape sequence */
-            }
-        } else if (c < 0x20) {
-            /* Control characters must be escaped */
-            return -EINVAL;
-        } else {
-            parser->pos++;
-        }
+    if (low)
+        schedule_work(&jsonk_pool_work);
+    return page;
+}
+
+/**
+ * Return a chunk to the current CPU's pool, or free it if the pool is full
+ */
+static void jsonk_pool_give(void *chunk)
+{
+    struct jsonk_pool *pool = raw_cpu_ptr(&jsonk_pools);
+    struct jsonk_pool_page *page = chunk;
+    unsigned long flags;
+    
+    spin_lock_irqsave(&pool->lock, flags);
+    if (pool->count < READ_ONCE(jsonk_pool_chunks)) {
+        page->next = pool->pages;
+        pool->pages = page;
+        pool->count++;
+        page = NULL;
     }
+    spin_unlock_irqrestore(&pool->lock, flags);
     
-    /* Reached end without closing quote */
-    return -EINVAL;
+    if (page)
+        free_pages((unsigned long)page, JSONK_ARENA_CHUNK_ORDER);
 }
 
-static int jsonk_parse_number(struct jsonk_parser *parser, struct jsonk_token *token)
+static int jsonk_pool_fill(struct jsonk_pool *pool, unsigned int target)
 {
-    size_t start_pos = parser->pos;
-    char c;
+    struct jsonk_pool_page *page;
+    unsigned long flags;
     
-    /* Parse optional minus sign */
-    c = jsonk_peek_char(parser);
-    if (c == '-') {
-        parser->pos++;
+    while (READ_ONCE(pool->count) < target) {
+        page = (struct jsonk_pool_page *)__get_free_pages(GFP_KERNEL, JSONK_ARENA_CHUNK_ORDER);
+        if (!page)
+            return -ENOMEM;
+        
+        spin_lock_irqsave(&pool->lock, flags);
+        page->next = pool->pages;
+        pool->pages = page;
+        pool->count++;
+        spin_unlock_irqrestore(&pool->lock, flags);
     }
+    return 0;
+}
+
+/**
+ * Top up every CPU's chunk pool
+ */
+int jsonk_pool_refill(void)
+{
+    unsigned int target = READ_ONCE(jsonk_pool_chunks);
+    int cpu, ret = 0;
     
-    /* Parse integer part */
-    c = jsonk_peek_char(parser);
-    if (c == '0') {
-        /* Leading zero - must not be followed by more digits */
-        parser->pos++;
-        c = jsonk_peek_char(parser);
-        if (c >= '0' && c <= '9') {
-            return -EINVAL; /* Invalid: leading zeros not allowed */
-        }
-    } else if (c >= '1' && c <= '9') {
-        /* Non-zero digit - parse remaining digits */
-        parser->pos++;
-        while (parser->pos < parser->buffer_len) {
-            c = parser->buffer[parser->pos];
-            if (c >= '0' && c <= '9') {
-                parser->pos++;
-            } else {
-                break;
-            }
-        }
-    } else {
-        return -EINVAL; /* Invalid: no digits found */
+    might_sleep();
+    
+    for_each_possible_cpu(cpu) {
+        if (jsonk_pool_fill(per_cpu_ptr(&jsonk_pools, cpu), target) < 0)
+            ret = -ENOMEM;
     }
+    return ret;
+}
+
+static void jsonk_pool_refill_work(struct work_struct *work)
+{
+    if (jsonk_pool_refill() < 0)
+        jsonk_warn("Failed to refill chunk pools\n");
+}
+
+static void jsonk_pool_init(void)
+{
+    int cpu;
     
-    /* Parse optional fractional part */
-    if (parser->pos < parser->buffer_len && parser->buffer[parser->pos] == '.') {
-        parser->pos++; /* Skip decimal point */
-        
-        /* Must have at least one digit after decimal point */
-        if (parser->pos >= parser->buffer_len || 
-            parser->buffer[parser->pos] < '0' || 
-            parser->buffer[parser->pos] > '9') {
-            return -EINVAL;
-        }
-        
-        /* Parse fractional digits */
-        while (parser->pos < parser->buffer_len) {
-            c = parser->buffer[parser->pos];
-            if (c >= '0' && c <= '9') {
-                parser->pos++;
-            } else {
-                break;
-            }
+    for_each_possible_cpu(cpu)
+        spin_lock_init(&per_cpu_ptr(&jsonk_pools, cpu)->lock);
+    
+    /* Pool parses fail until a refill succeeds, nothing else depends on it */
+    if (jsonk_pool_refill() < 0)
+        jsonk_warn("Failed to fill chunk pools\n");
+}
+
+static void jsonk_pool_exit(void)
+{
+    struct jsonk_pool_page *page;
+    struct jsonk_pool *pool;
+    int cpu;
+    
+    cancel_work_sync(&jsonk_pool_work);
+    
+    for_each_possible_cpu(cpu) {
+        pool = per_cpu_ptr(&jsonk_pools, cpu);
+        while ((page = pool->pages)) {
+            pool->pages = page->next;
+            free_pages((unsigned long)page, JSONK_ARENA_CHUNK_ORDER);
         }
+        pool->count = 0;
     }
+}
+
+/* ========================================================================
+ * Document Arena
+ * ======================================================================== */
+
+#define JSONK_ARENA_ALIGN 8
+
+/* Header at the start of every chunk; chunks are naturally aligned */
+struct jsonk_arena_chunk {
+    struct jsonk_arena_chunk *next;
+    struct jsonk_arena *arena;
+    size_t used;
+};
+
+/* Block too large for a chunk, allocated separately */
+struct jsonk_arena_large {
+    struct jsonk_arena_large *next;
+    void *ptr;
+    size_t size;
+};
+
+/* Reference to a value from outside the arena linked into the document */
+struct jsonk_arena_ref {
+    struct jsonk_arena_ref *next;
+    struct jsonk_value *value;
+};
+
+struct jsonk_arena {
+    atomic_t refcount;                  /* References on the whole document */
+    gfp_t gfp;                          /* Flags for chunks, from the parse that created it */
+    bool pooled;                        /* Chunks come from and go back to the chunk pools */
+    struct jsonk_arena_chunk *chunks;   /* Current chunk first, home chunk last */
+    struct jsonk_arena_large *large;    /* Oversized blocks */
+    struct jsonk_arena_ref *external;   /* Foreign values owned by the document */
+};
+
+static struct jsonk_arena_chunk *jsonk_arena_chunk_alloc(gfp_t gfp, bool pooled)
+{
+    struct jsonk_arena_chunk *chunk;
+    
+    if (pooled)
+        chunk = jsonk_pool_take();
+    else
+        chunk = jsonk_counted((void *)__get_free_pages(gfp, JSONK_ARENA_CHUNK_ORDER));
+    if (!chunk)
+        return NULL;
+    
+    chunk->next = NULL;
+    chunk->arena = NULL;
+    chunk->used = ALIGN(sizeof(struct jsonk_arena_chunk), JSONK_ARENA_ALIGN);
+    return chunk;
+}
+
+/**
+ * Create an arena; the arena header lives in its first (home) chunk
+ */
+static struct jsonk_arena *jsonk_arena_create(gfp_t gfp, bool pooled)
+{
+    struct jsonk_arena_chunk *chunk;
+    struct jsonk_arena *arena;
+    
+    chunk = jsonk_arena_chunk_alloc(gfp, pooled);
+    if (!chunk)
+        return NULL;
+    
+    arena = (struct jsonk_arena *)((char *)chunk + chunk->used);
+    chunk->used += ALIGN(sizeof(struct jsonk_arena), JSONK_ARENA_ALIGN);
+    chunk->arena = arena;
+    
+    atomic_set(&arena->refcount, 1);
+    arena->gfp = gfp;
+    arena->pooled = pooled;
+    arena->chunks = chunk;
+    arena->large = NULL;
+    arena->external = NULL;
+    return arena;
+}
+
+static void *jsonk_arena_alloc(struct jsonk_arena *arena, size_t size)
+{
+    struct jsonk_arena_chunk *chunk = arena->chunks;
+    struct jsonk_arena_large *large;
+    void *ptr;
+    
+    size = ALIGN(size, JSONK_ARENA_ALIGN);
+    
+    /* Pooled arenas have nothing but chunks, so blocks get one to themselves */
+    if (arena->pooled) {
+        if (size > JSONK_ARENA_CHUNK_SIZE - ALIGN(sizeof(*chunk), JSONK_ARENA_ALIGN))
+            return NULL;
+    } else if (size > JSONK_ARENA_LARGE_THRESHOLD) {
+        large = jsonk_arena_alloc(arena, sizeof(struct jsonk_arena_large));
+        if (!large)
+            return NULL;
+        large->ptr = jsonk_counted(jsonk_memory_alloc_gfp(size, arena->gfp));
+        if (!large->ptr)
+            return NULL;
+        large->size = size;
+        large->next = arena->large;
+        arena->large = large;
+        return large->ptr;
+    }
+    
+    if (chunk->used + size > JSONK_ARENA_CHUNK_SIZE) {
+        chunk = jsonk_arena_chunk_alloc(arena->gfp, arena->pooled);
+        if (!chunk)
+            return NULL;
+        chunk->arena = arena;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    
+    ptr = (char *)chunk + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+/**
+ * Release everything owned by an arena in O(chunks)
+ */
+static void jsonk_arena_destroy(struct jsonk_arena *arena)
+{
+    struct jsonk_arena_chunk *chunk, *next;
+    struct jsonk_arena_large *large;
+    struct jsonk_arena_ref *ref;
+    
+    for (ref = arena->external; ref; ref = ref->next)
+        jsonk_value_put(ref->value);
+    
+    for (large = arena->large; large; large = large->next)
+        jsonk_memory_free(large->ptr, large->size);
+    
+    /* The arena header itself goes away with the home chunk, freed last */
+    chunk = arena->chunks;
+    while (chunk) {
+        next = chunk->next;
+        if (arena->pooled)
+            jsonk_pool_give(chunk);
+        else
+            free_pages((unsigned long)chunk, JSONK_ARENA_CHUNK_ORDER);
+        chunk = next;
+    }
+}
+
+/**
+ * Find the arena a node belongs to, NULL for slab nodes
+ */
+static inline struct jsonk_arena *jsonk_value_arena(const struct jsonk_value *value)
+{
+    unsigned long base;
+    
+    if (!(value->flags & JSONK_VALUE_F_ARENA))
+        return NULL;
+    
+    base = (unsigned long)value & ~(JSONK_ARENA_CHUNK_SIZE - 1);
+    return ((struct jsonk_arena_chunk *)base)->arena;
+}
+
+static inline struct jsonk_arena *jsonk_object_arena(struct jsonk_object *obj)
+{
+    return jsonk_value_arena(container_of(obj, struct jsonk_value, u.object));
+}
+
+static inline struct jsonk_arena *jsonk_array_arena(struct jsonk_array *arr)
+{
+    return jsonk_value_arena(container_of(arr, struct jsonk_value, u.array));
+}
+
+/* Drop the cached content hash of a container that changes */
+static inline void jsonk_value_changed(struct jsonk_value *value)
+{
+    WRITE_ONCE(value->hash, 0);
+}
+
+static inline void jsonk_object_changed(struct jsonk_object *obj)
+{
+    jsonk_value_changed(container_of(obj, struct jsonk_value, u.object));
+}
+
+static inline void jsonk_array_changed(struct jsonk_array *arr)
+{
+    jsonk_value_changed(container_of(arr, struct jsonk_value, u.array));
+}
+
+/**
+ * Hand a reference on a value to an arena document
+ * 
+ * Values from other arenas or from the slab are released when the
+ * document is; a reference into the same arena is simply dropped.
+ */
+static int jsonk_arena_adopt(struct jsonk_arena *arena, struct jsonk_value *value)
+{
+    struct jsonk_arena_ref *ref;
+    
+    if (jsonk_value_arena(value) == arena) {
+        atomic_dec(&arena->refcount);
+        return 0;
+    }
+    
+    ref = jsonk_arena_alloc(arena, sizeof(struct jsonk_arena_ref));
+    if (!ref)
+        return -ENOMEM;
+    
+    ref->value = value;
+    ref->next = arena->external;
+    arena->external = ref;
+    return 0;
+}
+
+/* ========================================================================
+ * Key Interning
+ * ======================================================================== */
+
+/*
+ * Keys shared by the members of JSONK_PARSE_INTERN documents. Lookups run
+ * under RCU, adding and removing keys takes jsonk_keys_lock. A key leaves
+ * the table as soon as its last member is freed and no lookup takes a
+ * reference on a key on its way out, so every live key string is in the
+ * table once: two interned keys are equal exactly when they are the same
+ * key. The table holds at most intern_keys keys; past that, members get
+ * keys of their own again.
+ */
+struct jsonk_key {
+    struct hlist_node node;
+    struct rcu_head rcu;
+    atomic_t refcount;
+    u32 hash;
+    u16 len;
+    char data[];
+};
+
+#define JSONK_KEY_BUCKETS 1024
+
+static struct hlist_head jsonk_keys[JSONK_KEY_BUCKETS];
+static DEFINE_SPINLOCK(jsonk_keys_lock);
+static unsigned int jsonk_keys_count;
+
+static unsigned int jsonk_intern_keys = JSONK_INTERN_KEYS;
+module_param_named(intern_keys, jsonk_intern_keys, uint, 0644);
+MODULE_PARM_DESC(intern_keys, "Most keys held in the interned key table");
+
+static inline u32 jsonk_key_hash(const char *key, size_t key_len)
+{
+    return full_name_hash(NULL, key, key_len);
+}
+
+static inline struct jsonk_key *jsonk_member_ikey(const struct jsonk_member *member)
+{
+    return container_of(member->key, struct jsonk_key, data[0]);
+}
+
+/**
+ * Find a live key and take a reference on it, under RCU or jsonk_keys_lock
+ */
+static struct jsonk_key *jsonk_key_find(struct hlist_head *bucket, const char *key,
+                                        size_t key_len, u32 hash)
+{
+    struct jsonk_key *ikey;
+    
+    hlist_for_each_entry_rcu(ikey, bucket, node, lockdep_is_held(&jsonk_keys_lock)) {
+        if (ikey->hash == hash && ikey->len == key_len &&
+            memcmp(ikey->data, key, key_len) == 0 && atomic_inc_not_zero(&ikey->refcount))
+            return ikey;
+    }
+    return NULL;
+}
+
+/**
+ * Reference the interned copy of a key, adding it to the table if needed
+ * 
+ * NULL if the table is full or the allocation fails; the caller then
+ * stores the key itself.
+ */
+static struct jsonk_key *jsonk_key_intern(const char *key, size_t key_len, gfp_t gfp)
+{
+    u32 hash = jsonk_key_hash(key, key_len);
+    struct hlist_head *bucket = &jsonk_keys[hash & (JSONK_KEY_BUCKETS - 1)];
+    struct jsonk_key *ikey, *fresh;
+    unsigned long flags;
+    
+    rcu_read_lock();
+    ikey = jsonk_key_find(bucket, key, key_len, hash);
+    rcu_read_unlock();
+    if (ikey || READ_ONCE(jsonk_keys_count) >= READ_ONCE(jsonk_intern_keys))
+        return ikey;
+    
+    fresh = jsonk_counted(kmalloc(struct_size(fresh, data, key_len + 1), gfp));
+    if (!fresh)
+        return NULL;
+    atomic_set(&fresh->refcount, 1);
+    fresh->hash = hash;
+    fresh->len = key_len;
+    memcpy(fresh->data, key, key_len);
+    fresh->data[key_len] = '\0';
+    
+    /* Another parse may have added the key in the meantime */
+    spin_lock_irqsave(&jsonk_keys_lock, flags);
+    ikey = jsonk_key_find(bucket, key, key_len, hash);
+    if (!ikey && jsonk_keys_count < READ_ONCE(jsonk_intern_keys)) {
+        hlist_add_head_rcu(&fresh->node, bucket);
+        jsonk_keys_count++;
+        ikey = fresh;
+        fresh = NULL;
+    }
+    spin_unlock_irqrestore(&jsonk_keys_lock, flags);
+    
+    kfree(fresh);
+    return ikey;
+}
+
+static void jsonk_key_put(struct jsonk_key *ikey)
+{
+    unsigned long flags;
+    
+    if (!atomic_dec_and_test(&ikey->refcount))
+        return;
+    
+    spin_lock_irqsave(&jsonk_keys_lock, flags);
+    hlist_del_rcu(&ikey->node);
+    jsonk_keys_count--;
+    spin_unlock_irqrestore(&jsonk_keys_lock, flags);
+    kfree_rcu(ikey, rcu);
+}
+
+/* ========================================================================
+ * Memory Management
+ * ======================================================================== */
+
+static inline gfp_t jsonk_parser_gfp(const struct jsonk_parser *parser)
+{
+    return parser ? parser->gfp : GFP_KERNEL;
+}
+
+/*
+ * The ranges of a parallel parse share the document's memory and string
+ * limits. Their own limits start at 0 and grow by slices leased from
+ * what the document has left, so the shared counters are rarely touched.
+ * A range that finds too little left marks the budget dry and fails;
+ * the document is then parsed serially, which reports the verdict.
+ */
+struct jsonk_split_budget {
+    atomic_long_t memory;           /* Bytes not leased yet */
+    atomic_long_t strings;          /* Strings not leased yet */
+    long memory_slice;
+    long strings_slice;
+    bool dry;
+};
+
+/**
+ * Lease at least need, and a slice if there is one, out of left
+ * @return The amount leased, 0 if less than need was left
+ */
+static long jsonk_split_lease(struct jsonk_split_budget *budget, atomic_long_t *left,
+                              long slice, size_t need)
+{
+    long have = atomic_long_read(left), take;
+    
+    do {
+        if ((unsigned long)have < need) {
+            WRITE_ONCE(budget->dry, true);
+            return 0;
+        }
+        take = max_t(long, need, min(have, slice));
+    } while (!atomic_long_try_cmpxchg(left, &have, have - take));
+    return take;
+}
+
+/*
+ * Limit checks for a parse. The inline halves only test whether the
+ * parser checks the limit at all; the rest stays out of the allocators.
+ */
+static noinline bool jsonk_parser_charge_checked(struct jsonk_parser *parser, size_t size)
+{
+    struct jsonk_split_budget *budget = parser->budget;
+    size_t need = parser->total_memory_used + size;
+    long lease;
+    
+    if (need > parser->max_memory && budget) {
+        lease = jsonk_split_lease(budget, &budget->memory, budget->memory_slice,
+                                  need - parser->max_memory);
+        if (!lease)
+            return false;
+        parser->max_memory += lease;
+    } else if (need > parser->max_memory) {
+        jsonk_reject(JSONK_LIMIT_MEMORY, "Memory limit exceeded (%zu + %zu > %zu)\n",
+                     parser->total_memory_used, size, parser->max_memory);
+        return false;
+    }
+    parser->total_memory_used += size;
+    return true;
+}
+
+static noinline bool jsonk_text_checked(struct jsonk_parser *parser, size_t len, const char *what)
+{
+    size_t max = parser ? parser->max_string_length : JSONK_MAX_STRING_LENGTH;
+    
+    if (len > max) {
+        jsonk_reject(JSONK_LIMIT_STRING_LENGTH, "%s too long (%zu > %zu)\n", what, len, max);
+        return false;
+    }
+    return true;
+}
+
+static noinline bool jsonk_parser_count_string_checked(struct jsonk_parser *parser)
+{
+    struct jsonk_split_budget *budget = parser->budget;
+    long lease;
+    
+    if (parser->string_count >= parser->max_strings && budget) {
+        lease = jsonk_split_lease(budget, &budget->strings, budget->strings_slice, 1);
+        if (!lease)
+            return false;
+        parser->max_strings += lease;
+    } else if (parser->string_count >= parser->max_strings) {
+        jsonk_reject(JSONK_LIMIT_STRINGS, "Too many strings (%zu >= %u)\n",
+                     parser->string_count, parser->max_strings);
+        return false;
+    }
+    parser->string_count++;
+    return true;
+}
+
+/**
+ * Count an allocation against the parse's memory limit
+ * @return false if it would take the document past the limit
+ */
+static inline bool jsonk_parser_charge(struct jsonk_parser *parser, size_t size)
+{
+    if (!parser || !(parser->checks & JSONK_CHECK_MEMORY))
+        return true;
+    return jsonk_parser_charge_checked(parser, size);
+}
+
+/**
+ * Check the length of a string or number, against the default limit outside a parse
+ */
+static inline bool jsonk_parser_check_text(struct jsonk_parser *parser, size_t len, const char *what)
+{
+    if (parser && !(parser->checks & JSONK_CHECK_LENGTH))
+        return true;
+    return jsonk_text_checked(parser, len, what);
+}
+
+/**
+ * Count a string value against the parse's limit
+ */
+static inline bool jsonk_parser_count_string(struct jsonk_parser *parser)
+{
+    if (!parser || !(parser->checks & JSONK_CHECK_COUNTS))
+        return true;
+    return jsonk_parser_count_string_checked(parser);
+}
+
+static void *jsonk_tracked_alloc(struct jsonk_parser *parser, size_t size)
+{
+    if (!jsonk_parser_charge(parser, size))
+        return NULL;
+    
+    if (parser && parser->arena)
+        return jsonk_arena_alloc(parser->arena, size);
+    return jsonk_counted(jsonk_memory_alloc_gfp(size, jsonk_parser_gfp(parser)));
+}
+
+static void jsonk_tracked_free(struct jsonk_parser *parser, void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+    
+    /* Arena memory is only reclaimed together with the arena */
+    if (parser && parser->arena)
+        return;
+        
+    if (size <= JSONK_LARGE_ALLOC_THRESHOLD)
+        kfree(ptr);
+    else
+        vfree(ptr);
+}
+
+/**
+ * Allocated size of a value node
+ */
+static inline size_t jsonk_value_node_size(const struct jsonk_value *value)
+{
+    if (value->type == JSONK_VALUE_OBJECT || value->type == JSONK_VALUE_ARRAY ||
+        (value->flags & JSONK_VALUE_F_INLINE))
+        return sizeof(struct jsonk_value);
+    return JSONK_SCALAR_NODE_SIZE;
+}
+
+/**
+ * Whether a member key has an allocation of its own
+ */
+static inline bool jsonk_member_key_allocated(const struct jsonk_member *member)
+{
+    return member->key && member->key != member->inline_key &&
+           !(member->flags & JSONK_MEMBER_F_KEY_REF);
+}
+
+/**
+ * Allocated size of a member
+ */
+static inline size_t jsonk_member_size(const struct jsonk_member *member)
+{
+    return member->flags & JSONK_MEMBER_F_KEY_REF ? JSONK_MEMBER_REF_SIZE : sizeof(struct jsonk_member);
+}
+
+/**
+ * Free a slab member and its key, but not its value
+ */
+static void jsonk_member_free(struct jsonk_member *member)
+{
+    if (member->flags & JSONK_MEMBER_F_INTERNED)
+        jsonk_key_put(jsonk_member_ikey(member));
+    else if (jsonk_member_key_allocated(member))
+        jsonk_memory_free(member->key, member->key_len + 1);
+    
+    if (member->flags & JSONK_MEMBER_F_KEY_REF)
+        kmem_cache_free(jsonk_member_ref_cache, member);
+    else
+        kmem_cache_free(jsonk_member_cache, member);
+}
+
+/**
+ * Allocate a value node of the given size class with tracking
+ */
+static struct jsonk_value *jsonk_value_alloc_tracked(enum jsonk_value_type type, size_t size,
+                                                     struct jsonk_parser *parser)
+{
+    struct kmem_cache *cache = size == JSONK_SCALAR_NODE_SIZE ? jsonk_scalar_cache : jsonk_value_cache;
+    struct jsonk_value *value;
+    
+    if (!jsonk_parser_charge(parser, size))
+        return NULL;
+    
+    if (parser && parser->arena) {
+        value = jsonk_arena_alloc(parser->arena, size);
+    } else {
+        if (!cache) {
+            printk(KERN_ERR "JSONK: Value cache not initialized\n");
+            return NULL;
+        }
+        value = jsonk_counted(kmem_cache_alloc(cache, jsonk_parser_gfp(parser)));
+    }
+    if (!value)
+        return NULL;
+    
+    memset(value, 0, size);
+    atomic_set(&value->refcount, 1);
+    value->type = type;
+    if (parser) {
+        parser->node_count++;
+        if (parser->arena)
+            value->flags |= JSONK_VALUE_F_ARENA;
+    }
+    
+    return value;
+}
+
+static struct jsonk_value *jsonk_value_create_tracked(enum jsonk_value_type type, struct jsonk_parser *parser)
+{
+    struct jsonk_value *value;
+    bool container = type == JSONK_VALUE_OBJECT || type == JSONK_VALUE_ARRAY;
+    
+    value = jsonk_value_alloc_tracked(type, container ? sizeof(struct jsonk_value) : JSONK_SCALAR_NODE_SIZE,
+                                      parser);
+    if (!value)
+        return NULL;
+    
+    if (type == JSONK_VALUE_OBJECT) {
+        INIT_LIST_HEAD(&value->u.object.members);
+        value->u.object.size = 0;
+        if (parser) {
+            parser->object_count++;
+        }
+    } else if (type == JSONK_VALUE_ARRAY) {
+        /* Element vector is allocated on first insertion */
+        if (parser) {
+            parser->array_count++;
+        }
+    }
+    
+    return value;
+}
+
+/**
+ * Drop a partially built value on a parse error path
+ */
+static void jsonk_value_discard(struct jsonk_value *value, struct jsonk_parser *parser)
+{
+    /* Arena nodes hold no references of their own */
+    if (parser && parser->arena)
+        return;
+    jsonk_value_put(value);
+}
+
+/* ========================================================================
+ * Nesting Stacks
+ * ======================================================================== */
+
+/*
+ * Nothing recurses over the nesting of a document. Parsers and tree walks
+ * keep one frame per open container; the first JSONK_NEST_INLINE frames
+ * live on the kernel stack and deeper structures move them to the heap,
+ * so only max_depth decides how deep parsed input may go. Frames take 4
+ * to 56 bytes, so no walker puts more than 448 bytes of them on the
+ * stack; the ordinary shallow document still never allocates.
+ */
+
+static unsigned int jsonk_max_depth = JSONK_MAX_DEPTH;
+
+static int jsonk_max_depth_set(const char *val, const struct kernel_param *kp)
+{
+    return param_set_uint_minmax(val, kp, 1, JSONK_DEPTH_LIMIT);
+}
+
+static const struct kernel_param_ops jsonk_max_depth_ops = {
+    .set = jsonk_max_depth_set,
+    .get = param_get_uint,
+};
+
+module_param_cb(max_depth, &jsonk_max_depth_ops, &jsonk_max_depth, 0644);
+MODULE_PARM_DESC(max_depth, "Maximum nesting depth of parsed documents (1-" __stringify(JSONK_DEPTH_LIMIT) ")");
+
+static inline unsigned int jsonk_parser_max_depth(const struct jsonk_parser *parser)
+{
+    return parser->max_depth ?: READ_ONCE(jsonk_max_depth);
+}
+
+/**
+ * Double a frame stack, moving it off the kernel stack the first time
+ * @param frames The full frames, inline_frames until the first growth
+ * @param cap In/out: number of frames
+ * @return The grown frames, or NULL with the old ones freed
+ */
+static void *jsonk_nest_grow(void *frames, const void *inline_frames, size_t *cap,
+                             size_t size, gfp_t gfp)
+{
+    void *grown;
+    
+    grown = jsonk_counted(kmalloc_array(*cap * 2, size, gfp | __GFP_NOWARN));
+    if (grown) {
+        memcpy(grown, frames, *cap * size);
+        *cap *= 2;
+    }
+    if (frames != inline_frames)
+        kfree(frames);
+    return grown;
+}
+
+static inline void jsonk_nest_release(void *frames, const void *inline_frames)
+{
+    if (frames != inline_frames)
+        kfree(frames);
+}
+
+/* Position inside a container during a tree walk */
+struct jsonk_walk_frame {
+    struct jsonk_value *value;
+    union {
+        struct jsonk_member *member;    /* Next member of an object, NULL at the end */
+        u32 index;                      /* Next element of an array */
+    };
+};
+
+static inline void jsonk_walk_frame_init(struct jsonk_walk_frame *frame, struct jsonk_value *value)
+{
+    frame->value = value;
+    if (value->type == JSONK_VALUE_OBJECT)
+        frame->member = list_first_entry_or_null(&value->u.object.members, struct jsonk_member, list);
+    else
+        frame->index = 0;
+}
+
+/**
+ * Step to the next child of a container
+ * @param child Out: the child, which may be NULL in a malformed tree
+ * @param member Out: the member holding it, NULL for arrays
+ * @return false once the container has no more children
+ */
+static inline bool jsonk_walk_child(struct jsonk_walk_frame *frame, struct jsonk_value **child,
+                                    struct jsonk_member **member)
+{
+    struct jsonk_value *value = frame->value;
+    struct jsonk_member *next = frame->member;
+    
+    if (value->type == JSONK_VALUE_ARRAY) {
+        if (frame->index == value->u.array.size)
+            return false;
+        *child = value->u.array.items[frame->index++];
+        *member = NULL;
+        return true;
+    }
+    
+    if (!next)
+        return false;
+    frame->member = list_is_last(&next->list, &value->u.object.members) ?
+                    NULL : list_next_entry(next, list);
+    *child = next->value;
+    *member = next;
+    return true;
+}
+
+/**
+ * Step to the next value of a walk, leaving containers that are done
+ * @return false when the walk is over
+ */
+static inline bool jsonk_walk_next(struct jsonk_walk_frame *frames, size_t *depth,
+                                   struct jsonk_value **child, struct jsonk_member **member)
+{
+    while (*depth) {
+        if (jsonk_walk_child(&frames[*depth - 1], child, member))
+            return true;
+        (*depth)--;
+    }
+    return false;
+}
+
+/* ========================================================================
+ * Fast Scanning
+ * ======================================================================== */
+
+/*
+ * Strings and whitespace runs are scanned a word at a time.  Once a run
+ * has gone JSONK_SCAN_PROBE bytes without a hit and enough input is left
+ * to amortize saving the FPU state, the rest is handed to the vector
+ * scanners in jsonk_simd.c.
+ */
+#define JSONK_SCAN_PROBE    64
+#define JSONK_SIMD_MIN_LEN  256
+
+#define JSONK_WORD_ONES     (~0UL / 0xff)
+#define JSONK_WORD_REPEAT(c) (JSONK_WORD_ONES * (unsigned long)(c))
+#define JSONK_WORD_HIGHS    JSONK_WORD_REPEAT(0x80)
+
+#ifdef JSONK_HAVE_SIMD
+static bool jsonk_use_simd = true;
+module_param_named(simd, jsonk_use_simd, bool, 0644);
+MODULE_PARM_DESC(simd, "Use vector instructions for long string and whitespace runs");
+
+static unsigned int jsonk_simd_features;
+
+static void jsonk_simd_detect(void)
+{
+#ifdef CONFIG_X86
+    if (boot_cpu_has(X86_FEATURE_AVX2) &&
+        cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL))
+        jsonk_simd_features |= JSONK_SIMD_AVX2;
+#endif
+}
+
+static inline bool jsonk_simd_begin(void)
+{
+    if (!READ_ONCE(jsonk_use_simd) || !kernel_fpu_available() ||
+        !may_use_simd())
+        return false;
+    kernel_fpu_begin();
+    return true;
+}
+#else
+static inline void jsonk_simd_detect(void)
+{
+}
+#endif
+
+static __always_inline unsigned long jsonk_word_load(const char *p)
+{
+    unsigned long word;
+
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/* 0x80 in every zero byte of x; exact per byte, no carries between them */
+static __always_inline unsigned long jsonk_word_zero_bytes(unsigned long x)
+{
+    const unsigned long low7 = JSONK_WORD_REPEAT(0x7f);
+
+    return ~(((x & low7) + low7) | x) & JSONK_WORD_HIGHS;
+}
+
+/* Offset in memory order of the first byte flagged in a non-zero mask */
+static __always_inline size_t jsonk_word_first(unsigned long mask)
+{
+#if defined(__LITTLE_ENDIAN)
+    return __ffs(mask) / 8;
+#else
+    return (BITS_PER_LONG - 1 - __fls(mask)) / 8;
+#endif
+}
+
+static __always_inline unsigned long jsonk_word_string_stops(unsigned long w)
+{
+    return jsonk_word_zero_bytes(w ^ JSONK_WORD_REPEAT('"')) |
+           jsonk_word_zero_bytes(w ^ JSONK_WORD_REPEAT('\\')) |
+           jsonk_word_zero_bytes(w & JSONK_WORD_REPEAT(0xe0));
+}
+
+static __always_inline unsigned long jsonk_word_non_space(unsigned long w)
+{
+    unsigned long space = jsonk_word_zero_bytes(w ^ JSONK_WORD_REPEAT(' ')) |
+                          jsonk_word_zero_bytes(w ^ JSONK_WORD_REPEAT('\t')) |
+                          jsonk_word_zero_bytes(w ^ JSONK_WORD_REPEAT('\n')) |
+                          jsonk_word_zero_bytes(w ^ JSONK_WORD_REPEAT('\r'));
+
+    return space ^ JSONK_WORD_HIGHS;
+}
+
+size_t jsonk_scan_string(const char *buf, size_t pos, size_t len)
+{
+    const char *p = buf + pos;
+    size_t n = len - pos;
+    size_t i = 0;
+    unsigned long stops;
+
+    if (pos >= len)
+        return len;
+
+    while (i + sizeof(unsigned long) <= n) {
+        stops = jsonk_word_string_stops(jsonk_word_load(p + i));
+        if (stops)
+            return pos + i + jsonk_word_first(stops);
+        i += sizeof(unsigned long);
+
+#ifdef JSONK_HAVE_SIMD
+        /* The vector scanner stops on the hit and leaves it to us */
+        if (i == JSONK_SCAN_PROBE && n - i >= JSONK_SIMD_MIN_LEN &&
+            jsonk_simd_begin()) {
+            i += jsonk_simd_scan_string(p + i, n - i, jsonk_simd_features);
+            kernel_fpu_end();
+        }
+#endif
+    }
+
+    for (; i < n; i++) {
+        unsigned char c = p[i];
+
+        if (c == '"' || c == '\\' || c < 0x20)
+            break;
+    }
+    return pos + i;
+}
+
+size_t jsonk_scan_whitespace(const char *buf, size_t pos, size_t len)
+{
+    const char *p = buf + pos;
+    size_t n = len - pos;
+    size_t i = 0;
+    unsigned long stops;
+
+    if (pos >= len)
+        return len;
+
+    while (i + sizeof(unsigned long) <= n) {
+        stops = jsonk_word_non_space(jsonk_word_load(p + i));
+        if (stops)
+            return pos + i + jsonk_word_first(stops);
+        i += sizeof(unsigned long);
+
+#ifdef JSONK_HAVE_SIMD
+        if (i == JSONK_SCAN_PROBE && n - i >= JSONK_SIMD_MIN_LEN &&
+            jsonk_simd_begin()) {
+            i += jsonk_simd_scan_whitespace(p + i, n - i, jsonk_simd_features);
+            kernel_fpu_end();
+        }
+#endif
+    }
+
+    while (i < n && jsonk_is_whitespace(p[i]))
+        i++;
+    return pos + i;
+}
+
+/* ========================================================================
+ * Internal Helper Functions
+ * ======================================================================== */
+
+/**
+ * Length of a valid escape sequence, without its backslash
+ * @return 1, 5 for \uXXXX, or 0 if p does not start a valid escape
+ */
+static size_t jsonk_escape_seq_len(const char *p, size_t avail)
+{
+    int i;
+    
+    if (!avail)
+        return 0;
+    
+    switch (p[0]) {
+    case '"':
+    case '\\':
+    case '/':
+    case 'b':
+    case 'f':
+    case 'n':
+    case 'r':
+    case 't':
+        return 1;
+    case 'u':
+        /* Unicode escape: \uXXXX */
+        if (avail < 5)
+            return 0;
+        for (i = 1; i < 5; i++) {
+            if (hex_to_bin(p[i]) < 0)
+                return 0; /* Invalid hex digit */
+        }
+        return 5;
+    default:
+        return 0; /* Invalid escape sequence */
+    }
+}
+
+/**
+ * Whether text can stand between the quotes of a JSON string, as a key
+ * from outside the text parser must: no bare quote or control byte, and
+ * only valid escapes
+ */
+static bool jsonk_string_body_valid(const char *str, size_t len)
+{
+    size_t pos = 0, n;
+    
+    while ((pos = jsonk_scan_string(str, pos, len)) < len) {
+        if (str[pos] != '\\')
+            return false;
+        n = jsonk_escape_seq_len(str + pos + 1, len - pos - 1);
+        if (!n)
+            return false;
+        pos += 1 + n;
+    }
+    return true;
+}
+
+static int jsonk_parse_string(struct jsonk_parser *parser, struct jsonk_token *token)
+{
+    size_t start_pos, n;
+    char c;
+    
+    /* Skip the opening quote */
+    parser->pos++;
+    start_pos = parser->pos;
+    
+    /* Find the closing quote, handling escapes */
+    while (parser->pos < parser->buffer_len) {
+        parser->pos = jsonk_scan_string(parser->buffer, parser->pos,
+                                        parser->buffer_len);
+        if (parser->pos >= parser->buffer_len)
+            break;
+        c = parser->buffer[parser->pos];
+        
+        if (c == '"') {
+            /* Found closing quote */
+            token->type = JSONK_TOKEN_STRING;
+            token->start = &parser->buffer[start_pos];
+            token->len = parser->pos - start_pos;
+            parser->pos++; /* Skip closing quote */
+            return 0;
+        } else if (c == '\\') {
+            /* Handle escape sequence */
+            parser->pos++; /* Skip backslash */
+            n = jsonk_escape_seq_len(parser->buffer + parser->pos, parser->buffer_len - parser->pos);
+            if (!n)
+                return -EINVAL; /* Incomplete or invalid escape */
+            parser->pos += n;
+        } else {
+            /* Control characters must be escaped */
+            return -EINVAL;
+        }
+    }
+    
+    /* Reached end without closing quote */
+    return -EINVAL;
+}
+
+static int jsonk_parse_number(struct jsonk_parser *parser, struct jsonk_token *token)
+{
+    size_t start_pos = parser->pos;
+    char c;
+    
+    /* Parse optional minus sign */
+    c = jsonk_peek_char(parser);
+    if (c == '-') {
+        parser->pos++;
+    }
+    
+    /* Parse integer part */
+    c = jsonk_peek_char(parser);
+    if (c == '0') {
+        /* Leading zero - must not be followed by more digits */
+        parser->pos++;
+        c = jsonk_peek_char(parser);
+        if (c >= '0' && c <= '9') {
+            return -EINVAL; /* Invalid: leading zeros not allowed */
+        }
+    } else if (c >= '1' && c <= '9') {
+        /* Non-zero digit - parse remaining digits */
+        parser->pos++;
+        while (parser->pos < parser->buffer_len) {
+            c = parser->buffer[parser->pos];
+            if (c >= '0' && c <= '9') {
+                parser->pos++;
+            } else {
+                break;
+            }
+        }
+    } else {
+        return -EINVAL; /* Invalid: no digits found */
+    }
+    
+    /* Parse optional fractional part */
+    if (parser->pos < parser->buffer_len && parser->buffer[parser->pos] == '.') {
+        parser->pos++; /* Skip decimal point */
+        
+        /* Must have at least one digit after decimal point */
+        if (parser->pos >= parser->buffer_len || 
+            parser->buffer[parser->pos] < '0' || 
+            parser->buffer[parser->pos] > '9') {
+            return -EINVAL;
+        }
+        
+        /* Parse fractional digits */
+        while (parser->pos < parser->buffer_len) {
+            c = parser->buffer[parser->pos];
+            if (c >= '0' && c <= '9') {
+                parser->pos++;
+            } else {
+                break;
+            }
+        }
+    }
+    
+    /* Parse optional exponent */
+    if (parser->pos < parser->buffer_len && 
+        (parser->buffer[parser->pos] == 'e' || parser->buffer[parser->pos] == 'E')) {
+        parser->pos++; /* Skip 'e' or 'E' */
+        
+        /* Parse optional exponent sign */
+        if (parser->pos < parser->buffer_len && 
+            (parser->buffer[parser->pos] == '+' || parser->buffer[parser->pos] == '-')) {
+            parser->pos++;
+        }
+        
+        /* Must have at least one digit in exponent */
+        if (parser->pos >= parser->buffer_len || 
+            parser->buffer[parser->pos] < '0' || 
+            parser->buffer[parser->pos] > '9') {
+            return -EINVAL;
+        }
+        
+        /* Parse exponent digits */
+        while (parser->pos < parser->buffer_len) {
+            c = parser->buffer[parser->pos];
+            if (c >= '0' && c <= '9') {
+                parser->pos++;
+            } else {
+                break;
+            }
+        }
+    }
+    
+    /* Set token */
+    token->type = JSONK_TOKEN_NUMBER;
+    token->start = &parser->buffer[start_pos];
+    token->len = parser->pos - start_pos;
+    return 0;
+}
+
+static int jsonk_parse_literal(struct jsonk_parser *parser, struct jsonk_token *token)
+{
+    size_t start_pos = parser->pos;
+    const char *literals[] = {"true", "false", "null"};
+    enum jsonk_token_type types[] = {JSONK_TOKEN_TRUE, JSONK_TOKEN_FALSE, JSONK_TOKEN_NULL};
+    size_t lengths[] = {4, 5, 4};
+    int i;
+    
+    for (i = 0; i < 3; i++) {
+        if (parser->pos + lengths[i] <= parser->buffer_len &&
+            memcmp(&parser->buffer[parser->pos], literals[i], lengths[i]) == 0) {
+            
+            token->type = types[i];
+            token->start = &parser->buffer[start_pos];
+            token->len = lengths[i];
+            parser->pos += lengths[i];
+            return 0;
+        }
+    }
+    
+    return -EINVAL;
+}
+
+/**
+ * Get the next token from the JSON input
+ * @param parser Parser context
+ * @param token Token structure to fill
+ * @return 0 on success, negative error code on failure
+ */
+static int jsonk_next_token(struct jsonk_parser *parser, struct jsonk_token *token)
+{
+    char c;
+    
+    /* Skip whitespace */
+    jsonk_skip_whitespace(parser);
+    
+    /* Check if we reached the end */
+    if (parser->pos >= parser->buffer_len)
+        return -ENODATA;
+    
+    c = parser->buffer[parser->pos];
+    
+    /* Parse the token based on the first character */
+    switch (c) {
+    case '{':
+        token->type = JSONK_TOKEN_OBJECT_START;
+        token->start = &parser->buffer[parser->pos];
+        token->len = 1;
+        parser->pos++;
+        return 0;
+    case '}':
+        token->type = JSONK_TOKEN_OBJECT_END;
+        token->start = &parser->buffer[parser->pos];
+        token->len = 1;
+        parser->pos++;
+        return 0;
+    case '[':
+        token->type = JSONK_TOKEN_ARRAY_START;
+        token->start = &parser->buffer[parser->pos];
+        token->len = 1;
+        parser->pos++;
+        return 0;
+    case ']':
+        token->type = JSONK_TOKEN_ARRAY_END;
+        token->start = &parser->buffer[parser->pos];
+        token->len = 1;
+        parser->pos++;
+        return 0;
+    case ':':
+        token->type = JSONK_TOKEN_COLON;
+        token->start = &parser->buffer[parser->pos];
+        token->len = 1;
+        parser->pos++;
+        return 0;
+    case ',':
+        token->type = JSONK_TOKEN_COMMA;
+        token->start = &parser->buffer[parser->pos];
+        token->len = 1;
+        parser->pos++;
+        return 0;
+    case '"':
+        return jsonk_parse_string(parser, token);
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+        return jsonk_parse_number(parser, token);
+    case 't':
+    case 'f':
+    case 'n':
+        return jsonk_parse_literal(parser, token);
+    default:
+        return -EINVAL;
+    }
+}
+
+/* ========================================================================
+ * Numbers
+ * ======================================================================== */
+
+/* Longest integer a u64 can hold, for inputs of 20 digits */
+#define JSONK_U64_MAX_DIGITS "18446744073709551615"
+
+static const char jsonk_digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Load 8 bytes with the first one in the low byte on any byte order */
+static __always_inline u64 jsonk_digits_load(const char *p)
+{
+    u64 word;
+
+    memcpy(&word, p, sizeof(word));
+    return le64_to_cpu((__force __le64)word);
+}
+
+/* True if all 8 bytes are ASCII digits */
+static __always_inline bool jsonk_digits_all(u64 w)
+{
+    return ((w & 0xf0f0f0f0f0f0f0f0ULL) |
+            (((w + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4)) ==
+           0x3333333333333333ULL;
+}
+
+/* Value of 8 ASCII digits, combining pairs, then quads, then both halves */
+static __always_inline u32 jsonk_digits_value(u64 w)
+{
+    w -= 0x3030303030303030ULL;
+    w = w * 10 + (w >> 8);
+    w = ((w & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32)) +
+         ((w >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32))) >> 32;
+    return (u32)w;
+}
+
+/* Check the fraction and exponent that may follow the integer digits */
+static bool jsonk_number_tail_valid(const char *p, size_t len)
+{
+    size_t i = 0;
+    
+    if (i < len && p[i] == '.') {
+        i++;
+        if (i >= len || !isdigit(p[i]))
+            return false;
+        while (i < len && isdigit(p[i]))
+            i++;
+    }
+    
+    if (i < len && (p[i] == 'e' || p[i] == 'E')) {
+        i++;
+        if (i < len && (p[i] == '+' || p[i] == '-'))
+            i++;
+        if (i >= len || !isdigit(p[i]))
+            return false;
+        while (i < len && isdigit(p[i]))
+            i++;
+    }
+    
+    return i == len;
+}
+
+/**
+ * Classify a number and convert it if it is an integer
+ * @param p Number text
+ * @param len Length of the text
+ * @param magnitude Where to store the absolute value of an integer
+ * @param negative Where to store the sign of an integer
+ * @return enum jsonk_number_kind, or -EINVAL if the text is not a JSON number
+ */
+static int jsonk_number_scan(const char *p, size_t len, u64 *magnitude, bool *negative)
+{
+    size_t i = 0, digits;
+    u64 v = 0;
+    u64 w;
+    
+    *negative = len && p[0] == '-';
+    if (*negative)
+        i++;
+    
+    if (i >= len || !isdigit(p[i]))
+        return -EINVAL;
+    
+    if (p[i] == '0') {
+        i++;
+    } else {
+        /* Eight digits per step; wider integers wrap here and are caught below */
+        while (len - i >= 8) {
+            w = jsonk_digits_load(p + i);
+            if (!jsonk_digits_all(w))
+                break;
+            v = v * 100000000 + jsonk_digits_value(w);
+            i += 8;
+        }
+        while (i < len && isdigit(p[i]))
+            v = v * 10 + (p[i++] - '0');
+    }
+    digits = i - *negative;
+    
+    if (i < len)
+        return jsonk_number_tail_valid(p + i, len - i) ? JSONK_NUMBER_DECIMAL : -EINVAL;
+    
+    /* Equal-length digit strings compare like their values */
+    if (digits > 20 ||
+        (digits == 20 && memcmp(p + *negative, JSONK_U64_MAX_DIGITS, 20) > 0))
+        return JSONK_NUMBER_DECIMAL;
+    
+    *magnitude = v;
+    if (*negative)
+        return v <= (u64)S64_MAX + 1 ? JSONK_NUMBER_INT : JSONK_NUMBER_DECIMAL;
+    return v <= S64_MAX ? JSONK_NUMBER_INT : JSONK_NUMBER_UINT;
+}
+
+/* Write v below 100 million as exactly 8 digits ending at end */
+static char *jsonk_format_digits8(char *end, u32 v)
+{
+    int i;
+    
+    for (i = 0; i < 4; i++) {
+        u32 q = v / 100;
+        
+        end -= 2;
+        memcpy(end, &jsonk_digit_pairs[(v - q * 100) * 2], 2);
+        v = q;
+    }
+    return end;
+}
+
+/* Write v without leading zeros ending at end */
+static char *jsonk_format_u32(char *end, u32 v)
+{
+    while (v >= 100) {
+        u32 q = v / 100;
+        
+        end -= 2;
+        memcpy(end, &jsonk_digit_pairs[(v - q * 100) * 2], 2);
+        v = q;
+    }
+    
+    if (v >= 10) {
+        end -= 2;
+        memcpy(end, &jsonk_digit_pairs[v * 2], 2);
+    } else {
+        *--end = '0' + v;
+    }
+    return end;
+}
+
+/**
+ * Format an integer number value into the tail of a scratch buffer
+ * @param value Number value of kind JSONK_NUMBER_INT or JSONK_NUMBER_UINT
+ * @param buf Scratch buffer of JSONK_NUMBER_BUF bytes
+ * @param len Where to store the length of the text
+ * @return Start of the text inside buf
+ */
+static char *jsonk_number_format(const struct jsonk_value *value, char *buf, size_t *len)
+{
+    char *end = buf + JSONK_NUMBER_BUF;
+    char *p = end;
+    bool negative = value->u.number.kind == JSONK_NUMBER_INT && value->u.number.integer < 0;
+    u64 v = negative ? 0 - value->u.number.uinteger : value->u.number.uinteger;
+    
+    /* Only the top 32 bits need 64-bit division */
+    while (v > U32_MAX) {
+        u32 rem = do_div(v, 100000000);
+        
+        p = jsonk_format_digits8(p, rem);
+    }
+    p = jsonk_format_u32(p, (u32)v);
+    if (negative)
+        *--p = '-';
+    
+    *len = end - p;
+    return p;
+}
+
+/* ========================================================================
+ * Value Creation and Management Functions
+ * ======================================================================== */
+
+/* Value of the 4 hex digits at p, or -1 */
+static int jsonk_hex4(const char *p)
+{
+    int i, digit, code = 0;
+    
+    for (i = 0; i < 4; i++) {
+        digit = hex_to_bin(p[i]);
+        if (digit < 0)
+            return -1;
+        code = code << 4 | digit;
+    }
+    return code;
+}
+
+/*
+ * Encode a code point as UTF-8, with unpaired surrogates replaced by
+ * U+FFFD. Never longer than the escape it came from.
+ */
+static size_t jsonk_utf8_encode(char *out, u32 code)
+{
+    if (code >= 0xd800 && code <= 0xdfff)
+        code = 0xfffd;
+    
+    if (code < 0x80) {
+        out[0] = code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = 0xc0 | (code >> 6);
+        out[1] = 0x80 | (code & 0x3f);
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = 0xe0 | (code >> 12);
+        out[1] = 0x80 | ((code >> 6) & 0x3f);
+        out[2] = 0x80 | (code & 0x3f);
+        return 3;
+    }
+    out[0] = 0xf0 | (code >> 18);
+    out[1] = 0x80 | ((code >> 12) & 0x3f);
+    out[2] = 0x80 | ((code >> 6) & 0x3f);
+    out[3] = 0x80 | (code & 0x3f);
+    return 4;
+}
+
+/**
+ * Decode the escape sequences of a JSON string body
+ * @param out Room for len bytes; the result is never longer than its escaped form
+ * @return 0, or -EINVAL on an invalid escape
+ */
+static int jsonk_unescape(const char *str, size_t len, char *out, size_t *out_len)
+{
+    size_t i = 0, n = 0;
+    int code, low;
+    
+    /* Process the string, handling escape sequences */
+    while (i < len) {
+        char c = str[i];
+        
+        if (c == '\\' && i + 1 < len) {
+            /* Handle escape sequence */
+            i++; /* Skip backslash */
+            char escaped = str[i];
+            
+            switch (escaped) {
+            case '"':
+                out[n++] = '"';
+                break;
+            case '\\':
+                out[n++] = '\\';
+                break;
+            case '/':
+                out[n++] = '/';
+                break;
+            case 'b':
+                out[n++] = '\b';
+                break;
+            case 'f':
+                out[n++] = '\f';
+                break;
+            case 'n':
+                out[n++] = '\n';
+                break;
+            case 'r':
+                out[n++] = '\r';
+                break;
+            case 't':
+                out[n++] = '\t';
+                break;
+            case 'u':
+                /* Unicode escape: \uXXXX, decoded to UTF-8 */
+                code = i + 4 < len ? jsonk_hex4(str + i + 1) : -1;
+                if (code >= 0) {
+                    i += 4;
+                    if (code >= 0xd800 && code <= 0xdbff) {
+                        /* A high surrogate combines with a following low one */
+                        low = i + 6 < len && str[i + 1] == '\\' && str[i + 2] == 'u' ?
+                              jsonk_hex4(str + i + 3) : -1;
+                        if (low >= 0xdc00 && low <= 0xdfff) {
+                            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                            i += 6;
+                        }
+                    }
+                    n += jsonk_utf8_encode(out + n, code);
+                } else {
+                    /* Invalid unicode escape */
+                    return -EINVAL;
+                }
+                break;
+            default:
+                /* Invalid escape sequence */
+                return -EINVAL;
+            }
+            i++;
+        } else {
+            /* Regular character */
+            out[n++] = c;
+            i++;
+        }
+    }
+    
+    *out_len = n;
+    return 0;
+}
+
+/**
+ * Unescape a JSON string and create a value with tracking
+ */
+static struct jsonk_value *jsonk_value_create_string_tracked(const char *str, size_t len, struct jsonk_parser *parser)
+{
+    struct jsonk_value *value;
+    char *unescaped;
+    size_t unescaped_len;
+    
+    if (!jsonk_parser_check_text(parser, len, "String") || !jsonk_parser_count_string(parser))
+        return NULL;
+    
+    /* Unescaped input can be referenced as is */
+    if (parser && (parser->flags & JSONK_PARSE_BORROW) && !memchr(str, '\\', len)) {
+        value = jsonk_value_create_tracked(JSONK_VALUE_STRING, parser);
+        if (!value)
+            return NULL;
+        value->u.string.data = (char *)str;
+        value->u.string.len = len;
+        value->flags |= JSONK_VALUE_F_BORROWED;
+        return value;
+    }
+    
+    /* Short strings live in the tail of a full-size node */
+    if (len <= JSONK_INLINE_STRING_MAX) {
+        value = jsonk_value_alloc_tracked(JSONK_VALUE_STRING, sizeof(struct jsonk_value), parser);
+        if (!value)
+            return NULL;
+        value->flags |= JSONK_VALUE_F_INLINE;
+        unescaped = (char *)value + JSONK_SCALAR_NODE_SIZE;
+    } else {
+        value = jsonk_value_create_tracked(JSONK_VALUE_STRING, parser);
+        if (!value)
+            return NULL;
+        
+        /* Allocate buffer for unescaped string (worst case: same size) */
+        unescaped = jsonk_tracked_alloc(parser, len + 1);
+        if (!unescaped) {
+            jsonk_value_discard(value, parser);
+            return NULL;
+        }
+    }
+    
+    if (jsonk_unescape(str, len, unescaped, &unescaped_len) < 0) {
+        if (!(value->flags & JSONK_VALUE_F_INLINE))
+            jsonk_tracked_free(parser, unescaped, len + 1);
+        jsonk_value_discard(value, parser);
+        return NULL;
+    }
+    
+    unescaped[unescaped_len] = '\0';
+    
+    /* Resize buffer to actual size needed (pointless for arena and inline memory) */
+    if (unescaped_len < len && !(parser && parser->arena) && !(value->flags & JSONK_VALUE_F_INLINE)) {
+        char *resized = jsonk_tracked_alloc(parser, unescaped_len + 1);
+        if (resized) {
+            memcpy(resized, unescaped, unescaped_len + 1);
+            jsonk_tracked_free(parser, unescaped, len + 1);
+            unescaped = resized;
+        }
+        /* If resize fails, keep the larger buffer */
+    }
+    
+    value->u.string.data = unescaped;
+    value->u.string.len = unescaped_len;
+    return value;
+}
+
+/**
+ * Create a JSON number value from string with tracking
+ */
+static struct jsonk_value *jsonk_value_create_number_tracked(const char *str, size_t len, struct jsonk_parser *parser)
+{
+    struct jsonk_value *value;
+    char *lexeme;
+    u64 magnitude;
+    bool negative;
+    int kind;
+    
+    if (!jsonk_parser_check_text(parser, len, "Number"))
+        return NULL;
+    
+    kind = jsonk_number_scan(str, len, &magnitude, &negative);
+    if (kind < 0)
+        return NULL;
+    
+    /* An integer would lose the sign of -0, so it keeps its text */
+    if (kind != JSONK_NUMBER_DECIMAL && !(negative && !magnitude)) {
+        value = jsonk_value_create_tracked(JSONK_VALUE_NUMBER, parser);
+        if (!value)
+            return NULL;
+        value->u.number.kind = kind;
+        value->u.number.uinteger = negative ? 0 - magnitude : magnitude;
+        return value;
+    }
+    
+    /* Decimals keep their text, referenced in the input, inline or allocated */
+    if (parser && (parser->flags & JSONK_PARSE_BORROW)) {
+        value = jsonk_value_create_tracked(JSONK_VALUE_NUMBER, parser);
+        if (!value)
+            return NULL;
+        value->u.number.lexeme = str;
+        value->flags |= JSONK_VALUE_F_BORROWED;
+    } else {
+        if (len <= JSONK_INLINE_STRING_MAX) {
+            value = jsonk_value_alloc_tracked(JSONK_VALUE_NUMBER, sizeof(struct jsonk_value), parser);
+            if (!value)
+                return NULL;
+            value->flags |= JSONK_VALUE_F_INLINE;
+            lexeme = (char *)value + JSONK_SCALAR_NODE_SIZE;
+        } else {
+            value = jsonk_value_create_tracked(JSONK_VALUE_NUMBER, parser);
+            if (!value)
+                return NULL;
+            lexeme = jsonk_tracked_alloc(parser, len + 1);
+            if (!lexeme) {
+                jsonk_value_discard(value, parser);
+                return NULL;
+            }
+        }
+        memcpy(lexeme, str, len);
+        lexeme[len] = '\0';
+        value->u.number.lexeme = lexeme;
+    }
+    value->u.number.kind = JSONK_NUMBER_DECIMAL;
+    value->u.number.len = len;
+    
+    return value;
+}
+
+/* "-0", the one integer stored as a decimal */
+static inline bool jsonk_number_is_minus_zero(const struct jsonk_value *value)
+{
+    return value->u.number.kind == JSONK_NUMBER_DECIMAL && value->u.number.len == 2 &&
+           !memcmp(value->u.number.lexeme, "-0", 2);
+}
+
+/**
+ * Create a JSON number value from string
+ */
+struct jsonk_value *jsonk_value_create_number(const char *str, size_t len)
+{
+    return jsonk_value_create_number_tracked(str, len, NULL);
+}
+
+/**
+ * Create a JSON number value from a signed integer
+ */
+struct jsonk_value *jsonk_value_create_s64(s64 val)
+{
+    struct jsonk_value *value = jsonk_value_create_tracked(JSONK_VALUE_NUMBER, NULL);
+    
+    if (value)
+        value->u.number.integer = val;
+    return value;
+}
+
+/**
+ * Create a JSON number value from an unsigned integer
+ */
+struct jsonk_value *jsonk_value_create_u64(u64 val)
+{
+    struct jsonk_value *value = jsonk_value_create_tracked(JSONK_VALUE_NUMBER, NULL);
+    
+    if (value) {
+        value->u.number.kind = val > S64_MAX ? JSONK_NUMBER_UINT : JSONK_NUMBER_INT;
+        value->u.number.uinteger = val;
+    }
+    return value;
+}
+
+/**
+ * Read a number value as a signed integer
+ */
+int jsonk_number_get_s64(const struct jsonk_value *value, s64 *out)
+{
+    if (!value || value->type != JSONK_VALUE_NUMBER || !out)
+        return -EINVAL;
+    if (jsonk_number_is_minus_zero(value)) {
+        *out = 0;
+        return 0;
+    }
+    if (value->u.number.kind != JSONK_NUMBER_INT)
+        return -ERANGE;
+    
+    *out = value->u.number.integer;
+    return 0;
+}
+
+/**
+ * Read a number value as an unsigned integer
+ */
+int jsonk_number_get_u64(const struct jsonk_value *value, u64 *out)
+{
+    if (!value || value->type != JSONK_VALUE_NUMBER || !out)
+        return -EINVAL;
+    if (jsonk_number_is_minus_zero(value)) {
+        *out = 0;
+        return 0;
+    }
+    if (value->u.number.kind == JSONK_NUMBER_DECIMAL ||
+        (value->u.number.kind == JSONK_NUMBER_INT && value->u.number.integer < 0))
+        return -ERANGE;
+    
+    *out = value->u.number.uinteger;
+    return 0;
+}
+
+/**
+ * Create a JSON boolean value
+ */
+struct jsonk_value *jsonk_value_create_boolean(bool val)
+{
+    struct jsonk_value *value;
+    
+    value = jsonk_value_create(JSONK_VALUE_BOOLEAN);
+    if (!value)
+        return NULL;
+    
+    value->u.boolean = val;
+    return value;
+}
+
+/**
+ * Create a JSON null value
+ */
+struct jsonk_value *jsonk_value_create_null(void)
+{
+    return jsonk_value_create(JSONK_VALUE_NULL);
+}
+
+/**
+ * Free what a node owns besides its children, then the node itself
+ * 
+ * Containers are not freed here but pushed on *dying, linked through
+ * u.dying.next; their children are dropped when they are popped again.
+ */
+static void jsonk_value_bury(struct jsonk_value *value, struct jsonk_value **dying)
+{
+    switch (value->type) {
+    case JSONK_VALUE_NUMBER:
+        if (value->u.number.kind == JSONK_NUMBER_DECIMAL &&
+            !(value->flags & (JSONK_VALUE_F_BORROWED | JSONK_VALUE_F_INLINE)))
+            jsonk_memory_free((char *)value->u.number.lexeme, value->u.number.len + 1);
+        break;
+        
+    case JSONK_VALUE_STRING:
+        if (value->u.string.data && !(value->flags & (JSONK_VALUE_F_BORROWED | JSONK_VALUE_F_INLINE)))
+            jsonk_memory_free(value->u.string.data, value->u.string.len + 1);
+        break;
+        
+    case JSONK_VALUE_OBJECT:
+        /* The link goes where the index was */
+        if (value->u.object.index)
+            jsonk_memory_free(value->u.object.index,
+                              value->u.object.index_size * sizeof(struct jsonk_member *));
+        fallthrough;
+    case JSONK_VALUE_ARRAY:
+        value->u.dying.next = *dying;
+        *dying = value;
+        return;
+        
+    default:
+        break;
+    }
+    
+    if (jsonk_value_node_size(value) == JSONK_SCALAR_NODE_SIZE)
+        kmem_cache_free(jsonk_scalar_cache, value);
+    else
+        kmem_cache_free(jsonk_value_cache, value);
+}
+
+/* Drop a container's reference on a child */
+static inline void jsonk_value_drop(struct jsonk_value *value, struct jsonk_value **dying)
+{
+    if (!value)
+        return;
+    if (value->flags & JSONK_VALUE_F_ARENA)
+        jsonk_value_put(value);
+    else if (atomic_dec_and_test(&value->refcount))
+        jsonk_value_bury(value, dying);
+}
+
+/**
+ * Free a node and every descendant only it referenced
+ * 
+ * Containers waiting for their children to be dropped are kept on a list
+ * threaded through the nodes themselves, so freeing needs neither
+ * recursion nor memory, however deep the tree.
+ */
+static void jsonk_value_free_internal(struct jsonk_value *value)
+{
+    struct jsonk_member *member, *tmp_member;
+    struct jsonk_value *dying = NULL;
+    size_t i;
+    
+    BUILD_BUG_ON(offsetof(struct jsonk_value, u.dying.next) !=
+                 offsetof(struct jsonk_value, u.object.index));
+    BUILD_BUG_ON(offsetof(struct jsonk_value, u.dying.next) <
+                 offsetof(struct jsonk_value, u.array) + sizeof(struct jsonk_array));
+    
+    jsonk_value_bury(value, &dying);
+    
+    while (dying) {
+        value = dying;
+        dying = value->u.dying.next;
+        
+        if (value->type == JSONK_VALUE_OBJECT) {
+            list_for_each_entry_safe(member, tmp_member, &value->u.object.members, list) {
+                jsonk_value_drop(member->value, &dying);
+                jsonk_member_free(member);
+            }
+        } else {
+            for (i = 0; i < value->u.array.size; i++)
+                jsonk_value_drop(value->u.array.items[i], &dying);
+            if (value->u.array.items)
+                jsonk_memory_free(value->u.array.items,
+                                  value->u.array.capacity * sizeof(struct jsonk_value *));
+        }
+        
+        kmem_cache_free(jsonk_value_cache, value);
+    }
+}
+
+struct jsonk_value *jsonk_value_get(struct jsonk_value *value)
+{
+    if (!value)
+        return NULL;
+    
+    /* Any reference on an arena node pins the whole document */
+    if (value->flags & JSONK_VALUE_F_ARENA)
+        atomic_inc(&jsonk_value_arena(value)->refcount);
+    else
+        atomic_inc(&value->refcount);
+    return value;
+}
+
+void jsonk_value_put(struct jsonk_value *value)
+{
+    struct jsonk_arena *arena;
+    
+    if (!value)
+        return;
+    
+    if (value->flags & JSONK_VALUE_F_ARENA) {
+        arena = jsonk_value_arena(value);
+        if (atomic_dec_and_test(&arena->refcount))
+            jsonk_arena_destroy(arena);
+        return;
+    }
+    
+    if (atomic_dec_and_test(&value->refcount)) {
+        jsonk_value_free_internal(value);
+    }
+}
+/**
+ * Count the memory held by a tree
+ */
+size_t jsonk_value_footprint(struct jsonk_value *value, size_t *nodes)
+{
+    struct jsonk_walk_frame inline_frames[JSONK_NEST_INLINE], *frames = inline_frames;
+    struct jsonk_member *member = NULL;
+    size_t cap = ARRAY_SIZE(inline_frames), depth = 0;
+    size_t bytes = 0;
+    
+    if (!value)
+        return 0;
+    
+    do {
+        if (member) {
+            /* Interned keys belong to no document in particular */
+            bytes += jsonk_member_size(member);
+            if (jsonk_member_key_allocated(member))
+                bytes += member->key_len + 1;
+        }
+        if (!value)
+            continue;
+        
+        bytes += jsonk_value_node_size(value);
+        if (nodes)
+            (*nodes)++;
+        
+        switch (value->type) {
+        case JSONK_VALUE_NUMBER:
+            if (value->u.number.kind == JSONK_NUMBER_DECIMAL &&
+                !(value->flags & (JSONK_VALUE_F_BORROWED | JSONK_VALUE_F_INLINE)))
+                bytes += value->u.number.len + 1;
+            break;
+            
+        case JSONK_VALUE_STRING:
+            if (!(value->flags & (JSONK_VALUE_F_BORROWED | JSONK_VALUE_F_INLINE)))
+                bytes += value->u.string.len + 1;
+            break;
+            
+        case JSONK_VALUE_OBJECT:
+        case JSONK_VALUE_ARRAY:
+            if (value->type == JSONK_VALUE_OBJECT)
+                bytes += value->u.object.index_size * sizeof(struct jsonk_member *);
+            else
+                bytes += value->u.array.capacity * sizeof(struct jsonk_value *);
+            if (depth == cap) {
+                frames = jsonk_nest_grow(frames, inline_frames, &cap, sizeof(*frames), GFP_KERNEL);
+                if (!frames)
+                    return 0;
+            }
+            jsonk_walk_frame_init(&frames[depth++], value);
+            break;
+            
+        default:
+            break;
+        }
+    } while (jsonk_walk_next(frames, &depth, &value, &member));
+    
+    jsonk_nest_release(frames, inline_frames);
+    return bytes;
+}
+
+
+/* ========================================================================
+ * Object Manipulation Functions
+ * ======================================================================== */
+
+static inline void jsonk_object_index_link(struct jsonk_object *obj, struct jsonk_member *member)
+{
+    struct jsonk_member **bucket = &obj->index[member->hash & (obj->index_size - 1)];
+    
+    member->hash_next = *bucket;
+    *bucket = member;
+}
+
+/**
+ * (Re)build the hash index of an object with the given number of buckets
+ * 
+ * Only a rejected memory charge is an error. Failing to allocate is not
+ * fatal: the object keeps its previous index, or falls back to linear
+ * lookups if it had none.
+ */
+static int jsonk_object_index_build(struct jsonk_object *obj, size_t nbuckets, struct jsonk_parser *parser)
+{
+    struct jsonk_arena *arena = jsonk_object_arena(obj);
+    size_t bytes = nbuckets * sizeof(struct jsonk_member *);
+    struct jsonk_member **old_index = obj->index;
+    size_t old_size = obj->index_size;
+    struct jsonk_member **index;
+    struct jsonk_member *member;
+    bool rehash = !old_index;
+    
+    if (!jsonk_parser_charge(parser, bytes))
+        return -ENOMEM;
+    
+    /* Old arena buckets are simply left behind until teardown */
+    if (arena)
+        index = jsonk_arena_alloc(arena, bytes);
+    else
+        index = jsonk_counted(jsonk_memory_alloc_gfp(bytes, jsonk_parser_gfp(parser)));
+    if (!index)
+        return 0;
+    
+    memset(index, 0, bytes);
+    obj->index = index;
+    obj->index_size = nbuckets;
+    
+    list_for_each_entry(member, &obj->members, list) {
+        if (rehash && !(member->flags & JSONK_MEMBER_F_INTERNED))
+            member->hash = jsonk_key_hash(member->key, member->key_len);
+        jsonk_object_index_link(obj, member);
+    }
+    
+    if (old_index && !arena)
+        jsonk_memory_free(old_index, old_size * sizeof(struct jsonk_member *));
+    return 0;
+}
+
+/**
+ * Grow the index ahead of adding a member, so a rejected charge leaves the object as it was
+ */
+static int jsonk_object_index_reserve(struct jsonk_object *obj, struct jsonk_parser *parser)
+{
+    size_t size = obj->size + 1;
+    
+    if (!obj->index)
+        return size >= JSONK_OBJECT_INDEX_THRESHOLD ?
+               jsonk_object_index_build(obj, roundup_pow_of_two(size * 2), parser) : 0;
+    
+    /* Keep the load factor at or below one */
+    if (size > obj->index_size)
+        return jsonk_object_index_build(obj, obj->index_size * 2, parser);
+    return 0;
+}
+
+/**
+ * Account for a member just appended to the object's list
+ */
+static void jsonk_object_index_insert(struct jsonk_object *obj, struct jsonk_member *member)
+{
+    if (!obj->index)
+        return;
+    
+    /* An index that could not grow just has longer chains */
+    if (!(member->flags & JSONK_MEMBER_F_INTERNED))
+        member->hash = jsonk_key_hash(member->key, member->key_len);
+    jsonk_object_index_link(obj, member);
+}
+
+static void jsonk_object_index_remove(struct jsonk_object *obj, struct jsonk_member *member)
+{
+    struct jsonk_member **link;
+    
+    if (!obj->index)
+        return;
+    
+    for (link = &obj->index[member->hash & (obj->index_size - 1)]; *link; link = &(*link)->hash_next) {
+        if (*link == member) {
+            *link = member->hash_next;
+            return;
+        }
+    }
+}
+
+/**
+ * Add a member to a JSON object with tracking
+ * 
+ * A slab object shares ikey, if given, or the interned copy of the key
+ * under JSONK_PARSE_INTERN. The caller keeps its own reference on ikey.
+ */
+static int jsonk_object_add_member_key(struct jsonk_object *obj, const char *key, size_t key_len,
+                                       struct jsonk_key *ikey, struct jsonk_value *value,
+                                       struct jsonk_parser *parser)
+{
+    struct jsonk_arena *arena = jsonk_object_arena(obj);
+    struct jsonk_member *member;
+    bool borrow, inline_key;
+    size_t key_size, size;
+    u32 max_members;
+    int ret;
+    
+    /* Check object member limit */
+    if (!parser || (parser->checks & JSONK_CHECK_COUNTS)) {
+        max_members = parser ? parser->max_object_members : JSONK_MAX_OBJECT_MEMBERS;
+        if (obj->size >= max_members) {
+            jsonk_reject(JSONK_LIMIT_OBJECT_MEMBERS, "Too many object members (%u >= %u)\n",
+                         obj->size, max_members);
+            return -ENOSPC;
+        }
+    }
+    
+    /* Check key length limit */
+    if (key_len > JSONK_MAX_KEY_LENGTH) {
+        jsonk_reject(JSONK_LIMIT_KEY_LENGTH, "Object key too long (%zu > %d)\n", 
+                     key_len, JSONK_MAX_KEY_LENGTH);
+        return -EINVAL;
+    }
+    
+    /* Arena documents keep their keys in the arena, which is never walked on teardown */
+    if (arena)
+        ikey = NULL;
+    else if (ikey)
+        atomic_inc(&ikey->refcount);
+    else if (parser && (parser->flags & JSONK_PARSE_INTERN))
+        ikey = jsonk_key_intern(key, key_len, jsonk_parser_gfp(parser));
+    
+    borrow = !ikey && parser && (parser->flags & JSONK_PARSE_BORROW);
+    inline_key = !ikey && !borrow && key_len < JSONK_MEMBER_INLINE_KEY;
+    key_size = ikey || borrow || inline_key ? 0 : key_len + 1;
+    size = ikey || borrow ? JSONK_MEMBER_REF_SIZE : sizeof(struct jsonk_member);
+    
+    /* Check memory limit, an allocated key is charged on its own */
+    if (!jsonk_parser_charge(parser, size + (arena ? key_size : 0))) {
+        ret = -ENOMEM;
+        goto err_key;
+    }
+    ret = jsonk_object_index_reserve(obj, parser);
+    if (ret < 0)
+        goto err_key;
+    
+    if (arena) {
+        /* Member and key share one bump allocation */
+        member = jsonk_arena_alloc(arena, size + key_size);
+        if (!member)
+            return -ENOMEM;
+        member->key = (char *)member + size;
+        
+        if (!parser) {
+            ret = jsonk_arena_adopt(arena, value);
+            if (ret < 0)
+                return ret;
+        }
+    } else {
+        /* Create new member */
+        if (!jsonk_member_cache) {
+            printk(KERN_ERR "JSONK: Member cache not initialized\n");
+            ret = -ENOMEM;
+            goto err_key;
+        }
+        
+        member = jsonk_counted(kmem_cache_alloc(size == JSONK_MEMBER_REF_SIZE ? jsonk_member_ref_cache :
+                                                jsonk_member_cache, jsonk_parser_gfp(parser)));
+        if (!member) {
+            ret = -ENOMEM;
+            goto err_key;
+        }
+        
+        if (key_size) {
+            member->key = jsonk_tracked_alloc(parser, key_size);
+            if (!member->key) {
+                kmem_cache_free(jsonk_member_cache, member);
+                return -ENOMEM;
+            }
+        }
+    }
+    
+    if (ikey) {
+        member->key = ikey->data;
+        member->flags = JSONK_MEMBER_F_INTERNED;
+    } else if (borrow) {
+        /* Keys are kept verbatim, so they can always stay in the input */
+        member->key = (char *)key;
+        member->flags = JSONK_MEMBER_F_BORROWED;
+    } else {
+        if (inline_key)
+            member->key = member->inline_key;
+        memcpy(member->key, key, key_len);
+        member->key[key_len] = '\0';
+        member->flags = 0;
+    }
+    member->key_len = key_len;
+    member->value = value;
+    member->hash_next = NULL;
+    member->hash = ikey ? ikey->hash : 0;
+    
+    list_add_tail(&member->list, &obj->members);
+    obj->size++;
+    jsonk_object_index_insert(obj, member);
+    jsonk_object_changed(obj);
+    
+    return 0;
+    
+err_key:
+    if (ikey)
+        jsonk_key_put(ikey);
+    return ret;
+}
+
+static inline int jsonk_object_add_member_tracked(struct jsonk_object *obj, const char *key, size_t key_len,
+                                                  struct jsonk_value *value, struct jsonk_parser *parser)
+{
+    return jsonk_object_add_member_key(obj, key, key_len, NULL, value, parser);
+}
+
+/**
+ * Add a member under the key of another member, sharing the key if it is interned
+ */
+static inline int jsonk_object_add_member_like(struct jsonk_object *obj, const struct jsonk_member *source,
+                                               struct jsonk_value *value)
+{
+    return jsonk_object_add_member_key(obj, source->key, source->key_len,
+                                       source->flags & JSONK_MEMBER_F_INTERNED ?
+                                       jsonk_member_ikey(source) : NULL, value, NULL);
+}
+
+/**
+ * Find a member through the hash index of an object, given the key's hash
+ */
+static struct jsonk_member *jsonk_object_index_find(struct jsonk_object *obj, const char *key,
+                                                    size_t key_len, u32 hash)
+{
+    struct jsonk_member *member, *found = NULL;
+    
+    /* Buckets run newest first; duplicate keys resolve to the oldest, as in the list scan */
+    for (member = obj->index[hash & (obj->index_size - 1)]; member; member = member->hash_next) {
+        if (member->hash == hash && member->key_len == key_len &&
+            memcmp(member->key, key, key_len) == 0) {
+            found = member;
+        }
+    }
+    return found;
+}
+
+/**
+ * Find a member in a JSON object
+ */
+struct jsonk_member *jsonk_object_find_member(struct jsonk_object *obj, const char *key, size_t key_len)
+{
+    struct jsonk_member *member;
+    
+    if (obj->index)
+        return jsonk_object_index_find(obj, key, key_len, jsonk_key_hash(key, key_len));
+    
+    list_for_each_entry(member, &obj->members, list) {
+        if (member->key_len == key_len && 
+            memcmp(member->key, key, key_len) == 0) {
+            return member;
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * Whether a member has the key of another; interned keys compare by address
+ */
+static inline bool jsonk_member_key_eq(const struct jsonk_member *member, const struct jsonk_member *like)
+{
+    if (member->key == like->key)
+        return true;
+    if (member->flags & like->flags & JSONK_MEMBER_F_INTERNED)
+        return false;
+    return member->key_len == like->key_len && memcmp(member->key, like->key, like->key_len) == 0;
+}
+
+/**
+ * Find the member of an object with the key of another member
+ */
+static struct jsonk_member *jsonk_object_find_like(struct jsonk_object *obj, const struct jsonk_member *like)
+{
+    struct jsonk_member *member, *found = NULL;
+    
+    if (!(like->flags & JSONK_MEMBER_F_INTERNED))
+        return jsonk_object_find_member(obj, like->key, like->key_len);
+    
+    /* Interned keys carry their hash, and hashing is all the index needs */
+    if (obj->index) {
+        for (member = obj->index[like->hash & (obj->index_size - 1)]; member; member = member->hash_next) {
+            if (member->hash == like->hash && jsonk_member_key_eq(member, like))
+                found = member;
+        }
+        return found;
+    }
+    
+    list_for_each_entry(member, &obj->members, list) {
+        if (jsonk_member_key_eq(member, like))
+            return member;
+    }
+    return NULL;
+}
+
+static void jsonk_object_unlink_member(struct jsonk_object *obj, struct jsonk_member *member)
+{
+    jsonk_object_index_remove(obj, member);
+    list_del(&member->list);
+    obj->size--;
+    jsonk_object_changed(obj);
+}
+
+/**
+ * Free a member already unlinked from its object, with its value
+ */
+static void jsonk_member_release(struct jsonk_object *obj, struct jsonk_member *member)
+{
+    /* Arena members and their values are reclaimed with the document */
+    if (jsonk_object_arena(obj))
+        return;
+    
+    if (member->value)
+        jsonk_value_put(member->value);
+    jsonk_member_free(member);
+}
+
+/**
+ * Remove a member from a JSON object
+ */
+int jsonk_object_remove_member(struct jsonk_object *obj, const char *key, size_t key_len)
+{
+    struct jsonk_member *member = jsonk_object_find_member(obj, key, key_len);
+    
+    if (!member)
+        return -ENOENT;
+    
+    jsonk_object_unlink_member(obj, member);
+    jsonk_member_release(obj, member);
+    
+    return 0;
+}
+
+/**
+ * Replace the value of an existing member, taking over the new reference
+ */
+static int jsonk_member_replace_value(struct jsonk_object *obj, struct jsonk_member *member,
+                                      struct jsonk_value *new_value)
+{
+    struct jsonk_arena *arena = jsonk_object_arena(obj);
+    struct jsonk_value *old_value = member->value;
+    int ret;
+    
+    jsonk_object_changed(obj);
+    if (arena) {
+        /* The old value stays owned by the arena until teardown */
+        ret = jsonk_arena_adopt(arena, new_value);
+        if (ret < 0)
+            return ret;
+        member->value = new_value;
+        return 0;
+    }
+    
+    member->value = new_value;
+    jsonk_value_put(old_value);
+    return 0;
+}
+
+/* ========================================================================
+ * Array Manipulation Functions
+ * ======================================================================== */
+
+/**
+ * Move an array to a vector of exactly the given capacity
+ */
+static int jsonk_array_resize(struct jsonk_array *arr, size_t capacity, struct jsonk_parser *parser)
+{
+    struct jsonk_arena *arena = jsonk_array_arena(arr);
+    size_t bytes = capacity * sizeof(struct jsonk_value *);
+    struct jsonk_value **items;
+    
+    if (!jsonk_parser_charge(parser, bytes))
+        return -ENOMEM;
+    
+    /* Outgrown arena vectors are left behind until teardown */
+    if (arena)
+        items = jsonk_arena_alloc(arena, bytes);
+    else
+        items = jsonk_counted(jsonk_memory_alloc_gfp(bytes, jsonk_parser_gfp(parser)));
+    if (!items)
+        return -ENOMEM;
+    
+    if (arr->size)
+        memcpy(items, arr->items, arr->size * sizeof(struct jsonk_value *));
+    if (arr->items && !arena)
+        jsonk_memory_free(arr->items, arr->capacity * sizeof(struct jsonk_value *));
+    
+    arr->items = items;
+    arr->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Add an element to a JSON array with tracking
+ */
+static int jsonk_array_add_element_tracked(struct jsonk_array *arr, struct jsonk_value *value, struct jsonk_parser *parser)
+{
+    struct jsonk_arena *arena = jsonk_array_arena(arr);
+    u32 max_size;
+    int ret;
+    
+    /* Check array size limit */
+    if (!parser || (parser->checks & JSONK_CHECK_COUNTS)) {
+        max_size = parser ? parser->max_array_size : JSONK_MAX_ARRAY_SIZE;
+        if (arr->size >= max_size) {
+            jsonk_reject(JSONK_LIMIT_ARRAY_SIZE, "Array too large (%u >= %u)\n", arr->size, max_size);
+            return -ENOSPC;
+        }
+    }
+    
+    if (arr->size == arr->capacity) {
+        ret = jsonk_array_resize(arr, arr->capacity ? arr->capacity * 2 : 4, parser);
+        if (ret < 0)
+            return ret;
+    }
+    
+    if (arena && !parser) {
+        ret = jsonk_arena_adopt(arena, value);
+        if (ret < 0)
+            return ret;
+    }
+    
+    arr->items[arr->size++] = value;
+    jsonk_array_changed(arr);
+    return 0;
+}
+
+/**
+ * Replace an existing element, taking over the new reference
+ */
+static int jsonk_array_replace_element(struct jsonk_array *arr, size_t idx, struct jsonk_value *new_value)
+{
+    struct jsonk_arena *arena = jsonk_array_arena(arr);
+    struct jsonk_value *old_value = arr->items[idx];
+    int ret;
+    
+    jsonk_array_changed(arr);
+    if (arena) {
+        /* The old value stays owned by the arena until teardown */
+        ret = jsonk_arena_adopt(arena, new_value);
+        if (ret < 0)
+            return ret;
+        arr->items[idx] = new_value;
+        return 0;
+    }
+    
+    arr->items[idx] = new_value;
+    jsonk_value_put(old_value);
+    return 0;
+}
+
+/* ========================================================================
+ * Parser Implementation
+ * ======================================================================== */
+
+/**
+ * Apply parse options and drop the checks the input is too short to fail
+ * 
+ * Every value takes at least two bytes with its separator, so no count
+ * can pass a limit of half the input length, no token is longer than the
+ * input, and no parse allocates more than JSONK_PARSE_EXPANSION bytes per
+ * input byte. Incremental parses, whose length is unknown, check all.
+ */
+static int jsonk_parser_set_limits(struct jsonk_parser *parser, const struct jsonk_parse_opts *opts)
+{
+    size_t len = parser->buffer_len;
+    u32 min_count;
+    
+    if (opts) {
+        if (opts->max_depth > JSONK_DEPTH_LIMIT || opts->max_array_size > INT_MAX ||
+            opts->max_object_members > INT_MAX || opts->max_strings > INT_MAX) {
+            jsonk_warn("Parse limits out of range\n");
+            return -EINVAL;
+        }
+        
+        parser->flags = opts->flags;
+        parser->gfp = opts->gfp ?: GFP_KERNEL;
+        parser->max_depth = opts->max_depth;
+        if (opts->max_array_size)
+            parser->max_array_size = opts->max_array_size;
+        if (opts->max_object_members)
+            parser->max_object_members = opts->max_object_members;
+        if (opts->max_strings)
+            parser->max_strings = opts->max_strings;
+        if (opts->max_string_length)
+            parser->max_string_length = opts->max_string_length;
+        if (opts->max_memory)
+            parser->max_memory = opts->max_memory;
+        parser->max_workers = opts->max_workers;
+    }
+    
+    /*
+     * Pool parses take nothing but pool chunks: no vmalloc, no index
+     * tape, and their nesting frames go to a chunk once off the stack.
+     */
+    if (parser->flags & JSONK_PARSE_POOL) {
+        parser->flags |= JSONK_PARSE_ARENA;
+        parser->flags &= ~JSONK_PARSE_PARALLEL;
+        parser->gfp = GFP_NOWAIT;
+        parser->max_depth = min_t(unsigned int, jsonk_parser_max_depth(parser), JSONK_MAX_DEPTH);
+    }
+    
+    parser->checks = JSONK_CHECK_ALL;
+    if (!parser->buffer)
+        return 0;
+    
+    min_count = min3(parser->max_array_size, parser->max_object_members, parser->max_strings);
+    if (len / 2 <= min_count)
+        parser->checks &= ~JSONK_CHECK_COUNTS;
+    if (len <= parser->max_string_length)
+        parser->checks &= ~JSONK_CHECK_LENGTH;
+    if (len <= parser->max_memory / JSONK_PARSE_EXPANSION)
+        parser->checks &= ~JSONK_CHECK_MEMORY;
+    return 0;
+}
+
+/**
+ * Push a parsed element onto the scratch stack
+ */
+static int jsonk_parser_push(struct jsonk_parser *parser, struct jsonk_value *value)
+{
+    struct jsonk_value **stack;
+    size_t cap;
+    
+    if (parser->stack_len == parser->stack_cap && (parser->flags & JSONK_PARSE_POOL)) {
+        /* Pool parses stack elements in a single chunk */
+        if (parser->stack)
+            return -ENOSPC;
+        parser->stack = jsonk_pool_take();
+        if (!parser->stack)
+            return -ENOMEM;
+        parser->stack_cap = JSONK_ARENA_CHUNK_SIZE / sizeof(struct jsonk_value *);
+    } else if (parser->stack_len == parser->stack_cap) {
+        cap = parser->stack_cap ? parser->stack_cap * 2 : 64;
+        stack = jsonk_counted(jsonk_memory_alloc_gfp(cap * sizeof(struct jsonk_value *), parser->gfp));
+        if (!stack)
+            return -ENOMEM;
+        if (parser->stack_len)
+            memcpy(stack, parser->stack, parser->stack_len * sizeof(struct jsonk_value *));
+        if (parser->stack)
+            jsonk_memory_free(parser->stack, parser->stack_cap * sizeof(struct jsonk_value *));
+        parser->stack = stack;
+        parser->stack_cap = cap;
+    }
+    
+    parser->stack[parser->stack_len++] = value;
+    return 0;
+}
+
+/**
+ * Grow the nesting frames of a parse
+ * 
+ * Pool parses move their frames to a single pool chunk, which holds far
+ * more than the JSONK_MAX_DEPTH levels they are limited to.
+ */
+static void *jsonk_parser_nest_grow(struct jsonk_parser *parser, void *frames,
+                                    const void *inline_frames, size_t *cap, size_t size)
+{
+    void *chunk = NULL;
+    
+    if (!(parser->flags & JSONK_PARSE_POOL))
+        return jsonk_nest_grow(frames, inline_frames, cap, size, parser->gfp);
+    
+    if (frames == inline_frames)
+        chunk = jsonk_pool_take();
+    if (chunk) {
+        memcpy(chunk, frames, *cap * size);
+        *cap = JSONK_ARENA_CHUNK_SIZE / size;
+    } else if (frames != inline_frames) {
+        jsonk_pool_give(frames);
+    }
+    return chunk;
+}
+
+static void jsonk_parser_nest_release(struct jsonk_parser *parser, void *frames,
+                                      const void *inline_frames)
+{
+    if (frames != inline_frames && (parser->flags & JSONK_PARSE_POOL))
+        jsonk_pool_give(frames);
+    else
+        jsonk_nest_release(frames, inline_frames);
+}
+
+/**
+ * Drop stacked elements above base on an error path
+ */
+static void jsonk_parser_unwind(struct jsonk_parser *parser, size_t base)
+{
+    while (parser->stack_len > base)
+        jsonk_value_discard(parser->stack[--parser->stack_len], parser);
+}
+
+static void jsonk_parser_release(struct jsonk_parser *parser)
+{
+    jsonk_parser_unwind(parser, 0);
+    if (parser->stack && (parser->flags & JSONK_PARSE_POOL))
+        jsonk_pool_give(parser->stack);
+    else if (parser->stack)
+        jsonk_memory_free(parser->stack, parser->stack_cap * sizeof(struct jsonk_value *));
+    parser->stack = NULL;
+    parser->stack_cap = 0;
+}
+
+/**
+ * Create the value for a scalar token, NULL for any other token
+ */
+static struct jsonk_value *jsonk_token_value(struct jsonk_parser *parser, const struct jsonk_token *token)
+{
+    struct jsonk_value *value;
+    
+    switch (token->type) {
+    case JSONK_TOKEN_STRING:
+        return jsonk_value_create_string_tracked(token->start, token->len, parser);
+        
+    case JSONK_TOKEN_NUMBER:
+        return jsonk_value_create_number_tracked(token->start, token->len, parser);
+        
+    case JSONK_TOKEN_TRUE:
+    case JSONK_TOKEN_FALSE:
+        value = jsonk_value_create_tracked(JSONK_VALUE_BOOLEAN, parser);
+        if (value)
+            value->u.boolean = (token->type == JSONK_TOKEN_TRUE);
+        return value;
+        
+    case JSONK_TOKEN_NULL:
+        return jsonk_value_create_tracked(JSONK_VALUE_NULL, parser);
+        
+    default:
+        /* Invalid token */
+        return NULL;
+    }
+}
+
+/* An object or array still being parsed */
+struct jsonk_parse_frame {
+    struct jsonk_value *container;
+    size_t base;                    /* Where an array's elements start on the parser stack */
+};
+
+/**
+ * Parse the root value into a tree
+ * 
+ * Containers are tracked in an explicit frame stack. Members are added
+ * as soon as their key is read and get their value when it is complete;
+ * array elements are collected on the parser stack and moved into a
+ * vector of exactly the right size once the array closes. Every node is
+ * reachable from the root or the parser stack, so an error only has to
+ * drop those two.
+ */
+static struct jsonk_value *jsonk_parse_tree(struct jsonk_parser *parser)
+{
+    struct jsonk_parse_frame inline_frames[JSONK_NEST_INLINE];
+    struct jsonk_parse_frame *frames = inline_frames, *top = NULL;
+    unsigned int max_depth = jsonk_parser_max_depth(parser);
+    struct jsonk_value *root = NULL, *value, *container;
+    size_t stack_base = parser->stack_len;
+    size_t cap = ARRAY_SIZE(inline_frames);
+    size_t depth = 0, count;
+    struct jsonk_token token;
+    int ret;
+    
+    while (true) {
+        /* A value is due: the root, a member's value or an array element */
+        ret = jsonk_next_token(parser, &token);
+        if (ret < 0)
+            goto error;
+        if (depth >= max_depth) {
+            jsonk_reject(JSONK_LIMIT_DEPTH, "Nesting too deep (> %u)\n", max_depth);
+            goto error;
+        }
+        
+        if (token.type == JSONK_TOKEN_OBJECT_START)
+            value = jsonk_value_create_tracked(JSONK_VALUE_OBJECT, parser);
+        else if (token.type == JSONK_TOKEN_ARRAY_START)
+            value = jsonk_value_create_tracked(JSONK_VALUE_ARRAY, parser);
+        else
+            value = jsonk_token_value(parser, &token);
+        if (!value)
+            goto error;
+        
+        if (!top) {
+            root = value;
+        } else if (top->container->type == JSONK_VALUE_OBJECT) {
+            list_last_entry(&top->container->u.object.members, struct jsonk_member, list)->value = value;
+        } else {
+            ret = jsonk_parser_push(parser, value);
+            if (ret < 0) {
+                jsonk_value_discard(value, parser);
+                goto error;
+            }
+        }
+        
+        if (value->type == JSONK_VALUE_OBJECT) {
+            if (depth == cap) {
+                frames = jsonk_parser_nest_grow(parser, frames, inline_frames, &cap, sizeof(*frames));
+                if (!frames)
+                    goto error;
+            }
+            top = &frames[depth++];
+            top->container = value;
+            
+            ret = jsonk_next_token(parser, &token);
+            if (ret < 0)
+                goto error;
+            if (token.type == JSONK_TOKEN_OBJECT_END)
+                goto close;
+            goto key;
+        }
+        
+        if (value->type == JSONK_VALUE_ARRAY) {
+            if (depth == cap) {
+                frames = jsonk_parser_nest_grow(parser, frames, inline_frames, &cap, sizeof(*frames));
+                if (!frames)
+                    goto error;
+            }
+            top = &frames[depth++];
+            top->container = value;
+            top->base = parser->stack_len;
+            
+            /* Peek for an empty array; "[1,]" is invalid */
+            jsonk_skip_whitespace(parser);
+            if (parser->pos < parser->buffer_len && parser->buffer[parser->pos] == ']') {
+                parser->pos++;
+                goto close;
+            }
+            continue;
+        }
+        
+        if (!depth)
+            break;
+        
+next:
+        /* After a value: a comma or the end of the innermost container */
+        ret = jsonk_next_token(parser, &token);
+        if (ret < 0)
+            goto error;
+        
+        if (top->container->type == JSONK_VALUE_OBJECT) {
+            if (token.type == JSONK_TOKEN_OBJECT_END)
+                goto close;
+            if (token.type != JSONK_TOKEN_COMMA)
+                goto error;
+            ret = jsonk_next_token(parser, &token);
+            if (ret < 0)
+                goto error;
+            goto key;
+        }
+        
+        if (token.type == JSONK_TOKEN_ARRAY_END)
+            goto close;
+        if (token.type != JSONK_TOKEN_COMMA)
+            goto error;
+        
+        /* Check array size limit */
+        if ((parser->checks & JSONK_CHECK_COUNTS) &&
+            parser->stack_len - top->base >= parser->max_array_size) {
+            jsonk_reject(JSONK_LIMIT_ARRAY_SIZE, "Array too large (%zu >= %u)\n",
+                         parser->stack_len - top->base, parser->max_array_size);
+            goto error;
+        }
+        continue;
+        
+key:
+        /* The key is copied straight out of the input buffer */
+        if (token.type != JSONK_TOKEN_STRING)
+            goto error;
+        ret = jsonk_object_add_member_tracked(&top->container->u.object, token.start, token.len,
+                                              NULL, parser);
+        if (ret < 0)
+            goto error;
+        
+        ret = jsonk_next_token(parser, &token);
+        if (ret < 0 || token.type != JSONK_TOKEN_COLON)
+            goto error;
+        continue;
+        
+close:
+        container = top->container;
+        if (container->type == JSONK_VALUE_ARRAY) {
+            count = parser->stack_len - top->base;
+            if (count) {
+                ret = jsonk_array_resize(&container->u.array, count, parser);
+                if (ret < 0)
+                    goto error;
+                memcpy(container->u.array.items, &parser->stack[top->base],
+                       count * sizeof(struct jsonk_value *));
+                container->u.array.size = count;
+                parser->stack_len = top->base;
+            }
+        }
+        
+        if (!--depth)
+            break;
+        top = &frames[depth - 1];
+        goto next;
+    }
+    
+    jsonk_parser_nest_release(parser, frames, inline_frames);
+    return root;
+    
+error:
+    jsonk_parser_nest_release(parser, frames, inline_frames);
+    jsonk_parser_unwind(parser, stack_base);
+    if (root)
+        jsonk_value_discard(root, parser);
+    return NULL;
+}
+
+/* ========================================================================
+ * Event Parser
+ * ======================================================================== */
+
+enum jsonk_sax_state {
+    JSONK_SAX_VALUE,            /* A value must follow */
+    JSONK_SAX_VALUE_OR_END,     /* Just after '[' */
+    JSONK_SAX_KEY,              /* Just after ',' inside an object */
+    JSONK_SAX_KEY_OR_END,       /* Just after '{' */
+    JSONK_SAX_COLON,            /* Just after a key */
+    JSONK_SAX_NEXT              /* ',' or the closing bracket */
+};
+
+/* Frame bit of the event walker marking an object */
+#define JSONK_SAX_OBJECT 0x80000000U
+
+#define JSONK_SAX_CALL(ops, ctx, fn, ...) \
+    ((ops) && (ops)->fn ? (ops)->fn((ctx), ##__VA_ARGS__) : 0)
+
+/**
+ * Walk the root value in the parser's buffer, reporting it through ops
+ * @param strict Reject anything but whitespace after the root value
+ * @return 0 when done, a callback's non-zero return, or -EINVAL/-ENOSPC/-ENOMEM
+ * 
+ * This is the one place that checks the grammar together with the depth,
+ * container, key and string limits without building anything. Callers
+ * inside this file pass constant ops, so after inlining the callbacks are
+ * direct calls.
+ */
+static __always_inline int jsonk_sax_walk(struct jsonk_parser *parser,
+                                          const struct jsonk_sax_ops *ops,
+                                          void *ctx, bool strict)
+{
+    u32 inline_frames[JSONK_NEST_INLINE];   /* Members or elements so far, and JSONK_SAX_OBJECT */
+    u32 *frames = inline_frames;
+    unsigned int max_depth = jsonk_parser_max_depth(parser);
+    bool counts = parser->checks & JSONK_CHECK_COUNTS;
+    bool lengths = parser->checks & JSONK_CHECK_LENGTH;
+    enum jsonk_sax_state state = JSONK_SAX_VALUE;
+    struct jsonk_token token;
+    size_t cap = ARRAY_SIZE(inline_frames);
+    size_t depth = 0;
+    size_t strings = 0;
+    bool in_object;
+    int ret;
+    
+    /* Count limits are at most INT_MAX, see jsonk_parser_set_limits() */
+    BUILD_BUG_ON(INT_MAX >= JSONK_SAX_OBJECT);
+    
+    do {
+        ret = jsonk_next_token(parser, &token);
+        if (ret < 0)
+            goto invalid;
+        
+        in_object = depth && (frames[depth - 1] & JSONK_SAX_OBJECT);
+        
+        switch (state) {
+        case JSONK_SAX_COLON:
+            if (token.type != JSONK_TOKEN_COLON)
+                goto invalid;
+            state = JSONK_SAX_VALUE;
+            continue;
+            
+        case JSONK_SAX_NEXT:
+            if (token.type == JSONK_TOKEN_COMMA) {
+                state = in_object ? JSONK_SAX_KEY : JSONK_SAX_VALUE;
+                continue;
+            }
+            if (token.type != (in_object ? JSONK_TOKEN_OBJECT_END : JSONK_TOKEN_ARRAY_END))
+                goto invalid;
+            goto close;
+            
+        case JSONK_SAX_KEY_OR_END:
+            if (token.type == JSONK_TOKEN_OBJECT_END)
+                goto close;
+            fallthrough;
+        case JSONK_SAX_KEY:
+            if (token.type != JSONK_TOKEN_STRING)
+                goto invalid;
+            if (token.len > JSONK_MAX_KEY_LENGTH) {
+                jsonk_reject(JSONK_LIMIT_KEY_LENGTH, "Object key too long (%zu > %d)\n",
+                             token.len, JSONK_MAX_KEY_LENGTH);
+                goto invalid;
+            }
+            if (counts) {
+                if ((frames[depth - 1] & ~JSONK_SAX_OBJECT) >= parser->max_object_members) {
+                    jsonk_reject(JSONK_LIMIT_OBJECT_MEMBERS, "Too many object members (%u >= %u)\n",
+                                 frames[depth - 1] & ~JSONK_SAX_OBJECT, parser->max_object_members);
+                    ret = -ENOSPC;
+                    goto out;
+                }
+                frames[depth - 1]++;
+            }
+            ret = JSONK_SAX_CALL(ops, ctx, on_key, token.start, token.len);
+            if (ret)
+                goto out;
+            state = JSONK_SAX_COLON;
+            continue;
+            
+        case JSONK_SAX_VALUE_OR_END:
+            if (token.type == JSONK_TOKEN_ARRAY_END)
+                goto close;
+            fallthrough;
+        case JSONK_SAX_VALUE:
+            break;
+        }
+        
+        /* A value nested depth containers deep, as in jsonk_parse_tree() */
+        if (depth >= max_depth) {
+            jsonk_reject(JSONK_LIMIT_DEPTH, "Nesting too deep (> %u)\n", max_depth);
+            goto invalid;
+        }
+        
+        if (counts && depth && !in_object) {
+            if (frames[depth - 1] >= parser->max_array_size) {
+                jsonk_reject(JSONK_LIMIT_ARRAY_SIZE, "Array too large (%u >= %u)\n",
+                             frames[depth - 1], parser->max_array_size);
+                ret = -ENOSPC;
+                goto out;
+            }
+            frames[depth - 1]++;
+        }
+        
+        if ((token.type == JSONK_TOKEN_OBJECT_START || token.type == JSONK_TOKEN_ARRAY_START) &&
+            depth == cap) {
+            frames = jsonk_nest_grow(frames, inline_frames, &cap, sizeof(*frames), parser->gfp);
+            if (!frames) {
+                ret = -ENOMEM;
+                goto out;
+            }
+        }
+        
+        switch (token.type) {
+        case JSONK_TOKEN_OBJECT_START:
+            ret = JSONK_SAX_CALL(ops, ctx, on_object_start);
+            state = JSONK_SAX_KEY_OR_END;
+            frames[depth++] = JSONK_SAX_OBJECT;
+            break;
+            
+        case JSONK_TOKEN_ARRAY_START:
+            ret = JSONK_SAX_CALL(ops, ctx, on_array_start);
+            state = JSONK_SAX_VALUE_OR_END;
+            frames[depth++] = 0;
+            break;
+            
+        case JSONK_TOKEN_STRING:
+            if (lengths && token.len > parser->max_string_length) {
+                jsonk_reject(JSONK_LIMIT_STRING_LENGTH, "String too long (%zu > %zu)\n",
+                             token.len, parser->max_string_length);
+                goto invalid;
+            }
+            if (counts) {
+                if (strings >= parser->max_strings) {
+                    jsonk_reject(JSONK_LIMIT_STRINGS, "Too many strings (%zu >= %u)\n",
+                                 strings, parser->max_strings);
+                    ret = -ENOSPC;
+                    goto out;
+                }
+                strings++;
+            }
+            fallthrough;
+        case JSONK_TOKEN_NUMBER:
+        case JSONK_TOKEN_TRUE:
+        case JSONK_TOKEN_FALSE:
+        case JSONK_TOKEN_NULL:
+            ret = JSONK_SAX_CALL(ops, ctx, on_value, &token);
+            state = JSONK_SAX_NEXT;
+            break;
+            
+        default:
+            goto invalid;
+        }
+        if (ret)
+            goto out;
+        continue;
+        
+close:
+        depth--;
+        if (frames[depth] & JSONK_SAX_OBJECT)
+            ret = JSONK_SAX_CALL(ops, ctx, on_object_end);
+        else
+            ret = JSONK_SAX_CALL(ops, ctx, on_array_end);
+        if (ret)
+            goto out;
+        state = JSONK_SAX_NEXT;
+    } while (depth);
+    
+    if (strict) {
+        jsonk_skip_whitespace(parser);
+        if (parser->pos < parser->buffer_len)
+            goto invalid;
+    }
+    ret = 0;
+    goto out;
+    
+invalid:
+    ret = -EINVAL;
+out:
+    jsonk_nest_release(frames, inline_frames);
+    return ret;
+}
+
+/**
+ * Parse a JSON string, reporting it through callbacks instead of building a tree
+ */
+int jsonk_sax_parse(const char *json_str, size_t json_len,
+                    const struct jsonk_sax_ops *ops, void *ctx)
+{
+    struct jsonk_parser parser;
+    u64 start;
+    int ret;
+    
+    if (!json_str || json_len == 0)
+        return -EINVAL;
+    
+    jsonk_parser_init(&parser, json_str, json_len);
+    jsonk_parser_set_limits(&parser, NULL);
+    start = jsonk_parse_begin(&parser);
+    ret = jsonk_sax_walk(&parser, ops, ctx, true);
+    jsonk_parse_end(&parser, json_len, ret == 0, start);
+    return ret;
+}
+
+/**
+ * Check that a buffer holds exactly one valid JSON document
+ */
+int jsonk_validate(const char *json_str, size_t json_len)
+{
+    struct jsonk_parser parser;
+    u64 start;
+    int ret;
+    
+    if (!json_str || json_len == 0)
+        return -EINVAL;
+    
+    jsonk_parser_init(&parser, json_str, json_len);
+    jsonk_parser_set_limits(&parser, NULL);
+    start = jsonk_parse_begin(&parser);
+    ret = jsonk_sax_walk(&parser, NULL, NULL, true);
+    jsonk_parse_end(&parser, json_len, ret == 0, start);
+    return ret;
+}
+
+/* ========================================================================
+ * Structural Index Parser
+ * ======================================================================== */
+
+/*
+ * Documents of JSONK_INDEX_PARSE_THRESHOLD bytes or more are parsed in two
+ * stages.  Stage one tokenizes the whole document into a flat index of
+ * value and key positions, checking the grammar and the parse limits
+ * before any node is allocated.  Stage two builds the tree from the index
+ * without recursion; every container's child count is known by then, so
+ * array vectors and object hash indexes are allocated at their final size.
+ */
+
+struct jsonk_index_entry {
+    u32 pos;   /* Offset of the token, strings and keys at their opening quote */
+    u32 aux;   /* Containers: number of children, strings: body length, scalars: length */
+};
+
+struct jsonk_index {
+    struct jsonk_index_entry *entries;
+    size_t len;
+    size_t cap;
+    size_t max;     /* Entries max_memory can hold */
+    gfp_t gfp;
+};
+
+
+static int jsonk_index_push(struct jsonk_index *index, size_t pos, size_t aux)
+{
+    struct jsonk_index_entry *entries;
+    size_t cap;
+    
+    if (index->len == index->cap) {
+        if (index->len >= index->max) {
+            jsonk_reject(JSONK_LIMIT_MEMORY, "Memory limit exceeded (index of more than %zu entries)\n",
+                         index->max);
+            return -ENOMEM;
+        }
+        cap = min(index->cap * 2, index->max);
+        entries = jsonk_counted(jsonk_memory_alloc_gfp(cap * sizeof(*entries), index->gfp));
+        if (!entries)
+            return -ENOMEM;
+        memcpy(entries, index->entries, index->len * sizeof(*entries));
+        jsonk_memory_free(index->entries, index->cap * sizeof(*entries));
+        index->entries = entries;
+        index->cap = cap;
+    }
+    
+    index->entries[index->len].pos = pos;
+    index->entries[index->len].aux = aux;
+    index->len++;
+    return 0;
+}
+
+struct jsonk_index_scan {
+    struct jsonk_parser *parser;
+    struct jsonk_index *index;
+    u32 *open;                      /* Entries of the open containers */
+    size_t depth;
+    size_t cap;
+    u32 inline_open[JSONK_NEST_INLINE];
+    size_t values;
+    size_t members;
+    size_t key_bytes;
+};
+
+static inline int jsonk_index_scan_value(struct jsonk_index_scan *scan, size_t pos, size_t aux)
+{
+    struct jsonk_index_entry *parent;
+    
+    /* Object members are counted by their keys */
+    if (scan->depth) {
+        parent = &scan->index->entries[scan->open[scan->depth - 1]];
+        if (scan->parser->buffer[parent->pos] == '[')
+            parent->aux++;
+    }
+    scan->values++;
+    return jsonk_index_push(scan->index, pos, aux);
+}
+
+static int jsonk_index_on_start(void *ctx)
+{
+    struct jsonk_index_scan *scan = ctx;
+    size_t entry = scan->index->len;
+    int ret;
+    
+    /* The tokenizer has just consumed the bracket */
+    ret = jsonk_index_scan_value(scan, scan->parser->pos - 1, 0);
+    if (ret < 0)
+        return ret;
+    if (scan->depth == scan->cap) {
+        scan->open = jsonk_nest_grow(scan->open, scan->inline_open, &scan->cap,
+                                     sizeof(*scan->open), scan->parser->gfp);
+        if (!scan->open)
+            return -ENOMEM;
+    }
+    scan->open[scan->depth++] = entry;
+    return 0;
+}
+
+static int jsonk_index_on_end(void *ctx)
+{
+    struct jsonk_index_scan *scan = ctx;
+    
+    scan->depth--;
+    return 0;
+}
+
+static int jsonk_index_on_key(void *ctx, const char *key, size_t key_len)
+{
+    struct jsonk_index_scan *scan = ctx;
+    
+    scan->index->entries[scan->open[scan->depth - 1]].aux++;
+    scan->members++;
+    if (key_len >= JSONK_MEMBER_INLINE_KEY)
+        scan->key_bytes += key_len + 1;
+    return jsonk_index_push(scan->index, key - scan->parser->buffer - 1, key_len);
+}
+
+static int jsonk_index_on_value(void *ctx, const struct jsonk_token *token)
+{
+    struct jsonk_index_scan *scan = ctx;
+    size_t pos = token->start - scan->parser->buffer;
+    
+    if (token->type == JSONK_TOKEN_STRING)
+        pos--; /* Record the opening quote */
+    return jsonk_index_scan_value(scan, pos, token->len);
+}
+
+static const struct jsonk_sax_ops jsonk_index_sax_ops = {
+    .on_object_start = jsonk_index_on_start,
+    .on_object_end = jsonk_index_on_end,
+    .on_array_start = jsonk_index_on_start,
+    .on_array_end = jsonk_index_on_end,
+    .on_key = jsonk_index_on_key,
+    .on_value = jsonk_index_on_value,
+};
+
+/**
+ * Stage one: index every value and key of the root value in the buffer
+ * 
+ * Content after the root value is ignored, as in jsonk_parse_tree().
+ */
+static int jsonk_index_scan(struct jsonk_parser *parser, struct jsonk_index *index)
+{
+    struct jsonk_index_scan scan = {
+        .parser = parser,
+        .index = index,
+        .cap = JSONK_NEST_INLINE,
+    };
+    size_t estimate;
+    int ret;
+    
+    /*
+     * The tape itself is not charged, so that the limit stays the one on
+     * the tree. Every entry becomes a node or member larger than itself,
+     * so capping the tape at max_memory rejects no document that fits.
+     */
+    index->max = SIZE_MAX;
+    if (parser->checks & JSONK_CHECK_MEMORY)
+        index->max = max_t(size_t, parser->max_memory / sizeof(*index->entries), 1);
+    
+    /* Typical documents have a value or key every 8-16 bytes */
+    index->cap = min(max_t(size_t, parser->buffer_len / 16, 256), index->max);
+    index->gfp = parser->gfp;
+    index->entries = jsonk_counted(jsonk_memory_alloc_gfp(index->cap * sizeof(*index->entries), index->gfp));
+    if (!index->entries)
+        return -ENOMEM;
+    
+    scan.open = scan.inline_open;
+    ret = jsonk_sax_walk(parser, &jsonk_index_sax_ops, &scan, false);
+    jsonk_nest_release(scan.open, scan.inline_open);
+    if (ret)
+        return ret < 0 ? ret : -EINVAL;
+    
+    /* Nodes, members and keys alone must fit the memory limit */
+    estimate = scan.values * JSONK_SCALAR_NODE_SIZE +
+               scan.members * sizeof(struct jsonk_member) + scan.key_bytes;
+    if ((parser->checks & JSONK_CHECK_MEMORY) &&
+        parser->total_memory_used + estimate > parser->max_memory) {
+        jsonk_reject(JSONK_LIMIT_MEMORY, "Memory limit exceeded (document needs at least %zu bytes)\n",
+                     estimate);
+        return -ENOMEM;
+    }
+    
+    return 0;
+}
+
+/**
+ * Create the node for one index entry, containers at their final size
+ */
+static struct jsonk_value *jsonk_index_value(struct jsonk_parser *parser,
+                                             const struct jsonk_index_entry *entry)
+{
+    const char *p = parser->buffer + entry->pos;
+    struct jsonk_value *value;
+    
+    switch (*p) {
+    case '{':
+        value = jsonk_value_create_tracked(JSONK_VALUE_OBJECT, parser);
+        if (value && entry->aux >= JSONK_OBJECT_INDEX_THRESHOLD &&
+            jsonk_object_index_build(&value->u.object, roundup_pow_of_two(entry->aux), parser) < 0) {
+            jsonk_value_discard(value, parser);
+            return NULL;
+        }
+        return value;
+    case '[':
+        value = jsonk_value_create_tracked(JSONK_VALUE_ARRAY, parser);
+        if (value && entry->aux && jsonk_array_resize(&value->u.array, entry->aux, parser) < 0) {
+            jsonk_value_discard(value, parser);
+            return NULL;
+        }
+        return value;
+    case '"':
+        return jsonk_value_create_string_tracked(p + 1, entry->aux, parser);
+    case 't':
+    case 'f':
+        value = jsonk_value_create_tracked(JSONK_VALUE_BOOLEAN, parser);
+        if (value)
+            value->u.boolean = (*p == 't');
+        return value;
+    case 'n':
+        return jsonk_value_create_tracked(JSONK_VALUE_NULL, parser);
+    default:
+        return jsonk_value_create_number_tracked(p, entry->aux, parser);
+    }
+}
+
+/**
+ * Stage two: build the tree described by a complete index
+ */
+/* A container of the index tree that still has children to come */
+struct jsonk_index_frame {
+    struct jsonk_value *container;
+    u32 remaining;
+};
+
+static struct jsonk_value *jsonk_index_tree(struct jsonk_parser *parser,
+                                            const struct jsonk_index *index)
+{
+    struct jsonk_index_frame inline_open[JSONK_NEST_INLINE], *open = inline_open;
+    const struct jsonk_index_entry *entry = index->entries;
+    const struct jsonk_index_entry *end = entry + index->len;
+    const struct jsonk_index_entry *key;
+    struct jsonk_value *root = NULL;
+    struct jsonk_value *parent, *value;
+    size_t cap = ARRAY_SIZE(inline_open);
+    size_t depth = 0;
+    int ret;
+    
+    while (entry < end) {
+        parent = depth ? open[depth - 1].container : NULL;
+        key = (parent && parent->type == JSONK_VALUE_OBJECT) ? entry++ : NULL;
+        
+        value = jsonk_index_value(parser, entry);
+        if (!value)
+            goto error;
+        
+        if (!parent) {
+            root = value;
+        } else if (key) {
+            ret = jsonk_object_add_member_tracked(&parent->u.object, parser->buffer + key->pos + 1,
+                                                  key->aux, value, parser);
+            if (ret < 0) {
+                jsonk_value_discard(value, parser);
+                goto error;
+            }
+        } else {
+            parent->u.array.items[parent->u.array.size++] = value;
+        }
+        
+        /* Close every container whose last child this was */
+        if (depth)
+            open[depth - 1].remaining--;
+        while (depth && !open[depth - 1].remaining)
+            depth--;
+        
+        if ((value->type == JSONK_VALUE_OBJECT || value->type == JSONK_VALUE_ARRAY) && entry->aux) {
+            /* Already attached, so the error path frees it */
+            if (depth == cap) {
+                open = jsonk_nest_grow(open, inline_open, &cap, sizeof(*open), parser->gfp);
+                if (!open)
+                    goto error;
+            }
+            open[depth].container = value;
+            open[depth].remaining = entry->aux;
+            depth++;
+        }
+        entry++;
+    }
+    
+    jsonk_nest_release(open, inline_open);
+    return root;
+    
+error:
+    jsonk_nest_release(open, inline_open);
+    if (root)
+        jsonk_value_discard(root, parser);
+    return NULL;
+}
+
+/**
+ * Parse a whole document through the structural index
+ */
+static struct jsonk_value *jsonk_parse_indexed(struct jsonk_parser *parser)
+{
+    struct jsonk_index index = { };
+    struct jsonk_value *value = NULL;
+    
+    if (jsonk_index_scan(parser, &index) == 0)
+        value = jsonk_index_tree(parser, &index);
+    
+    if (index.entries)
+        jsonk_memory_free(index.entries, index.cap * sizeof(*index.entries));
+    return value;
+}
+
+/* ========================================================================
+ * Parallel Array Parser
+ * ======================================================================== */
+
+/*
+ * A root array is split into ranges of whole elements at top-level
+ * commas. The pre-scan only follows brackets and strings, which is
+ * enough to find those commas in valid input; everything else is left to
+ * the workers, whose parsers check each element as strictly as a serial
+ * parse would. Malformed input can shift the split points, but then some
+ * range fails to parse, so nothing invalid is accepted. Each range is
+ * parsed by its own parser and, in arena mode, into its own arena; the
+ * elements land straight in the root array's vector.
+ */
+
+/* Bytes the pre-scan stops on outside strings */
+static const bool jsonk_split_stops[256] = {
+    ['"'] = true, [','] = true,
+    ['['] = true, [']'] = true, ['{'] = true, ['}'] = true,
+};
+
+struct jsonk_split_worker {
+    struct work_struct work;
+    struct jsonk_parser parser;     /* Limits copied from the document's parser */
+    struct jsonk_value **items;     /* Slots of the range in the root array */
+    size_t first;                   /* Index of the first element */
+    size_t count;                   /* Elements in the range */
+    size_t done;                    /* Elements parsed so far */
+    size_t start, end;              /* First element, and the comma or bracket after the last */
+    bool failed;
+};
+
+/**
+ * Count the root array's elements and split them into up to nr ranges
+ * 
+ * @return Number of ranges, or -EINVAL if the array never closes
+ */
+static int jsonk_split_scan(const struct jsonk_parser *parser, struct jsonk_split_worker *workers,
+                            unsigned int nr, size_t open, size_t *count)
+{
+    const char *buf = parser->buffer;
+    size_t len = parser->buffer_len;
+    size_t spacing = len / nr;
+    size_t pos = open + 1, depth = 1, commas = 0;
+    unsigned int ranges = 1;
+    
+    workers[0].start = pos;
+    workers[0].first = 0;
+    
+    for (;; pos++) {
+        while (pos < len && !jsonk_split_stops[(unsigned char)buf[pos]])
+            pos++;
+        if (pos >= len)
+            return -EINVAL;
+        
+        switch (buf[pos]) {
+        case '"':
+            pos = jsonk_scan_string(buf, pos + 1, len);
+            while (pos < len && buf[pos] != '"')
+                pos = jsonk_scan_string(buf, pos + (buf[pos] == '\\' ? 2 : 1), len);
+            break;
+        case '[':
+        case '{':
+            depth++;
+            break;
+        case ']':
+        case '}':
+            if (--depth)
+                break;
+            if (buf[pos] != ']')
+                return -EINVAL;
+            workers[ranges - 1].end = pos;
+            *count = commas + 1;
+            return ranges;
+        case ',':
+            if (depth != 1)
+                break;
+            commas++;
+            if (ranges < nr && pos - workers[ranges - 1].start >= spacing) {
+                workers[ranges - 1].end = pos;
+                workers[ranges].start = pos + 1;
+                workers[ranges].first = commas;
+                ranges++;
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * Parse one range of elements, each followed by a comma except the last
+ */
+static void jsonk_split_parse(struct jsonk_split_worker *worker)
+{
+    struct jsonk_parser *parser = &worker->parser;
+    struct jsonk_value *value;
+    
+    if ((parser->flags & JSONK_PARSE_ARENA) && !parser->arena) {
+        parser->arena = jsonk_arena_create(parser->gfp, false);
+        if (!parser->arena)
+            goto fail;
+    }
+    
+    while (worker->done < worker->count) {
+        value = jsonk_parse_tree(parser);
+        if (!value)
+            goto fail;
+        worker->items[worker->done++] = value;
+        
+        jsonk_skip_whitespace(parser);
+        if (worker->done == worker->count)
+            break;
+        if (parser->pos >= parser->buffer_len || parser->buffer[parser->pos] != ',')
+            goto fail;
+        parser->pos++;
+    }
+    if (parser->pos == parser->buffer_len)
+        goto out;
+    
+fail:
+    worker->failed = true;
+out:
+    jsonk_parser_release(parser);
+}
+
+static void jsonk_split_work(struct work_struct *work)
+{
+    jsonk_split_parse(container_of(work, struct jsonk_split_worker, work));
+}
+
+/**
+ * Drop what the ranges of a failed parse have built
+ * 
+ * Slab elements are released one by one. Arena ranges from the first
+ * adopted one on still own their arena; the document's arena holds the
+ * rest and goes away with the document.
+ */
+static void jsonk_split_discard(struct jsonk_parser *parser, struct jsonk_split_worker *workers,
+                                unsigned int ranges, unsigned int adopted)
+{
+    struct jsonk_split_worker *worker;
+    unsigned int w;
+    
+    for (w = 0; w < ranges; w++) {
+        worker = &workers[w];
+        if (!parser->arena) {
+            while (worker->done)
+                jsonk_value_put(worker->items[--worker->done]);
+        } else if (w >= adopted && worker->parser.arena) {
+            jsonk_arena_destroy(worker->parser.arena);
+        }
+    }
+}
+
+/* Leases a range takes from the budget when the document uses all of it */
+#define JSONK_SPLIT_SLICES 16
+
+/**
+ * Undo a split parse that ran its budget dry, so it can start over
+ * serially from the same parser
+ */
+static int jsonk_split_restart(struct jsonk_parser *parser, struct jsonk_split_worker *workers,
+                               unsigned int ranges, struct jsonk_value *root)
+{
+    jsonk_split_discard(parser, workers, ranges, 1);
+    jsonk_value_discard(root, parser);
+    parser->total_memory_used = 0;
+    parser->string_count = 0;
+    parser->array_count = 0;
+    parser->object_count = 0;
+    parser->node_count = 0;
+    
+    /* The first range and the root used the document's arena */
+    if (parser->arena) {
+        jsonk_arena_destroy(parser->arena);
+        parser->arena = jsonk_arena_create(parser->gfp, false);
+        if (!parser->arena)
+            return 0;
+    }
+    return -EAGAIN;
+}
+
+/**
+ * Parse a root array with its elements spread over several workers
+ * 
+ * @return 0 with the root or NULL in *result, or -EAGAIN if the document
+ *         should be parsed serially
+ */
+static int jsonk_parse_split(struct jsonk_parser *parser, struct jsonk_value **result)
+{
+    unsigned int max_depth = jsonk_parser_max_depth(parser);
+    struct jsonk_split_worker *workers, *worker;
+    struct jsonk_split_budget budget = {};
+    struct jsonk_value *root = NULL;
+    unsigned int nr, ranges, adopted, w;
+    size_t open, count;
+    long left;
+    bool failed = false;
+    int ret;
+    
+    open = jsonk_scan_whitespace(parser->buffer, parser->pos, parser->buffer_len);
+    if (open >= parser->buffer_len || parser->buffer[open] != '[' || max_depth < 2 ||
+        !gfpflags_allow_blocking(parser->gfp))
+        return -EAGAIN;
+    
+    nr = num_online_cpus();
+    if (parser->max_workers)
+        nr = min(nr, parser->max_workers);
+    nr = min_t(size_t, nr, parser->buffer_len / JSONK_BATCH_WORKER_BYTES);
+    if (nr < 2)
+        return -EAGAIN;
+    
+    workers = jsonk_counted(kcalloc(nr, sizeof(*workers), parser->gfp));
+    if (!workers)
+        return -EAGAIN;
+    
+    /* A root array that never closes cannot be valid */
+    ret = jsonk_split_scan(parser, workers, nr, open, &count);
+    if (ret < 2) {
+        kfree(workers);
+        *result = NULL;
+        return ret < 0 ? 0 : -EAGAIN;
+    }
+    ranges = ret;
+    
+    if ((parser->checks & JSONK_CHECK_COUNTS) && count > parser->max_array_size) {
+        jsonk_reject(JSONK_LIMIT_ARRAY_SIZE, "Array too large (%zu > %u)\n", count, parser->max_array_size);
+        goto out;
+    }
+    root = jsonk_value_create_tracked(JSONK_VALUE_ARRAY, parser);
+    if (!root || jsonk_array_resize(&root->u.array, count, parser) < 0)
+        goto out;
+    
+    /* The ranges lease what the root left of the limits */
+    left = min_t(size_t, parser->max_memory - parser->total_memory_used, LONG_MAX);
+    atomic_long_set(&budget.memory, left);
+    budget.memory_slice = max_t(long, left / (ranges * JSONK_SPLIT_SLICES), 1);
+    left = parser->max_strings - parser->string_count;
+    atomic_long_set(&budget.strings, left);
+    budget.strings_slice = max_t(long, left / (ranges * JSONK_SPLIT_SLICES), 1);
+    
+    for (w = 0; w < ranges; w++) {
+        worker = &workers[w];
+        worker->parser = *parser;
+        worker->parser.flags &= ~JSONK_PARSE_PARALLEL;
+        worker->parser.pos = worker->start;
+        worker->parser.buffer_len = worker->end;
+        worker->parser.max_depth = max_depth - 1;
+        worker->parser.budget = &budget;
+        worker->parser.max_memory = 0;
+        worker->parser.max_strings = 0;
+        worker->parser.total_memory_used = 0;
+        worker->parser.string_count = 0;
+        worker->parser.array_count = 0;
+        worker->parser.object_count = 0;
+        worker->parser.node_count = 0;
+        worker->parser.stack = NULL;
+        worker->parser.stack_len = 0;
+        worker->parser.stack_cap = 0;
+        /* The caller's range shares the document's arena, the others get their own */
+        if (w)
+            worker->parser.arena = NULL;
+        worker->items = root->u.array.items + worker->first;
+        worker->count = (w + 1 < ranges ? workers[w + 1].first : count) - worker->first;
+    }
+    
+    for (w = 1; w < ranges; w++) {
+        INIT_WORK(&workers[w].work, jsonk_split_work);
+        queue_work(system_unbound_wq, &workers[w].work);
+    }
+    jsonk_split_parse(&workers[0]);
+    for (w = 1; w < ranges; w++)
+        flush_work(&workers[w].work);
+    
+    if (READ_ONCE(budget.dry)) {
+        ret = jsonk_split_restart(parser, workers, ranges, root);
+        kfree(workers);
+        *result = NULL;
+        return ret;
+    }
+    
+    /* Leases kept the sums within the document's limits */
+    for (w = 0; w < ranges; w++) {
+        worker = &workers[w];
+        failed |= worker->failed;
+        parser->total_memory_used += worker->parser.total_memory_used;
+        parser->string_count += worker->parser.string_count;
+        parser->array_count += worker->parser.array_count;
+        parser->object_count += worker->parser.object_count;
+        parser->node_count += worker->parser.node_count;
+    }
+    
+    /* Any node of a range pins its arena; the document keeps one */
+    for (adopted = 1; !failed && parser->arena && adopted < ranges; adopted++) {
+        if (jsonk_arena_adopt(parser->arena, workers[adopted].items[0]) < 0)
+            break;
+    }
+    if (parser->arena && adopted < ranges)
+        failed = true;
+    
+    if (failed) {
+        jsonk_split_discard(parser, workers, ranges, adopted);
+        goto out;
+    }
+    
+    root->u.array.size = count;
+    *result = root;
+    kfree(workers);
+    return 0;
+    
+out:
+    if (root)
+        jsonk_value_discard(root, parser);
+    kfree(workers);
+    *result = NULL;
+    return 0;
+}
+
+/**
+ * Parse the root value, picking the engine by document size
+ */
+static struct jsonk_value *jsonk_parse_document(struct jsonk_parser *parser)
+{
+    struct jsonk_value *root;
+    
+    if ((parser->flags & JSONK_PARSE_PARALLEL) && jsonk_parse_split(parser, &root) == 0)
+        return root;
+    if (parser->buffer_len >= JSONK_INDEX_PARSE_THRESHOLD && parser->buffer_len <= U32_MAX &&
+        !(parser->flags & JSONK_PARSE_POOL))
+        return jsonk_parse_indexed(parser);
+    return jsonk_parse_tree(parser);
+}
+
+/* ========================================================================
+ * Incremental Parser
+ * ======================================================================== */
+
+/*
+ * Chunks are tokenized in place. A string, number or literal that runs
+ * into the end of a chunk is copied to the carry buffer and completed from
+ * the following chunks; the tree is built token by token with an explicit
+ * container stack, so nothing else needs to survive between chunks.
+ */
+
+enum jsonk_stream_state {
+    JSONK_STREAM_VALUE,         /* A value must follow */
+    JSONK_STREAM_VALUE_OR_END,  /* Just after '[' */
+    JSONK_STREAM_KEY,           /* Just after ',' inside an object */
+    JSONK_STREAM_KEY_OR_END,    /* Just after '{' */
+    JSONK_STREAM_COLON,         /* Just after a key */
+    JSONK_STREAM_NEXT,          /* ',' or the closing bracket */
+    JSONK_STREAM_DONE           /* Root value complete */
+};
+
+enum jsonk_carry_kind {
+    JSONK_CARRY_NONE,
+    JSONK_CARRY_STRING,
+    JSONK_CARRY_NUMBER,
+    JSONK_CARRY_LITERAL
+};
+
+struct jsonk_stream {
+    enum jsonk_stream_state state;
+    int error;                              /* Sticky error from an earlier chunk */
+    struct jsonk_value *root;
+    size_t depth;
+    unsigned int max_depth;                 /* max_depth when the parse started */
+    size_t fed;                             /* Bytes fed so far, for the statistics */
+    
+    /* Key waiting for its value; the chunk it came from may be gone */
+    char key[JSONK_MAX_KEY_LENGTH + 1];
+    size_t key_len;
+    
+    /* Token split across chunks */
+    enum jsonk_carry_kind carry_kind;
+    bool carry_escape;                      /* Carried string ends in a lone backslash */
+    char *carry;
+    size_t carry_len;
+    size_t carry_cap;
+    
+    struct jsonk_value *open[];             /* Containers still being filled */
+};
+
+static inline bool jsonk_is_number_char(char c)
+{
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+static inline bool jsonk_is_literal_char(char c)
+{
+    return c >= 'a' && c <= 'z';
+}
+
+static int jsonk_stream_carry(struct jsonk_parser *parser, const char *data, size_t len)
+{
+    struct jsonk_stream *stream = parser->stream;
+    char *carry;
+    size_t cap;
+    
+    if (stream->carry_len + len > stream->carry_cap) {
+        /* Quotes included, a carried token is never longer than a string may be */
+        if (stream->carry_len + len > parser->max_string_length + 2) {
+            jsonk_reject(JSONK_LIMIT_STRING_LENGTH, "String too long (> %zu)\n", parser->max_string_length);
+            return -EINVAL;
+        }
+        cap = max_t(size_t, roundup_pow_of_two(stream->carry_len + len), 64);
+        carry = jsonk_counted(jsonk_memory_alloc_gfp(cap, parser->gfp));
+        if (!carry)
+            return -ENOMEM;
+        if (stream->carry_len)
+            memcpy(carry, stream->carry, stream->carry_len);
+        if (stream->carry)
+            jsonk_memory_free(stream->carry, stream->carry_cap);
+        stream->carry = carry;
+        stream->carry_cap = cap;
+    }
+    
+    memcpy(stream->carry + stream->carry_len, data, len);
+    stream->carry_len += len;
+    return 0;
+}
+
+/**
+ * Attach a new value to the innermost open container, or make it the root
+ */
+static int jsonk_stream_attach(struct jsonk_parser *parser, struct jsonk_value *value)
+{
+    struct jsonk_stream *stream = parser->stream;
+    struct jsonk_value *parent;
+    int ret;
+    
+    if (!stream->depth) {
+        stream->root = value;
+        return 0;
+    }
+    
+    parent = stream->open[stream->depth - 1];
+    if (parent->type == JSONK_VALUE_OBJECT)
+        ret = jsonk_object_add_member_tracked(&parent->u.object, stream->key, stream->key_len,
+                                              value, parser);
+    else
+        ret = jsonk_array_add_element_tracked(&parent->u.array, value, parser);
+    
+    if (ret < 0)
+        jsonk_value_discard(value, parser);
+    return ret;
+}
+
+/**
+ * Advance the tree under construction by one complete token
+ */
+static int jsonk_stream_token(struct jsonk_parser *parser, const struct jsonk_token *token)
+{
+    struct jsonk_stream *stream = parser->stream;
+    struct jsonk_value *value;
+    bool is_object;
+    int ret;
+    
+    switch (stream->state) {
+    case JSONK_STREAM_DONE:
+        return 0;
+        
+    case JSONK_STREAM_COLON:
+        if (token->type != JSONK_TOKEN_COLON)
+            return -EINVAL;
+        stream->state = JSONK_STREAM_VALUE;
+        return 0;
+        
+    case JSONK_STREAM_NEXT:
+        is_object = stream->open[stream->depth - 1]->type == JSONK_VALUE_OBJECT;
+        if (token->type == JSONK_TOKEN_COMMA) {
+            stream->state = is_object ? JSONK_STREAM_KEY : JSONK_STREAM_VALUE;
+            return 0;
+        }
+        if (token->type != (is_object ? JSONK_TOKEN_OBJECT_END : JSONK_TOKEN_ARRAY_END))
+            return -EINVAL;
+        goto close;
+        
+    case JSONK_STREAM_KEY_OR_END:
+        if (token->type == JSONK_TOKEN_OBJECT_END)
+            goto close;
+        fallthrough;
+    case JSONK_STREAM_KEY:
+        if (token->type != JSONK_TOKEN_STRING)
+            return -EINVAL;
+        if (token->len > JSONK_MAX_KEY_LENGTH) {
+            jsonk_reject(JSONK_LIMIT_KEY_LENGTH, "Object key too long (%zu > %d)\n",
+                         token->len, JSONK_MAX_KEY_LENGTH);
+            return -EINVAL;
+        }
+        memcpy(stream->key, token->start, token->len);
+        stream->key_len = token->len;
+        stream->state = JSONK_STREAM_COLON;
+        return 0;
+        
+    case JSONK_STREAM_VALUE_OR_END:
+        if (token->type == JSONK_TOKEN_ARRAY_END)
+            goto close;
+        fallthrough;
+    case JSONK_STREAM_VALUE:
+        break;
+    }
+    
+    /* Same depth rule as jsonk_parse_tree() */
+    if (stream->depth >= stream->max_depth) {
+        jsonk_reject(JSONK_LIMIT_DEPTH, "Nesting too deep (> %u)\n", stream->max_depth);
+        return -EINVAL;
+    }
+    
+    if (token->type == JSONK_TOKEN_OBJECT_START || token->type == JSONK_TOKEN_ARRAY_START) {
+        is_object = token->type == JSONK_TOKEN_OBJECT_START;
+        value = jsonk_value_create_tracked(is_object ? JSONK_VALUE_OBJECT : JSONK_VALUE_ARRAY, parser);
+        if (!value)
+            return -ENOMEM;
+        ret = jsonk_stream_attach(parser, value);
+        if (ret < 0)
+            return ret;
+        stream->open[stream->depth++] = value;
+        stream->state = is_object ? JSONK_STREAM_KEY_OR_END : JSONK_STREAM_VALUE_OR_END;
+        return 0;
+    }
+    
+    value = jsonk_token_value(parser, token);
+    if (!value)
+        return -EINVAL;
+    ret = jsonk_stream_attach(parser, value);
+    if (ret < 0)
+        return ret;
+    stream->state = stream->depth ? JSONK_STREAM_NEXT : JSONK_STREAM_DONE;
+    return 0;
+    
+close:
+    stream->depth--;
+    stream->state = stream->depth ? JSONK_STREAM_NEXT : JSONK_STREAM_DONE;
+    return 0;
+}
+
+/**
+ * Find where a string starting at the current position ends
+ * @return Offset just past the closing quote, or 0 if the buffer ends first
+ */
+static size_t jsonk_stream_string_end(struct jsonk_parser *parser)
+{
+    size_t pos = parser->pos + 1;
+    
+    while (pos < parser->buffer_len) {
+        pos = jsonk_scan_string(parser->buffer, pos, parser->buffer_len);
+        if (pos >= parser->buffer_len)
+            break;
+        if (parser->buffer[pos] == '"')
+            return pos + 1;
+        /* Skip the escaped byte; control bytes are left to the tokenizer */
+        pos += parser->buffer[pos] == '\\' ? 2 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Tokenize the current buffer
+ * @param final No more input follows, so no token can be incomplete
+ * 
+ * A token running into the end of a non-final buffer is moved to the
+ * carry buffer instead.
+ */
+static int jsonk_stream_tokens(struct jsonk_parser *parser, bool final)
+{
+    struct jsonk_stream *stream = parser->stream;
+    struct jsonk_token token;
+    enum jsonk_carry_kind kind;
+    size_t end;
+    char c;
+    int ret;
+    
+    while (stream->state != JSONK_STREAM_DONE) {
+        jsonk_skip_whitespace(parser);
+        if (parser->pos >= parser->buffer_len)
+            return 0;
+        
+        c = parser->buffer[parser->pos];
+        kind = JSONK_CARRY_NONE;
+        if (c == '"') {
+            if (!jsonk_stream_string_end(parser))
+                kind = JSONK_CARRY_STRING;
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            for (end = parser->pos; end < parser->buffer_len && jsonk_is_number_char(parser->buffer[end]); end++)
+                ;
+            if (end == parser->buffer_len)
+                kind = JSONK_CARRY_NUMBER;
+        } else if (jsonk_is_literal_char(c)) {
+            for (end = parser->pos; end < parser->buffer_len && jsonk_is_literal_char(parser->buffer[end]); end++)
+                ;
+            if (end == parser->buffer_len)
+                kind = JSONK_CARRY_LITERAL;
+        }
+        
+        if (kind != JSONK_CARRY_NONE && !final) {
+            stream->carry_kind = kind;
+            stream->carry_escape = false;
+            if (kind == JSONK_CARRY_STRING) {
+                /* A trailing backslash escapes the next chunk's first byte */
+                for (end = parser->buffer_len; end > parser->pos + 1 && parser->buffer[end - 1] == '\\'; end--)
+                    ;
+                stream->carry_escape = (parser->buffer_len - end) & 1;
+            }
+            ret = jsonk_stream_carry(parser, parser->buffer + parser->pos,
+                                     parser->buffer_len - parser->pos);
+            parser->pos = parser->buffer_len;
+            return ret;
+        }
+        
+        ret = jsonk_next_token(parser, &token);
+        if (ret < 0)
+            return -EINVAL;
+        ret = jsonk_stream_token(parser, &token);
+        if (ret < 0)
+            return ret;
+    }
+    
+    return 0;
+}
+
+/**
+ * Tokenize the carry buffer once its token is complete
+ */
+static int jsonk_stream_flush_carry(struct jsonk_parser *parser)
+{
+    struct jsonk_stream *stream = parser->stream;
+    const char *buffer = parser->buffer;
+    size_t buffer_len = parser->buffer_len;
+    size_t pos = parser->pos;
+    int ret;
+    
+    parser->buffer = stream->carry;
+    parser->buffer_len = stream->carry_len;
+    parser->pos = 0;
+    ret = jsonk_stream_tokens(parser, true);
+    
+    parser->buffer = buffer;
+    parser->buffer_len = buffer_len;
+    parser->pos = pos;
+    stream->carry_kind = JSONK_CARRY_NONE;
+    stream->carry_len = 0;
+    return ret;
+}
+
+/**
+ * Extend the carried token from the start of a new chunk
+ * @return 1 if the token is now complete, 0 if it needs more input
+ */
+static int jsonk_stream_continue_carry(struct jsonk_parser *parser, const char *chunk, size_t len,
+                                       size_t *used)
+{
+    struct jsonk_stream *stream = parser->stream;
+    bool complete = false;
+    size_t i = 0;
+    int ret;
+    
+    if (stream->carry_kind == JSONK_CARRY_STRING) {
+        while (i < len) {
+            if (stream->carry_escape) {
+                stream->carry_escape = false;
+                i++;
+                continue;
+            }
+            i = jsonk_scan_string(chunk, i, len);
+            if (i >= len)
+                break;
+            if (chunk[i++] == '"') {
+                complete = true;
+                break;
+            }
+            stream->carry_escape = chunk[i - 1] == '\\';
+        }
+    } else {
+        bool (*is_token_char)(char) = stream->carry_kind == JSONK_CARRY_NUMBER ?
+                                      jsonk_is_number_char : jsonk_is_literal_char;
+        
+        while (i < len && is_token_char(chunk[i]))
+            i++;
+        complete = i < len;
+    }
+    
+    ret = jsonk_stream_carry(parser, chunk, i);
+    if (ret < 0)
+        return ret;
+    *used = i;
+    return complete;
+}
+
+/**
+ * Start an incremental parse
+ */
+int jsonk_parser_start(struct jsonk_parser *parser, unsigned int flags)
+{
+    struct jsonk_parse_opts opts = { .flags = flags };
+    
+    return jsonk_parser_start_ex(parser, &opts);
+}
+
+/**
+ * Start an incremental parse with per-parse options
+ */
+int jsonk_parser_start_ex(struct jsonk_parser *parser, const struct jsonk_parse_opts *opts)
+{
+    struct jsonk_stream *stream;
+    unsigned int max_depth;
+    
+    if (!parser)
+        return -EINVAL;
+    
+    jsonk_parser_init(parser, NULL, 0);
+    if (jsonk_parser_set_limits(parser, opts) < 0 ||
+        (parser->flags & (JSONK_PARSE_BORROW | JSONK_PARSE_POOL)))
+        return -EINVAL;
+    
+    /* The container stack is sized for the deepest document allowed */
+    max_depth = jsonk_parser_max_depth(parser);
+    stream = jsonk_counted(jsonk_memory_alloc_gfp(struct_size(stream, open, max_depth), parser->gfp));
+    if (!stream)
+        return -ENOMEM;
+    memset(stream, 0, sizeof(*stream));
+    stream->max_depth = max_depth;
+    
+    if (parser->flags & JSONK_PARSE_ARENA) {
+        parser->arena = jsonk_arena_create(parser->gfp, false);
+        if (!parser->arena) {
+            jsonk_memory_free(stream, struct_size(stream, open, max_depth));
+            return -ENOMEM;
+        }
+    }
+    
+    parser->stream = stream;
+    trace_jsonk_parse_start(0, parser->flags);
+    return 0;
+}
+
+/**
+ * Feed the next chunk of the document
+ */
+int jsonk_parser_feed(struct jsonk_parser *parser, const char *chunk, size_t len)
+{
+    struct jsonk_stream *stream;
+    size_t used = 0;
+    int ret;
+    
+    if (!parser || !parser->stream || (!chunk && len))
+        return -EINVAL;
+    
+    stream = parser->stream;
+    if (stream->error)
+        return stream->error;
+    stream->fed += len;
+    
+    if (stream->carry_kind != JSONK_CARRY_NONE) {
+        ret = jsonk_stream_continue_carry(parser, chunk, len, &used);
+        if (ret > 0)
+            ret = jsonk_stream_flush_carry(parser);
+        if (ret < 0 || stream->carry_kind != JSONK_CARRY_NONE)
+            goto out;
+    }
+    
+    parser->buffer = chunk;
+    parser->buffer_len = len;
+    parser->pos = used;
+    ret = jsonk_stream_tokens(parser, false);
+    
+    /* The chunk belongs to the caller again */
+    parser->buffer = NULL;
+    parser->buffer_len = 0;
+    parser->pos = 0;
+    
+out:
+    if (ret < 0)
+        stream->error = ret;
+    return ret < 0 ? ret : 0;
+}
+
+static void jsonk_stream_release(struct jsonk_parser *parser)
+{
+    struct jsonk_stream *stream = parser->stream;
+    
+    if (stream->carry)
+        jsonk_memory_free(stream->carry, stream->carry_cap);
+    jsonk_memory_free(stream, struct_size(stream, open, stream->max_depth));
+    parser->stream = NULL;
+}
+
+/**
+ * Abandon an incremental parse and free everything built so far
+ */
+void jsonk_parser_abort(struct jsonk_parser *parser)
+{
+    if (!parser || !parser->stream)
+        return;
+    
+    jsonk_parse_end(parser, parser->stream->fed, false, 0);
+    if (parser->stream->root)
+        jsonk_value_discard(parser->stream->root, parser);
+    if (parser->arena)
+        jsonk_arena_destroy(parser->arena);
+    parser->arena = NULL;
+    jsonk_stream_release(parser);
+}
+
+/**
+ * Complete an incremental parse
+ */
+struct jsonk_value *jsonk_parser_finish(struct jsonk_parser *parser)
+{
+    struct jsonk_stream *stream;
+    struct jsonk_value *root;
+    int ret = 0;
+    
+    if (!parser || !parser->stream)
+        return NULL;
+    
+    stream = parser->stream;
+    if (!stream->error && stream->carry_kind != JSONK_CARRY_NONE) {
+        /* Numbers and literals may end with the input, strings may not */
+        if (stream->carry_kind == JSONK_CARRY_STRING)
+            ret = -EINVAL;
+        else
+            ret = jsonk_stream_flush_carry(parser);
+    }
+    
+    if (stream->error || ret < 0 || stream->state != JSONK_STREAM_DONE) {
+        jsonk_parser_abort(parser);
+        return NULL;
+    }
+    
+    root = stream->root;
+    jsonk_parse_end(parser, stream->fed, true, 0);
+    jsonk_stream_release(parser);
+    return root;
+}
+
+/**
+ * Parse a JSON string into an in-memory structure
+ */
+struct jsonk_value *jsonk_parse(const char *json_str, size_t json_len)
+{
+    return jsonk_parse_flags(json_str, json_len, 0);
+}
+
+/**
+ * Parse a JSON string into an arena-backed in-memory structure
+ */
+struct jsonk_value *jsonk_parse_arena(const char *json_str, size_t json_len)
+{
+    return jsonk_parse_flags(json_str, json_len, JSONK_PARSE_ARENA);
+}
+
+/**
+ * Parse a JSON string from the per-CPU chunk pools, without sleeping
+ */
+struct jsonk_value *jsonk_parse_atomic(const char *json_str, size_t json_len)
+{
+    return jsonk_parse_flags(json_str, json_len, JSONK_PARSE_POOL);
+}
+
+/**
+ * Parse a JSON string with JSONK_PARSE_* flags
+ */
+struct jsonk_value *jsonk_parse_flags(const char *json_str, size_t json_len, unsigned int flags)
+{
+    struct jsonk_parse_opts opts = { .flags = flags };
+    
+    return jsonk_parse_ex(json_str, json_len, &opts);
+}
+
+/**
+ * Parse a JSON string with per-parse limits and allocation flags
+ */
+struct jsonk_value *jsonk_parse_ex(const char *json_str, size_t json_len,
+                                   const struct jsonk_parse_opts *opts)
+{
+    struct jsonk_value *value = NULL;
+    struct jsonk_parser parser;
+    u64 start;
+    
+    if (!json_str || json_len == 0)
+        return NULL;
+    
+    jsonk_parser_init(&parser, json_str, json_len);
+    if (jsonk_parser_set_limits(&parser, opts) < 0)
+        return NULL;
+    start = jsonk_parse_begin(&parser);
+    if (parser.flags & JSONK_PARSE_ARENA) {
+        parser.arena = jsonk_arena_create(parser.gfp, parser.flags & JSONK_PARSE_POOL);
+        if (!parser.arena)
+            goto out;
+    }
+    
+    value = jsonk_parse_document(&parser);
+    jsonk_parser_release(&parser);
+    if (!value && parser.arena)
+        jsonk_arena_destroy(parser.arena);
+    
+out:
+    jsonk_parse_end(&parser, json_len, value != NULL, start);
+    return value;
+}
+
+/* ========================================================================
+ * Batch Parsing
+ * ======================================================================== */
+
+/*
+ * Documents are claimed one at a time from a shared counter, so a worker
+ * that draws short documents simply takes more of them. The caller takes
+ * its share like any worker and then waits for the rest.
+ */
+struct jsonk_batch {
+    const char *const *bufs;
+    const size_t *lens;
+    struct jsonk_value **out;
+    size_t n;
+    const struct jsonk_parse_opts *opts;
+    atomic_long_t next;                 /* First unclaimed document */
+    atomic_t parsed;
+};
+
+struct jsonk_batch_worker {
+    struct work_struct work;
+    struct jsonk_batch *batch;
+};
+
+static void jsonk_batch_run(struct jsonk_batch *batch)
+{
+    struct jsonk_value *value;
+    int parsed = 0;
+    size_t i;
+    
+    while ((i = atomic_long_inc_return(&batch->next) - 1) < batch->n) {
+        value = jsonk_parse_ex(batch->bufs[i], batch->lens[i], batch->opts);
+        batch->out[i] = value;
+        if (value)
+            parsed++;
+    }
+    atomic_add(parsed, &batch->parsed);
+}
+
+static void jsonk_batch_work(struct work_struct *work)
+{
+    jsonk_batch_run(container_of(work, struct jsonk_batch_worker, work)->batch);
+}
+
+/**
+ * Parse independent documents in parallel on the unbound workqueue
+ */
+int jsonk_parse_batch(const char *const bufs[], const size_t lens[], size_t n,
+                      struct jsonk_value *out[], const struct jsonk_parse_opts *opts)
+{
+    struct jsonk_batch_worker *workers = NULL;
+    struct jsonk_parse_opts doc_opts = { };
+    struct jsonk_batch batch;
+    size_t total = 0, i;
+    unsigned int nr, w;
+    
+    if (!bufs || !lens || !out || n > INT_MAX)
+        return -EINVAL;
+    if (opts && (opts->flags & JSONK_PARSE_POOL))
+        return -EINVAL;
+    
+    might_sleep();
+    
+    for (i = 0; i < n; i++)
+        total += lens[i];
+    
+    nr = num_online_cpus();
+    if (opts && opts->max_workers)
+        nr = min(nr, opts->max_workers);
+    nr = min3((size_t)nr, n, total / JSONK_BATCH_WORKER_BYTES);
+    
+    batch.bufs = bufs;
+    batch.lens = lens;
+    batch.out = out;
+    batch.n = n;
+    /* The batch is already spread out, each document is parsed serially */
+    if (opts)
+        doc_opts = *opts;
+    doc_opts.flags &= ~JSONK_PARSE_PARALLEL;
+    batch.opts = &doc_opts;
+    atomic_long_set(&batch.next, 0);
+    atomic_set(&batch.parsed, 0);
+    
+    /* Without the workers the caller simply parses everything itself */
+    if (nr > 1)
+        workers = jsonk_counted(kmalloc_array(nr - 1, sizeof(*workers), GFP_KERNEL));
+    if (!workers)
+        nr = 1;
+    
+    for (w = 0; w + 1 < nr; w++) {
+        workers[w].batch = &batch;
+        INIT_WORK(&workers[w].work, jsonk_batch_work);
+        queue_work(system_unbound_wq, &workers[w].work);
+    }
+    
+    jsonk_batch_run(&batch);
+    
+    for (w = 0; w + 1 < nr; w++)
+        flush_work(&workers[w].work);
+    kfree(workers);
+    
+    return atomic_read(&batch.parsed);
+}
+
+/* ========================================================================
+ * Serialization Implementation
+ * ======================================================================== */
+
+/*
+ * Escape written for each byte of string output: 0 for bytes copied as
+ * is, else the character after the backslash, with 'u' for \u00XX. The
+ * string scanner stops on exactly the bytes with an entry.
+ */
+static const char jsonk_escape_table[256] = {
+    [0x00 ... 0x1f] = 'u',
+    ['\b'] = 'b',
+    ['\t'] = 't',
+    ['\n'] = 'n',
+    ['\f'] = 'f',
+    ['\r'] = 'r',
+    ['"'] = '"',
+    ['\\'] = '\\',
+};
+
+/* Length of the escape for a byte that needs one */
+static inline size_t jsonk_escape_len(unsigned char c)
+{
+    return jsonk_escape_table[c] == 'u' ? 6 : 2;
+}
+
+/* Write the escape for a byte that needs one, return its length */
+static inline size_t jsonk_escape_write(char *out, unsigned char c)
+{
+    out[0] = '\\';
+    out[1] = jsonk_escape_table[c];
+    if (out[1] != 'u')
+        return 2;
+    out[2] = '0';
+    out[3] = '0';
+    out[4] = hex_asc_hi(c);
+    out[5] = hex_asc_lo(c);
+    return 6;
+}
+
+/*
+ * Containers are walked with an explicit frame stack. Frames beyond the
+ * inline ones are allocated without sleeping, so this stays usable under
+ * rcu_read_lock().
+ */
+static int jsonk_serialize_buffer(struct jsonk_value *value, char *buffer, size_t buffer_size,
+                                  size_t *written)
+{
+    struct jsonk_walk_frame inline_frames[JSONK_NEST_INLINE];
+    struct jsonk_walk_frame *frames = inline_frames, *frame;
+    struct jsonk_member *member;
+    size_t cap = ARRAY_SIZE(inline_frames), depth = 0;
+    size_t pos = 0;
+    size_t i;
+    bool first;
+    int ret = -EOVERFLOW;
+    
+    if (!value || !buffer || !written)
+        return -EINVAL;
+    
+    *written = 0;
+    
+    while (true) {
+        switch (value->type) {
+        case JSONK_VALUE_NULL:
+            if (pos + 4 >= buffer_size)
+                goto out;
+            memcpy(buffer + pos, "null", 4);
+            pos += 4;
+            break;
+            
+        case JSONK_VALUE_BOOLEAN:
+            if (value->u.boolean) {
+                if (pos + 4 >= buffer_size)
+                    goto out;
+                memcpy(buffer + pos, "true", 4);
+                pos += 4;
+            } else {
+                if (pos + 5 >= buffer_size)
+                    goto out;
+                memcpy(buffer + pos, "false", 5);
+                pos += 5;
+            }
+            break;
+            
+        case JSONK_VALUE_NUMBER: {
+            char digits[JSONK_NUMBER_BUF];
+            const char *text;
+            size_t len;
+            
+            /* Decimals are written back exactly as they were parsed */
+            if (value->u.number.kind == JSONK_NUMBER_DECIMAL) {
+                text = value->u.number.lexeme;
+                len = value->u.number.len;
+            } else {
+                text = jsonk_number_format(value, digits, &len);
+            }
+            if (pos + len >= buffer_size)
+                goto out;
+            memcpy(buffer + pos, text, len);
+            pos += len;
+            break;
+        }
+            
+        case JSONK_VALUE_STRING: {
+            const char *data = value->u.string.data;
+            size_t len = value->u.string.len;
+            size_t stop;
+            
+            if (pos + 1 >= buffer_size)
+                goto out;
+            buffer[pos++] = '"';
+            
+            /* Copy runs up to the next byte needing an escape in one go */
+            for (i = 0; ; i = stop + 1) {
+                stop = jsonk_scan_string(data, i, len);
+                if (pos + stop - i >= buffer_size)
+                    goto out;
+                memcpy(buffer + pos, data + i, stop - i);
+                pos += stop - i;
+                if (stop == len)
+                    break;
+                
+                if (pos + jsonk_escape_len(data[stop]) >= buffer_size)
+                    goto out;
+                pos += jsonk_escape_write(buffer + pos, data[stop]);
+            }
+            
+            if (pos + 1 >= buffer_size)
+                goto out;
+            buffer[pos++] = '"';
+            break;
+        }
+            
+        case JSONK_VALUE_OBJECT:
+        case JSONK_VALUE_ARRAY:
+            if (pos + 1 >= buffer_size)
+                goto out;
+            buffer[pos++] = value->type == JSONK_VALUE_OBJECT ? '{' : '[';
+            if (depth == cap) {
+                frames = jsonk_nest_grow(frames, inline_frames, &cap, sizeof(*frames), GFP_NOWAIT);
+                if (!frames) {
+                    ret = -ENOMEM;
+                    goto out;
+                }
+            }
+            jsonk_walk_frame_init(&frames[depth++], value);
+            break;
+        }
+        
+        /* Move on to the next value, closing the containers that are done */
+        while (true) {
+            if (!depth) {
+                ret = 0;
+                goto out;
+            }
+            frame = &frames[depth - 1];
+            if (jsonk_walk_child(frame, &value, &member))
+                break;
+            if (pos + 1 >= buffer_size)
+                goto out;
+            buffer[pos++] = frame->value->type == JSONK_VALUE_OBJECT ? '}' : ']';
+            depth--;
+        }
+        
+        first = member ? list_is_first(&member->list, &frame->value->u.object.members) :
+                         frame->index == 1;
+        if (!first) {
+            if (pos + 1 >= buffer_size)
+                goto out;
+            buffer[pos++] = ',';
+        }
+        
+        if (member) {
+            /* Write key */
+            if (pos + member->key_len + 3 >= buffer_size)
+                goto out;
+            buffer[pos++] = '"';
+            memcpy(buffer + pos, member->key, member->key_len);
+            pos += member->key_len;
+            buffer[pos++] = '"';
+            buffer[pos++] = ':';
+        }
+        
+        if (!value) {
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+    
+out:
+    jsonk_nest_release(frames, inline_frames);
+    if (!ret)
+        *written = pos;
+    return ret;
+}
+
+/**
+ * Serialize a JSON value structure to a string
+ */
+int jsonk_serialize(struct jsonk_value *value, char *buffer, size_t buffer_size, size_t *written)
+{
+    u64 start = jsonk_serialize_begin(value);
+    int ret = jsonk_serialize_buffer(value, buffer, buffer_size, written);
+    
+    jsonk_serialize_end(ret, ret < 0 ? 0 : *written, start);
+    return ret;
+}
+
+/**
+ * Length of a string body once escaped by jsonk_serialize()
+ */
+static size_t jsonk_escaped_len(const char *str, size_t len)
+{
+    size_t i, escaped = len;
+    
+    /* The string scanner stops on exactly the bytes that need escaping */
+    for (i = jsonk_scan_string(str, 0, len); i < len; i = jsonk_scan_string(str, i + 1, len))
+        escaped += jsonk_escape_len(str[i]) - 1;
+    return escaped;
+}
+
+/**
+ * Compute the length jsonk_serialize() will produce for a value
+ */
+size_t jsonk_serialized_size(struct jsonk_value *value)
+{
+    struct jsonk_walk_frame inline_frames[JSONK_NEST_INLINE], *frames = inline_frames;
+    char digits[JSONK_NUMBER_BUF];
+    struct jsonk_member *member = NULL;
+    size_t cap = ARRAY_SIZE(inline_frames), depth = 0;
+    size_t size = 0, len;
+    
+    if (!value)
+        return 0;
+    
+    do {
+        /* Quotes and a colon around each key */
+        if (member)
+            size += member->key_len + 3;
+        if (!value)
+            continue;
+        
+        switch (value->type) {
+        case JSONK_VALUE_NULL:
+            size += 4;
+            break;
+            
+        case JSONK_VALUE_BOOLEAN:
+            size += value->u.boolean ? 4 : 5;
+            break;
+            
+        case JSONK_VALUE_NUMBER:
+            if (value->u.number.kind == JSONK_NUMBER_DECIMAL) {
+                size += value->u.number.len;
+            } else {
+                jsonk_number_format(value, digits, &len);
+                size += len;
+            }
+            break;
+            
+        case JSONK_VALUE_STRING:
+            size += jsonk_escaped_len(value->u.string.data, value->u.string.len) + 2;
+            break;
+            
+        case JSONK_VALUE_OBJECT:
+        case JSONK_VALUE_ARRAY:
+            /* Brackets and separating commas */
+            len = value->type == JSONK_VALUE_OBJECT ? value->u.object.size : value->u.array.size;
+            size += 2 + (len ? len - 1 : 0);
+            if (depth == cap) {
+                frames = jsonk_nest_grow(frames, inline_frames, &cap, sizeof(*frames), GFP_NOWAIT);
+                if (!frames)
+                    return 0;
+            }
+            jsonk_walk_frame_init(&frames[depth++], value);
+            break;
+        }
+    } while (jsonk_walk_next(frames, &depth, &value, &member));
+    
+    jsonk_nest_release(frames, inline_frames);
+    return size;
+}
+
+/**
+ * Serialize a JSON value into a buffer allocated to fit
+ */
+char *jsonk_serialize_alloc(struct jsonk_value *value, size_t *len)
+{
+    size_t size, written;
+    char *buffer;
+    
+    if (!value || !len)
+        return NULL;
+    
+    size = jsonk_serialized_size(value);
+    buffer = jsonk_counted(jsonk_memory_alloc(size + 1));
+    if (!buffer)
+        return NULL;
+    
+    if (jsonk_serialize(value, buffer, size + 1, &written) < 0) {
+        jsonk_memory_free(buffer, size + 1);
+        return NULL;
+    }
+    
+    buffer[written] = '\0';
+    *len = written;
+    return buffer;
+}
+
+/* ========================================================================
+ * Streaming Serialization
+ * ======================================================================== */
+
+static inline int jsonk_writer_piece(struct jsonk_writer *writer, const char *piece, size_t len)
+{
+    writer->piece = piece;
+    writer->piece_len = len;
+    return 1;
+}
+
+/* Frames of the writer, on the heap once the tree was deeper than frames[] */
+static inline struct jsonk_writer_frame *jsonk_writer_frames(struct jsonk_writer *writer)
+{
+    return writer->heap_frames ?: writer->frames;
+}
+
+/* Make sure there is a free frame */
+static int jsonk_writer_reserve(struct jsonk_writer *writer)
+{
+    struct jsonk_writer_frame *frames;
+    size_t cap;
+    
+    if (!writer->heap_frames) {
+        if (writer->depth < ARRAY_SIZE(writer->frames))
+            return 0;
+        frames = writer->frames;
+        cap = ARRAY_SIZE(writer->frames);
+    } else {
+        if (writer->depth < writer->heap_cap)
+            return 0;
+        frames = writer->heap_frames;
+        cap = writer->heap_cap;
+    }
+    
+    /* On failure the old frames are gone too, the writer is done for */
+    writer->heap_frames = jsonk_nest_grow(frames, writer->frames, &cap, sizeof(*frames), GFP_NOWAIT);
+    writer->heap_cap = cap;
+    return writer->heap_frames ? 0 : -ENOMEM;
+}
+
+/* Emit the opening piece of a value, entering it if it is a container */
+static int jsonk_writer_open(struct jsonk_writer *writer, struct jsonk_value *value)
+{
+    struct jsonk_writer_frame *frame;
+    size_t len;
+    
+    /* The caller has already moved past value, so failures are sticky */
+    if (!value) {
+        writer->error = -EINVAL;
+        jsonk_writer_release(writer);
+        return -EINVAL;
+    }
+    
+    switch (value->type) {
+    case JSONK_VALUE_NULL:
+        return jsonk_writer_piece(writer, "null", 4);
+        
+    case JSONK_VALUE_BOOLEAN:
+        return value->u.boolean ? jsonk_writer_piece(writer, "true", 4) :
+                                  jsonk_writer_piece(writer, "false", 5);
+        
+    case JSONK_VALUE_NUMBER:
+        if (value->u.number.kind == JSONK_NUMBER_DECIMAL)
+            return jsonk_writer_piece(writer, value->u.number.lexeme, value->u.number.len);
+        writer->piece = jsonk_number_format(value, writer->digits, &len);
+        writer->piece_len = len;
+        return 1;
+        
+    case JSONK_VALUE_STRING:
+        writer->str = value->u.string.data;
+        writer->str_len = value->u.string.len;
+        writer->str_pos = 0;
+        return jsonk_writer_piece(writer, "\"", 1);
+        
+    case JSONK_VALUE_OBJECT:
+    case JSONK_VALUE_ARRAY:
+        if (jsonk_writer_reserve(writer) < 0) {
+            writer->error = -ENOMEM;
+            jsonk_writer_release(writer);
+            return -ENOMEM;
+        }
+        frame = &jsonk_writer_frames(writer)[writer->depth++];
+        frame->value = value;
+        frame->index = 0;
+        frame->phase = 0;
+        if (value->type == JSONK_VALUE_ARRAY)
+            return jsonk_writer_piece(writer, "[", 1);
+        frame->member = list_first_entry_or_null(&value->u.object.members, struct jsonk_member, list);
+        return jsonk_writer_piece(writer, "{", 1);
+    }
+    
+    return -EINVAL;
+}
+
+/* Advance to the next piece: 1 if there is one, 0 at the end, or an error */
+static int jsonk_writer_next(struct jsonk_writer *writer)
+{
+    struct jsonk_writer_frame *frame;
+    struct jsonk_member *member;
+    struct jsonk_array *arr;
+    size_t stop;
+    
+    if (writer->error)
+        return writer->error;
+    
+    if (!writer->started) {
+        writer->started = true;
+        return jsonk_writer_open(writer, writer->root);
+    }
+    
+    /* Inside a string: runs of plain bytes, single escapes, then the quote */
+    if (writer->str) {
+        if (writer->str_pos == writer->str_len) {
+            writer->str = NULL;
+            return jsonk_writer_piece(writer, "\"", 1);
+        }
+        stop = jsonk_scan_string(writer->str, writer->str_pos, writer->str_len);
+        if (stop == writer->str_pos) {
+            jsonk_writer_piece(writer, writer->digits,
+                               jsonk_escape_write(writer->digits, writer->str[stop]));
+            stop++;
+        } else {
+            jsonk_writer_piece(writer, writer->str + writer->str_pos, stop - writer->str_pos);
+        }
+        writer->str_pos = stop;
+        return 1;
+    }
+    
+    if (!writer->depth) {
+        jsonk_writer_release(writer);
+        return 0;
+    }
+    frame = &jsonk_writer_frames(writer)[writer->depth - 1];
+    
+    if (frame->value->type == JSONK_VALUE_OBJECT) {
+        member = frame->member;
+        if (!member) {
+            writer->depth--;
+            return jsonk_writer_piece(writer, "}", 1);
+        }
+        
+        switch (frame->phase++) {
+        case 0:
+            if (list_is_first(&member->list, &frame->value->u.object.members))
+                return jsonk_writer_piece(writer, "\"", 1);
+            return jsonk_writer_piece(writer, ",\"", 2);
+        case 1:
+            return jsonk_writer_piece(writer, member->key, member->key_len);
+        case 2:
+            return jsonk_writer_piece(writer, "\":", 2);
+        default:
+            frame->phase = 0;
+            frame->member = list_is_last(&member->list, &frame->value->u.object.members) ?
+                            NULL : list_next_entry(member, list);
+            return jsonk_writer_open(writer, member->value);
+        }
+    }
+    
+    arr = &frame->value->u.array;
+    if (frame->index == arr->size) {
+        writer->depth--;
+        return jsonk_writer_piece(writer, "]", 1);
+    }
+    if (frame->index && !frame->phase) {
+        frame->phase = 1;
+        return jsonk_writer_piece(writer, ",", 1);
+    }
+    frame->phase = 0;
+    return jsonk_writer_open(writer, arr->items[frame->index++]);
+}
+
+/**
+ * Start writing a value
+ */
+void jsonk_writer_init(struct jsonk_writer *writer, struct jsonk_value *value)
+{
+    writer->root = value;
+    writer->piece = NULL;
+    writer->piece_len = 0;
+    writer->str = NULL;
+    writer->depth = 0;
+    writer->started = false;
+    writer->error = 0;
+    writer->heap_frames = NULL;
+    writer->heap_cap = 0;
+}
+
+/**
+ * Free the frames a writer took for a very deep tree
+ */
+void jsonk_writer_release(struct jsonk_writer *writer)
+{
+    kfree(writer->heap_frames);
+    writer->heap_frames = NULL;
+    writer->heap_cap = 0;
+}
+
+/**
+ * Copy the next part of the serialized text into a buffer
+ */
+ssize_t jsonk_writer_read(struct jsonk_writer *writer, char *buf, size_t len)
+{
+    size_t n, copied = 0;
+    int ret;
+    
+    while (copied < len) {
+        if (!writer->piece_len) {
+            ret = jsonk_writer_next(writer);
+            if (ret < 0)
+                return copied ? copied : ret;
+            if (!ret)
+                break;
+            continue;
+        }
+        
+        n = min(len - copied, writer->piece_len);
+        memcpy(buf + copied, writer->piece, n);
+        writer->piece += n;
+        writer->piece_len -= n;
+        copied += n;
+    }
+    
+    return copied;
+}
+
+/**
+ * Copy the next part of the serialized text into an iov_iter
+ */
+ssize_t jsonk_writer_read_iter(struct jsonk_writer *writer, struct iov_iter *to)
+{
+    size_t n, copied = 0;
+    int ret;
+    
+    while (iov_iter_count(to)) {
+        if (!writer->piece_len) {
+            ret = jsonk_writer_next(writer);
+            if (ret < 0)
+                return copied ? copied : ret;
+            if (!ret)
+                break;
+            continue;
+        }
+        
+        n = copy_to_iter(writer->piece, writer->piece_len, to);
+        writer->piece += n;
+        writer->piece_len -= n;
+        copied += n;
+        if (!n)
+            return copied ? copied : -EFAULT;
+    }
+    
+    return copied;
+}
+
+/**
+ * Serialize a JSON value through a callback
+ */
+int jsonk_serialize_to(struct jsonk_value *value,
+                       int (*write)(void *ctx, const char *data, size_t len), void *ctx)
+{
+    struct jsonk_writer writer;
+    size_t total = 0;
+    u64 start;
+    int ret;
+    
+    if (!value || !write)
+        return -EINVAL;
+    
+    start = jsonk_serialize_begin(value);
+    jsonk_writer_init(&writer, value);
+    while ((ret = jsonk_writer_next(&writer)) > 0) {
+        if (!writer.piece_len)
+            continue;
+        ret = write(ctx, writer.piece, writer.piece_len);
+        if (ret < 0)
+            break;
+        total += writer.piece_len;
+    }
+    
+    jsonk_writer_release(&writer);
+    jsonk_serialize_end(ret, total, start);
+    return ret;
+}
+
+static int jsonk_seq_write(void *ctx, const char *data, size_t len)
+{
+    return seq_write(ctx, data, len) ? -EOVERFLOW : 0;
+}
+
+/**
+ * Serialize a JSON value into a seq_file from its show() handler
+ */
+int jsonk_seq_serialize(struct seq_file *m, struct jsonk_value *value)
+{
+    int ret = jsonk_serialize_to(value, jsonk_seq_write, m);
+    
+    /* seq_file sees the overflow and calls show() again with more room */
+    return ret == -EOVERFLOW ? 0 : ret;
+}
+
+/* ========================================================================
+ * Deep Copy Implementation
+ * ======================================================================== */
+
+/**
+ * Copy a node without its children; containers are sized for them
+ * 
+ * String text is already unescaped, so it is copied as is.
+ */
+static struct jsonk_value *jsonk_value_copy_node(const struct jsonk_value *source)
+{
+    struct jsonk_value *copy;
+    size_t len;
+    char *data;
+    
+    switch (source->type) {
+    case JSONK_VALUE_NUMBER:
+        if (source->u.number.kind == JSONK_NUMBER_DECIMAL)
+            return jsonk_value_create_number_tracked(source->u.number.lexeme, source->u.number.len, NULL);
+        copy = jsonk_value_create(JSONK_VALUE_NUMBER);
+        if (copy)
+            copy->u.number = source->u.number;
+        return copy;
+        
+    case JSONK_VALUE_STRING:
+        len = source->u.string.len;
+        if (len <= JSONK_INLINE_STRING_MAX) {
+            copy = jsonk_value_alloc_tracked(JSONK_VALUE_STRING, sizeof(struct jsonk_value), NULL);
+            if (!copy)
+                return NULL;
+            copy->flags |= JSONK_VALUE_F_INLINE;
+            data = (char *)copy + JSONK_SCALAR_NODE_SIZE;
+        } else {
+            copy = jsonk_value_create(JSONK_VALUE_STRING);
+            if (!copy)
+                return NULL;
+            data = jsonk_counted(jsonk_memory_alloc(len + 1));
+            if (!data) {
+                jsonk_value_put(copy);
+                return NULL;
+            }
+        }
+        memcpy(data, source->u.string.data, len);
+        data[len] = '\0';
+        copy->u.string.data = data;
+        copy->u.string.len = len;
+        return copy;
+        
+    case JSONK_VALUE_OBJECT:
+        copy = jsonk_value_create(JSONK_VALUE_OBJECT);
+        if (copy && source->u.object.size >= JSONK_OBJECT_INDEX_THRESHOLD)
+            jsonk_object_index_build(&copy->u.object, roundup_pow_of_two(source->u.object.size), NULL);
+        return copy;
+        
+    case JSONK_VALUE_ARRAY:
+        copy = jsonk_value_create(JSONK_VALUE_ARRAY);
+        if (copy && source->u.array.size &&
+            jsonk_array_resize(&copy->u.array, source->u.array.size, NULL) < 0) {
+            jsonk_value_put(copy);
+            return NULL;
+        }
+        return copy;
+        
+    default:
+        copy = jsonk_value_create(source->type);
+        if (copy)
+            copy->u.boolean = source->u.boolean;
+        return copy;
+    }
+}
+
+/* A container being copied: where the walk of the source is, and the copy */
+struct jsonk_copy_frame {
+    struct jsonk_walk_frame source;
+    struct jsonk_value *copy;
+};
+
+/**
+ * Deep copy a JSON value
+ * 
+ * Each copy is attached to its parent as soon as it is made, so on
+ * failure dropping the root copy frees everything.
+ */
+struct jsonk_value *jsonk_value_deep_copy(struct jsonk_value *source, int current_depth)
+{
+    struct jsonk_copy_frame inline_frames[JSONK_NEST_INLINE];
+    struct jsonk_copy_frame *frames = inline_frames, *frame;
+    unsigned int max_depth = READ_ONCE(jsonk_max_depth);
+    struct jsonk_value *root = NULL, *copy;
+    struct jsonk_member *member = NULL;
+    size_t cap = ARRAY_SIZE(inline_frames);
+    size_t depth = 0;
+    
+    if (!source || current_depth < 0 || current_depth > max_depth)
+        return NULL;
+    
+    while (true) {
+        copy = jsonk_value_copy_node(source);
+        if (!copy)
+            goto error;
+        
+        if (!depth) {
+            root = copy;
+        } else if (member) {
+            if (jsonk_object_add_member_like(&frames[depth - 1].copy->u.object, member, copy) < 0) {
+                jsonk_value_put(copy);
+                goto error;
+            }
+        } else {
+            frame = &frames[depth - 1];
+            frame->copy->u.array.items[frame->copy->u.array.size++] = copy;
+        }
+        
+        if (source->type == JSONK_VALUE_OBJECT || source->type == JSONK_VALUE_ARRAY) {
+            if (depth == cap) {
+                frames = jsonk_nest_grow(frames, inline_frames, &cap, sizeof(*frames), GFP_KERNEL);
+                if (!frames)
+                    goto error;
+            }
+            frame = &frames[depth++];
+            jsonk_walk_frame_init(&frame->source, source);
+            frame->copy = copy;
+        }
+        
+        /* Next source value, leaving the containers that are done */
+        while (true) {
+            if (!depth)
+                goto out;
+            if (jsonk_walk_child(&frames[depth - 1].source, &source, &member))
+                break;
+            depth--;
+        }
+        
+        /* Values nested as deep as a parse allows */
+        if (!source || current_depth + depth > max_depth)
+            goto error;
+    }
+    
+error:
+    if (root)
+        jsonk_value_put(root);
+    root = NULL;
+out:
+    jsonk_nest_release(frames, inline_frames);
+    return root;
+}
+
+/**
+ * Check whether a node may be reachable from more than one tree
+ * 
+ * Arena nodes carry no count of their own and are always treated as shared.
+ */
+static inline bool jsonk_value_shared(struct jsonk_value *value)
+{
+    return (value->flags & JSONK_VALUE_F_ARENA) || atomic_read(&value->refcount) > 1;
+}
+
+/**
+ * Copy a container one level deep, sharing its children
+ */
+static struct jsonk_value *jsonk_value_shallow_copy(struct jsonk_value *source)
+{
+    struct jsonk_value *copy;
+    struct jsonk_member *member;
+    size_t i;
+    
+    copy = jsonk_value_create(source->type);
+    if (!copy)
+        return NULL;
+    
+    if (source->type == JSONK_VALUE_OBJECT) {
+        list_for_each_entry(member, &source->u.object.members, list) {
+            jsonk_value_get(member->value);
+            if (jsonk_object_add_member_like(&copy->u.object, member, member->value) < 0) {
+                jsonk_value_put(member->value);
+                goto fail;
+            }
+        }
+    } else if (source->type == JSONK_VALUE_ARRAY && source->u.array.size) {
+        if (jsonk_array_resize(&copy->u.array, source->u.array.size, NULL) < 0)
+            goto fail;
+        for (i = 0; i < source->u.array.size; i++)
+            copy->u.array.items[i] = jsonk_value_get(source->u.array.items[i]);
+        copy->u.array.size = source->u.array.size;
+    }
+    
+    return copy;
+    
+fail:
+    jsonk_value_put(copy);
+    return NULL;
+}
+
+/* ========================================================================
+ * JSON Patch Implementation
+ * ======================================================================== */
+
+/* One step of a JSON path: an object key or an array index */
+struct jsonk_path_component {
+    const char *key;
+    size_t key_len;
+    size_t index;
+    u32 hash;               /* Key hash, valid if hashed */
+    bool hashed;
+    bool is_index;
+};
+
+/* A path split ahead of time by jsonk_path_compile() */
+struct jsonk_path {
+    size_t count;
+    struct jsonk_path_component comps[];
+};
+
+/* Source of path components: a path string, or a compiled path */
+struct jsonk_path_iter {
+    const char *pos;
+    const char *end;
+    const struct jsonk_path *compiled;
+    size_t next;
+    bool cow;               /* Copy shared containers before descending into them */
+};
+
+/**
+ * Split the next component off a path
+ * 
+ * Keys are separated by '.', array indexes are written as "[n]" and may
+ * follow a key directly ("items[3]") or another index ("grid[1][2]").
+ * 
+ * @param path In/out: current path position, advanced past the component
+ * @param end End of the path
+ * @param comp Output component
+ * @return 1 if a component was produced, 0 at the end, -EINVAL on bad syntax
+ */
+static int jsonk_parse_path_component(const char **path, const char *end,
+                                      struct jsonk_path_component *comp)
+{
+    const char *p = *path;
+    
+    if (p >= end)
+        return 0;
+    
+    if (*p == '[') {
+        size_t index = 0;
+        
+        p++;
+        if (p >= end || *p < '0' || *p > '9')
+            return -EINVAL;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (index > (SIZE_MAX - 9) / 10)
+                return -EINVAL;
+            index = index * 10 + (*p - '0');
+            p++;
+        }
+        if (p >= end || *p != ']')
+            return -EINVAL;
+        p++;
+        
+        comp->is_index = true;
+        comp->index = index;
+        comp->key = NULL;
+        comp->key_len = 0;
+        comp->hashed = false;
+    } else {
+        const char *start = p;
+        
+        while (p < end && *p != '.' && *p != '[')
+            p++;
+        if (p == start)
+            return -EINVAL;
+        
+        comp->is_index = false;
+        comp->key = start;
+        comp->key_len = p - start;
+        comp->hashed = false;
+    }
+    
+    /* A dot separates components; it may not end the path */
+    if (p < end && *p == '.') {
+        p++;
+        if (p >= end || *p == '[')
+            return -EINVAL;
+    }
+    
+    *path = p;
+    return 1;
+}
+
+static int jsonk_path_next(struct jsonk_path_iter *iter, struct jsonk_path_component *comp)
+{
+    if (iter->compiled) {
+        if (iter->next == iter->compiled->count)
+            return 0;
+        *comp = iter->compiled->comps[iter->next++];
+        return 1;
+    }
+    return jsonk_parse_path_component(&iter->pos, iter->end, comp);
+}
+
+/**
+ * Find the member named by a key component, using its hash if precomputed
+ */
+static struct jsonk_member *jsonk_path_find_member(struct jsonk_object *obj,
+                                                   const struct jsonk_path_component *comp)
+{
+    if (obj->index && comp->hashed)
+        return jsonk_object_index_find(obj, comp->key, comp->key_len, comp->hash);
+    return jsonk_object_find_member(obj, comp->key, comp->key_len);
+}
+
+/**
+ * Look up one path component in a container
+ */
+static struct jsonk_value *jsonk_path_step(struct jsonk_value *curr, const struct jsonk_path_component *comp)
+{
+    struct jsonk_member *member;
+    
+    if (comp->is_index) {
+        if (curr->type != JSONK_VALUE_ARRAY)
+            return NULL;
+        return jsonk_array_get(&curr->u.array, comp->index);
+    }
+    
+    if (curr->type != JSONK_VALUE_OBJECT)
+        return NULL;
+    member = jsonk_path_find_member(&curr->u.object, comp);
+    return member ? member->value : NULL;
+}
+
+static struct jsonk_value *jsonk_path_iter_get(struct jsonk_value *root, struct jsonk_path_iter *iter)
+{
+    struct jsonk_value *curr = root;
+    struct jsonk_path_component comp;
+    int ret;
+    
+    while ((ret = jsonk_path_next(iter, &comp)) > 0) {
+        curr = jsonk_path_step(curr, &comp);
+        if (!curr)
+            return NULL;
+    }
+    
+    return ret < 0 ? NULL : curr;
+}
+
+/**
+ * Get a value from a JSON structure using a path
+ */
+struct jsonk_value *jsonk_get_value_by_path(struct jsonk_value *root, const char *path, size_t path_len)
+{
+    struct jsonk_path_iter iter = { .pos = path, .end = path + path_len };
+    
+    if (!root || !path || path_len == 0)
+        return NULL;
+    
+    return jsonk_path_iter_get(root, &iter);
+}
+
+/* ========================================================================
+ * Raw Buffer Lookup
+ * ======================================================================== */
+
+/* 0x80 in every byte of w that opens or closes a container or a string */
+static __always_inline unsigned long jsonk_word_skip_stops(unsigned long w)
+{
+    /*
+     * Each bracket pair differs only in bits 0x06; the fold also lets 'Y',
+     * '_', 'y' and DEL through, which the caller steps over.
+     */
+    unsigned long folded = w & JSONK_WORD_REPEAT(0xf9);
+    
+    return jsonk_word_zero_bytes(w ^ JSONK_WORD_REPEAT('"')) |
+           jsonk_word_zero_bytes(folded ^ JSONK_WORD_REPEAT('[' & 0xf9)) |
+           jsonk_word_zero_bytes(folded ^ JSONK_WORD_REPEAT('{' & 0xf9));
+}
+
+/**
+ * Skip the rest of a container whose opening bracket was just consumed
+ * 
+ * Only brackets and string boundaries are looked at, a word at a time;
+ * the contents of skipped containers are not validated.
+ */
+static int jsonk_raw_skip_container(struct jsonk_parser *parser)
+{
+    struct jsonk_token token;
+    size_t depth = 1;
+    unsigned long stops;
+    char c;
+    
+    while (parser->pos < parser->buffer_len) {
+        if (parser->pos + sizeof(unsigned long) <= parser->buffer_len) {
+            stops = jsonk_word_skip_stops(jsonk_word_load(parser->buffer + parser->pos));
+            if (!stops) {
+                parser->pos += sizeof(unsigned long);
+                continue;
+            }
+            parser->pos += jsonk_word_first(stops);
+        }
+        
+        c = parser->buffer[parser->pos];
+        switch (c) {
+        case '"':
+            if (jsonk_parse_string(parser, &token) < 0)
+                return -EINVAL;
+            continue;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            if (--depth == 0) {
+                parser->pos++;
+                return 0;
+            }
+            break;
+        }
+        parser->pos++;
+    }
+    
+    return -EINVAL;
+}
+
+/**
+ * Consume the next value, returning it as a token
+ * 
+ * Containers come back as JSONK_TOKEN_OBJECT_START/ARRAY_START tokens
+ * covering everything from the opening to the closing bracket.
+ */
+static int jsonk_raw_value(struct jsonk_parser *parser, struct jsonk_token *token)
+{
+    int ret;
+    
+    ret = jsonk_next_token(parser, token);
+    if (ret < 0)
+        return -EINVAL;
+    
+    switch (token->type) {
+    case JSONK_TOKEN_OBJECT_START:
+    case JSONK_TOKEN_ARRAY_START:
+        ret = jsonk_raw_skip_container(parser);
+        if (ret < 0)
+            return ret;
+        token->len = &parser->buffer[parser->pos] - token->start;
+        return 0;
+    case JSONK_TOKEN_STRING:
+    case JSONK_TOKEN_NUMBER:
+    case JSONK_TOKEN_TRUE:
+    case JSONK_TOKEN_FALSE:
+    case JSONK_TOKEN_NULL:
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+/**
+ * Position the parser at the value one path component below the container
+ * whose opening token is passed in
+ */
+static int jsonk_raw_step(struct jsonk_parser *parser, const struct jsonk_token *container,
+                          const struct jsonk_path_component *comp)
+{
+    struct jsonk_token token;
+    size_t i;
+    int ret;
+    
+    if (comp->is_index) {
+        if (container->type != JSONK_TOKEN_ARRAY_START)
+            return -ENOENT;
+        
+        jsonk_skip_whitespace(parser);
+        if (parser->pos < parser->buffer_len && parser->buffer[parser->pos] == ']')
+            return -ENOENT;
+        
+        for (i = 0; i < comp->index; i++) {
+            ret = jsonk_raw_value(parser, &token);
+            if (ret < 0)
+                return ret;
+            ret = jsonk_next_token(parser, &token);
+            if (ret < 0)
+                return -EINVAL;
+            if (token.type == JSONK_TOKEN_ARRAY_END)
+                return -ENOENT;
+            if (token.type != JSONK_TOKEN_COMMA)
+                return -EINVAL;
+        }
+        return 0;
+    }
+    
+    if (container->type != JSONK_TOKEN_OBJECT_START)
+        return -ENOENT;
+    
+    ret = jsonk_next_token(parser, &token);
+    if (ret < 0)
+        return -EINVAL;
+    if (token.type == JSONK_TOKEN_OBJECT_END)
+        return -ENOENT;
+    
+    while (true) {
+        /* Keys are compared verbatim, as in the tree lookup */
+        bool match;
+        
+        if (token.type != JSONK_TOKEN_STRING)
+            return -EINVAL;
+        match = token.len == comp->key_len && memcmp(token.start, comp->key, token.len) == 0;
+        
+        ret = jsonk_next_token(parser, &token);
+        if (ret < 0 || token.type != JSONK_TOKEN_COLON)
+            return -EINVAL;
+        if (match)
+            return 0;
+        
+        ret = jsonk_raw_value(parser, &token);
+        if (ret < 0)
+            return ret;
+        
+        ret = jsonk_next_token(parser, &token);
+        if (ret < 0)
+            return -EINVAL;
+        if (token.type == JSONK_TOKEN_OBJECT_END)
+            return -ENOENT;
+        if (token.type != JSONK_TOKEN_COMMA)
+            return -EINVAL;
+        
+        ret = jsonk_next_token(parser, &token);
+        if (ret < 0)
+            return -EINVAL;
+    }
+}
+
+/**
+ * Find the value at a path in an unparsed JSON buffer
+ */
+int jsonk_get_raw_by_path(const char *json_str, size_t json_len, const char *path, size_t path_len,
+                          struct jsonk_token *token)
+{
+    const char *end = path + path_len;
+    struct jsonk_path_component comp;
+    struct jsonk_parser parser;
+    struct jsonk_token container;
+    int ret;
+    
+    if (!json_str || json_len == 0 || !token || (!path && path_len))
+        return -EINVAL;
+    
+    jsonk_parser_init(&parser, json_str, json_len);
+    
+    while ((ret = jsonk_parse_path_component(&path, end, &comp)) > 0) {
+        /* Only containers on the path are opened */
+        ret = jsonk_next_token(&parser, &container);
+        if (ret < 0)
+            return -EINVAL;
+        ret = jsonk_raw_step(&parser, &container, &comp);
+        if (ret < 0)
+            return ret;
+    }
+    if (ret < 0)
+        return ret;
+    
+    return jsonk_raw_value(&parser, token);
+}
+
+/**
+ * Parse only the value at a path in an unparsed JSON buffer
+ */
+struct jsonk_value *jsonk_parse_by_path(const char *json_str, size_t json_len,
+                                        const char *path, size_t path_len)
+{
+    struct jsonk_token token;
+    
+    if (jsonk_get_raw_by_path(json_str, json_len, path, path_len, &token) < 0)
+        return NULL;
+    
+    /* Hand strings over with their quotes */
+    if (token.type == JSONK_TOKEN_STRING)
+        return jsonk_parse(token.start - 1, token.len + 2);
+    return jsonk_parse(token.start, token.len);
+}
+
+
+/**
+ * Store a value in a container at one path component
+ * 
+ * Takes over the reference on value, also on failure.
+ */
+static int jsonk_path_assign(struct jsonk_value *curr, const struct jsonk_path_component *comp,
+                             struct jsonk_value *value)
+{
+    struct jsonk_member *member;
+    int ret;
+    
+    if (comp->is_index) {
+        if (curr->type != JSONK_VALUE_ARRAY || comp->index > curr->u.array.size) {
+            ret = -EINVAL;
+        } else if (comp->index == curr->u.array.size) {
+            /* Index one past the end appends */
+            ret = jsonk_array_add_element_tracked(&curr->u.array, value, NULL);
+        } else {
+            ret = jsonk_array_replace_element(&curr->u.array, comp->index, value);
+        }
+    } else if (curr->type != JSONK_VALUE_OBJECT) {
+        ret = -EINVAL;
+    } else {
+        member = jsonk_path_find_member(&curr->u.object, comp);
+        if (member)
+            ret = jsonk_member_replace_value(&curr->u.object, member, value);
+        else
+            ret = jsonk_object_add_member_tracked(&curr->u.object, comp->key, comp->key_len, value, NULL);
+    }
+    
+    if (ret < 0)
+        jsonk_value_put(value);
+    return ret;
+}
+
+static int jsonk_path_iter_set(struct jsonk_value *root, struct jsonk_path_iter *iter, struct jsonk_value *value)
+{
+    struct jsonk_value *curr = root;
+    struct jsonk_path_component comp, next;
+    int ret;
+    
+    /* Root must be a container */
+    if (root->type != JSONK_VALUE_OBJECT && root->type != JSONK_VALUE_ARRAY)
+        return -EINVAL;
+    
+    ret = jsonk_path_next(iter, &comp);
+    if (ret <= 0)
+        return -EINVAL;
+    
+    while (true) {
+        ret = jsonk_path_next(iter, &next);
+        if (ret < 0)
+            return ret;
+        jsonk_value_changed(curr);
+        
+        if (ret == 0) {
+            /* Last component - set the value */
+            struct jsonk_value *value_copy = jsonk_value_deep_copy(value, 1);
+            if (!value_copy)
+                return -ENOMEM;
+            return jsonk_path_assign(curr, &comp, value_copy);
+        }
+        
+        /* Not the last component - ensure the intermediate container exists */
+        enum jsonk_value_type want = next.is_index ? JSONK_VALUE_ARRAY : JSONK_VALUE_OBJECT;
+        struct jsonk_value *child = jsonk_path_step(curr, &comp);
+        
+        if (!child || child->type != want) {
+            /* Create it, replacing any value of the wrong type */
+            child = jsonk_value_create(want);
+            if (!child)
+                return -ENOMEM;
+            ret = jsonk_path_assign(curr, &comp, child);
+            if (ret < 0)
+                return ret;
+        } else if (iter->cow && jsonk_value_shared(child)) {
+            /* Other versions keep the original */
+            child = jsonk_value_shallow_copy(child);
+            if (!child)
+                return -ENOMEM;
+            ret = jsonk_path_assign(curr, &comp, child);
+            if (ret < 0)
+                return ret;
+        }
+        
+        curr = child;
+        comp = next;
+    }
+}
+
+/**
+ * Set a value in a JSON structure using a path
+ */
+int jsonk_set_value_by_path(struct jsonk_value *root, const char *path, size_t path_len, struct jsonk_value *value)
+{
+    struct jsonk_path_iter iter = { .pos = path, .end = path + path_len };
+    
+    if (!root || !path || path_len == 0 || !value)
+        return -EINVAL;
+    
+    return jsonk_path_iter_set(root, &iter, value);
+}
+
+/*
+ * Undo log for in-place patching
+ * 
+ * Every change made to the target is recorded before it becomes visible.
+ * Removed members and replaced values are kept alive until the patch is
+ * committed, so rolling back only relinks pointers.
+ */
+enum jsonk_undo_op {
+    JSONK_UNDO_ADD,         /* Member was appended */
+    JSONK_UNDO_REMOVE,      /* Member was unlinked from after prev */
+    JSONK_UNDO_REPLACE,     /* Member's value was swapped for a new one */
+    JSONK_UNDO_INSERT,      /* Element was inserted at index */
+    JSONK_UNDO_DELETE,      /* Element old_value was taken out at index */
+    JSONK_UNDO_SET,         /* Element at index was swapped for a new one */
+    JSONK_UNDO_ROOT,        /* Whole document was swapped for a new one */
+};
+
+struct jsonk_undo_entry {
+    enum jsonk_undo_op op;
+    union {
+        struct jsonk_object *obj;
+        struct jsonk_array *arr;
+        struct jsonk_value **root;
+    };
+    union {
+        struct jsonk_member *member;
+        size_t index;
+    };
+    union {
+        struct list_head *prev;
+        struct jsonk_value *old_value;
+    };
+};
+
+struct jsonk_undo_log {
+    struct jsonk_undo_entry *entries;
+    size_t len;
+    size_t capacity;
+};
+
+/**
+ * Make room for one more entry, before the change it records is made
+ */
+static struct jsonk_undo_entry *jsonk_undo_reserve(struct jsonk_undo_log *log)
+{
+    struct jsonk_undo_entry *entries;
+    size_t capacity;
+    
+    if (log->len == log->capacity) {
+        capacity = log->capacity ? log->capacity * 2 : 16;
+        entries = jsonk_counted(krealloc_array(log->entries, capacity, sizeof(*entries), GFP_KERNEL));
+        if (!entries)
+            return NULL;
+        log->entries = entries;
+        log->capacity = capacity;
+    }
+    
+    return &log->entries[log->len];
+}
+
+/**
+ * Keep the changes, releasing what they displaced
+ */
+static void jsonk_undo_commit(struct jsonk_undo_log *log)
+{
+    struct jsonk_undo_entry *entry;
+    size_t i;
+    
+    for (i = 0; i < log->len; i++) {
+        entry = &log->entries[i];
+        switch (entry->op) {
+        case JSONK_UNDO_ADD:
+            break;
+        case JSONK_UNDO_REMOVE:
+            jsonk_member_release(entry->obj, entry->member);
+            break;
+        case JSONK_UNDO_REPLACE:
+            /* Arena documents keep the old value until teardown */
+            if (!jsonk_object_arena(entry->obj))
+                jsonk_value_put(entry->old_value);
+            break;
+        case JSONK_UNDO_INSERT:
+            break;
+        case JSONK_UNDO_DELETE:
+        case JSONK_UNDO_SET:
+            if (!jsonk_array_arena(entry->arr))
+                jsonk_value_put(entry->old_value);
+            break;
+        case JSONK_UNDO_ROOT:
+            /* The caller's reference on the old document */
+            jsonk_value_put(entry->old_value);
+            break;
+        }
+    }
+    
+    kfree(log->entries);
+}
+
+/**
+ * Revert the changes, newest first
+ */
+static void jsonk_undo_rollback(struct jsonk_undo_log *log)
+{
+    struct jsonk_undo_entry *entry;
+    struct jsonk_value *new_value;
+    struct jsonk_array *arr;
+    size_t i;
+    
+    for (i = log->len; i-- > 0; ) {
+        entry = &log->entries[i];
+        switch (entry->op) {
+        case JSONK_UNDO_ADD:
+            jsonk_object_unlink_member(entry->obj, entry->member);
+            jsonk_member_release(entry->obj, entry->member);
+            break;
+        case JSONK_UNDO_REMOVE:
+            list_add(&entry->member->list, entry->prev);
+            entry->obj->size++;
+            if (entry->obj->index) {
+                /* The index may have been built since the member was unlinked */
+                entry->member->hash = jsonk_key_hash(entry->member->key, entry->member->key_len);
+                jsonk_object_index_link(entry->obj, entry->member);
+            }
+            break;
+        case JSONK_UNDO_REPLACE:
+            new_value = entry->member->value;
+            entry->member->value = entry->old_value;
+            if (!jsonk_object_arena(entry->obj))
+                jsonk_value_put(new_value);
+            break;
+        case JSONK_UNDO_INSERT:
+            arr = entry->arr;
+            new_value = arr->items[entry->index];
+            arr->size--;
+            memmove(&arr->items[entry->index], &arr->items[entry->index + 1],
+                    (arr->size - entry->index) * sizeof(*arr->items));
+            if (!jsonk_array_arena(arr))
+                jsonk_value_put(new_value);
+            break;
+        case JSONK_UNDO_DELETE:
+            /* Capacity never shrinks, so there is room for it again */
+            arr = entry->arr;
+            memmove(&arr->items[entry->index + 1], &arr->items[entry->index],
+                    (arr->size - entry->index) * sizeof(*arr->items));
+            arr->items[entry->index] = entry->old_value;
+            arr->size++;
+            break;
+        case JSONK_UNDO_SET:
+            arr = entry->arr;
+            new_value = arr->items[entry->index];
+            arr->items[entry->index] = entry->old_value;
+            if (!jsonk_array_arena(arr))
+                jsonk_value_put(new_value);
+            break;
+        case JSONK_UNDO_ROOT:
+            new_value = *entry->root;
+            *entry->root = entry->old_value;
+            jsonk_value_put(new_value);
+            break;
+        }
+    }
+    
+    kfree(log->entries);
+}
+
+static int jsonk_merge_remove(struct jsonk_object *target, struct jsonk_member *member,
+                              struct jsonk_undo_log *log)
+{
+    struct jsonk_undo_entry *entry;
+    
+    if (!log) {
+        jsonk_object_unlink_member(target, member);
+        jsonk_member_release(target, member);
+        return 0;
+    }
+    
+    entry = jsonk_undo_reserve(log);
+    if (!entry)
+        return -ENOMEM;
+    entry->op = JSONK_UNDO_REMOVE;
+    entry->obj = target;
+    entry->member = member;
+    entry->prev = member->list.prev;
+    jsonk_object_unlink_member(target, member);
+    log->len++;
+    return 0;
+}
+
+/**
+ * Append a member, taking over the reference on value
+ * @param ikey Interned key to share, or NULL to store key
+ */
+static int jsonk_merge_add_key(struct jsonk_object *target, const char *key, size_t key_len,
+                               struct jsonk_key *ikey, struct jsonk_value *value,
+                               struct jsonk_undo_log *log)
+{
+    struct jsonk_undo_entry *entry = NULL;
+    int ret;
+    
+    if (log) {
+        entry = jsonk_undo_reserve(log);
+        if (!entry) {
+            jsonk_value_put(value);
+            return -ENOMEM;
+        }
+    }
+    
+    ret = jsonk_object_add_member_key(target, key, key_len, ikey, value, NULL);
+    if (ret < 0) {
+        jsonk_value_put(value);
+        return ret;
+    }
+    
+    if (entry) {
+        entry->op = JSONK_UNDO_ADD;
+        entry->obj = target;
+        entry->member = list_last_entry(&target->members, struct jsonk_member, list);
+        log->len++;
+    }
+    return 0;
+}
+
+/**
+ * Append a member under the key of a patch member, taking over the reference on value
+ */
+static inline int jsonk_merge_add(struct jsonk_object *target, const struct jsonk_member *source,
+                                  struct jsonk_value *value, struct jsonk_undo_log *log)
+{
+    return jsonk_merge_add_key(target, source->key, source->key_len,
+                               source->flags & JSONK_MEMBER_F_INTERNED ? jsonk_member_ikey(source) : NULL,
+                               value, log);
+}
+
+/**
+ * Replace the value of a member, taking over the reference on value
+ */
+static int jsonk_merge_replace(struct jsonk_object *target, struct jsonk_member *member,
+                               struct jsonk_value *value, struct jsonk_undo_log *log)
+{
+    struct jsonk_arena *arena = jsonk_object_arena(target);
+    struct jsonk_undo_entry *entry;
+    int ret;
+    
+    if (!log) {
+        ret = jsonk_member_replace_value(target, member, value);
+        if (ret < 0)
+            jsonk_value_put(value);
+        return ret;
+    }
+    
+    entry = jsonk_undo_reserve(log);
+    if (!entry) {
+        jsonk_value_put(value);
+        return -ENOMEM;
+    }
+    
+    if (arena) {
+        ret = jsonk_arena_adopt(arena, value);
+        if (ret < 0) {
+            jsonk_value_put(value);
+            return ret;
+        }
+    }
+    
+    entry->op = JSONK_UNDO_REPLACE;
+    entry->obj = target;
+    entry->member = member;
+    entry->old_value = member->value;
+    member->value = value;
+    jsonk_object_changed(target);
+    log->len++;
+    return 0;
+}
+
+#define JSONK_MERGE_COW 0x01        /* Copy shared objects before merging into them */
+#define JSONK_MERGE_RFC7386 0x02    /* Only null removes, objects merge into non-objects */
+
+/* A pair of objects being merged, and the next patch member to apply */
+struct jsonk_merge_frame {
+    struct jsonk_object *target;
+    struct jsonk_object *patch;
+    struct jsonk_member *member;
+};
+
+/* Note a change, which alters the hash of every object on the way to it */
+static void jsonk_merge_changed(struct jsonk_merge_frame *frames, size_t depth, bool *changed)
+{
+    *changed = true;
+    while (depth--)
+        jsonk_object_changed(frames[depth].target);
+}
+
+/**
+ * Merge two JSON objects (fail-fast for atomicity)
+ * 
+ * With an undo log every change is recorded so the caller can roll the
+ * whole merge back; without one, changes are final as they are made.
+ * With JSONK_MERGE_COW, shared objects are copied before being merged
+ * into. JSONK_MERGE_RFC7386 selects the standard rules over the
+ * jsonk_apply_patch() ones. Nested objects are merged through an
+ * explicit frame stack.
+ */
+static int jsonk_merge_objects(struct jsonk_object *target, struct jsonk_object *patch, bool *changed,
+                               struct jsonk_undo_log *log, unsigned int flags)
+{
+    struct jsonk_merge_frame inline_frames[JSONK_NEST_INLINE];
+    struct jsonk_merge_frame *frames = inline_frames, *frame;
+    struct jsonk_member *member;
+    size_t cap = ARRAY_SIZE(inline_frames);
+    size_t depth = 0;
+    int ret = 0;
+    
+    *changed = false;
+    
+    frame = &frames[depth++];
+    frame->target = target;
+    frame->patch = patch;
+    frame->member = list_first_entry(&patch->members, struct jsonk_member, list);
+    
+    while (depth) {
+        frame = &frames[depth - 1];
+        member = frame->member;
+        if (list_entry_is_head(member, &frame->patch->members, list)) {
+            depth--;
+            continue;
+        }
+        frame->member = list_next_entry(member, list);
+        target = frame->target;
+        
+        struct jsonk_member *target_member = jsonk_object_find_like(target, member);
+        
+        /* Check if patch value is empty (should remove the key) */
+        bool is_empty = false;
+        if (member->value->type == JSONK_VALUE_NULL) {
+            is_empty = true;
+        } else if (flags & JSONK_MERGE_RFC7386) {
+            /* Only null removes */
+        } else if (member->value->type == JSONK_VALUE_STRING && member->value->u.string.len == 0) {
+            is_empty = true;
+        } else if (member->value->type == JSONK_VALUE_OBJECT && member->value->u.object.size == 0) {
+            is_empty = true;
+        } else if (member->value->type == JSONK_VALUE_ARRAY && member->value->u.array.size == 0) {
+            is_empty = true;
+        }
+        
+        if (is_empty) {
+            /* Remove the key if it exists in target */
+            if (target_member) {
+                ret = jsonk_merge_remove(target, target_member, log);
+                if (ret < 0)
+                    goto out;
+                jsonk_merge_changed(frames, depth, changed);
+            }
+            continue;
+        }
+        
+        struct jsonk_object *nested = NULL;
+        
+        if (target_member && member->value->type == JSONK_VALUE_OBJECT &&
+            target_member->value->type == JSONK_VALUE_OBJECT) {
+            /* Nested merge for objects */
+            if ((flags & JSONK_MERGE_COW) && jsonk_value_shared(target_member->value)) {
+                struct jsonk_value *copy = jsonk_value_shallow_copy(target_member->value);
+                
+                if (!copy) {
+                    ret = -ENOMEM;
+                    goto out;
+                }
+                ret = jsonk_merge_replace(target, target_member, copy, NULL);
+                if (ret < 0)
+                    goto out;
+            }
+            nested = &target_member->value->u.object;
+        } else if ((flags & JSONK_MERGE_RFC7386) && member->value->type == JSONK_VALUE_OBJECT) {
+            /*
+             * RFC 7386 merges an object into anything else as into an empty
+             * object, so its nulls are dropped rather than copied.
+             */
+            struct jsonk_value *empty = jsonk_value_create(JSONK_VALUE_OBJECT);
+            
+            if (!empty) {
+                ret = -ENOMEM;
+                goto out;
+            }
+            if (target_member)
+                ret = jsonk_merge_replace(target, target_member, empty, log);
+            else
+                ret = jsonk_merge_add(target, member, empty, log);
+            if (ret < 0)
+                goto out;
+            jsonk_merge_changed(frames, depth, changed);
+            nested = &empty->u.object;
+        }
+        
+        if (nested) {
+            if (depth == cap) {
+                frames = jsonk_nest_grow(frames, inline_frames, &cap, sizeof(*frames), GFP_KERNEL);
+                if (!frames) {
+                    ret = -ENOMEM;
+                    goto out;
+                }
+            }
+            frame = &frames[depth++];
+            frame->target = nested;
+            frame->patch = &member->value->u.object;
+            frame->member = list_first_entry(&frame->patch->members, struct jsonk_member, list);
+            continue;
+        }
+        
+        /* New keys are added, other values replaced */
+        struct jsonk_value *value_copy = jsonk_value_deep_copy(member->value, 1);
+        if (!value_copy) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        
+        if (target_member)
+            ret = jsonk_merge_replace(target, target_member, value_copy, log);
+        else
+            ret = jsonk_merge_add(target, member, value_copy, log);
+        if (ret < 0)
+            goto out;
+        jsonk_merge_changed(frames, depth, changed);
+    }
+    
+out:
+    jsonk_nest_release(frames, inline_frames);
+    return ret;
+}
+
+/**
+ * Apply a patch to a target buffer, into result or into an allocation
+ */
+static int jsonk_apply_patch_buffers(const char *target, size_t target_len,
+                                     const char *patch, size_t patch_len,
+                                     char *result, size_t result_max_len,
+                                     char **alloc, size_t *result_len)
+{
+    struct jsonk_value *target_json = NULL;
+    struct jsonk_value *patch_json = NULL;
+    int ret = JSONK_PATCH_ERROR_PARSE;
+    bool changed;
+    
+    if (alloc)
+        *alloc = NULL;
+    
+    /* Parse target JSON */
+    target_json = jsonk_parse(target, target_len);
+    if (!target_json)
+        goto error;
+    
+    /* Validate target is an object */
+    if (target_json->type != JSONK_VALUE_OBJECT) {
+        ret = JSONK_PATCH_ERROR_TYPE;
+        goto error;
+    }
+    
+    /* Parse patch JSON */
+    patch_json = jsonk_parse(patch, patch_len);
+    if (!patch_json) {
+        /* If patch is invalid, return original JSON unchanged */
+        if (alloc) {
+            *alloc = jsonk_counted(jsonk_memory_alloc(target_len + 1));
+            if (*alloc) {
+                memcpy(*alloc, target, target_len);
+                (*alloc)[target_len] = '\0';
+                *result_len = target_len;
+                ret = JSONK_PATCH_NO_CHANGE;
+            } else {
+                ret = JSONK_PATCH_ERROR_MEMORY;
+            }
+        } else if (target_len <= result_max_len) {
+            memcpy(result, target, target_len);
+            *result_len = target_len;
+            ret = JSONK_PATCH_NO_CHANGE;
+        } else {
+            ret = JSONK_PATCH_ERROR_OVERFLOW;
+        }
+        goto error;
+    }
+    
+    /* Validate patch is an object */
+    if (patch_json->type != JSONK_VALUE_OBJECT) {
+        ret = JSONK_PATCH_ERROR_TYPE;
+        goto error;
+    }
+    
+    /*
+     * The tree is private to this call and the caller's buffers are not
+     * touched until the patched result is complete, so if the merge fails
+     * the tree can simply be thrown away.
+     */
+    ret = jsonk_merge_objects(&target_json->u.object, &patch_json->u.object, &changed, NULL, 0);
+    if (ret < 0) {
+        ret = JSONK_PATCH_ERROR_MEMORY;
+        goto error;
+    }
+    
+    /* Serialize result from the successfully patched tree */
+    if (alloc) {
+        *alloc = jsonk_serialize_alloc(target_json, result_len);
+        if (!*alloc) {
+            ret = JSONK_PATCH_ERROR_MEMORY;
+            goto error;
+        }
+    } else {
+        size_t written;
+        
+        ret = jsonk_serialize(target_json, result, result_max_len, &written);
+        if (ret < 0) {
+            if (ret == -EOVERFLOW)
+                ret = JSONK_PATCH_ERROR_OVERFLOW;
+            else
+                ret = JSONK_PATCH_ERROR_PARSE;
+            goto error;
+        }
+        *result_len = written;
+    }
+    
+    ret = changed ? JSONK_PATCH_SUCCESS : JSONK_PATCH_NO_CHANGE;
+    
+error:
+    if (target_json)
+        jsonk_value_put(target_json);
+    if (patch_json)
+        jsonk_value_put(patch_json);
+    
+    return ret;
+}
+
+/**
+ * Apply a JSON patch to a target buffer (truly atomic)
+ */
+int jsonk_apply_patch(const char *target, size_t target_len,
+                      const char *patch, size_t patch_len,
+                      char *result, size_t result_max_len, size_t *result_len)
+{
+    u64 start = jsonk_patch_begin(JSONK_PATCH_KIND_BUFFER);
+    
+    return jsonk_patch_end(JSONK_PATCH_KIND_BUFFER, start,
+                           jsonk_apply_patch_buffers(target, target_len, patch, patch_len,
+                                                     result, result_max_len, NULL, result_len));
+}
+
+/**
+ * Apply a JSON patch to a target buffer into a buffer allocated to fit
+ */
+int jsonk_apply_patch_alloc(const char *target, size_t target_len,
+                            const char *patch, size_t patch_len,
+                            char **result, size_t *result_len)
+{
+    u64 start = jsonk_patch_begin(JSONK_PATCH_KIND_BUFFER);
+    
+    return jsonk_patch_end(JSONK_PATCH_KIND_BUFFER, start,
+                           jsonk_apply_patch_buffers(target, target_len, patch, patch_len,
+                                                     NULL, 0, result, result_len));
+}
+
+static int jsonk_patch_tree(struct jsonk_value *target, struct jsonk_value *patch)
+{
+    struct jsonk_undo_log log = {};
+    bool changed;
+    int ret;
+    
+    if (!target || !patch || target->type != JSONK_VALUE_OBJECT || patch->type != JSONK_VALUE_OBJECT)
+        return JSONK_PATCH_ERROR_TYPE;
+    
+    ret = jsonk_merge_objects(&target->u.object, &patch->u.object, &changed, &log, 0);
+    if (ret < 0) {
+        jsonk_undo_rollback(&log);
+        return JSONK_PATCH_ERROR_MEMORY;
+    }
+    
+    jsonk_undo_commit(&log);
+    return changed ? JSONK_PATCH_SUCCESS : JSONK_PATCH_NO_CHANGE;
+}
+
+/**
+ * Apply a JSON patch to a parsed target in place (atomic)
+ */
+int jsonk_apply_patch_tree(struct jsonk_value *target, struct jsonk_value *patch)
+{
+    u64 start = jsonk_patch_begin(JSONK_PATCH_KIND_TREE);
+    
+    return jsonk_patch_end(JSONK_PATCH_KIND_TREE, start, jsonk_patch_tree(target, patch));
+}
+
+static int jsonk_merge_patch(struct jsonk_value **target, struct jsonk_value *patch)
+{
+    struct jsonk_undo_log log = {};
+    struct jsonk_value *root;
+    bool changed;
+    int ret;
+    
+    if (!target || !*target || !patch)
+        return JSONK_PATCH_ERROR_TYPE;
+    
+    /* Anything but an object replaces the document, as does an object merged into a non-object */
+    if (patch->type != JSONK_VALUE_OBJECT || (*target)->type != JSONK_VALUE_OBJECT) {
+        root = patch->type == JSONK_VALUE_OBJECT ? jsonk_value_create(JSONK_VALUE_OBJECT) :
+               jsonk_value_deep_copy(patch, 1);
+        if (!root)
+            return JSONK_PATCH_ERROR_MEMORY;
+        
+        /* The new root is private until it is returned, so nothing needs logging */
+        if (patch->type == JSONK_VALUE_OBJECT &&
+            jsonk_merge_objects(&root->u.object, &patch->u.object, &changed, NULL, JSONK_MERGE_RFC7386) < 0) {
+            jsonk_value_put(root);
+            return JSONK_PATCH_ERROR_MEMORY;
+        }
+        jsonk_value_put(*target);
+        *target = root;
+        return JSONK_PATCH_SUCCESS;
+    }
+    
+    ret = jsonk_merge_objects(&(*target)->u.object, &patch->u.object, &changed, &log, JSONK_MERGE_RFC7386);
+    if (ret < 0) {
+        jsonk_undo_rollback(&log);
+        return JSONK_PATCH_ERROR_MEMORY;
+    }
+    
+    jsonk_undo_commit(&log);
+    return changed ? JSONK_PATCH_SUCCESS : JSONK_PATCH_NO_CHANGE;
+}
+
+/**
+ * Apply an RFC 7386 merge patch in place (atomic)
+ */
+int jsonk_apply_merge_patch(struct jsonk_value **target, struct jsonk_value *patch)
+{
+    u64 start = jsonk_patch_begin(JSONK_PATCH_KIND_MERGE);
+    
+    return jsonk_patch_end(JSONK_PATCH_KIND_MERGE, start, jsonk_merge_patch(target, patch));
+}
+
+/* ========================================================================
+ * JSON Patch Operations
+ * ======================================================================== */
+
+/*
+ * RFC 6902 operations on a parsed tree, addressed by RFC 6901 JSON
+ * Pointers. Each operation resolves its pointers against the tree as the
+ * previous ones left it and records its changes in one undo log, so a
+ * whole list applies in a single pass and fails as a unit.
+ */
+
+/* Where a JSON Pointer leads: a member or element of parent, or the root */
+struct jsonk_pointer_loc {
+    struct jsonk_value *parent;     /* NULL for the whole document */
+    struct jsonk_member *member;    /* Existing member of an object parent */
+    const char *key;                /* Last token in stored key form, for objects */
+    size_t key_len;
+    size_t index;                   /* Element of an array parent, its size for "-" */
+    bool exists;
+    char buf[JSONK_MAX_KEY_LENGTH]; /* Key, if the token had to be rewritten */
+};
+
+/**
+ * Turn a reference token into the form keys are stored in
+ * 
+ * "~0" is '~' and "~1" is '/'. The result is key text as it appears in
+ * JSON, so quotes, backslashes and control bytes get the escapes
+ * jsonk_serialize() writes for them; keys spelled with other escapes in
+ * their document, such as "\u0041" for 'A', are not found.
+ * 
+ * @param buf Room for JSONK_MAX_KEY_LENGTH bytes, used only if the token has escapes
+ * @return 0, -ENOENT if the key is too long to exist, or -EINVAL on a bad escape
+ */
+static int jsonk_pointer_key(const char *token, size_t len, char *buf, const char **key, size_t *key_len)
+{
+    size_t i, n = 0;
+    unsigned char c;
+    
+    if (!memchr(token, '~', len) && jsonk_scan_string(token, 0, len) == len) {
+        if (len > JSONK_MAX_KEY_LENGTH)
+            return -ENOENT;
+        *key = token;
+        *key_len = len;
+        return 0;
+    }
+    
+    for (i = 0; i < len; i++) {
+        c = token[i];
+        if (c == '~') {
+            if (i + 1 == len || (token[i + 1] != '0' && token[i + 1] != '1'))
+                return -EINVAL;
+            c = token[++i] == '0' ? '~' : '/';
+        }
+        if (!jsonk_escape_table[c]) {
+            if (n == JSONK_MAX_KEY_LENGTH)
+                return -ENOENT;
+            buf[n++] = c;
+            continue;
+        }
+        if (n + jsonk_escape_len(c) > JSONK_MAX_KEY_LENGTH)
+            return -ENOENT;
+        n += jsonk_escape_write(buf + n, c);
+    }
+    *key = buf;
+    *key_len = n;
+    return 0;
+}
+
+/**
+ * Parse an array index token: digits without leading zeros, or "-" for the end
+ * @return 0, or -ENOENT if the token is no index of the array
+ */
+static int jsonk_pointer_index(const char *token, size_t len, const struct jsonk_array *arr, size_t *index)
+{
+    size_t i, n = 0;
+    
+    if (len == 1 && token[0] == '-') {
+        *index = arr->size;
+        return 0;
+    }
+    if (!len || len > 10 || (token[0] == '0' && len > 1))
+        return -ENOENT;
+    
+    for (i = 0; i < len; i++) {
+        if (token[i] < '0' || token[i] > '9')
+            return -ENOENT;
+        n = n * 10 + (token[i] - '0');
+    }
+    if (n > arr->size)
+        return -ENOENT;
+    *index = n;
+    return 0;
+}
+
+/**
+ * Find the child a reference token names within a container
+ */
+static int jsonk_pointer_step(struct jsonk_value *parent, const char *token, size_t len,
+                              struct jsonk_pointer_loc *loc)
+{
+    int ret;
+    
+    loc->parent = parent;
+    loc->member = NULL;
+    
+    if (parent->type == JSONK_VALUE_OBJECT) {
+        ret = jsonk_pointer_key(token, len, loc->buf, &loc->key, &loc->key_len);
+        if (ret < 0)
+            return ret;
+        loc->member = jsonk_object_find_member(&parent->u.object, loc->key, loc->key_len);
+        loc->exists = loc->member;
+        return 0;
+    }
+    
+    if (parent->type == JSONK_VALUE_ARRAY) {
+        ret = jsonk_pointer_index(token, len, &parent->u.array, &loc->index);
+        if (ret < 0)
+            return ret;
+        loc->exists = loc->index < parent->u.array.size;
+        return 0;
+    }
+    
+    return -ENOENT;
+}
+
+static struct jsonk_value *jsonk_pointer_loc_value(const struct jsonk_pointer_loc *loc,
+                                                   struct jsonk_value *root)
+{
+    if (!loc->parent)
+        return root;
+    if (!loc->exists)
+        return NULL;
+    if (loc->member)
+        return loc->member->value;
+    return loc->parent->u.array.items[loc->index];
+}
+
+/**
+ * Resolve a JSON Pointer down to its last token
+ * 
+ * Every token but the last must name an existing value; the last one may
+ * name a member or element that does not exist yet, for "add".
+ * 
+ * @param change Whether the location is about to change, which clears the
+ *               cached hashes of the containers above it
+ * @return 0, -ENOENT if the path does not lead anywhere, or -EINVAL on bad syntax
+ */
+static int jsonk_pointer_resolve(struct jsonk_value *root, const char *ptr, size_t len,
+                                 struct jsonk_pointer_loc *loc, bool change)
+{
+    const char *end = ptr + len, *token, *next;
+    struct jsonk_value *curr = root;
+    int ret;
+    
+    loc->parent = NULL;
+    loc->member = NULL;
+    loc->exists = true;
+    if (!len)
+        return 0;
+    if (*ptr != '/')
+        return -EINVAL;
+    
+    for (token = ptr + 1; ; token = next + 1) {
+        next = memchr(token, '/', end - token);
+        if (!next)
+            next = end;
+        if (!curr)
+            return -ENOENT;
+        ret = jsonk_pointer_step(curr, token, next - token, loc);
+        if (ret == 0 && change)
+            jsonk_value_changed(curr);
+        if (ret < 0)
+            return ret;
+        if (next == end)
+            return 0;
+        curr = jsonk_pointer_loc_value(loc, root);
+    }
+}
+
+/* State of a list of operations being applied */
+struct jsonk_patch_run {
+    struct jsonk_value **root;
+    struct jsonk_undo_log log;
+    bool changed;
+};
+
+/**
+ * Put a value at a location, taking over the reference on it
+ */
+static int jsonk_patch_insert(struct jsonk_patch_run *run, struct jsonk_pointer_loc *loc,
+                              struct jsonk_value *value, bool replace)
+{
+    struct jsonk_undo_entry *entry;
+    struct jsonk_arena *arena;
+    struct jsonk_array *arr;
+    int ret;
+    
+    if (loc->parent && loc->parent->type == JSONK_VALUE_OBJECT) {
+        if (loc->member)
+            return jsonk_merge_replace(&loc->parent->u.object, loc->member, value, &run->log);
+        return jsonk_merge_add_key(&loc->parent->u.object, loc->key, loc->key_len, NULL, value, &run->log);
+    }
+    
+    entry = jsonk_undo_reserve(&run->log);
+    if (!entry) {
+        ret = -ENOMEM;
+        goto err;
+    }
+    
+    if (!loc->parent) {
+        entry->op = JSONK_UNDO_ROOT;
+        entry->root = run->root;
+        entry->old_value = *run->root;
+        *run->root = value;
+        run->log.len++;
+        return 0;
+    }
+    
+    arr = &loc->parent->u.array;
+    arena = jsonk_array_arena(arr);
+    if (!replace && arr->size >= JSONK_MAX_ARRAY_SIZE) {
+        ret = -ENOSPC;
+        goto err;
+    }
+    if (!replace && arr->size == arr->capacity) {
+        ret = jsonk_array_resize(arr, arr->capacity ? arr->capacity * 2 : 4, NULL);
+        if (ret < 0)
+            goto err;
+    }
+    if (arena) {
+        ret = jsonk_arena_adopt(arena, value);
+        if (ret < 0)
+            goto err;
+    }
+    
+    entry->arr = arr;
+    entry->index = loc->index;
+    if (replace) {
+        entry->op = JSONK_UNDO_SET;
+        entry->old_value = arr->items[loc->index];
+    } else {
+        entry->op = JSONK_UNDO_INSERT;
+        memmove(&arr->items[loc->index + 1], &arr->items[loc->index],
+                (arr->size - loc->index) * sizeof(*arr->items));
+        arr->size++;
+    }
+    arr->items[loc->index] = value;
+    jsonk_array_changed(arr);
+    run->log.len++;
+    return 0;
+    
+err:
+    jsonk_value_put(value);
+    return ret;
+}
+
+/**
+ * Take the value at an existing location out of its parent
+ */
+static int jsonk_patch_remove(struct jsonk_patch_run *run, struct jsonk_pointer_loc *loc)
+{
+    struct jsonk_undo_entry *entry;
+    struct jsonk_array *arr;
+    
+    if (loc->parent->type == JSONK_VALUE_OBJECT)
+        return jsonk_merge_remove(&loc->parent->u.object, loc->member, &run->log);
+    
+    entry = jsonk_undo_reserve(&run->log);
+    if (!entry)
+        return -ENOMEM;
+    
+    arr = &loc->parent->u.array;
+    entry->op = JSONK_UNDO_DELETE;
+    entry->arr = arr;
+    entry->index = loc->index;
+    entry->old_value = arr->items[loc->index];
+    arr->size--;
+    memmove(&arr->items[loc->index], &arr->items[loc->index + 1],
+            (arr->size - loc->index) * sizeof(*arr->items));
+    jsonk_array_changed(arr);
+    run->log.len++;
+    return 0;
+}
+
+/* A pair of containers being compared, and the next child of the first */
+struct jsonk_equal_frame {
+    struct jsonk_walk_frame walk;
+    struct jsonk_value *other;
+};
+
+/*
+ * A number reduced to its value, 0.digits * 10^exp. The significant
+ * digits are a span of the lexeme without leading or trailing zeros,
+ * with possibly the decimal point inside; zero has none. exact is false
+ * for exponents too large to add up, which compare by text instead.
+ */
+struct jsonk_number_value {
+    const char *digits;
+    const char *end;
+    size_t count;
+    s64 exp;
+    bool negative;
+    bool exact;
+};
+
+/* Exponents past this are left as text; no lexeme can make up for them */
+#define JSONK_NUMBER_EXP_MAX (S64_MAX / 4)
+
+static void jsonk_decimal_value(const struct jsonk_value *value, struct jsonk_number_value *num)
+{
+    const char *p = value->u.number.lexeme, *end = p + value->u.number.len;
+    const char *last = NULL;
+    s64 int_digits = 0, skipped = 0, exp = 0;
+    bool point = false, negative_exp;
+    
+    num->negative = *p == '-';
+    p += num->negative;
+    num->digits = NULL;
+    num->count = 0;
+    num->exact = true;
+    
+    for (; p < end && *p != 'e' && *p != 'E'; p++) {
+        if (*p == '.') {
+            point = true;
+            continue;
+        }
+        if (!point)
+            int_digits++;
+        if (!num->digits && *p == '0') {
+            skipped++;
+            continue;
+        }
+        if (!num->digits)
+            num->digits = p;
+        if (*p != '0')
+            last = p;
+    }
+    
+    if (p < end) {
+        p++;
+        negative_exp = *p == '-';
+        p += *p == '-' || *p == '+';
+        for (; p < end; p++) {
+            if (exp > (JSONK_NUMBER_EXP_MAX - 9) / 10) {
+                num->exact = false;
+                break;
+            }
+            exp = exp * 10 + (*p - '0');
+        }
+        if (negative_exp)
+            exp = -exp;
+    }
+    
+    /* Zero is zero whatever its sign or exponent */
+    if (!last) {
+        num->exp = 0;
+        num->negative = false;
+        num->exact = true;
+        return;
+    }
+    
+    /* Trailing zeros are not significant */
+    num->end = last + 1;
+    num->count = 0;
+    for (p = num->digits; p < num->end; p++)
+        num->count += *p != '.';
+    num->exp = int_digits - skipped + exp;
+}
+
+/**
+ * Read a number as a sign and a 64-bit magnitude if it is an integer
+ * @return false for fractions and magnitudes above U64_MAX
+ */
+static bool jsonk_number_integral(const struct jsonk_value *value, const struct jsonk_number_value *num,
+                                  bool *negative, u64 *magnitude)
+{
+    const char *p;
+    u64 v = 0;
+    s64 i;
+    
+    if (value->u.number.kind == JSONK_NUMBER_INT) {
+        *negative = value->u.number.integer < 0;
+        *magnitude = *negative ? -(u64)value->u.number.integer : value->u.number.integer;
+        return true;
+    }
+    if (value->u.number.kind == JSONK_NUMBER_UINT) {
+        *negative = false;
+        *magnitude = value->u.number.uinteger;
+        return true;
+    }
+    
+    if (!num->exact || num->exp < (s64)num->count || num->exp > 20)
+        return false;
+    for (p = num->digits; p < num->end; p++) {
+        if (*p != '.' && (check_mul_overflow(v, 10ULL, &v) || check_add_overflow(v, (u64)(*p - '0'), &v)))
+            return false;
+    }
+    for (i = num->count; i < num->exp; i++) {
+        if (check_mul_overflow(v, 10ULL, &v))
+            return false;
+    }
+    *negative = num->negative;
+    *magnitude = v;
+    return true;
+}
+
+/* Same significant digits, wherever each one has its decimal point */
+static bool jsonk_digits_equal(const struct jsonk_number_value *a, const struct jsonk_number_value *b)
+{
+    const char *p = a->digits, *q = b->digits;
+    
+    while (p < a->end && q < b->end) {
+        p += *p == '.';
+        q += *q == '.';
+        if (*p++ != *q++)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Numbers are equal when their values are, as RFC 6902 "test" wants
+ * them: 1, 1.0 and 1e0 are one number, and so are 0 and -0.
+ */
+static bool jsonk_number_equal(const struct jsonk_value *a, const struct jsonk_value *b)
+{
+    struct jsonk_number_value a_num = {}, b_num = {};
+    bool a_negative, b_negative, a_int, b_int;
+    u64 a_mag, b_mag;
+    
+    if (a->u.number.kind != JSONK_NUMBER_DECIMAL && b->u.number.kind != JSONK_NUMBER_DECIMAL)
+        return a->u.number.kind == b->u.number.kind && a->u.number.uinteger == b->u.number.uinteger;
+    
+    if (a->u.number.kind == JSONK_NUMBER_DECIMAL)
+        jsonk_decimal_value(a, &a_num);
+    if (b->u.number.kind == JSONK_NUMBER_DECIMAL)
+        jsonk_decimal_value(b, &b_num);
+    
+    a_int = jsonk_number_integral(a, &a_num, &a_negative, &a_mag);
+    b_int = jsonk_number_integral(b, &b_num, &b_negative, &b_mag);
+    if (a_int || b_int)
+        return a_int && b_int && a_negative == b_negative && a_mag == b_mag;
+    
+    if (!a_num.exact || !b_num.exact)
+        return a->u.number.len == b->u.number.len &&
+               memcmp(a->u.number.lexeme, b->u.number.lexeme, a->u.number.len) == 0;
+    return a_num.negative == b_num.negative && a_num.exp == b_num.exp &&
+           a_num.count == b_num.count && jsonk_digits_equal(&a_num, &b_num);
+}
+
+static bool jsonk_scalar_equal(const struct jsonk_value *a, const struct jsonk_value *b)
+{
+    switch (a->type) {
+    case JSONK_VALUE_BOOLEAN:
+        return a->u.boolean == b->u.boolean;
+    case JSONK_VALUE_STRING:
+        return a->u.string.len == b->u.string.len &&
+               memcmp(a->u.string.data, b->u.string.data, a->u.string.len) == 0;
+    case JSONK_VALUE_NUMBER:
+        return jsonk_number_equal(a, b);
+    default:
+        return true;
+    }
+}
+
+/**
+ * Compare two trees as RFC 6902 "test" does: members in any order
+ */
+int jsonk_value_equal(struct jsonk_value *a, struct jsonk_value *b)
+{
+    struct jsonk_equal_frame inline_frames[JSONK_NEST_INLINE];
+    struct jsonk_equal_frame *frames = inline_frames, *frame;
+    size_t cap = ARRAY_SIZE(inline_frames), depth = 0;
+    struct jsonk_member *member, *other;
+    u64 a_hash, b_hash;
+    int ret = 0;
+    
+    while (true) {
+        if (!a || !b || a->type != b->type)
+            goto out;
+        
+        if (a == b) {
+            /* A shared subtree is equal to itself */
+        } else if (a->type == JSONK_VALUE_OBJECT || a->type == JSONK_VALUE_ARRAY) {
+            if (a->type == JSONK_VALUE_OBJECT ? a->u.object.size != b->u.object.size :
+                a->u.array.size != b->u.array.size)
+                goto out;
+            a_hash = READ_ONCE(a->hash);
+            b_hash = READ_ONCE(b->hash);
+            if (a_hash && b_hash && a_hash != b_hash)
+                goto out;
+            if (depth == cap) {
+                frames = jsonk_nest_grow(frames, inline_frames, &cap, sizeof(*frames), GFP_KERNEL);
+                if (!frames)
+                    return -ENOMEM;
+            }
+            frame = &frames[depth++];
+            jsonk_walk_frame_init(&frame->walk, a);
+            frame->other = b;
+        } else if (!jsonk_scalar_equal(a, b)) {
+            goto out;
+        }
+        
+        /* Pair up the next children, leaving the containers that are done */
+        while (true) {
+            if (!depth) {
+                ret = 1;
+                goto out;
+            }
+            frame = &frames[depth - 1];
+            if (jsonk_walk_child(&frame->walk, &a, &member))
+                break;
+            depth--;
+        }
+        
+        if (member) {
+            other = jsonk_object_find_member(&frame->other->u.object, member->key, member->key_len);
+            b = other ? other->value : NULL;
+        } else {
+            b = frame->other->u.array.items[frame->walk.index - 1];
+        }
+    }
+    
+out:
+    jsonk_nest_release(frames, inline_frames);
+    return ret;
+}
+
+/**
+ * Check whether pointer b lies strictly inside pointer a
+ */
+static bool jsonk_pointer_inside(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    return b_len > a_len && b[a_len] == '/' && memcmp(a, b, a_len) == 0;
+}
+
+/**
+ * Apply one operation, as a jsonk_patch_result
+ */
+static int jsonk_patch_op_apply(struct jsonk_patch_run *run, const struct jsonk_patch_op *op)
+{
+    struct jsonk_pointer_loc loc, from;
+    struct jsonk_value *value;
+    int ret;
     
-    /* Parse optional exponent */
-    if (parser->pos < parser->buffer_len && 
-        (parser->buffer[parser->pos] == 'e' || parser->buffer[parser->pos] == 'E')) {
-        parser->pos++; /* Skip 'e' or 'E' */
+    ret = jsonk_pointer_resolve(*run->root, op->path, op->path_len, &loc, op->op != JSONK_PATCH_OP_TEST);
+    if (ret < 0)
+        return ret == -EINVAL ? JSONK_PATCH_ERROR_TYPE : JSONK_PATCH_ERROR_PATH;
+    
+    /* Only the inserting operations may name a location that is not there yet */
+    if (!loc.exists && (op->op == JSONK_PATCH_OP_REMOVE || op->op == JSONK_PATCH_OP_REPLACE ||
+                        op->op == JSONK_PATCH_OP_TEST))
+        return JSONK_PATCH_ERROR_PATH;
+    
+    switch (op->op) {
+    case JSONK_PATCH_OP_TEST:
+        if (!op->value)
+            return JSONK_PATCH_ERROR_TYPE;
+        ret = jsonk_value_equal(jsonk_pointer_loc_value(&loc, *run->root), op->value);
+        if (ret < 0)
+            return JSONK_PATCH_ERROR_MEMORY;
+        return ret ? JSONK_PATCH_SUCCESS : JSONK_PATCH_ERROR_TEST;
         
-        /* Parse optional exponent sign */
-        if (parser->pos < parser->buffer_len && 
-            (parser->buffer[parser->pos] == '+' || parser->buffer[parser->pos] == '-')) {
-            parser->pos++;
+    case JSONK_PATCH_OP_REMOVE:
+        if (!loc.parent)
+            return JSONK_PATCH_ERROR_PATH;
+        ret = jsonk_patch_remove(run, &loc);
+        break;
+        
+    case JSONK_PATCH_OP_ADD:
+    case JSONK_PATCH_OP_REPLACE:
+        if (!op->value)
+            return JSONK_PATCH_ERROR_TYPE;
+        value = jsonk_value_deep_copy(op->value, 1);
+        if (!value)
+            return JSONK_PATCH_ERROR_MEMORY;
+        ret = jsonk_patch_insert(run, &loc, value, op->op == JSONK_PATCH_OP_REPLACE);
+        break;
+        
+    case JSONK_PATCH_OP_MOVE:
+    case JSONK_PATCH_OP_COPY:
+        if (!op->from)
+            return JSONK_PATCH_ERROR_TYPE;
+        ret = jsonk_pointer_resolve(*run->root, op->from, op->from_len, &from, op->op == JSONK_PATCH_OP_MOVE);
+        if (ret < 0)
+            return ret == -EINVAL ? JSONK_PATCH_ERROR_TYPE : JSONK_PATCH_ERROR_PATH;
+        value = jsonk_pointer_loc_value(&from, *run->root);
+        if (!value)
+            return JSONK_PATCH_ERROR_PATH;
+        
+        if (op->op == JSONK_PATCH_OP_COPY) {
+            value = jsonk_value_deep_copy(value, 1);
+            if (!value)
+                return JSONK_PATCH_ERROR_MEMORY;
+            ret = jsonk_patch_insert(run, &loc, value, false);
+            break;
         }
         
-        /* Must have at least one digit in exponent */
-        if (parser->pos >= parser->buffer_len || 
-            parser->buffer[parser->pos] < '0' || 
-            parser->buffer[parser->pos] > '9') {
-            return -EINVAL;
+        /* A value cannot move into itself; moving it onto itself changes nothing */
+        if (jsonk_pointer_inside(op->from, op->from_len, op->path, op->path_len))
+            return JSONK_PATCH_ERROR_PATH;
+        if (op->from_len == op->path_len && memcmp(op->from, op->path, op->path_len) == 0)
+            return JSONK_PATCH_SUCCESS;
+        
+        /* The taken out value stays alive in the log; the new place gets its own reference */
+        ret = jsonk_patch_remove(run, &from);
+        if (ret < 0)
+            break;
+        ret = jsonk_pointer_resolve(*run->root, op->path, op->path_len, &loc, true);
+        if (ret < 0)
+            return JSONK_PATCH_ERROR_PATH;
+        ret = jsonk_patch_insert(run, &loc, jsonk_value_get(value), false);
+        break;
+        
+    default:
+        return JSONK_PATCH_ERROR_TYPE;
+    }
+    
+    /* Other failures are keys or arrays the target cannot take */
+    if (ret < 0)
+        return ret == -ENOMEM ? JSONK_PATCH_ERROR_MEMORY : JSONK_PATCH_ERROR_PATH;
+    run->changed = true;
+    return JSONK_PATCH_SUCCESS;
+}
+
+/**
+ * Keep or revert everything a run did, by its result
+ */
+static int jsonk_patch_run_finish(struct jsonk_patch_run *run, int ret)
+{
+    if (ret != JSONK_PATCH_SUCCESS) {
+        jsonk_undo_rollback(&run->log);
+        return ret;
+    }
+    
+    jsonk_undo_commit(&run->log);
+    return run->changed ? JSONK_PATCH_SUCCESS : JSONK_PATCH_NO_CHANGE;
+}
+
+/**
+ * Apply a list of RFC 6902 operations in place (atomic)
+ */
+int jsonk_apply_json_patch_ops(struct jsonk_value **target, const struct jsonk_patch_op *ops, size_t count)
+{
+    u64 start = jsonk_patch_begin(JSONK_PATCH_KIND_JSON);
+    struct jsonk_patch_run run = { .root = target };
+    int ret = JSONK_PATCH_SUCCESS;
+    size_t i;
+    
+    if (!target || !*target || (!ops && count))
+        return jsonk_patch_end(JSONK_PATCH_KIND_JSON, start, JSONK_PATCH_ERROR_TYPE);
+    
+    for (i = 0; i < count && ret == JSONK_PATCH_SUCCESS; i++)
+        ret = jsonk_patch_op_apply(&run, &ops[i]);
+    
+    return jsonk_patch_end(JSONK_PATCH_KIND_JSON, start, jsonk_patch_run_finish(&run, ret));
+}
+
+/**
+ * Read the string member of an operation object
+ * @return 0, or -ENOENT if it is missing or not a string
+ */
+static int jsonk_patch_op_string(struct jsonk_value *op, const char *name, const char **str, size_t *len)
+{
+    struct jsonk_member *member = jsonk_object_find_member(&op->u.object, name, strlen(name));
+    
+    if (!member || member->value->type != JSONK_VALUE_STRING)
+        return -ENOENT;
+    *str = member->value->u.string.data;
+    *len = member->value->u.string.len;
+    return 0;
+}
+
+static const char *const jsonk_patch_op_names[] = {
+    [JSONK_PATCH_OP_ADD] = "add",
+    [JSONK_PATCH_OP_REMOVE] = "remove",
+    [JSONK_PATCH_OP_REPLACE] = "replace",
+    [JSONK_PATCH_OP_MOVE] = "move",
+    [JSONK_PATCH_OP_COPY] = "copy",
+    [JSONK_PATCH_OP_TEST] = "test",
+};
+
+/**
+ * Read an operation object of an RFC 6902 patch document
+ */
+static int jsonk_patch_op_decode(struct jsonk_value *value, struct jsonk_patch_op *op)
+{
+    struct jsonk_member *member;
+    const char *name;
+    unsigned int i;
+    size_t len;
+    
+    if (value->type != JSONK_VALUE_OBJECT || jsonk_patch_op_string(value, "op", &name, &len) < 0 ||
+        jsonk_patch_op_string(value, "path", &op->path, &op->path_len) < 0)
+        return -EINVAL;
+    
+    for (i = 0; i < ARRAY_SIZE(jsonk_patch_op_names); i++) {
+        if (strlen(jsonk_patch_op_names[i]) == len && memcmp(jsonk_patch_op_names[i], name, len) == 0)
+            break;
+    }
+    if (i == ARRAY_SIZE(jsonk_patch_op_names))
+        return -EINVAL;
+    op->op = i;
+    
+    if (jsonk_patch_op_string(value, "from", &op->from, &op->from_len) < 0) {
+        op->from = NULL;
+        op->from_len = 0;
+    }
+    member = jsonk_object_find_member(&value->u.object, "value", 5);
+    op->value = member ? member->value : NULL;
+    return 0;
+}
+
+/**
+ * Apply an RFC 6902 patch document in place (atomic)
+ */
+int jsonk_apply_json_patch(struct jsonk_value **target, struct jsonk_value *patch)
+{
+    u64 start = jsonk_patch_begin(JSONK_PATCH_KIND_JSON);
+    struct jsonk_patch_run run = { .root = target };
+    int ret = JSONK_PATCH_SUCCESS;
+    struct jsonk_patch_op op;
+    size_t i;
+    
+    if (!target || !*target || !patch || patch->type != JSONK_VALUE_ARRAY)
+        return jsonk_patch_end(JSONK_PATCH_KIND_JSON, start, JSONK_PATCH_ERROR_TYPE);
+    
+    for (i = 0; i < patch->u.array.size && ret == JSONK_PATCH_SUCCESS; i++) {
+        if (jsonk_patch_op_decode(patch->u.array.items[i], &op) < 0)
+            ret = JSONK_PATCH_ERROR_TYPE;
+        else
+            ret = jsonk_patch_op_apply(&run, &op);
+    }
+    
+    return jsonk_patch_end(JSONK_PATCH_KIND_JSON, start, jsonk_patch_run_finish(&run, ret));
+}
+
+/* ========================================================================
+ * Content Hashes and Diff
+ * ======================================================================== */
+
+/* Keys the content hash, so documents cannot be built to collide */
+static siphash_key_t jsonk_hash_key;
+
+/* 0 marks a container without a cached hash */
+static inline u64 jsonk_hash_nonzero(u64 hash)
+{
+    return hash ?: 1;
+}
+
+static inline bool jsonk_value_is_container(const struct jsonk_value *value)
+{
+    return value->type == JSONK_VALUE_OBJECT || value->type == JSONK_VALUE_ARRAY;
+}
+
+/**
+ * Hash a number by its value, as jsonk_number_equal() compares it
+ */
+static u64 jsonk_number_hash(const struct jsonk_value *value, const siphash_key_t *key)
+{
+    struct jsonk_number_value num = {};
+    const char *p;
+    bool negative;
+    u64 magnitude, chunk = 0, hash;
+    unsigned int n = 0;
+    
+    if (value->u.number.kind == JSONK_NUMBER_DECIMAL)
+        jsonk_decimal_value(value, &num);
+    if (jsonk_number_integral(value, &num, &negative, &magnitude))
+        return siphash_3u64(JSONK_VALUE_NUMBER, negative, magnitude, key);
+    if (!num.exact)
+        return siphash_2u64(JSONK_VALUE_NUMBER, siphash(value->u.number.lexeme, value->u.number.len, key), key);
+    
+    /* Fold the significant digits in, 18 at a time, wherever the point is */
+    hash = siphash_3u64(JSONK_VALUE_NUMBER | (u64)num.negative << 8, num.exp, num.count, key);
+    for (p = num.digits; p < num.end; p++) {
+        if (*p == '.')
+            continue;
+        chunk = chunk * 10 + (*p - '0');
+        if (++n == 18) {
+            hash = siphash_2u64(hash, chunk, key);
+            chunk = 0;
+            n = 0;
+        }
+    }
+    return n ? siphash_2u64(hash, chunk, key) : hash;
+}
+
+/**
+ * Hash a scalar, tagged with its type as jsonk_scalar_equal() compares it
+ */
+static u64 jsonk_scalar_hash(const struct jsonk_value *value)
+{
+    const siphash_key_t *key = &jsonk_hash_key;
+    u64 hash;
+    
+    switch (value ? value->type : JSONK_VALUE_NULL) {
+    case JSONK_VALUE_BOOLEAN:
+        hash = siphash_2u64(JSONK_VALUE_BOOLEAN, value->u.boolean, key);
+        break;
+    case JSONK_VALUE_NUMBER:
+        hash = jsonk_number_hash(value, key);
+        break;
+    case JSONK_VALUE_STRING:
+        hash = siphash_2u64(JSONK_VALUE_STRING, siphash(value->u.string.data, value->u.string.len, key), key);
+        break;
+    default:
+        hash = siphash_1u64(JSONK_VALUE_NULL, key);
+        break;
+    }
+    return jsonk_hash_nonzero(hash);
+}
+
+/* A container being hashed, and the member of the child in progress */
+struct jsonk_hash_frame {
+    struct jsonk_walk_frame walk;
+    struct jsonk_member *member;
+    u64 hash;                   /* Children folded in so far */
+};
+
+/**
+ * Fold the hash of a child into its container's
+ * 
+ * Elements are chained in order. Members are mixed with their keys and
+ * summed, so that their order does not count.
+ */
+static inline void jsonk_hash_fold(struct jsonk_hash_frame *frame, u64 child)
+{
+    const struct jsonk_member *member = frame->member;
+    const siphash_key_t *key = &jsonk_hash_key;
+    
+    if (member)
+        frame->hash += siphash_2u64(siphash(member->key, member->key_len, key), child, key);
+    else
+        frame->hash = siphash_2u64(frame->hash, child, key);
+}
+
+static inline u64 jsonk_hash_finish(const struct jsonk_hash_frame *frame)
+{
+    const struct jsonk_value *value = frame->walk.value;
+    u32 size = value->type == JSONK_VALUE_OBJECT ? value->u.object.size : value->u.array.size;
+    
+    return jsonk_hash_nonzero(siphash_3u64(value->type, size, frame->hash, &jsonk_hash_key));
+}
+
+/**
+ * Content hash of a value, filling in the hashes of containers without one
+ */
+u64 jsonk_value_hash(struct jsonk_value *value)
+{
+    struct jsonk_hash_frame inline_frames[JSONK_NEST_INLINE];
+    struct jsonk_hash_frame *frames = inline_frames, *frame;
+    size_t cap = ARRAY_SIZE(inline_frames), depth = 0;
+    u64 hash;
+    
+    if (!value)
+        return 0;
+    
+    while (true) {
+        if (!value || !jsonk_value_is_container(value)) {
+            hash = jsonk_scalar_hash(value);
+        } else {
+            hash = READ_ONCE(value->hash);
+            if (!hash) {
+                /* Hash the children first */
+                if (depth == cap) {
+                    frames = jsonk_nest_grow(frames, inline_frames, &cap, sizeof(*frames), GFP_KERNEL);
+                    if (!frames)
+                        return 0;
+                }
+                frame = &frames[depth++];
+                jsonk_walk_frame_init(&frame->walk, value);
+                frame->hash = 0;
+            }
         }
         
-        /* Parse exponent digits */
-        while (parser->pos < parser->buffer_len) {
-            c = parser->buffer[parser->pos];
-            if (c >= '0' && c <= '9') {
-                parser->pos++;
-            } else {
+        /* Fold the hash into its container, finishing containers with no children left */
+        while (depth) {
+            frame = &frames[depth - 1];
+            if (hash)
+                jsonk_hash_fold(frame, hash);
+            if (jsonk_walk_child(&frame->walk, &value, &frame->member))
                 break;
-            }
+            hash = jsonk_hash_finish(frame);
+            WRITE_ONCE(frame->walk.value->hash, hash);
+            depth--;
         }
+        if (!depth)
+            break;
     }
     
-    /* Set token */
-    token->type = JSONK_TOKEN_NUMBER;
-    token->start = &parser->buffer[start_pos];
-    token->len = parser->pos - start_pos;
+    jsonk_nest_release(frames, inline_frames);
+    return hash;
+}
+
+/**
+ * Forget the cached hash of a container changed from outside
+ */
+void jsonk_value_hash_reset(struct jsonk_value *value)
+{
+    /* Inline text of scalars covers the field */
+    if (value && jsonk_value_is_container(value))
+        jsonk_value_changed(value);
+}
+
+/* A pair of containers being diffed */
+struct jsonk_diff_frame {
+    struct jsonk_value *from;
+    struct jsonk_value *to;
+    size_t path_len;                    /* Length of the pointer to the pair */
+    union {
+        struct {
+            struct jsonk_member *member; /* Next member of from, then of to */
+            bool adding;                /* Walking the members of to */
+        };
+        struct {
+            u32 index;                  /* Next element pair */
+            u32 pairs;                  /* End of the pairs to diff in place */
+            u32 from_end;               /* End of the elements of from left, before the common suffix */
+            u32 to_end;                 /* Same for to */
+        };
+    };
+};
+
+struct jsonk_diff_state {
+    struct jsonk_value *patch;          /* Operations so far */
+    char *path;                         /* Pointer to the current pair, as JSON text */
+    size_t path_len;
+    size_t path_cap;
+    struct jsonk_diff_frame *frames;    /* Always on the heap, they are larger than most */
+    size_t depth;
+    size_t cap;
+};
+
+static int jsonk_diff_path_reserve(struct jsonk_diff_state *diff, size_t len)
+{
+    size_t cap = diff->path_cap ?: 64;
+    char *path;
+    
+    if (len <= diff->path_cap)
+        return 0;
+    while (cap < len)
+        cap *= 2;
+    path = jsonk_counted(krealloc(diff->path, cap, GFP_KERNEL));
+    if (!path)
+        return -ENOMEM;
+    diff->path = path;
+    diff->path_cap = cap;
     return 0;
 }
 
-static int jsonk_parse_literal(struct jsonk_parser *parser, struct jsonk_token *token)
+/**
+ * Append the reference token for a stored key
+ * 
+ * Pointers name keys by their content, so the key is unescaped into
+ * scratch room past the longest token it can make. The token is then
+ * escaped again as a JSON string body, because the path is JSON text
+ * for jsonk_value_create_string() until it goes into the patch.
+ */
+static int jsonk_diff_path_key(struct jsonk_diff_state *diff, size_t base, const char *key, size_t len)
 {
-    size_t start_pos = parser->pos;
-    const char *literals[] = {"true", "false", "null"};
-    enum jsonk_token_type types[] = {JSONK_TOKEN_TRUE, JSONK_TOKEN_FALSE, JSONK_TOKEN_NULL};
-    size_t lengths[] = {4, 5, 4};
-    int i;
+    unsigned char c;
+    char *out, *name;
+    size_t i, name_len;
+    int ret;
     
-    for (i = 0; i < 3; i++) {
-        if (parser->pos + lengths[i] <= parser->buffer_len &&
-            memcmp(&parser->buffer[parser->pos], literals[i], lengths[i]) == 0) {
-            
-            token->type = types[i];
-            token->start = &parser->buffer[start_pos];
-            token->len = lengths[i];
-            parser->pos += lengths[i];
+    /* Every character may need a "~" or a "\u00XX" escape */
+    ret = jsonk_diff_path_reserve(diff, base + 1 + 7 * len);
+    if (ret < 0)
+        return ret;
+    
+    name = diff->path + base + 1 + 6 * len;
+    if (jsonk_unescape(key, len, name, &name_len) < 0)
+        return -EINVAL;
+    
+    out = diff->path + base;
+    *out++ = '/';
+    for (i = 0; i < name_len; i++) {
+        c = name[i];
+        if (c == '~' || c == '/') {
+            *out++ = '~';
+            *out++ = c == '~' ? '0' : '1';
+        } else if (jsonk_escape_table[c]) {
+            out += jsonk_escape_write(out, c);
+        } else {
+            *out++ = c;
+        }
+    }
+    diff->path_len = out - diff->path;
+    return 0;
+}
+
+/**
+ * Point the path at an element of the pair whose pointer ends at base
+ */
+static int jsonk_diff_path_index(struct jsonk_diff_state *diff, size_t base, u32 index)
+{
+    int ret;
+    
+    ret = jsonk_diff_path_reserve(diff, base + 12);
+    if (ret < 0)
+        return ret;
+    diff->path_len = base + snprintf(diff->path + base, 12, "/%u", index);
+    return 0;
+}
+
+/* Add a member to an operation object, taking over the reference on value */
+static int jsonk_diff_field(struct jsonk_value *entry, const char *name, struct jsonk_value *value)
+{
+    int ret;
+    
+    if (!value)
+        return -ENOMEM;
+    ret = jsonk_object_add_member_tracked(&entry->u.object, name, strlen(name), value, NULL);
+    if (ret < 0)
+        jsonk_value_put(value);
+    return ret;
+}
+
+/**
+ * Append an operation on the current path, with a copy of value if given
+ */
+static int jsonk_diff_emit(struct jsonk_diff_state *diff, enum jsonk_patch_op_type op, struct jsonk_value *value)
+{
+    const char *name = jsonk_patch_op_names[op];
+    struct jsonk_value *entry;
+    int ret;
+    
+    entry = jsonk_value_create(JSONK_VALUE_OBJECT);
+    if (!entry)
+        return -ENOMEM;
+    
+    ret = jsonk_diff_field(entry, "op", jsonk_value_create_string(name, strlen(name)));
+    if (ret == 0)
+        ret = jsonk_diff_field(entry, "path", jsonk_value_create_string(diff->path, diff->path_len));
+    if (ret == 0 && value)
+        ret = jsonk_diff_field(entry, "value", jsonk_value_deep_copy(value, 1));
+    if (ret == 0)
+        ret = jsonk_array_add_element_tracked(&diff->patch->u.array, entry, NULL);
+    if (ret < 0)
+        jsonk_value_put(entry);
+    return ret;
+}
+
+/**
+ * Whether two values are known equal, by identity, hash or scalar content
+ */
+static bool jsonk_diff_same(struct jsonk_value *from, struct jsonk_value *to)
+{
+    if (from == to)
+        return true;
+    if (from->type != to->type)
+        return false;
+    if (jsonk_value_is_container(from))
+        return READ_ONCE(from->hash) == READ_ONCE(to->hash);
+    return jsonk_scalar_equal(from, to);
+}
+
+/**
+ * Diff a pair of values at the current path
+ * @return 0, or a negative errno; containers that differ are pushed as a frame
+ */
+static int jsonk_diff_pair(struct jsonk_diff_state *diff, struct jsonk_value *from, struct jsonk_value *to)
+{
+    struct jsonk_value **from_items, **to_items;
+    struct jsonk_diff_frame *frame;
+    u32 start = 0, from_end, to_end;
+    
+    if (jsonk_diff_same(from, to))
+        return 0;
+    if (from->type != to->type || !jsonk_value_is_container(from))
+        return jsonk_diff_emit(diff, JSONK_PATCH_OP_REPLACE, to);
+    
+    if (diff->depth == diff->cap) {
+        diff->frames = jsonk_nest_grow(diff->frames, NULL, &diff->cap, sizeof(*diff->frames), GFP_KERNEL);
+        if (!diff->frames)
+            return -ENOMEM;
+    }
+    frame = &diff->frames[diff->depth++];
+    frame->from = from;
+    frame->to = to;
+    frame->path_len = diff->path_len;
+    
+    if (from->type == JSONK_VALUE_OBJECT) {
+        frame->member = list_first_entry_or_null(&from->u.object.members, struct jsonk_member, list);
+        frame->adding = false;
+        return 0;
+    }
+    
+    /* Equal runs at either end are left alone, so inserts and removals do not shift the rest */
+    from_items = from->u.array.items;
+    to_items = to->u.array.items;
+    from_end = from->u.array.size;
+    to_end = to->u.array.size;
+    while (start < from_end && start < to_end && jsonk_diff_same(from_items[start], to_items[start]))
+        start++;
+    while (from_end > start && to_end > start &&
+           jsonk_diff_same(from_items[from_end - 1], to_items[to_end - 1])) {
+        from_end--;
+        to_end--;
+    }
+    
+    frame->index = start;
+    frame->pairs = min(from_end, to_end);
+    frame->from_end = from_end;
+    frame->to_end = to_end;
+    return 0;
+}
+
+/* Next member after member in obj, or NULL */
+static inline struct jsonk_member *jsonk_diff_next_member(struct jsonk_object *obj, struct jsonk_member *member)
+{
+    return list_is_last(&member->list, &obj->members) ? NULL : list_next_entry(member, list);
+}
+
+/**
+ * Take one step through the top frame, popping it once it is done
+ */
+static int jsonk_diff_step(struct jsonk_diff_state *diff)
+{
+    struct jsonk_diff_frame *frame = &diff->frames[diff->depth - 1];
+    struct jsonk_member *member = frame->member, *other;
+    struct jsonk_value *to = frame->to;
+    int ret;
+    
+    if (frame->from->type == JSONK_VALUE_OBJECT) {
+        if (!member && !frame->adding) {
+            /* Members of from are done, look for the new ones */
+            frame->adding = true;
+            frame->member = list_first_entry_or_null(&to->u.object.members, struct jsonk_member, list);
+            return 0;
+        }
+        if (!member) {
+            diff->depth--;
             return 0;
         }
+        
+        if (frame->adding) {
+            frame->member = jsonk_diff_next_member(&to->u.object, member);
+            if (jsonk_object_find_member(&frame->from->u.object, member->key, member->key_len))
+                return 0;
+            ret = jsonk_diff_path_key(diff, frame->path_len, member->key, member->key_len);
+            return ret < 0 ? ret : jsonk_diff_emit(diff, JSONK_PATCH_OP_ADD, member->value);
+        }
+        
+        frame->member = jsonk_diff_next_member(&frame->from->u.object, member);
+        ret = jsonk_diff_path_key(diff, frame->path_len, member->key, member->key_len);
+        if (ret < 0)
+            return ret;
+        other = jsonk_object_find_member(&to->u.object, member->key, member->key_len);
+        if (!other)
+            return jsonk_diff_emit(diff, JSONK_PATCH_OP_REMOVE, NULL);
+        return jsonk_diff_pair(diff, member->value, other->value);
     }
     
-    return -EINVAL;
+    if (frame->index < frame->pairs) {
+        ret = jsonk_diff_path_index(diff, frame->path_len, frame->index);
+        if (ret < 0)
+            return ret;
+        frame->index++;
+        return jsonk_diff_pair(diff, frame->from->u.array.items[frame->index - 1], to->u.array.items[frame->index - 1]);
+    }
+    
+    /* Past the pairs, the extra elements of from go, each in turn at the same index */
+    if (frame->from_end > frame->to_end) {
+        frame->from_end--;
+        ret = jsonk_diff_path_index(diff, frame->path_len, frame->to_end);
+        return ret < 0 ? ret : jsonk_diff_emit(diff, JSONK_PATCH_OP_REMOVE, NULL);
+    }
+    
+    /* or the extra elements of to come in order */
+    if (frame->from_end < frame->to_end) {
+        ret = jsonk_diff_path_index(diff, frame->path_len, frame->from_end);
+        if (ret < 0)
+            return ret;
+        frame->from_end++;
+        return jsonk_diff_emit(diff, JSONK_PATCH_OP_ADD, to->u.array.items[frame->from_end - 1]);
+    }
+    
+    diff->depth--;
+    return 0;
 }
 
 /**
- * Get the next token from the JSON input
- * @param parser Parser context
- * @param token Token structure to fill
- * @return 0 on success, negative error code on failure
+ * Build the RFC 6902 patch that turns one document into another
  */
-static int jsonk_next_token(struct jsonk_parser *parser, struct jsonk_token *token)
+struct jsonk_value *jsonk_diff(struct jsonk_value *from, struct jsonk_value *to)
 {
-    char c;
+    struct jsonk_diff_state diff = { .cap = JSONK_NEST_INLINE };
+    int ret = -ENOMEM;
     
-    /* Skip whitespace */
-    jsonk_skip_whitespace(parser);
+    if (!from || !to)
+        return NULL;
     
-    /* Check if we reached the end */
-    if (parser->pos >= parser->buffer_len)
-        return -ENODATA;
+    /* Cached hashes let unchanged subtrees be skipped without a walk */
+    if (!jsonk_value_hash(from) || !jsonk_value_hash(to))
+        return NULL;
     
-    c = parser->buffer[parser->pos];
+    diff.patch = jsonk_value_create(JSONK_VALUE_ARRAY);
+    diff.frames = jsonk_counted(kmalloc_array(diff.cap, sizeof(*diff.frames), GFP_KERNEL));
+    if (diff.patch && diff.frames) {
+        ret = jsonk_diff_pair(&diff, from, to);
+        while (ret == 0 && diff.depth)
+            ret = jsonk_diff_step(&diff);
+    }
     
-    /* Parse the token based on the first character */
-    switch (c) {
-    case '{':
-        token->type = JSONK_TOKEN_OBJECT_START;
-        token->start = &parser->buffer[parser->pos];
-        token->len = 1;
-        parser->pos++;
-        return 0;
-    case '}':
-        token->type = JSONK_TOKEN_OBJECT_END;
-        token->start = &parser->buffer[parser->pos];
-        token->len = 1;
-        parser->pos++;
-        return 0;
-    case '[':
-        token->type = JSONK_TOKEN_ARRAY_START;
-        token->start = &parser->buffer[parser->pos];
-        token->len = 1;
-        parser->pos++;
-        return 0;
-    case ']':
-        token->type = JSONK_TOKEN_ARRAY_END;
-        token->start = &parser->buffer[parser->pos];
-        token->len = 1;
-        parser->pos++;
-        return 0;
-    case ':':
-        token->type = JSONK_TOKEN_COLON;
-        token->start = &parser->buffer[parser->pos];
-        token->len = 1;
-        parser->pos++;
-        return 0;
-    case ',':
-        token->type = JSONK_TOKEN_COMMA;
-        token->start = &parser->buffer[parser->pos];
-        token->len = 1;
-        parser->pos++;
-        return 0;
-    case '"':
-        return jsonk_parse_string(parser, token);
-    case '-':
-    case '0': case '1': case '2': case '3': case '4':
-    case '5': case '6': case '7': case '8': case '9':
-        return jsonk_parse_number(parser, token);
-    case 't':
-    case 'f':
-    case 'n':
-        return jsonk_parse_literal(parser, token);
-    default:
-        return -EINVAL;
+    kfree(diff.frames);
+    kfree(diff.path);
+    if (ret < 0 && diff.patch) {
+        jsonk_value_put(diff.patch);
+        return NULL;
     }
+    return diff.patch;
 }
 
 /* ========================================================================
- * Value Creation and Management Functions
+ * Compiled Paths
  * ======================================================================== */
 
 /**
- * Unescape a JSON string and create a value with tracking
+ * Split a path once for repeated lookups
  */
-static struct jsonk_value *jsonk_value_create_string_tracked(const char *str, size_t len, struct jsonk_parser *parser)
+struct jsonk_path *jsonk_path_compile(const char *path, size_t path_len)
 {
-    struct jsonk_value *value;
-    char *unescaped;
-    size_t unescaped_len = 0;
-    size_t i = 0;
+    const char *pos = path, *end = path + path_len;
+    struct jsonk_path_component comp;
+    struct jsonk_path *compiled;
+    size_t count = 0, key_bytes = 0;
+    char *keys;
+    int ret;
     
-    /* Check string length limit */
-    if (len > JSONK_MAX_STRING_LENGTH) {
-        printk(KERN_WARNING "JSONK: String too long (%zu > %d)\n", len, JSONK_MAX_STRING_LENGTH);
+    if (!path || path_len == 0)
         return NULL;
-    }
     
-    /* Check string count limit */
-    if (parser && parser->string_count >= JSONK_MAX_ARRAY_SIZE) {
-        printk(KERN_WARNING "JSONK: Too many strings (%zu >= %d)\n", parser->string_count, JSONK_MAX_ARRAY_SIZE);
-        return NULL;
+    while ((ret = jsonk_parse_path_component(&pos, end, &comp)) > 0) {
+        count++;
+        key_bytes += comp.key_len;
     }
-    
-    value = jsonk_value_create_tracked(JSONK_VALUE_STRING, parser);
-    if (!value)
+    if (ret < 0)
         return NULL;
     
-    /* Allocate buffer for unescaped string (worst case: same size) */
-    unescaped = jsonk_tracked_alloc(parser, len + 1);
-    if (!unescaped) {
-        kmem_cache_free(jsonk_value_cache, value);
+    /* Components and a private copy of the keys share one allocation */
+    compiled = jsonk_counted(kmalloc(struct_size(compiled, comps, count) + key_bytes, GFP_KERNEL));
+    if (!compiled)
         return NULL;
-    }
+    compiled->count = count;
+    keys = (char *)&compiled->comps[count];
     
-    /* Process the string, handling escape sequences */
-    while (i < len) {
-        char c = str[i];
-        
-        if (c == '\\' && i + 1 < len) {
-            /* Handle escape sequence */
-            i++; /* Skip backslash */
-            char escaped = str[i];
-            
-            switch (escaped) {
-            case '"':
-                unescaped[unescaped_len++] = '"';
-                break;
-            case '\\':
-                unescaped[unescaped_len++] = '\\';
-                break;
-            case '/':
-                unescaped[unescaped_len++] = '/';
-                break;
-            case 'b':
-                unescaped[unescaped_len++] = '\b';
-                break;
-            case 'f':
-                unescaped[unescaped_len++] = '\f';
-                break;
-            case 'n':
-                unescaped[unescaped_len++] = '\n';
-                break;
-            case 'r':
-                unescaped[unescaped_len++] = '\r';
-                break;
-            case 't':
-                unescaped[unescaped_len++] = '\t';
-                break;
-            case 'u':
-                /* Unicode escape: \uXXXX - simplified to ASCII for kernel space */
-                if (i + 4 < len) {
-                    /* For kernel space, we'll just store the literal \uXXXX */
-                    /* In production, you might want proper Unicode handling */
-                    unescaped[unescaped_len++] = '\\';
-                    unescaped[unescaped_len++] = 'u';
-                    i++; /* We'll copy the hex digits as-is */
-                    for (int j = 0; j < 4 && i < len; j++, i++) {
-                        unescaped[unescaped_len++] = str[i];
-                    }
-                    i--; /* Adjust for loop increment */
-                } else {
-                    /* Invalid unicode escape */
-                    jsonk_tracked_free(unescaped, len + 1);
-                    kmem_cache_free(jsonk_value_cache, value);
-                    return NULL;
-                }
-                break;
-            default:
-                /* Invalid escape sequence */
-                jsonk_tracked_free(unescaped, len + 1);
-                kmem_cache_free(jsonk_value_cache, value);
-                return NULL;
-            }
-            i++;
-        } else {
-            /* Regular character */
-            unescaped[unescaped_len++] = c;
-            i++;
+    pos = path;
+    for (count = 0; jsonk_parse_path_component(&pos, end, &comp) > 0; count++) {
+        if (!comp.is_index) {
+            memcpy(keys, comp.key, comp.key_len);
+            comp.key = keys;
+            comp.hash = jsonk_key_hash(keys, comp.key_len);
+            comp.hashed = true;
+            keys += comp.key_len;
         }
+        compiled->comps[count] = comp;
     }
     
-    unescaped[unescaped_len] = '\0';
+    return compiled;
+}
+
+/**
+ * Release a compiled path
+ */
+void jsonk_path_free(struct jsonk_path *path)
+{
+    kfree(path);
+}
+
+/**
+ * Get a value using a compiled path
+ */
+struct jsonk_value *jsonk_path_get(struct jsonk_value *root, const struct jsonk_path *path)
+{
+    struct jsonk_path_iter iter = { .compiled = path };
     
-    /* Resize buffer to actual size needed */
-    if (unescaped_len < len) {
-        char *resized = jsonk_tracked_alloc(parser, unescaped_len + 1);
-        if (resized) {
-            memcpy(resized, unescaped, unescaped_len + 1);
-            jsonk_tracked_free(unescaped, len + 1);
-            unescaped = resized;
-        }
-        /* If resize fails, keep the larger buffer */
-    }
+    if (!root || !path)
+        return NULL;
     
-    value->u.string.data = unescaped;
-    value->u.string.len = unescaped_len;
+    return jsonk_path_iter_get(root, &iter);
+}
+
+/**
+ * Set a value using a compiled path
+ */
+int jsonk_path_set(struct jsonk_value *root, const struct jsonk_path *path, struct jsonk_value *value)
+{
+    struct jsonk_path_iter iter = { .compiled = path };
     
-    if (parser) {
-        parser->string_count++;
-    }
+    if (!root || !path || !value)
+        return -EINVAL;
     
-    return value;
+    return jsonk_path_iter_set(root, &iter, value);
+}
+
+static int jsonk_path_merge(struct jsonk_value *root, const struct jsonk_path *path, struct jsonk_value *patch)
+{
+    struct jsonk_path_iter iter = { .compiled = path };
+    struct jsonk_path_component comp;
+    struct jsonk_value *target;
+    int ret;
+    
+    if (!root || !path || !patch)
+        return JSONK_PATCH_ERROR_PATH;
+    
+    target = jsonk_path_get(root, path);
+    if (!target)
+        return JSONK_PATCH_ERROR_PATH;
+    
+    ret = jsonk_patch_tree(target, patch);
+    if (ret != JSONK_PATCH_SUCCESS)
+        return ret;
+    
+    /* The containers above the target changed with it */
+    for (target = root; jsonk_path_next(&iter, &comp) > 0; target = jsonk_path_step(target, &comp))
+        jsonk_value_changed(target);
+    return ret;
 }
 
 /**
- * Create a JSON number value from string (improved implementation)
+ * Merge a patch object into the object at a compiled path (atomic)
  */
-struct jsonk_value *jsonk_value_create_number(const char *str, size_t len)
+int jsonk_path_patch(struct jsonk_value *root, const struct jsonk_path *path, struct jsonk_value *patch)
 {
-    struct jsonk_value *value;
-    char *num_str;
-    char *endptr;
+    u64 start = jsonk_patch_begin(JSONK_PATCH_KIND_PATH);
     
-    value = jsonk_value_create(JSONK_VALUE_NUMBER);
-    if (!value)
-        return NULL;
+    return jsonk_patch_end(JSONK_PATCH_KIND_PATH, start, jsonk_path_merge(root, path, patch));
+}
+
+/* ========================================================================
+ * Binary Encoding
+ * ======================================================================== */
+
+#define JSONK_BIN_ARRAY_HEADER 9     /* Tag, size, count */
+#define JSONK_BIN_OBJECT_HEADER 13   /* Tag, size, count, buckets */
+#define JSONK_BIN_ENTRY_SIZE 12      /* Offset, hash, next */
+
+/**
+ * Key hash of the encoding, which userspace has to compute as well: FNV-1a
+ */
+static u32 jsonk_bin_hash(const char *key, size_t key_len)
+{
+    u32 hash = 0x811c9dc5;
+    size_t i;
+    
+    for (i = 0; i < key_len; i++)
+        hash = (hash ^ (u8)key[i]) * 0x01000193;
+    return hash;
+}
+
+/* Entries of containers without buckets hold only the offset */
+static inline size_t jsonk_bin_entry_size(u32 buckets)
+{
+    return buckets ? JSONK_BIN_ENTRY_SIZE : sizeof(__le32);
+}
+
+/* Encoder output; writes that do not fit are only counted */
+struct jsonk_bin_out {
+    u8 *buf;
+    size_t size;
+    size_t pos;
+};
+
+static inline bool jsonk_bin_fits(const struct jsonk_bin_out *out, size_t at, size_t len)
+{
+    return at <= out->size && len <= out->size - at;
+}
+
+static inline void jsonk_bin_put(struct jsonk_bin_out *out, const void *data, size_t len)
+{
+    if (jsonk_bin_fits(out, out->pos, len))
+        memcpy(out->buf + out->pos, data, len);
+    out->pos += len;
+}
+
+static inline void jsonk_bin_put_zero(struct jsonk_bin_out *out, size_t len)
+{
+    if (jsonk_bin_fits(out, out->pos, len))
+        memset(out->buf + out->pos, 0, len);
+    out->pos += len;
+}
+
+static inline void jsonk_bin_put8(struct jsonk_bin_out *out, u8 v)
+{
+    jsonk_bin_put(out, &v, 1);
+}
+
+static inline void jsonk_bin_put16(struct jsonk_bin_out *out, u16 v)
+{
+    __le16 le = cpu_to_le16(v);
     
-    /* Initialize default values */
-    value->u.number.integer = 0;
-    value->u.number.fraction = 0;
-    value->u.number.is_negative = false;
-    value->u.number.is_integer = true;
+    jsonk_bin_put(out, &le, sizeof(le));
+}
+
+static inline void jsonk_bin_put32(struct jsonk_bin_out *out, u32 v)
+{
+    __le32 le = cpu_to_le32(v);
     
-    /* Allocate null-terminated string for parsing */
-    num_str = jsonk_memory_alloc(len + 1);
-    if (!num_str) {
-        kmem_cache_free(jsonk_value_cache, value);
-        return NULL;
+    jsonk_bin_put(out, &le, sizeof(le));
+}
+
+static inline void jsonk_bin_put64(struct jsonk_bin_out *out, u64 v)
+{
+    __le64 le = cpu_to_le64(v);
+    
+    jsonk_bin_put(out, &le, sizeof(le));
+}
+
+static inline void jsonk_bin_set32(struct jsonk_bin_out *out, size_t at, u32 v)
+{
+    if (jsonk_bin_fits(out, at, sizeof(v)))
+        put_unaligned_le32(v, out->buf + at);
+}
+
+static int jsonk_bin_put_scalar(struct jsonk_bin_out *out, const struct jsonk_value *value)
+{
+    s64 integer;
+    
+    switch (value->type) {
+    case JSONK_VALUE_NULL:
+        jsonk_bin_put8(out, JSONK_BIN_NULL);
+        return 0;
+        
+    case JSONK_VALUE_BOOLEAN:
+        jsonk_bin_put8(out, value->u.boolean ? JSONK_BIN_TRUE : JSONK_BIN_FALSE);
+        return 0;
+        
+    case JSONK_VALUE_STRING:
+        if (value->u.string.len > U32_MAX)
+            return -E2BIG;
+        jsonk_bin_put8(out, JSONK_BIN_STRING);
+        jsonk_bin_put32(out, value->u.string.len);
+        jsonk_bin_put(out, value->u.string.data, value->u.string.len);
+        return 0;
+        
+    case JSONK_VALUE_NUMBER:
+        break;
+        
+    default:
+        return -EINVAL;
+    }
+    
+    switch (value->u.number.kind) {
+    case JSONK_NUMBER_INT:
+        /* Integers take the narrowest width that holds them */
+        integer = value->u.number.integer;
+        if (integer == (s8)integer) {
+            jsonk_bin_put8(out, JSONK_BIN_INT8);
+            jsonk_bin_put8(out, (u8)integer);
+        } else if (integer == (s16)integer) {
+            jsonk_bin_put8(out, JSONK_BIN_INT16);
+            jsonk_bin_put16(out, (u16)integer);
+        } else if (integer == (s32)integer) {
+            jsonk_bin_put8(out, JSONK_BIN_INT32);
+            jsonk_bin_put32(out, (u32)integer);
+        } else {
+            jsonk_bin_put8(out, JSONK_BIN_INT64);
+            jsonk_bin_put64(out, (u64)integer);
+        }
+        return 0;
+        
+    case JSONK_NUMBER_UINT:
+        jsonk_bin_put8(out, JSONK_BIN_UINT64);
+        jsonk_bin_put64(out, value->u.number.uinteger);
+        return 0;
+        
+    default:
+        jsonk_bin_put8(out, JSONK_BIN_DECIMAL);
+        jsonk_bin_put32(out, value->u.number.len);
+        jsonk_bin_put(out, value->u.number.lexeme, value->u.number.len);
+        return 0;
     }
+}
+
+/* A container being encoded */
+struct jsonk_bin_frame {
+    struct jsonk_walk_frame walk;
+    size_t start;               /* Position of its tag */
+    size_t table;               /* Position of its offset or entry table */
+    u32 count;
+    u32 buckets;
+    u32 next;                   /* Children written so far */
+};
+
+static void jsonk_bin_open(struct jsonk_bin_out *out, struct jsonk_bin_frame *frame,
+                           struct jsonk_value *value)
+{
+    bool object = value->type == JSONK_VALUE_OBJECT;
+    
+    jsonk_walk_frame_init(&frame->walk, value);
+    frame->start = out->pos;
+    frame->count = object ? value->u.object.size : value->u.array.size;
+    frame->buckets = object && frame->count >= JSONK_OBJECT_INDEX_THRESHOLD ?
+                     roundup_pow_of_two(frame->count) : 0;
+    frame->next = 0;
     
-    memcpy(num_str, str, len);
-    num_str[len] = '\0';
+    jsonk_bin_put8(out, object ? JSONK_BIN_OBJECT : JSONK_BIN_ARRAY);
+    jsonk_bin_put32(out, 0);
+    jsonk_bin_put32(out, frame->count);
+    if (object) {
+        jsonk_bin_put32(out, frame->buckets);
+        jsonk_bin_put_zero(out, frame->buckets * sizeof(__le32));
+    }
+    frame->table = out->pos;
+    jsonk_bin_put_zero(out, (size_t)frame->count * jsonk_bin_entry_size(frame->buckets));
+}
+
+/**
+ * Record the size of a finished container and chain its buckets
+ */
+static void jsonk_bin_close(struct jsonk_bin_out *out, const struct jsonk_bin_frame *frame)
+{
+    u8 *heads, *entry;
+    u32 i, bucket;
     
-    /* Check if it contains decimal point or exponent */
-    bool has_decimal = false;
-    bool has_exponent = false;
-    size_t i;
+    jsonk_bin_set32(out, frame->start + 1, out->pos - frame->start);
+    if (!frame->buckets || out->pos > out->size)
+        return;
     
-    for (i = 0; i < len; i++) {
-        if (num_str[i] == '.') {
-            has_decimal = true;
-        } else if (num_str[i] == 'e' || num_str[i] == 'E') {
-            has_exponent = true;
-            break;
-        }
+    /* Pushed newest first, so every chain runs in insertion order */
+    heads = out->buf + frame->start + JSONK_BIN_OBJECT_HEADER;
+    for (i = frame->count; i-- > 0; ) {
+        entry = out->buf + frame->table + (size_t)i * JSONK_BIN_ENTRY_SIZE;
+        bucket = get_unaligned_le32(entry + 4) & (frame->buckets - 1);
+        put_unaligned_le32(get_unaligned_le32(heads + bucket * 4), entry + 8);
+        put_unaligned_le32(i + 1, heads + bucket * 4);
     }
+}
+
+/**
+ * Encode a tree, or only measure it when out->size is 0
+ */
+static int jsonk_bin_encode(struct jsonk_value *value, struct jsonk_bin_out *out)
+{
+    struct jsonk_bin_frame inline_frames[JSONK_NEST_INLINE];
+    struct jsonk_bin_frame *frames = inline_frames, *frame;
+    struct jsonk_member *member;
+    size_t cap = ARRAY_SIZE(inline_frames), depth = 0, entry;
+    int ret = 0;
     
-    if (has_decimal || has_exponent) {
-        /* Parse as floating point - simplified approach */
-        value->u.number.is_integer = false;
-        
-        /* For kernel space, we'll store a simplified representation */
-        /* Parse integer part */
-        s64 int_part = 0;
-        i = 0;
-        bool negative = false;
-        
-        if (num_str[i] == '-') {
-            negative = true;
-            i++;
+    jsonk_bin_put32(out, JSONK_BIN_MAGIC);
+    jsonk_bin_put16(out, JSONK_BIN_VERSION);
+    jsonk_bin_put16(out, 0);
+    jsonk_bin_put32(out, 0);
+    
+    while (true) {
+        if (value->type == JSONK_VALUE_OBJECT || value->type == JSONK_VALUE_ARRAY) {
+            if (depth == cap) {
+                frames = jsonk_nest_grow(frames, inline_frames, &cap, sizeof(*frames), GFP_NOWAIT);
+                if (!frames) {
+                    ret = -ENOMEM;
+                    goto out;
+                }
+            }
+            jsonk_bin_open(out, &frames[depth++], value);
+        } else {
+            ret = jsonk_bin_put_scalar(out, value);
+            if (ret < 0)
+                goto out;
         }
         
-        /* Parse digits before decimal */
-        while (i < len && num_str[i] >= '0' && num_str[i] <= '9') {
-            if (int_part > S64_MAX / 10) {
-                int_part = S64_MAX; /* Overflow protection */
+        /* Move on to the next value, closing the containers that are done */
+        while (true) {
+            if (!depth)
+                goto done;
+            frame = &frames[depth - 1];
+            if (jsonk_walk_child(&frame->walk, &value, &member))
                 break;
-            }
-            int_part = int_part * 10 + (num_str[i] - '0');
-            i++;
+            jsonk_bin_close(out, frame);
+            depth--;
         }
         
-        value->u.number.integer = negative ? -int_part : int_part;
-        value->u.number.is_negative = negative;
-        
-        /* Parse fractional part if present */
-        if (i < len && num_str[i] == '.') {
-            i++; /* Skip decimal point */
-            u32 frac_part = 0;
-            int frac_digits = 0;
-            
-            while (i < len && num_str[i] >= '0' && num_str[i] <= '9' && frac_digits < 9) {
-                if (frac_part > UINT_MAX / 10) {
-                    break; /* Overflow protection */
-                }
-                frac_part = frac_part * 10 + (num_str[i] - '0');
-                frac_digits++;
-                i++;
-            }
-            
-            value->u.number.fraction = frac_part;
+        if (!value) {
+            ret = -EINVAL;
+            goto out;
         }
         
-        /* Note: Exponent handling is simplified for kernel space */
-        /* In production, you might want more sophisticated floating point handling */
-        
-    } else {
-        /* Parse as integer */
-        value->u.number.is_integer = true;
-        value->u.number.integer = simple_strtoll(num_str, &endptr, 10);
-        value->u.number.is_negative = (value->u.number.integer < 0);
-        
-        /* Validate that entire string was consumed */
-        if (endptr != num_str + len) {
-            jsonk_memory_free(num_str, len + 1);
-            kmem_cache_free(jsonk_value_cache, value);
-            return NULL;
+        entry = frame->table + (size_t)frame->next++ * jsonk_bin_entry_size(frame->buckets);
+        jsonk_bin_set32(out, entry, out->pos - frame->start);
+        if (frame->buckets)
+            jsonk_bin_set32(out, entry + 4, jsonk_bin_hash(member->key, member->key_len));
+        if (member) {
+            jsonk_bin_put16(out, member->key_len);
+            jsonk_bin_put(out, member->key, member->key_len);
         }
     }
     
-    jsonk_memory_free(num_str, len + 1);
-    return value;
+done:
+    /* Offsets and sizes are 32 bits */
+    if (out->pos > U32_MAX)
+        ret = -E2BIG;
+    jsonk_bin_set32(out, 8, out->pos);
+out:
+    jsonk_nest_release(frames, inline_frames);
+    return ret;
 }
 
-/**
- * Create a JSON boolean value
- */
-struct jsonk_value *jsonk_value_create_boolean(bool val)
+size_t jsonk_binary_size(struct jsonk_value *value)
 {
-    struct jsonk_value *value;
+    struct jsonk_bin_out out = { };
     
-    value = jsonk_value_create(JSONK_VALUE_BOOLEAN);
-    if (!value)
-        return NULL;
+    if (!value || jsonk_bin_encode(value, &out) < 0)
+        return 0;
+    return out.pos;
+}
+
+int jsonk_encode_binary(struct jsonk_value *value, void *buf, size_t size, size_t *written)
+{
+    struct jsonk_bin_out out = { .buf = buf, .size = size };
+    int ret;
     
-    value->u.boolean = val;
-    return value;
+    if (!value || !buf || !written)
+        return -EINVAL;
+    
+    *written = 0;
+    ret = jsonk_bin_encode(value, &out);
+    if (ret < 0)
+        return ret;
+    if (out.pos > size)
+        return -EOVERFLOW;
+    
+    *written = out.pos;
+    return 0;
 }
 
 /**
- * Create a JSON null value
+ * Size of the encoding in a buffer, 0 unless its header is valid
  */
-struct jsonk_value *jsonk_value_create_null(void)
+static size_t jsonk_bin_header(const void *buf, size_t len)
 {
-    return jsonk_value_create(JSONK_VALUE_NULL);
+    size_t size;
+    
+    if (!buf || len < JSONK_BIN_HEADER_SIZE + 1 ||
+        get_unaligned_le32(buf) != JSONK_BIN_MAGIC ||
+        get_unaligned_le16(buf + 4) != JSONK_BIN_VERSION)
+        return 0;
+    
+    size = get_unaligned_le32(buf + 8);
+    return size > JSONK_BIN_HEADER_SIZE && size <= len ? size : 0;
 }
 
-static void jsonk_value_free_internal(struct jsonk_value *value)
+/**
+ * Size of the value encoded at p, 0 if it is unknown or overruns avail
+ */
+static size_t jsonk_bin_extent(const u8 *p, size_t avail)
 {
-    struct jsonk_member *member, *tmp_member;
-    struct jsonk_array_element *element, *tmp_element;
+    u64 need;
     
-    if (!value)
-        return;
+    if (!avail)
+        return 0;
     
-    switch (value->type) {
-    case JSONK_VALUE_STRING:
-        if (value->u.string.data)
-            jsonk_memory_free(value->u.string.data, value->u.string.len + 1);
+    switch (p[0]) {
+    case JSONK_BIN_NULL:
+    case JSONK_BIN_FALSE:
+    case JSONK_BIN_TRUE:
+        need = 1;
         break;
-        
-    case JSONK_VALUE_OBJECT:
-        list_for_each_entry_safe(member, tmp_member, &value->u.object.members, list) {
-            list_del(&member->list);
-            if (member->key)
-                jsonk_memory_free(member->key, member->key_len + 1);
-            if (member->value)
-                jsonk_value_put(member->value);
-            kmem_cache_free(jsonk_member_cache, member);
-        }
+    case JSONK_BIN_INT8:
+        need = 2;
         break;
-        
-    case JSONK_VALUE_ARRAY:
-        list_for_each_entry_safe(element, tmp_element, &value->u.array.elements, list) {
-            list_del(&element->list);
-            if (element->value)
-                jsonk_value_put(element->value);
-            kmem_cache_free(jsonk_element_cache, element);
-        }
+    case JSONK_BIN_INT16:
+        need = 3;
         break;
-        
-    default:
+    case JSONK_BIN_INT32:
+        need = 5;
+        break;
+    case JSONK_BIN_INT64:
+    case JSONK_BIN_UINT64:
+        need = 9;
+        break;
+    case JSONK_BIN_DECIMAL:
+    case JSONK_BIN_STRING:
+        if (avail < 5)
+            return 0;
+        need = 5 + (u64)get_unaligned_le32(p + 1);
+        break;
+    case JSONK_BIN_ARRAY:
+    case JSONK_BIN_OBJECT:
+        if (avail < 5)
+            return 0;
+        need = get_unaligned_le32(p + 1);
+        if (need < (p[0] == JSONK_BIN_OBJECT ? JSONK_BIN_OBJECT_HEADER : JSONK_BIN_ARRAY_HEADER))
+            return 0;
         break;
+    default:
+        return 0;
     }
     
-    kmem_cache_free(jsonk_value_cache, value);
-}
-
-struct jsonk_value *jsonk_value_get(struct jsonk_value *value)
-{
-    if (value)
-        atomic_inc(&value->refcount);
-    return value;
+    return need <= avail ? need : 0;
 }
 
-void jsonk_value_put(struct jsonk_value *value)
+/**
+ * Read the tables of a container whose tag has already been read
+ * @return Offset of the first child, past the tables, or 0 if they overrun len
+ */
+static size_t jsonk_bin_tables(const u8 *p, u8 tag, size_t len, u32 *count, u32 *buckets)
 {
-    if (!value)
-        return;
+    u64 end;
     
-    if (atomic_dec_and_test(&value->refcount)) {
-        jsonk_value_free_internal(value);
+    if (len < (tag == JSONK_BIN_OBJECT ? JSONK_BIN_OBJECT_HEADER : JSONK_BIN_ARRAY_HEADER))
+        return 0;
+    *count = get_unaligned_le32(p + 5);
+    if (tag == JSONK_BIN_OBJECT) {
+        *buckets = get_unaligned_le32(p + 9);
+        if (*buckets & (*buckets - 1))
+            return 0;
+        end = JSONK_BIN_OBJECT_HEADER + (u64)*buckets * 4 + (u64)*count * jsonk_bin_entry_size(*buckets);
+    } else {
+        *buckets = 0;
+        end = JSONK_BIN_ARRAY_HEADER + (u64)*count * 4;
     }
+    return end <= len ? end : 0;
 }
 
-/* ========================================================================
- * Object Manipulation Functions
- * ======================================================================== */
-
 /**
- * Add a member to a JSON object with tracking
+ * Create a string value from text that needs no unescaping
  */
-static int jsonk_object_add_member_tracked(struct jsonk_object *obj, const char *key, size_t key_len, 
-                                          struct jsonk_value *value, struct jsonk_parser *parser)
+static struct jsonk_value *jsonk_bin_string_value(struct jsonk_parser *parser, const u8 *data, u32 len)
 {
-    struct jsonk_member *member;
-    
-    /* Check object member limit */
-    if (obj->size >= JSONK_MAX_OBJECT_MEMBERS) {
-        printk(KERN_WARNING "JSONK: Too many object members (%zu >= %d)\n", 
-               obj->size, JSONK_MAX_OBJECT_MEMBERS);
-        return -ENOSPC;
-    }
+    struct jsonk_value *value;
+    char *text;
     
-    /* Check key length limit */
-    if (key_len > JSONK_MAX_KEY_LENGTH) {
-        printk(KERN_WARNING "JSONK: Object key too long (%zu > %d)\n", 
-               key_len, JSONK_MAX_KEY_LENGTH);
-        return -EINVAL;
-    }
+    if (!jsonk_parser_check_text(parser, len, "String") || !jsonk_parser_count_string(parser))
+        return NULL;
     
-    /* Create new member */
-    if (!jsonk_member_cache) {
-        printk(KERN_ERR "JSONK: Member cache not initialized\n");
-        return -ENOMEM;
+    if (parser->flags & JSONK_PARSE_BORROW) {
+        value = jsonk_value_create_tracked(JSONK_VALUE_STRING, parser);
+        if (!value)
+            return NULL;
+        value->u.string.data = (char *)data;
+        value->u.string.len = len;
+        value->flags |= JSONK_VALUE_F_BORROWED;
+        return value;
     }
     
-    /* Check memory limit */
-    if (parser && parser->total_memory_used + sizeof(struct jsonk_member) + key_len + 1 > JSONK_MAX_TOTAL_MEMORY) {
-        printk(KERN_WARNING "JSONK: Memory limit exceeded for member creation\n");
-        return -ENOMEM;
+    if (len <= JSONK_INLINE_STRING_MAX) {
+        value = jsonk_value_alloc_tracked(JSONK_VALUE_STRING, sizeof(struct jsonk_value), parser);
+        if (!value)
+            return NULL;
+        value->flags |= JSONK_VALUE_F_INLINE;
+        text = (char *)value + JSONK_SCALAR_NODE_SIZE;
+    } else {
+        value = jsonk_value_create_tracked(JSONK_VALUE_STRING, parser);
+        if (!value)
+            return NULL;
+        text = jsonk_tracked_alloc(parser, len + 1);
+        if (!text) {
+            jsonk_value_discard(value, parser);
+            return NULL;
+        }
     }
     
-    member = kmem_cache_alloc(jsonk_member_cache, GFP_KERNEL);
-    if (!member)
-        return -ENOMEM;
+    memcpy(text, data, len);
+    text[len] = '\0';
+    value->u.string.data = text;
+    value->u.string.len = len;
+    return value;
+}
+
+/**
+ * Create the node for the value encoded at p, containers still empty
+ */
+static struct jsonk_value *jsonk_bin_value(struct jsonk_parser *parser, const u8 *p, u32 count)
+{
+    struct jsonk_value *value;
+    u64 uinteger;
+    s64 integer;
     
-    member->key = jsonk_tracked_alloc(parser, key_len + 1);
-    if (!member->key) {
-        kmem_cache_free(jsonk_member_cache, member);
-        return -ENOMEM;
+    switch (p[0]) {
+    case JSONK_BIN_NULL:
+        return jsonk_value_create_tracked(JSONK_VALUE_NULL, parser);
+        
+    case JSONK_BIN_FALSE:
+    case JSONK_BIN_TRUE:
+        value = jsonk_value_create_tracked(JSONK_VALUE_BOOLEAN, parser);
+        if (value)
+            value->u.boolean = p[0] == JSONK_BIN_TRUE;
+        return value;
+        
+    case JSONK_BIN_STRING:
+        return jsonk_bin_string_value(parser, p + 5, get_unaligned_le32(p + 1));
+        
+    case JSONK_BIN_DECIMAL:
+        /* The text is written out verbatim later, so it has to be a valid number */
+        return jsonk_value_create_number_tracked((const char *)p + 5, get_unaligned_le32(p + 1), parser);
+        
+    case JSONK_BIN_ARRAY:
+        if (count > parser->max_array_size) {
+            jsonk_reject(JSONK_LIMIT_ARRAY_SIZE, "Array too large (%u > %u)\n", count, parser->max_array_size);
+            return NULL;
+        }
+        value = jsonk_value_create_tracked(JSONK_VALUE_ARRAY, parser);
+        if (value && count && jsonk_array_resize(&value->u.array, count, parser) < 0) {
+            jsonk_value_discard(value, parser);
+            return NULL;
+        }
+        return value;
+        
+    case JSONK_BIN_OBJECT:
+        if (count > parser->max_object_members) {
+            jsonk_reject(JSONK_LIMIT_OBJECT_MEMBERS, "Too many object members (%u > %u)\n",
+                         count, parser->max_object_members);
+            return NULL;
+        }
+        value = jsonk_value_create_tracked(JSONK_VALUE_OBJECT, parser);
+        if (value && count >= JSONK_OBJECT_INDEX_THRESHOLD &&
+            jsonk_object_index_build(&value->u.object, roundup_pow_of_two(count), parser) < 0) {
+            jsonk_value_discard(value, parser);
+            return NULL;
+        }
+        return value;
+        
+    default:
+        break;
     }
     
-    memcpy(member->key, key, key_len);
-    member->key[key_len] = '\0';
-    member->key_len = key_len;
-    member->value = value;
-    
-    list_add_tail(&member->list, &obj->members);
-    obj->size++;
+    value = jsonk_value_create_tracked(JSONK_VALUE_NUMBER, parser);
+    if (!value)
+        return NULL;
     
-    return 0;
+    switch (p[0]) {
+    case JSONK_BIN_INT8:
+        integer = (s8)p[1];
+        break;
+    case JSONK_BIN_INT16:
+        integer = (s16)get_unaligned_le16(p + 1);
+        break;
+    case JSONK_BIN_INT32:
+        integer = (s32)get_unaligned_le32(p + 1);
+        break;
+    case JSONK_BIN_INT64:
+        integer = (s64)get_unaligned_le64(p + 1);
+        break;
+    default:
+        /* Kept as a signed integer when it fits, as the parser does */
+        uinteger = get_unaligned_le64(p + 1);
+        value->u.number.kind = uinteger > S64_MAX ? JSONK_NUMBER_UINT : JSONK_NUMBER_INT;
+        value->u.number.uinteger = uinteger;
+        return value;
+    }
+    value->u.number.kind = JSONK_NUMBER_INT;
+    value->u.number.integer = integer;
+    return value;
 }
 
+/* A container being decoded */
+struct jsonk_bin_decode_frame {
+    struct jsonk_value *container;
+    const u8 *base;             /* Its encoding */
+    size_t len;                 /* Size of its encoding */
+    size_t table;               /* Offset of its entries */
+    size_t entry_size;
+    size_t pos;                 /* Where the next child has to start */
+    u32 count;
+    u32 next;
+};
+
 /**
- * Find a member in a JSON object
+ * Build the tree encoded at p
+ * 
+ * Children must follow each other without gaps or overlaps, exactly as
+ * the encoder lays them out, so every byte is decoded at most once.
  */
-struct jsonk_member *jsonk_object_find_member(struct jsonk_object *obj, const char *key, size_t key_len)
+static struct jsonk_value *jsonk_bin_decode(struct jsonk_parser *parser, const u8 *p, size_t len)
 {
-    struct jsonk_member *member;
+    struct jsonk_bin_decode_frame inline_open[JSONK_NEST_INLINE], *open = inline_open, *frame;
+    unsigned int max_depth = jsonk_parser_max_depth(parser);
+    const u8 *start = p, *key = NULL;
+    struct jsonk_value *root = NULL, *value;
+    size_t cap = ARRAY_SIZE(inline_open), depth = 0;
+    size_t extent, children, off;
+    u32 count, buckets;
+    u16 key_len = 0;
+    int ret;
     
-    list_for_each_entry(member, &obj->members, list) {
-        if (member->key_len == key_len && 
-            memcmp(member->key, key, key_len) == 0) {
-            return member;
+    while (true) {
+        extent = jsonk_bin_extent(p, len);
+        if (!extent || (!depth && extent != len))
+            goto invalid;
+        
+        /* A value nested depth containers deep, as in jsonk_parse_tree() */
+        if (depth >= max_depth) {
+            jsonk_reject(JSONK_LIMIT_DEPTH, "Nesting too deep (> %u)\n", max_depth);
+            goto error;
+        }
+        
+        count = 0;
+        children = 0;
+        if (p[0] == JSONK_BIN_ARRAY || p[0] == JSONK_BIN_OBJECT) {
+            children = jsonk_bin_tables(p, p[0], extent, &count, &buckets);
+            if (!children || (!count && children != extent))
+                goto invalid;
+        }
+        
+        value = jsonk_bin_value(parser, p, count);
+        if (!value)
+            goto error;
+        
+        if (!depth) {
+            root = value;
+        } else {
+            frame = &open[depth - 1];
+            if (key) {
+                ret = jsonk_object_add_member_tracked(&frame->container->u.object, (const char *)key,
+                                                      key_len, value, parser);
+                if (ret < 0) {
+                    jsonk_value_discard(value, parser);
+                    goto error;
+                }
+            } else {
+                frame->container->u.array.items[frame->container->u.array.size++] = value;
+            }
+            frame->pos += extent;
+        }
+        
+        if (count) {
+            /* Already attached, so the error path frees it */
+            if (depth == cap) {
+                open = jsonk_parser_nest_grow(parser, open, inline_open, &cap, sizeof(*open));
+                if (!open)
+                    goto error;
+            }
+            frame = &open[depth++];
+            frame->container = value;
+            frame->base = p;
+            frame->len = extent;
+            frame->entry_size = jsonk_bin_entry_size(buckets);
+            frame->table = children - (size_t)count * frame->entry_size;
+            frame->pos = children;
+            frame->count = count;
+            frame->next = 0;
+        }
+        
+        /* Find the next child, closing the containers that are complete */
+        while (depth && open[depth - 1].next == open[depth - 1].count) {
+            if (open[depth - 1].pos != open[depth - 1].len)
+                goto invalid;
+            depth--;
+        }
+        if (!depth)
+            break;
+        
+        frame = &open[depth - 1];
+        off = get_unaligned_le32(frame->base + frame->table + (size_t)frame->next * frame->entry_size);
+        if (off != frame->pos)
+            goto invalid;
+        if (frame->container->type == JSONK_VALUE_OBJECT) {
+            if (frame->len - off < 3)
+                goto invalid;
+            key_len = get_unaligned_le16(frame->base + off);
+            if (key_len > frame->len - off - 3)
+                goto invalid;
+            key = frame->base + off + 2;
+            /* Keys are written out verbatim, so they have to be valid key text */
+            if (!jsonk_string_body_valid((const char *)key, key_len))
+                goto invalid;
+            frame->pos = off + 2 + key_len;
+        } else {
+            key = NULL;
         }
+        frame->next++;
+        p = frame->base + frame->pos;
+        len = frame->len - frame->pos;
     }
     
+    jsonk_parser_nest_release(parser, open, inline_open);
+    return root;
+    
+invalid:
+    jsonk_warn("Invalid binary encoding at offset %zu\n",
+               (size_t)(p - start) + JSONK_BIN_HEADER_SIZE);
+error:
+    jsonk_parser_nest_release(parser, open, inline_open);
+    if (root)
+        jsonk_value_discard(root, parser);
     return NULL;
 }
 
-/**
- * Remove a member from a JSON object
- */
-int jsonk_object_remove_member(struct jsonk_object *obj, const char *key, size_t key_len)
+struct jsonk_value *jsonk_decode_binary(const void *buf, size_t len, const struct jsonk_parse_opts *opts)
 {
-    struct jsonk_member *member = jsonk_object_find_member(obj, key, key_len);
+    struct jsonk_parser parser;
+    struct jsonk_value *value;
+    size_t size;
     
-    if (!member)
-        return -ENOENT;
+    size = jsonk_bin_header(buf, len);
+    if (!size) {
+        jsonk_warn("Invalid binary encoding header\n");
+        return NULL;
+    }
     
-    list_del(&member->list);
-    obj->size--;
+    jsonk_parser_init(&parser, buf, size);
+    if (jsonk_parser_set_limits(&parser, opts) < 0)
+        return NULL;
     
-    if (member->key)
-        jsonk_memory_free(member->key, member->key_len + 1);
-    if (member->value)
-        jsonk_value_put(member->value);
-    kmem_cache_free(jsonk_member_cache, member);
+    /* The shortcuts taken from the input length only hold for JSON text */
+    parser.checks = JSONK_CHECK_ALL;
     
-    return 0;
+    if (parser.flags & JSONK_PARSE_ARENA) {
+        parser.arena = jsonk_arena_create(parser.gfp, parser.flags & JSONK_PARSE_POOL);
+        if (!parser.arena)
+            return NULL;
+    }
+    
+    value = jsonk_bin_decode(&parser, (const u8 *)buf + JSONK_BIN_HEADER_SIZE, size - JSONK_BIN_HEADER_SIZE);
+    if (!value && parser.arena)
+        jsonk_arena_destroy(parser.arena);
+    
+    return value;
 }
 
-/* ========================================================================
- * Array Manipulation Functions
- * ======================================================================== */
-
-/**
- * Add an element to a JSON array with tracking
+/*
+ * In-place accessors. The buffer may be shared with userspace, so every
+ * field is read once, checked against the extent of its value, and no
+ * result depends on having checked the buffer before.
  */
-static int jsonk_array_add_element_tracked(struct jsonk_array *arr, struct jsonk_value *value, struct jsonk_parser *parser)
+
+int jsonk_bin_root(const void *buf, size_t len, struct jsonk_bin_value *root)
 {
-    struct jsonk_array_element *element;
+    size_t size = jsonk_bin_header(buf, len);
     
-    /* Check array size limit */
-    if (arr->size >= JSONK_MAX_ARRAY_SIZE) {
-        printk(KERN_WARNING "JSONK: Array too large (%zu >= %d)\n", 
-               arr->size, JSONK_MAX_ARRAY_SIZE);
-        return -ENOSPC;
-    }
-    
-    if (!jsonk_element_cache) {
-        printk(KERN_ERR "JSONK: Element cache not initialized\n");
-        return -ENOMEM;
-    }
+    if (!size || !root)
+        return -EINVAL;
     
-    /* Check memory limit */
-    if (parser && parser->total_memory_used + sizeof(struct jsonk_array_element) > JSONK_MAX_TOTAL_MEMORY) {
-        printk(KERN_WARNING "JSONK: Memory limit exceeded for element creation\n");
-        return -ENOMEM;
+    root->data = (const u8 *)buf + JSONK_BIN_HEADER_SIZE;
+    root->len = jsonk_bin_extent(root->data, size - JSONK_BIN_HEADER_SIZE);
+    return root->len ? 0 : -EINVAL;
+}
+
+enum jsonk_value_type jsonk_bin_type(const struct jsonk_bin_value *value)
+{
+    switch (value->data[0]) {
+    case JSONK_BIN_NULL:
+        return JSONK_VALUE_NULL;
+    case JSONK_BIN_FALSE:
+    case JSONK_BIN_TRUE:
+        return JSONK_VALUE_BOOLEAN;
+    case JSONK_BIN_STRING:
+        return JSONK_VALUE_STRING;
+    case JSONK_BIN_ARRAY:
+        return JSONK_VALUE_ARRAY;
+    case JSONK_BIN_OBJECT:
+        return JSONK_VALUE_OBJECT;
+    default:
+        return JSONK_VALUE_NUMBER;
     }
+}
+
+size_t jsonk_bin_count(const struct jsonk_bin_value *value)
+{
+    u8 tag = READ_ONCE(value->data[0]);
+    u32 count, buckets;
     
-    element = kmem_cache_alloc(jsonk_element_cache, GFP_KERNEL);
-    if (!element)
-        return -ENOMEM;
-    
-    element->value = value;
-    list_add_tail(&element->list, &arr->elements);
-    arr->size++;
+    if (tag != JSONK_BIN_ARRAY && tag != JSONK_BIN_OBJECT)
+        return 0;
+    return jsonk_bin_tables(value->data, tag, value->len, &count, &buckets) ? count : 0;
+}
+
+/**
+ * Child of a container at offset off, which must lie past its tables
+ */
+static int jsonk_bin_child(const struct jsonk_bin_value *parent, size_t first, size_t off,
+                           struct jsonk_bin_value *out)
+{
+    size_t extent;
     
-    if (parser) {
-        parser->total_memory_used += sizeof(struct jsonk_array_element);
-    }
+    if (off < first || off >= parent->len)
+        return -EINVAL;
+    extent = jsonk_bin_extent(parent->data + off, parent->len - off);
+    if (!extent)
+        return -EINVAL;
     
+    out->data = parent->data + off;
+    out->len = extent;
     return 0;
 }
 
-/* ========================================================================
- * Parser Implementation
- * ======================================================================== */
-
-static struct jsonk_value *jsonk_parse_value(struct jsonk_parser *parser);
+int jsonk_bin_index(const struct jsonk_bin_value *array, size_t idx, struct jsonk_bin_value *out)
+{
+    u32 count, buckets;
+    size_t first;
+    
+    if (!array || !out || READ_ONCE(array->data[0]) != JSONK_BIN_ARRAY)
+        return -EINVAL;
+    first = jsonk_bin_tables(array->data, JSONK_BIN_ARRAY, array->len, &count, &buckets);
+    if (!first)
+        return -EINVAL;
+    if (idx >= count)
+        return -ENOENT;
+    
+    return jsonk_bin_child(array, first,
+                           get_unaligned_le32(array->data + JSONK_BIN_ARRAY_HEADER + idx * 4), out);
+}
 
 /**
- * Parse a JSON object
+ * Key and value of the member described by an entry of an object's table
  */
-static struct jsonk_value *jsonk_parse_object(struct jsonk_parser *parser)
+static int jsonk_bin_entry(const struct jsonk_bin_value *object, size_t first, const u8 *entry,
+                           const char **key, size_t *key_len, struct jsonk_bin_value *out)
 {
-    struct jsonk_value *object_value;
-    struct jsonk_token token;
+    size_t off = get_unaligned_le32(entry);
+    size_t len;
+    
+    if (off < first || off > object->len || object->len - off < 3)
+        return -EINVAL;
+    len = get_unaligned_le16(object->data + off);
+    if (len > object->len - off - 3)
+        return -EINVAL;
+    
+    *key = (const char *)object->data + off + 2;
+    *key_len = len;
+    return jsonk_bin_child(object, first, off + 2 + len, out);
+}
+
+int jsonk_bin_member_at(const struct jsonk_bin_value *object, size_t idx,
+                        const char **key, size_t *key_len, struct jsonk_bin_value *out)
+{
+    u32 count, buckets;
+    size_t first;
+    
+    if (!object || !key || !key_len || !out || READ_ONCE(object->data[0]) != JSONK_BIN_OBJECT)
+        return -EINVAL;
+    first = jsonk_bin_tables(object->data, JSONK_BIN_OBJECT, object->len, &count, &buckets);
+    if (!first)
+        return -EINVAL;
+    if (idx >= count)
+        return -ENOENT;
+    
+    return jsonk_bin_entry(object, first, object->data + JSONK_BIN_OBJECT_HEADER + buckets * 4 +
+                           idx * jsonk_bin_entry_size(buckets), key, key_len, out);
+}
+
+int jsonk_bin_member(const struct jsonk_bin_value *object, const char *key, size_t key_len,
+                     struct jsonk_bin_value *out)
+{
+    u32 hash = 0, count, buckets, i, steps;
+    const u8 *entries, *entry;
+    struct jsonk_bin_value found;
+    const char *entry_key;
+    size_t first, entry_len;
     int ret;
     
-    object_value = jsonk_value_create(JSONK_VALUE_OBJECT);
-    if (!object_value)
-        return NULL;
+    if (!object || !key || !out || READ_ONCE(object->data[0]) != JSONK_BIN_OBJECT)
+        return -EINVAL;
+    first = jsonk_bin_tables(object->data, JSONK_BIN_OBJECT, object->len, &count, &buckets);
+    if (!first)
+        return -EINVAL;
     
-    /* Skip the opening brace */
-    ret = jsonk_next_token(parser, &token);
-    if (ret < 0 || token.type != JSONK_TOKEN_OBJECT_START) {
-        jsonk_value_put(object_value);
-        return NULL;
+    entries = object->data + JSONK_BIN_OBJECT_HEADER + buckets * 4;
+    if (buckets) {
+        hash = jsonk_bin_hash(key, key_len);
+        i = get_unaligned_le32(object->data + JSONK_BIN_OBJECT_HEADER + (hash & (buckets - 1)) * 4);
+    } else {
+        i = 1;
     }
     
-    /* Check for empty object */
-    ret = jsonk_next_token(parser, &token);
-    if (ret < 0) {
-        jsonk_value_put(object_value);
-        return NULL;
+    /* Bucket chains are bounded by the member count, whatever the links say */
+    for (steps = 0; i && steps < count; steps++) {
+        if (i > count)
+            return -EINVAL;
+        entry = entries + (size_t)(i - 1) * jsonk_bin_entry_size(buckets);
+        if (!buckets || get_unaligned_le32(entry + 4) == hash) {
+            ret = jsonk_bin_entry(object, first, entry, &entry_key, &entry_len, &found);
+            if (ret < 0)
+                return ret;
+            if (entry_len == key_len && memcmp(entry_key, key, key_len) == 0) {
+                *out = found;
+                return 0;
+            }
+        }
+        i = buckets ? get_unaligned_le32(entry + 8) : i + 1;
     }
+    return -ENOENT;
+}
+
+int jsonk_bin_get_path(const struct jsonk_bin_value *root, const char *path, size_t path_len,
+                       struct jsonk_bin_value *out)
+{
+    struct jsonk_path_iter iter = { .pos = path, .end = path + path_len };
+    struct jsonk_path_component comp;
+    struct jsonk_bin_value curr;
+    int ret;
     
-    if (token.type == JSONK_TOKEN_OBJECT_END)
-        return object_value;
+    if (!root || !path || !out)
+        return -EINVAL;
     
-    /* Parse key-value pairs */
-    while (true) {
-        /* Expect a string key */
-        if (token.type != JSONK_TOKEN_STRING) {
-            jsonk_value_put(object_value);
-            return NULL;
-        }
-        
-        /* Extract key string */
-        char *key = jsonk_memory_alloc(token.len + 1);
-        if (!key)
-            return NULL;
-        
-        memcpy(key, token.start, token.len);
-        key[token.len] = '\0';
-        
-        /* Expect colon */
-        ret = jsonk_next_token(parser, &token);
-        if (ret < 0 || token.type != JSONK_TOKEN_COLON) {
-            jsonk_memory_free(key, token.len + 1);
-            jsonk_value_put(object_value);
-            return NULL;
-        }
-        
-        /* Parse value */
-        struct jsonk_value *member_value = jsonk_parse_value(parser);
-        if (!member_value) {
-            jsonk_memory_free(key, token.len + 1);
-            jsonk_value_put(object_value);
-            return NULL;
-        }
-        
-        /* Add member to object */
-        ret = jsonk_object_add_member_tracked(&object_value->u.object, key, token.len, member_value, parser);
-        jsonk_memory_free(key, token.len + 1);
-        if (ret < 0) {
-            jsonk_value_put(member_value);
-            jsonk_value_put(object_value);
-            return NULL;
-        }
-        
-        /* Check for comma or end of object */
-        ret = jsonk_next_token(parser, &token);
-        if (ret < 0) {
-            jsonk_value_put(object_value);
-            return NULL;
-        }
-        
-        if (token.type == JSONK_TOKEN_OBJECT_END)
-            break;
-        
-        if (token.type != JSONK_TOKEN_COMMA) {
-            jsonk_value_put(object_value);
-            return NULL;
-        }
-        
-        /* Get next key */
-        ret = jsonk_next_token(parser, &token);
-        if (ret < 0) {
-            jsonk_value_put(object_value);
-            return NULL;
-        }
+    curr = *root;
+    while ((ret = jsonk_path_next(&iter, &comp)) > 0) {
+        if (jsonk_bin_type(&curr) != (comp.is_index ? JSONK_VALUE_ARRAY : JSONK_VALUE_OBJECT))
+            return -ENOENT;
+        if (comp.is_index)
+            ret = jsonk_bin_index(&curr, comp.index, &curr);
+        else
+            ret = jsonk_bin_member(&curr, comp.key, comp.key_len, &curr);
+        if (ret < 0)
+            return ret;
     }
+    if (ret < 0)
+        return -EINVAL;
     
-    return object_value;
+    *out = curr;
+    return 0;
 }
 
-/**
- * Parse a JSON array
- */
-static struct jsonk_value *jsonk_parse_array(struct jsonk_parser *parser)
+int jsonk_bin_get_string(const struct jsonk_bin_value *value, const char **str, size_t *len)
 {
-    struct jsonk_value *array_value;
-    struct jsonk_token token;
-    int ret;
+    u32 size;
     
-    array_value = jsonk_value_create(JSONK_VALUE_ARRAY);
-    if (!array_value)
-        return NULL;
+    if (!value || !str || !len || READ_ONCE(value->data[0]) != JSONK_BIN_STRING || value->len < 5)
+        return -EINVAL;
+    size = get_unaligned_le32(value->data + 1);
+    if (size > value->len - 5)
+        return -EINVAL;
     
-    /* Consume the opening bracket */
-    ret = jsonk_next_token(parser, &token);
-    if (ret < 0 || token.type != JSONK_TOKEN_ARRAY_START) {
-        jsonk_value_put(array_value);
-        return NULL;
-    }
+    *str = (const char *)value->data + 5;
+    *len = size;
+    return 0;
+}
+
+int jsonk_bin_get_bool(const struct jsonk_bin_value *value, bool *out)
+{
+    u8 tag;
     
-    /* Parse array elements */
-    while (1) {
-        /* Peek at the next token to check for empty array */
-        jsonk_skip_whitespace(parser);
-        if (parser->pos < parser->buffer_len && parser->buffer[parser->pos] == ']') {
-            /* Empty array, consume the closing bracket */
-            parser->pos++;
-            break;
-        }
-        
-        /* Parse the element value */
-        struct jsonk_value *element_value = jsonk_parse_value(parser);
-        if (!element_value) {
-            jsonk_value_put(array_value);
-            return NULL;
-        }
-        
-        /* Add the element to the array */
-        ret = jsonk_array_add_element_tracked(&array_value->u.array, element_value, parser);
-        if (ret < 0) {
-            jsonk_value_put(element_value);
-            jsonk_value_put(array_value);
-            return NULL;
-        }
-        
-        /* Look ahead for comma or end of array */
-        ret = jsonk_next_token(parser, &token);
-        if (ret < 0) {
-            jsonk_value_put(array_value);
-            return NULL;
-        }
-        
-        if (token.type == JSONK_TOKEN_ARRAY_END)
-            break;
-        
-        if (token.type != JSONK_TOKEN_COMMA) {
-            jsonk_value_put(array_value);
-            return NULL;
-        }
-    }
+    if (!value || !out)
+        return -EINVAL;
+    tag = READ_ONCE(value->data[0]);
+    if (tag != JSONK_BIN_TRUE && tag != JSONK_BIN_FALSE)
+        return -EINVAL;
     
-    return array_value;
+    *out = tag == JSONK_BIN_TRUE;
+    return 0;
 }
 
 /**
- * Parse a JSON value (recursive)
+ * Read an integer whose tag has already been read
  */
-static struct jsonk_value *jsonk_parse_value(struct jsonk_parser *parser)
+static int jsonk_bin_integer(const struct jsonk_bin_value *value, u8 tag, s64 *out)
 {
-    struct jsonk_token token;
-    struct jsonk_value *value = NULL;
-    int ret;
+    const u8 *p = value->data + 1;
+    u64 uinteger;
+    size_t width;
     
-    /* Check depth limit */
-    if (parser->depth >= JSONK_MAX_DEPTH)
-        return NULL;
-    
-    parser->depth++;
-    
-    ret = jsonk_next_token(parser, &token);
-    if (ret < 0) {
-        parser->depth--;
-        return NULL;
-    }
-    
-    switch (token.type) {
-    case JSONK_TOKEN_OBJECT_START:
-        /* Put back the token and parse object */
-        parser->pos -= token.len;
-        value = jsonk_parse_object(parser);
-        break;
-        
-    case JSONK_TOKEN_ARRAY_START:
-        /* Put back the token and parse array */
-        parser->pos -= token.len;
-        value = jsonk_parse_array(parser);
-        break;
-        
-    case JSONK_TOKEN_STRING:
-        value = jsonk_value_create_string_tracked(token.start, token.len, parser);
-        break;
-        
-    case JSONK_TOKEN_NUMBER:
-        value = jsonk_value_create_number(token.start, token.len);
+    switch (tag) {
+    case JSONK_BIN_INT8:
+        width = 1;
         break;
-        
-    case JSONK_TOKEN_TRUE:
-        value = jsonk_value_create_boolean(true);
+    case JSONK_BIN_INT16:
+        width = 2;
         break;
-        
-    case JSONK_TOKEN_FALSE:
-        value = jsonk_value_create_boolean(false);
+    case JSONK_BIN_INT32:
+        width = 4;
         break;
-        
-    case JSONK_TOKEN_NULL:
-        value = jsonk_value_create_null();
+    case JSONK_BIN_INT64:
+    case JSONK_BIN_UINT64:
+        width = 8;
         break;
-        
+    case JSONK_BIN_DECIMAL:
+        return -ERANGE;
     default:
-        /* Invalid token */
-        break;
+        return -EINVAL;
     }
+    if (width > value->len - 1)
+        return -EINVAL;
     
-    parser->depth--;
-    return value;
+    switch (tag) {
+    case JSONK_BIN_INT8:
+        *out = (s8)p[0];
+        return 0;
+    case JSONK_BIN_INT16:
+        *out = (s16)get_unaligned_le16(p);
+        return 0;
+    case JSONK_BIN_INT32:
+        *out = (s32)get_unaligned_le32(p);
+        return 0;
+    case JSONK_BIN_INT64:
+        *out = (s64)get_unaligned_le64(p);
+        return 0;
+    default:
+        uinteger = get_unaligned_le64(p);
+        if (uinteger > S64_MAX)
+            return -ERANGE;
+        *out = uinteger;
+        return 0;
+    }
 }
 
-/**
- * Parse a JSON string into an in-memory structure
- */
-struct jsonk_value *jsonk_parse(const char *json_str, size_t json_len)
+int jsonk_bin_get_s64(const struct jsonk_bin_value *value, s64 *out)
 {
-    struct jsonk_parser parser;
-    struct jsonk_value *value;
+    if (!value || !out)
+        return -EINVAL;
     
-    if (!json_str || json_len == 0)
-        return NULL;
+    return jsonk_bin_integer(value, READ_ONCE(value->data[0]), out);
+}
+
+int jsonk_bin_get_u64(const struct jsonk_bin_value *value, u64 *out)
+{
+    s64 integer;
+    u8 tag;
+    int ret;
     
-    jsonk_parser_init(&parser, json_str, json_len);
-    value = jsonk_parse_value(&parser);
+    if (!value || !out)
+        return -EINVAL;
     
-    return value;
+    tag = READ_ONCE(value->data[0]);
+    if (tag == JSONK_BIN_UINT64) {
+        if (value->len < 9)
+            return -EINVAL;
+        *out = get_unaligned_le64(value->data + 1);
+        return 0;
+    }
+    
+    ret = jsonk_bin_integer(value, tag, &integer);
+    if (ret < 0)
+        return ret;
+    if (integer < 0)
+        return -ERANGE;
+    *out = integer;
+    return 0;
 }
 
 /* ========================================================================
- * Serialization Implementation
+ * Copy-on-Write Snapshots
  * ======================================================================== */
 
 /**
- * Serialize a JSON value structure to a string
+ * Take a snapshot of a tree
  */
-int jsonk_serialize(struct jsonk_value *value, char *buffer, size_t buffer_size, size_t *written)
+struct jsonk_value *jsonk_value_snapshot(struct jsonk_value *value)
 {
-    size_t pos = 0;
-    struct jsonk_member *member;
-    struct jsonk_array_element *element;
-    bool first;
-    
-    if (!value || !buffer || !written)
-        return -EINVAL;
-    
-    *written = 0;
-    
-    switch (value->type) {
-    case JSONK_VALUE_NULL:
-        if (pos + 4 >= buffer_size)
-            return -EOVERFLOW;
-        memcpy(buffer + pos, "null", 4);
-        pos += 4;
-        break;
-        
-    case JSONK_VALUE_BOOLEAN:
-        if (value->u.boolean) {
-            if (pos + 4 >= buffer_size)
-                return -EOVERFLOW;
-            memcpy(buffer + pos, "true", 4);
-            pos += 4;
-        } else {
-            if (pos + 5 >= buffer_size)
-                return -EOVERFLOW;
-            memcpy(buffer + pos, "false", 5);
-            pos += 5;
-        }
-        break;
-        
-    case JSONK_VALUE_NUMBER:
-        /* Simple integer serialization for now */
-        if (value->u.number.is_integer) {
-            int len = snprintf(buffer + pos, buffer_size - pos, "%lld", 
-                             value->u.number.is_negative ? -value->u.number.integer : value->u.number.integer);
-            if (len < 0 || pos + len >= buffer_size)
-                return -EOVERFLOW;
-            pos += len;
-        } else {
-            /* Handle fractional numbers - simplified */
-            int len = snprintf(buffer + pos, buffer_size - pos, "%lld.%u", 
-                             value->u.number.is_negative ? -value->u.number.integer : value->u.number.integer,
-                             value->u.number.fraction);
-            if (len < 0 || pos + len >= buffer_size)
-                return -EOVERFLOW;
-            pos += len;
-        }
-        break;
-        
-    case JSONK_VALUE_STRING:
-        /* Output with quotes and proper escaping */
-        if (pos + 1 >= buffer_size)
-            return -EOVERFLOW;
-        
-        buffer[pos++] = '"';
-        
-        /* Copy string with escaping */
-        for (size_t i = 0; i < value->u.string.len; i++) {
-            char c = value->u.string.data[i];
-            
-            /* Check for characters that need escaping */
-            if (c == '"' || c == '\\') {
-                if (pos + 2 >= buffer_size)
-                    return -EOVERFLOW;
-                buffer[pos++] = '\\';
-                buffer[pos++] = c;
-            } else if (c == '\b') {
-                if (pos + 2 >= buffer_size)
-                    return -EOVERFLOW;
-                buffer[pos++] = '\\';
-                buffer[pos++] = 'b';
-            } else if (c == '\f') {
-                if (pos + 2 >= buffer_size)
-                    return -EOVERFLOW;
-                buffer[pos++] = '\\';
-                buffer[pos++] = 'f';
-            } else if (c == '\n') {
-                if (pos + 2 >= buffer_size)
-                    return -EOVERFLOW;
-                buffer[pos++] = '\\';
-                buffer[pos++] = 'n';
-            } else if (c == '\r') {
-                if (pos + 2 >= buffer_size)
-                    return -EOVERFLOW;
-                buffer[pos++] = '\\';
-                buffer[pos++] = 'r';
-            } else if (c == '\t') {
-                if (pos + 2 >= buffer_size)
-                    return -EOVERFLOW;
-                buffer[pos++] = '\\';
-                buffer[pos++] = 't';
-            } else {
-                if (pos + 1 >= buffer_size)
-                    return -EOVERFLOW;
-                buffer[pos++] = c;
-            }
-        }
-        
-        if (pos + 1 >= buffer_size)
-            return -EOVERFLOW;
-        buffer[pos++] = '"';
-        break;
-        
-    case JSONK_VALUE_OBJECT:
-        if (pos + 1 >= buffer_size)
-            return -EOVERFLOW;
-        buffer[pos++] = '{';
-        
-        first = true;
-        list_for_each_entry(member, &value->u.object.members, list) {
-            if (!first) {
-                if (pos + 1 >= buffer_size)
-                    return -EOVERFLOW;
-                buffer[pos++] = ',';
-            }
-            first = false;
-            
-            /* Write key */
-            if (pos + member->key_len + 3 >= buffer_size)
-                return -EOVERFLOW;
-            buffer[pos++] = '"';
-            memcpy(buffer + pos, member->key, member->key_len);
-            pos += member->key_len;
-            buffer[pos++] = '"';
-            buffer[pos++] = ':';
-            
-            /* Write value */
-            size_t value_written;
-            int ret = jsonk_serialize(member->value, buffer + pos, buffer_size - pos, &value_written);
-            if (ret < 0)
-                return ret;
-            pos += value_written;
-        }
-        
-        if (pos + 1 >= buffer_size)
-            return -EOVERFLOW;
-        buffer[pos++] = '}';
-        break;
-        
-    case JSONK_VALUE_ARRAY:
-        if (pos + 1 >= buffer_size)
-            return -EOVERFLOW;
-        buffer[pos++] = '[';
-        
-        first = true;
-        list_for_each_entry(element, &value->u.array.elements, list) {
-            if (!first) {
-                if (pos + 1 >= buffer_size)
-                    return -EOVERFLOW;
-                buffer[pos++] = ',';
-            }
-            first = false;
-            
-            /* Write element */
-            size_t element_written;
-            int ret = jsonk_serialize(element->value, buffer + pos, buffer_size - pos, &element_written);
-            if (ret < 0)
-                return ret;
-            pos += element_written;
-        }
-        
-        if (pos + 1 >= buffer_size)
-            return -EOVERFLOW;
-        buffer[pos++] = ']';
-        break;
+    return jsonk_value_get(value);
+}
+
+/**
+ * Set a value by path, copying shared nodes on the way down
+ */
+int jsonk_cow_set_value_by_path(struct jsonk_value **root, const char *path, size_t path_len,
+                                struct jsonk_value *value)
+{
+    struct jsonk_path_iter iter = { .pos = path, .end = path + path_len, .cow = true };
+    struct jsonk_value *copy;
+    
+    if (!root || !*root || !path || path_len == 0 || !value)
+        return -EINVAL;
+    if ((*root)->type != JSONK_VALUE_OBJECT && (*root)->type != JSONK_VALUE_ARRAY)
+        return -EINVAL;
+    
+    if (jsonk_value_shared(*root)) {
+        copy = jsonk_value_shallow_copy(*root);
+        if (!copy)
+            return -ENOMEM;
+        jsonk_value_put(*root);
+        *root = copy;
     }
     
-    *written = pos;
-    return 0;
+    return jsonk_path_iter_set(*root, &iter, value);
+}
+
+static int jsonk_cow_patch(struct jsonk_value **root, struct jsonk_value *patch)
+{
+    struct jsonk_value *copy;
+    bool changed;
+    int ret;
+    
+    if (!root || !*root || !patch || (*root)->type != JSONK_VALUE_OBJECT ||
+        patch->type != JSONK_VALUE_OBJECT)
+        return JSONK_PATCH_ERROR_TYPE;
+    
+    /* The current version is left alone until the new one is complete */
+    copy = jsonk_value_shallow_copy(*root);
+    if (!copy)
+        return JSONK_PATCH_ERROR_MEMORY;
+    
+    ret = jsonk_merge_objects(&copy->u.object, &patch->u.object, &changed, NULL, JSONK_MERGE_COW);
+    if (ret < 0 || !changed) {
+        jsonk_value_put(copy);
+        return ret < 0 ? JSONK_PATCH_ERROR_MEMORY : JSONK_PATCH_NO_CHANGE;
+    }
+    
+    jsonk_value_put(*root);
+    *root = copy;
+    return JSONK_PATCH_SUCCESS;
+}
+
+/**
+ * Apply a JSON patch as a new version of a tree
+ */
+int jsonk_cow_apply_patch(struct jsonk_value **root, struct jsonk_value *patch)
+{
+    u64 start = jsonk_patch_begin(JSONK_PATCH_KIND_COW);
+    
+    return jsonk_patch_end(JSONK_PATCH_KIND_COW, start, jsonk_cow_patch(root, patch));
 }
 
 /* ========================================================================
- * Deep Copy Implementation
+ * RCU Documents
  * ======================================================================== */
 
+static void jsonk_doc_version_release(struct percpu_ref *ref)
+{
+    struct jsonk_doc_version *version = container_of(ref, struct jsonk_doc_version, ref);
+    
+    jsonk_value_put(version->root);
+    percpu_ref_exit(&version->ref);
+    kfree(version);
+}
+
 /**
- * Deep copy a JSON value
+ * Wrap a tree for publishing, taking over the reference on root
  */
-struct jsonk_value *jsonk_value_deep_copy(struct jsonk_value *source, int current_depth)
+static struct jsonk_doc_version *jsonk_doc_version_create(struct jsonk_value *root)
 {
-    struct jsonk_value *copy = NULL;
-    struct jsonk_member *member;
-    struct jsonk_array_element *element;
+    struct jsonk_doc_version *version;
     
-    if (!source || current_depth > JSONK_MAX_DEPTH)
-        return NULL;
+    version = jsonk_counted(kmalloc(sizeof(*version), GFP_KERNEL));
+    if (!version)
+        goto fail;
     
-    switch (source->type) {
-    case JSONK_VALUE_NULL:
-        copy = jsonk_value_create_null();
-        break;
-        
-    case JSONK_VALUE_BOOLEAN:
-        copy = jsonk_value_create_boolean(source->u.boolean);
-        break;
-        
-    case JSONK_VALUE_NUMBER:
-        copy = jsonk_value_create(JSONK_VALUE_NUMBER);
-        if (copy) {
-            copy->u.number = source->u.number;
-        }
-        break;
-        
-    case JSONK_VALUE_STRING:
-        copy = jsonk_value_create_string_tracked(source->u.string.data, source->u.string.len, NULL);
-        break;
-        
-    case JSONK_VALUE_OBJECT:
-        copy = jsonk_value_create(JSONK_VALUE_OBJECT);
-        if (copy) {
-            list_for_each_entry(member, &source->u.object.members, list) {
-                struct jsonk_value *value_copy = jsonk_value_deep_copy(member->value, current_depth + 1);
-                if (value_copy) {
-                    jsonk_object_add_member_tracked(&copy->u.object, member->key, member->key_len, value_copy, NULL);
-                }
-            }
-        }
-        break;
-        
-    case JSONK_VALUE_ARRAY:
-        copy = jsonk_value_create(JSONK_VALUE_ARRAY);
-        if (copy) {
-            list_for_each_entry(element, &source->u.array.elements, list) {
-                struct jsonk_value *value_copy = jsonk_value_deep_copy(element->value, current_depth + 1);
-                if (value_copy) {
-                    jsonk_array_add_element_tracked(&copy->u.array, value_copy, NULL);
-                }
-            }
-        }
-        break;
+    /* The initial reference belongs to the document */
+    if (percpu_ref_init(&version->ref, jsonk_doc_version_release, 0, GFP_KERNEL) < 0) {
+        kfree(version);
+        goto fail;
     }
     
-    return copy;
+    version->root = root;
+    return version;
+    
+fail:
+    jsonk_value_put(root);
+    return NULL;
 }
 
-/* ========================================================================
- * JSON Patch Implementation
- * ======================================================================== */
+/**
+ * Drop the document's reference on a version
+ * 
+ * The tree is put once the switch out of per-CPU mode has waited out a
+ * grace period and the last pin is gone.
+ */
+static void jsonk_doc_retire(struct jsonk_doc_version *version)
+{
+    if (version)
+        percpu_ref_kill(&version->ref);
+}
 
 /**
- * Parse a path component and find the next dot
- * @param path Current path position
- * @param path_len Remaining path length
- * @param component_len Output: length of current component
- * @return Pointer to next component or NULL if this is the last
+ * Initialize a document holder
  */
-static const char *jsonk_parse_path_component(const char *path, size_t path_len, size_t *component_len)
+int jsonk_doc_init(struct jsonk_doc *doc, struct jsonk_value *root)
 {
-    const char *dot = memchr(path, '.', path_len);
-    if (dot) {
-        *component_len = dot - path;
-        return dot + 1; /* Skip the dot */
-    } else {
-        *component_len = path_len;
-        return NULL; /* Last component */
+    struct jsonk_doc_version *version = NULL;
+    
+    mutex_init(&doc->lock);
+    
+    if (root) {
+        version = jsonk_doc_version_create(root);
+        if (!version) {
+            RCU_INIT_POINTER(doc->current_version, NULL);
+            return -ENOMEM;
+        }
     }
+    
+    RCU_INIT_POINTER(doc->current_version, version);
+    return 0;
 }
 
 /**
- * Get a value from a JSON object using a dot-separated path
+ * Release the current version of a document
  */
-struct jsonk_value *jsonk_get_value_by_path(struct jsonk_value *root, const char *path, size_t path_len)
+void jsonk_doc_destroy(struct jsonk_doc *doc)
 {
-    struct jsonk_value *curr = root;
-    const char *current_path = path;
-    size_t remaining_len = path_len;
+    struct jsonk_doc_version *old;
     
-    if (!root || !path || path_len == 0)
-        return NULL;
+    mutex_lock(&doc->lock);
+    old = rcu_dereference_protected(doc->current_version, lockdep_is_held(&doc->lock));
+    RCU_INIT_POINTER(doc->current_version, NULL);
+    mutex_unlock(&doc->lock);
     
-    /* Root must be an object */
-    if (root->type != JSONK_VALUE_OBJECT)
-        return NULL;
+    jsonk_doc_retire(old);
+    mutex_destroy(&doc->lock);
+}
+
+/**
+ * Take a reference on the current version of a document
+ */
+struct jsonk_value *jsonk_doc_get(struct jsonk_doc *doc)
+{
+    struct jsonk_value *root;
     
-    while (remaining_len > 0) {
-        size_t component_len;
-        const char *next_path = jsonk_parse_path_component(current_path, remaining_len, &component_len);
-        
-        /* Current value must be an object to continue */
-        if (curr->type != JSONK_VALUE_OBJECT)
-            return NULL;
-        
-        /* Find the member */
-        struct jsonk_member *member = jsonk_object_find_member(&curr->u.object, current_path, component_len);
-        if (!member)
-            return NULL;
-        
-        curr = member->value;
-        
-        /* Move to next component */
-        if (next_path) {
-            current_path = next_path;
-            remaining_len = path_len - (next_path - path);
-        } else {
-            /* This was the last component */
-            break;
-        }
-    }
+    /* A version is only put after a grace period, so its count is live here */
+    rcu_read_lock();
+    root = jsonk_value_get(jsonk_doc_deref(doc));
+    rcu_read_unlock();
     
-    return curr;
+    return root;
 }
 
 /**
- * Set a value in a JSON object using a dot-separated path
+ * Pin the current version of a document
  */
-int jsonk_set_value_by_path(struct jsonk_value *root, const char *path, size_t path_len, struct jsonk_value *value)
+struct jsonk_doc_version *jsonk_doc_pin(struct jsonk_doc *doc)
 {
-    struct jsonk_value *curr = root;
-    const char *current_path = path;
-    size_t remaining_len = path_len;
+    struct jsonk_doc_version *version;
     
-    if (!root || !path || path_len == 0 || !value)
-        return -EINVAL;
+    rcu_read_lock();
+    version = rcu_dereference(doc->current_version);
+    if (version && !percpu_ref_tryget(&version->ref))
+        version = NULL;
+    rcu_read_unlock();
     
-    /* Root must be an object */
-    if (root->type != JSONK_VALUE_OBJECT)
-        return -EINVAL;
+    return version;
+}
+
+/**
+ * Release a pinned version
+ */
+void jsonk_doc_unpin(struct jsonk_doc_version *version)
+{
+    percpu_ref_put(&version->ref);
+}
+
+/*
+ * Swap in a new version; called with the document lock held.
+ * Takes over the reference on root, also on failure.
+ */
+static int jsonk_doc_swap(struct jsonk_doc *doc, struct jsonk_value *root)
+{
+    struct jsonk_doc_version *version, *old;
     
-    while (remaining_len > 0) {
-        size_t component_len;
-        const char *next_path = jsonk_parse_path_component(current_path, remaining_len, &component_len);
-        
-        /* Current value must be an object to continue */
-        if (curr->type != JSONK_VALUE_OBJECT)
-            return -EINVAL;
-        
-        if (next_path) {
-            /* Not the last component - ensure intermediate object exists */
-            struct jsonk_member *member = jsonk_object_find_member(&curr->u.object, current_path, component_len);
-            if (!member) {
-                /* Create intermediate object */
-                struct jsonk_value *intermediate = jsonk_value_create(JSONK_VALUE_OBJECT);
-                if (!intermediate)
-                    return -ENOMEM;
-                
-                int ret = jsonk_object_add_member_tracked(&curr->u.object, current_path, component_len, intermediate, NULL);
-                if (ret < 0) {
-                    jsonk_value_put(intermediate);
-                    return ret;
-                }
-                curr = intermediate;
-            } else {
-                /* Use existing member, but ensure it's an object */
-                if (member->value->type != JSONK_VALUE_OBJECT) {
-                    /* Replace with empty object */
-                    struct jsonk_value *old_value = member->value;
-                    struct jsonk_value *new_object = jsonk_value_create(JSONK_VALUE_OBJECT);
-                    if (!new_object)
-                        return -ENOMEM;
-                    
-                    member->value = new_object;
-                    jsonk_value_put(old_value);
-                }
-                curr = member->value;
-            }
-            
-            /* Move to next component */
-            current_path = next_path;
-            remaining_len = path_len - (next_path - path);
-        } else {
-            /* Last component - set the value */
-            struct jsonk_member *member = jsonk_object_find_member(&curr->u.object, current_path, component_len);
-            struct jsonk_value *value_copy = jsonk_value_deep_copy(value, 1);
-            if (!value_copy)
-                return -ENOMEM;
-            
-            if (member) {
-                /* Replace existing value */
-                struct jsonk_value *old_value = member->value;
-                member->value = value_copy;
-                jsonk_value_put(old_value);
-            } else {
-                /* Add new member */
-                int ret = jsonk_object_add_member(&curr->u.object, current_path, component_len, value_copy);
-                if (ret < 0) {
-                    jsonk_value_put(value_copy);
-                    return ret;
-                }
-            }
-            break;
-        }
-    }
+    version = jsonk_doc_version_create(root);
+    if (!version)
+        return -ENOMEM;
     
+    old = rcu_dereference_protected(doc->current_version, lockdep_is_held(&doc->lock));
+    rcu_assign_pointer(doc->current_version, version);
+    jsonk_doc_retire(old);
     return 0;
 }
 
 /**
- * Merge two JSON objects (fail-fast for atomicity)
+ * Publish a new version of a document
  */
-static int jsonk_merge_objects(struct jsonk_object *target, struct jsonk_object *patch, bool *changed)
+int jsonk_doc_publish(struct jsonk_doc *doc, struct jsonk_value *root)
 {
-    struct jsonk_member *member;
+    int ret;
     
-    *changed = false;
+    mutex_lock(&doc->lock);
+    ret = jsonk_doc_swap(doc, root);
+    mutex_unlock(&doc->lock);
     
-    list_for_each_entry(member, &patch->members, list) {
-        struct jsonk_member *target_member = jsonk_object_find_member(target, member->key, member->key_len);
-        
-        /* Check if patch value is empty (should remove the key) */
-        bool is_empty = false;
-        if (member->value->type == JSONK_VALUE_NULL) {
-            is_empty = true;
-        } else if (member->value->type == JSONK_VALUE_STRING && member->value->u.string.len == 0) {
-            is_empty = true;
-        } else if (member->value->type == JSONK_VALUE_OBJECT && member->value->u.object.size == 0) {
-            is_empty = true;
-        } else if (member->value->type == JSONK_VALUE_ARRAY && member->value->u.array.size == 0) {
-            is_empty = true;
-        }
-        
-        if (is_empty) {
-            /* Remove the key if it exists in target */
-            if (target_member) {
-                int ret = jsonk_object_remove_member(target, member->key, member->key_len);
-                if (ret < 0)
-                    return ret;
-                *changed = true;
-            }
-            continue;
-        }
-        
-        if (!target_member) {
-            /* Key doesn't exist in target, add it */
-            struct jsonk_value *value_copy = jsonk_value_deep_copy(member->value, 1);
-            if (!value_copy)
-                return -ENOMEM;
-            
-            int ret = jsonk_object_add_member(target, member->key, member->key_len, value_copy);
-            if (ret < 0) {
-                jsonk_value_put(value_copy);
-                return ret;
-            }
-            *changed = true;
-        } else {
-            /* Key exists in target, update it */
-            if (member->value->type == JSONK_VALUE_OBJECT && target_member->value->type == JSONK_VALUE_OBJECT) {
-                /* Recursive merge for objects */
-                bool sub_changed = false;
-                int ret = jsonk_merge_objects(&target_member->value->u.object, &member->value->u.object, &sub_changed);
-                if (ret < 0)
-                    return ret;
-                if (sub_changed)
-                    *changed = true;
-            } else {
-                /* Replace value for non-objects */
-                struct jsonk_value *new_value = jsonk_value_deep_copy(member->value, 1);
-                if (!new_value)
-                    return -ENOMEM;
-                
-                struct jsonk_value *old_value = target_member->value;
-                target_member->value = new_value;
-                jsonk_value_put(old_value);
-                *changed = true;
-            }
-        }
-    }
+    return ret;
+}
+
+/*
+ * Take a private reference on the current root for a writer; with it the
+ * live root counts as shared, so the copy-on-write writers copy it
+ */
+static struct jsonk_value *jsonk_doc_writer_root(struct jsonk_doc *doc)
+{
+    struct jsonk_doc_version *version;
     
-    return 0;
+    version = rcu_dereference_protected(doc->current_version, lockdep_is_held(&doc->lock));
+    return version ? jsonk_value_get(version->root) : NULL;
 }
 
 /**
- * Apply a JSON patch to a target buffer (truly atomic)
+ * Publish a version with one value changed
  */
-int jsonk_apply_patch(const char *target, size_t target_len,
-                      const char *patch, size_t patch_len,
-                      char *result, size_t result_max_len, size_t *result_len)
+int jsonk_doc_set_value_by_path(struct jsonk_doc *doc, const char *path, size_t path_len,
+                                struct jsonk_value *value)
 {
-    struct jsonk_value *target_json = NULL;
-    struct jsonk_value *patch_json = NULL;
-    struct jsonk_value *target_copy = NULL;
-    int ret = JSONK_PATCH_ERROR_PARSE;
-    bool changed;
+    struct jsonk_value *root;
+    int ret;
     
-    /* Parse target JSON */
-    target_json = jsonk_parse(target, target_len);
-    if (!target_json)
-        goto error;
+    mutex_lock(&doc->lock);
     
-    /* Validate target is an object */
-    if (target_json->type != JSONK_VALUE_OBJECT) {
-        ret = JSONK_PATCH_ERROR_TYPE;
-        goto error;
+    root = jsonk_doc_writer_root(doc);
+    if (!root) {
+        mutex_unlock(&doc->lock);
+        return -ENOENT;
     }
     
-    /* Parse patch JSON */
-    patch_json = jsonk_parse(patch, patch_len);
-    if (!patch_json) {
-        /* If patch is invalid, return original JSON unchanged */
-        if (target_len <= result_max_len) {
-            memcpy(result, target, target_len);
-            *result_len = target_len;
-            ret = JSONK_PATCH_NO_CHANGE;
-        } else {
-            ret = JSONK_PATCH_ERROR_OVERFLOW;
-        }
-        goto error;
-    }
+    ret = jsonk_cow_set_value_by_path(&root, path, path_len, value);
+    if (ret == 0)
+        ret = jsonk_doc_swap(doc, root);
+    else
+        jsonk_value_put(root);
     
-    /* Validate patch is an object */
-    if (patch_json->type != JSONK_VALUE_OBJECT) {
-        ret = JSONK_PATCH_ERROR_TYPE;
-        goto error;
-    }
+    mutex_unlock(&doc->lock);
+    return ret;
+}
+
+/**
+ * Publish a patched version of a document
+ */
+int jsonk_doc_apply_patch(struct jsonk_doc *doc, struct jsonk_value *patch)
+{
+    u64 start = jsonk_patch_begin(JSONK_PATCH_KIND_DOC);
+    struct jsonk_value *root;
+    int ret;
     
-    /* ATOMIC OPERATION: Deep copy target before modification */
-    target_copy = jsonk_value_deep_copy(target_json, 0);
-    if (!target_copy) {
-        ret = JSONK_PATCH_ERROR_MEMORY;
-        goto error;
-    }
+    mutex_lock(&doc->lock);
     
-    /* Apply patch to the copy - if this fails, original is untouched */
-    ret = jsonk_merge_objects(&target_copy->u.object, &patch_json->u.object, &changed);
-    if (ret < 0) {
-        ret = JSONK_PATCH_ERROR_MEMORY;
-        goto error;
+    root = jsonk_doc_writer_root(doc);
+    if (!root) {
+        mutex_unlock(&doc->lock);
+        return jsonk_patch_end(JSONK_PATCH_KIND_DOC, start, JSONK_PATCH_ERROR_PATH);
     }
     
-    /* Serialize result from the successfully patched copy */
-    size_t written;
-    ret = jsonk_serialize(target_copy, result, result_max_len, &written);
-    if (ret < 0) {
-        if (ret == -EOVERFLOW)
-            ret = JSONK_PATCH_ERROR_OVERFLOW;
-        else
-            ret = JSONK_PATCH_ERROR_PARSE;
-        goto error;
+    ret = jsonk_cow_patch(&root, patch);
+    if (ret == JSONK_PATCH_SUCCESS) {
+        if (jsonk_doc_swap(doc, root) < 0)
+            ret = JSONK_PATCH_ERROR_MEMORY;
+    } else {
+        jsonk_value_put(root);
     }
     
-    *result_len = written;
-    ret = changed ? JSONK_PATCH_SUCCESS : JSONK_PATCH_NO_CHANGE;
-    
-error:
-    if (target_json)
-        jsonk_value_put(target_json);
-    if (patch_json)
-        jsonk_value_put(patch_json);
-    if (target_copy)
-        jsonk_value_put(target_copy);
-    
-    return ret;
+    mutex_unlock(&doc->lock);
+    return jsonk_patch_end(JSONK_PATCH_KIND_DOC, start, ret);
 }
 
 
 
+
 struct jsonk_value *jsonk_value_create(enum jsonk_value_type type)
 {
     return jsonk_value_create_tracked(type, NULL);
@@ -1663,44 +9395,74 @@ int jsonk_array_add_element(struct jsonk_array *arr, struct jsonk_value *value)
 
 static int __init jsonk_init(void)
 {
-    /* Create slab caches for different object types */
+    /* Scalar nodes must fit their size class, key lengths their field */
+    BUILD_BUG_ON(sizeof_field(struct jsonk_value, u.number) > sizeof_field(struct jsonk_value, u.string));
+    BUILD_BUG_ON(JSONK_MAX_KEY_LENGTH > U16_MAX);
+    
+    /*
+     * Create slab caches for different object types. Value nodes are
+     * packed rather than cache aligned, which would round them back up.
+     */
     jsonk_value_cache = kmem_cache_create("jsonk_value",
                                          sizeof(struct jsonk_value),
-                                         0, SLAB_HWCACHE_ALIGN, NULL);
+                                         0, 0, NULL);
     if (!jsonk_value_cache) {
         printk(KERN_ERR "JSONK: Failed to create value cache\n");
         return -ENOMEM;
     }
     
+    jsonk_scalar_cache = kmem_cache_create("jsonk_scalar",
+                                          JSONK_SCALAR_NODE_SIZE,
+                                          0, 0, NULL);
+    if (!jsonk_scalar_cache) {
+        printk(KERN_ERR "JSONK: Failed to create scalar cache\n");
+        kmem_cache_destroy(jsonk_value_cache);
+        return -ENOMEM;
+    }
+    
     jsonk_member_cache = kmem_cache_create("jsonk_member",
                                           sizeof(struct jsonk_member),
                                           0, SLAB_HWCACHE_ALIGN, NULL);
     if (!jsonk_member_cache) {
         printk(KERN_ERR "JSONK: Failed to create member cache\n");
+        kmem_cache_destroy(jsonk_scalar_cache);
         kmem_cache_destroy(jsonk_value_cache);
         return -ENOMEM;
     }
     
-    jsonk_element_cache = kmem_cache_create("jsonk_element",
-                                           sizeof(struct jsonk_array_element),
-                                           0, SLAB_HWCACHE_ALIGN, NULL);
-    if (!jsonk_element_cache) {
-        printk(KERN_ERR "JSONK: Failed to create element cache\n");
-        kmem_cache_destroy(jsonk_value_cache);
+    /* Packed like value nodes, alignment would round these up to full members */
+    jsonk_member_ref_cache = kmem_cache_create("jsonk_member_ref",
+                                              JSONK_MEMBER_REF_SIZE,
+                                              0, 0, NULL);
+    if (!jsonk_member_ref_cache) {
+        printk(KERN_ERR "JSONK: Failed to create member ref cache\n");
         kmem_cache_destroy(jsonk_member_cache);
+        kmem_cache_destroy(jsonk_scalar_cache);
+        kmem_cache_destroy(jsonk_value_cache);
         return -ENOMEM;
     }
     
+    get_random_bytes(&jsonk_hash_key, sizeof(jsonk_hash_key));
+    jsonk_simd_detect();
+    jsonk_pool_init();
+    jsonk_stats_init();
+    
     printk(KERN_INFO "JSONK: JSON Library loaded\n");
     return 0;
 }
 
 static void __exit jsonk_exit(void)
 {
+    jsonk_stats_exit();
+    
+    /* Let retired document versions drain back into the caches */
+    rcu_barrier();
+    jsonk_pool_exit();
+    
     /* Destroy slab caches */
-    if (jsonk_element_cache) {
-        kmem_cache_destroy(jsonk_element_cache);
-        jsonk_element_cache = NULL;
+    if (jsonk_member_ref_cache) {
+        kmem_cache_destroy(jsonk_member_ref_cache);
+        jsonk_member_ref_cache = NULL;
     }
     
     if (jsonk_member_cache) {
@@ -1708,6 +9470,11 @@ static void __exit jsonk_exit(void)
         jsonk_member_cache = NULL;
     }
     
+    if (jsonk_scalar_cache) {
+        kmem_cache_destroy(jsonk_scalar_cache);
+        jsonk_scalar_cache = NULL;
+    }
+    
     if (jsonk_value_cache) {
         kmem_cache_destroy(jsonk_value_cache);
         jsonk_value_cache = NULL;
@@ -1724,13 +9491,83 @@ module_exit(jsonk_exit);
  * ======================================================================== */
 
 EXPORT_SYMBOL(jsonk_parse);
+EXPORT_SYMBOL(jsonk_parse_arena);
+EXPORT_SYMBOL(jsonk_parse_flags);
+EXPORT_SYMBOL(jsonk_parse_ex);
+EXPORT_SYMBOL(jsonk_parse_atomic);
+EXPORT_SYMBOL(jsonk_parse_batch);
+EXPORT_SYMBOL(jsonk_pool_refill);
+EXPORT_SYMBOL(jsonk_sax_parse);
+EXPORT_SYMBOL(jsonk_validate);
+EXPORT_SYMBOL(jsonk_get_raw_by_path);
+EXPORT_SYMBOL(jsonk_parse_by_path);
+EXPORT_SYMBOL(jsonk_path_compile);
+EXPORT_SYMBOL(jsonk_path_free);
+EXPORT_SYMBOL(jsonk_path_get);
+EXPORT_SYMBOL(jsonk_path_set);
+EXPORT_SYMBOL(jsonk_path_patch);
+EXPORT_SYMBOL(jsonk_binary_size);
+EXPORT_SYMBOL(jsonk_encode_binary);
+EXPORT_SYMBOL(jsonk_decode_binary);
+EXPORT_SYMBOL(jsonk_bin_root);
+EXPORT_SYMBOL(jsonk_bin_type);
+EXPORT_SYMBOL(jsonk_bin_count);
+EXPORT_SYMBOL(jsonk_bin_index);
+EXPORT_SYMBOL(jsonk_bin_member);
+EXPORT_SYMBOL(jsonk_bin_member_at);
+EXPORT_SYMBOL(jsonk_bin_get_path);
+EXPORT_SYMBOL(jsonk_bin_get_string);
+EXPORT_SYMBOL(jsonk_bin_get_bool);
+EXPORT_SYMBOL(jsonk_bin_get_s64);
+EXPORT_SYMBOL(jsonk_bin_get_u64);
+EXPORT_SYMBOL(jsonk_value_snapshot);
+EXPORT_SYMBOL(jsonk_cow_set_value_by_path);
+EXPORT_SYMBOL(jsonk_cow_apply_patch);
+EXPORT_SYMBOL(jsonk_doc_init);
+EXPORT_SYMBOL(jsonk_doc_destroy);
+EXPORT_SYMBOL(jsonk_doc_get);
+EXPORT_SYMBOL(jsonk_doc_pin);
+EXPORT_SYMBOL(jsonk_doc_unpin);
+EXPORT_SYMBOL(jsonk_doc_publish);
+EXPORT_SYMBOL(jsonk_doc_set_value_by_path);
+EXPORT_SYMBOL(jsonk_doc_apply_patch);
+EXPORT_SYMBOL(jsonk_parser_start);
+EXPORT_SYMBOL(jsonk_parser_start_ex);
+EXPORT_SYMBOL(jsonk_parser_feed);
+EXPORT_SYMBOL(jsonk_parser_finish);
+EXPORT_SYMBOL(jsonk_parser_abort);
+EXPORT_SYMBOL(jsonk_scan_string);
+EXPORT_SYMBOL(jsonk_scan_whitespace);
 EXPORT_SYMBOL(jsonk_serialize);
+EXPORT_SYMBOL(jsonk_serialized_size);
+EXPORT_SYMBOL(jsonk_serialize_alloc);
+EXPORT_SYMBOL(jsonk_writer_init);
+EXPORT_SYMBOL(jsonk_writer_read);
+EXPORT_SYMBOL(jsonk_writer_read_iter);
+EXPORT_SYMBOL(jsonk_serialize_to);
+EXPORT_SYMBOL(jsonk_seq_serialize);
 EXPORT_SYMBOL(jsonk_value_get);
 EXPORT_SYMBOL(jsonk_value_put);
+EXPORT_SYMBOL(jsonk_value_footprint);
 EXPORT_SYMBOL(jsonk_apply_patch);
+EXPORT_SYMBOL(jsonk_apply_patch_alloc);
+EXPORT_SYMBOL(jsonk_apply_patch_tree);
+EXPORT_SYMBOL(jsonk_apply_merge_patch);
+EXPORT_SYMBOL(jsonk_apply_json_patch);
+EXPORT_SYMBOL(jsonk_apply_json_patch_ops);
+EXPORT_SYMBOL(jsonk_value_hash);
+EXPORT_SYMBOL(jsonk_value_hash_reset);
+EXPORT_SYMBOL(jsonk_value_equal);
+EXPORT_SYMBOL(jsonk_diff);
+EXPORT_SYMBOL(jsonk_stats_read);
+EXPORT_SYMBOL(jsonk_stats_reset);
 EXPORT_SYMBOL(jsonk_value_create);
 EXPORT_SYMBOL(jsonk_value_create_string);
 EXPORT_SYMBOL(jsonk_value_create_number);
+EXPORT_SYMBOL(jsonk_value_create_s64);
+EXPORT_SYMBOL(jsonk_value_create_u64);
+EXPORT_SYMBOL(jsonk_number_get_s64);
+EXPORT_SYMBOL(jsonk_number_get_u64);
 EXPORT_SYMBOL(jsonk_value_create_boolean);
 EXPORT_SYMBOL(jsonk_value_create_null);
 EXPORT_SYMBOL(jsonk_value_deep_copy);
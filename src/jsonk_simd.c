@@ -0,0 +1,269 @@
+/**
+ * jsonk_simd.c - Vector scanners for JSON strings and whitespace
+ *
+ * Built with CC_FLAGS_FPU.  Nothing here may be called outside a
+ * kernel_fpu_begin()/kernel_fpu_end() section; jsonk.c does the bracketing.
+ *
+ * Copyright (C) 2025 Mehran Toosi
+ * Licensed under GPL-2.0
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include "jsonk_simd.h"
+
+#if defined(CONFIG_X86_64)
+
+/*
+ * Hand-written SSE2/AVX2 loops: intrinsics headers are not usable in the
+ * kernel.  Each block is classified with byte compares and reduced to a
+ * bit mask with pmovmskb; the loop exits on the first block with a hit.
+ */
+static const u8 jsonk_simd_quote[32] __aligned(32) = { [0 ... 31] = '"' };
+static const u8 jsonk_simd_backslash[32] __aligned(32) = { [0 ... 31] = '\\' };
+static const u8 jsonk_simd_ctrl_max[32] __aligned(32) = { [0 ... 31] = 0x1f };
+static const u8 jsonk_simd_space[32] __aligned(32) = { [0 ... 31] = ' ' };
+static const u8 jsonk_simd_tab[32] __aligned(32) = { [0 ... 31] = '\t' };
+static const u8 jsonk_simd_newline[32] __aligned(32) = { [0 ... 31] = '\n' };
+static const u8 jsonk_simd_return[32] __aligned(32) = { [0 ... 31] = '\r' };
+
+#define JSONK_SIMD_CONST(name) (*(const u8 (*)[32])(name))
+
+static size_t jsonk_sse2_scan_string(const char *p, size_t n)
+{
+    const char *start = p;
+    const char *last;
+
+    if (n < 16)
+        return 0;
+    last = p + n - 16;
+
+    /* c <= 0x1f iff min(c, 0x1f) == c */
+    asm volatile(
+        "movdqa %[quote], %%xmm2\n\t"
+        "movdqa %[bslash], %%xmm3\n\t"
+        "movdqa %[ctrl], %%xmm4\n\t"
+        "1:\n\t"
+        "movdqu (%[p]), %%xmm0\n\t"
+        "movdqa %%xmm0, %%xmm1\n\t"
+        "pcmpeqb %%xmm2, %%xmm1\n\t"
+        "movdqa %%xmm0, %%xmm5\n\t"
+        "pcmpeqb %%xmm3, %%xmm5\n\t"
+        "por %%xmm5, %%xmm1\n\t"
+        "movdqa %%xmm0, %%xmm5\n\t"
+        "pminub %%xmm4, %%xmm5\n\t"
+        "pcmpeqb %%xmm0, %%xmm5\n\t"
+        "por %%xmm5, %%xmm1\n\t"
+        "pmovmskb %%xmm1, %%eax\n\t"
+        "test %%eax, %%eax\n\t"
+        "jnz 2f\n\t"
+        "add $16, %[p]\n\t"
+        "cmp %[last], %[p]\n\t"
+        "jbe 1b\n\t"
+        "2:\n\t"
+        : [p] "+r" (p)
+        : [last] "r" (last),
+          [quote] "m" (JSONK_SIMD_CONST(jsonk_simd_quote)),
+          [bslash] "m" (JSONK_SIMD_CONST(jsonk_simd_backslash)),
+          [ctrl] "m" (JSONK_SIMD_CONST(jsonk_simd_ctrl_max))
+        : "eax", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+          "cc", "memory");
+
+    return p - start;
+}
+
+static size_t jsonk_avx2_scan_string(const char *p, size_t n)
+{
+    const char *start = p;
+    const char *last;
+
+    if (n < 32)
+        return 0;
+    last = p + n - 32;
+
+    asm volatile(
+        "vmovdqa %[quote], %%ymm2\n\t"
+        "vmovdqa %[bslash], %%ymm3\n\t"
+        "vmovdqa %[ctrl], %%ymm4\n\t"
+        "1:\n\t"
+        "vmovdqu (%[p]), %%ymm0\n\t"
+        "vpcmpeqb %%ymm2, %%ymm0, %%ymm1\n\t"
+        "vpcmpeqb %%ymm3, %%ymm0, %%ymm5\n\t"
+        "vpor %%ymm5, %%ymm1, %%ymm1\n\t"
+        "vpminub %%ymm4, %%ymm0, %%ymm5\n\t"
+        "vpcmpeqb %%ymm0, %%ymm5, %%ymm5\n\t"
+        "vpor %%ymm5, %%ymm1, %%ymm1\n\t"
+        "vpmovmskb %%ymm1, %%eax\n\t"
+        "test %%eax, %%eax\n\t"
+        "jnz 2f\n\t"
+        "add $32, %[p]\n\t"
+        "cmp %[last], %[p]\n\t"
+        "jbe 1b\n\t"
+        "2:\n\t"
+        "vzeroupper\n\t"
+        : [p] "+r" (p)
+        : [last] "r" (last),
+          [quote] "m" (JSONK_SIMD_CONST(jsonk_simd_quote)),
+          [bslash] "m" (JSONK_SIMD_CONST(jsonk_simd_backslash)),
+          [ctrl] "m" (JSONK_SIMD_CONST(jsonk_simd_ctrl_max))
+        : "eax", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+          "cc", "memory");
+
+    return p - start;
+}
+
+static size_t jsonk_sse2_scan_whitespace(const char *p, size_t n)
+{
+    const char *start = p;
+    const char *last;
+
+    if (n < 16)
+        return 0;
+    last = p + n - 16;
+
+    asm volatile(
+        "movdqa %[space], %%xmm2\n\t"
+        "movdqa %[tab], %%xmm3\n\t"
+        "movdqa %[nl], %%xmm4\n\t"
+        "movdqa %[cr], %%xmm5\n\t"
+        "1:\n\t"
+        "movdqu (%[p]), %%xmm0\n\t"
+        "movdqa %%xmm0, %%xmm1\n\t"
+        "pcmpeqb %%xmm2, %%xmm1\n\t"
+        "movdqa %%xmm0, %%xmm6\n\t"
+        "pcmpeqb %%xmm3, %%xmm6\n\t"
+        "por %%xmm6, %%xmm1\n\t"
+        "movdqa %%xmm0, %%xmm6\n\t"
+        "pcmpeqb %%xmm4, %%xmm6\n\t"
+        "por %%xmm6, %%xmm1\n\t"
+        "pcmpeqb %%xmm5, %%xmm0\n\t"
+        "por %%xmm0, %%xmm1\n\t"
+        "pmovmskb %%xmm1, %%eax\n\t"
+        "cmp $0xffff, %%eax\n\t"
+        "jne 2f\n\t"
+        "add $16, %[p]\n\t"
+        "cmp %[last], %[p]\n\t"
+        "jbe 1b\n\t"
+        "2:\n\t"
+        : [p] "+r" (p)
+        : [last] "r" (last),
+          [space] "m" (JSONK_SIMD_CONST(jsonk_simd_space)),
+          [tab] "m" (JSONK_SIMD_CONST(jsonk_simd_tab)),
+          [nl] "m" (JSONK_SIMD_CONST(jsonk_simd_newline)),
+          [cr] "m" (JSONK_SIMD_CONST(jsonk_simd_return))
+        : "eax", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",
+          "cc", "memory");
+
+    return p - start;
+}
+
+static size_t jsonk_avx2_scan_whitespace(const char *p, size_t n)
+{
+    const char *start = p;
+    const char *last;
+
+    if (n < 32)
+        return 0;
+    last = p + n - 32;
+
+    asm volatile(
+        "vmovdqa %[space], %%ymm2\n\t"
+        "vmovdqa %[tab], %%ymm3\n\t"
+        "vmovdqa %[nl], %%ymm4\n\t"
+        "vmovdqa %[cr], %%ymm5\n\t"
+        "1:\n\t"
+        "vmovdqu (%[p]), %%ymm0\n\t"
+        "vpcmpeqb %%ymm2, %%ymm0, %%ymm1\n\t"
+        "vpcmpeqb %%ymm3, %%ymm0, %%ymm6\n\t"
+        "vpor %%ymm6, %%ymm1, %%ymm1\n\t"
+        "vpcmpeqb %%ymm4, %%ymm0, %%ymm6\n\t"
+        "vpor %%ymm6, %%ymm1, %%ymm1\n\t"
+        "vpcmpeqb %%ymm5, %%ymm0, %%ymm6\n\t"
+        "vpor %%ymm6, %%ymm1, %%ymm1\n\t"
+        "vpmovmskb %%ymm1, %%eax\n\t"
+        "cmp $-1, %%eax\n\t"
+        "jne 2f\n\t"
+        "add $32, %[p]\n\t"
+        "cmp %[last], %[p]\n\t"
+        "jbe 1b\n\t"
+        "2:\n\t"
+        "vzeroupper\n\t"
+        : [p] "+r" (p)
+        : [last] "r" (last),
+          [space] "m" (JSONK_SIMD_CONST(jsonk_simd_space)),
+          [tab] "m" (JSONK_SIMD_CONST(jsonk_simd_tab)),
+          [nl] "m" (JSONK_SIMD_CONST(jsonk_simd_newline)),
+          [cr] "m" (JSONK_SIMD_CONST(jsonk_simd_return))
+        : "eax", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",
+          "cc", "memory");
+
+    return p - start;
+}
+
+size_t jsonk_simd_scan_string(const char *p, size_t n, unsigned int features)
+{
+    if (features & JSONK_SIMD_AVX2)
+        return jsonk_avx2_scan_string(p, n);
+    return jsonk_sse2_scan_string(p, n);
+}
+
+size_t jsonk_simd_scan_whitespace(const char *p, size_t n, unsigned int features)
+{
+    if (features & JSONK_SIMD_AVX2)
+        return jsonk_avx2_scan_whitespace(p, n);
+    return jsonk_sse2_scan_whitespace(p, n);
+}
+
+#elif defined(CONFIG_ARM64)
+
+#include <asm/neon-intrinsics.h>
+
+/* Narrow a 0x00/0xff byte mask to 4 bits per byte and test it */
+static inline bool jsonk_neon_any(uint8x16_t mask)
+{
+    uint8x8_t bits = vshrn_n_u16(vreinterpretq_u16_u8(mask), 4);
+
+    return vget_lane_u64(vreinterpret_u64_u8(bits), 0) != 0;
+}
+
+size_t jsonk_simd_scan_string(const char *p, size_t n, unsigned int features)
+{
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t bslash = vdupq_n_u8('\\');
+    const uint8x16_t ctrl = vdupq_n_u8(0x20);
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8((const u8 *)p + i);
+        uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, quote),
+                                           vceqq_u8(v, bslash)),
+                                  vcltq_u8(v, ctrl));
+
+        if (jsonk_neon_any(hit))
+            break;
+    }
+    return i;
+}
+
+size_t jsonk_simd_scan_whitespace(const char *p, size_t n, unsigned int features)
+{
+    const uint8x16_t space = vdupq_n_u8(' ');
+    const uint8x16_t tab = vdupq_n_u8('\t');
+    const uint8x16_t nl = vdupq_n_u8('\n');
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8((const u8 *)p + i);
+        uint8x16_t ws = vorrq_u8(vorrq_u8(vceqq_u8(v, space),
+                                          vceqq_u8(v, tab)),
+                                 vorrq_u8(vceqq_u8(v, nl),
+                                          vceqq_u8(v, cr)));
+
+        if (jsonk_neon_any(vmvnq_u8(ws)))
+            break;
+    }
+    return i;
+}
+
+#endif
@@ -0,0 +1,27 @@
+/**
+ * jsonk_simd.h - Vector scanners shared between jsonk.c and jsonk_simd.c
+ *
+ * Copyright (C) 2025 Mehran Toosi
+ * Licensed under GPL-2.0
+ */
+
+#ifndef _JSONK_SIMD_H
+#define _JSONK_SIMD_H
+
+#include <linux/types.h>
+
+/* CPU features detected at module load and passed to the scanners */
+#define JSONK_SIMD_AVX2 0x01
+
+/*
+ * Both scanners only look at whole vector blocks.  They return the offset
+ * of the block holding the first hit, or the end of the last whole block,
+ * and leave the remaining bytes to the word-at-a-time code.
+ *
+ * jsonk_simd.c is built with FPU code generation enabled; everything in it
+ * must run between kernel_fpu_begin() and kernel_fpu_end().
+ */
+size_t jsonk_simd_scan_string(const char *p, size_t n, unsigned int features);
+size_t jsonk_simd_scan_whitespace(const char *p, size_t n, unsigned int features);
+
+#endif /* _JSONK_SIMD_H */
@@ -0,0 +1,140 @@
+/**
+ * jsonk_trace.h - Tracepoints for parse, serialize and patch calls
+ *
+ * Copyright (C) 2025 Mehran Toosi
+ * Licensed under GPL-2.0
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM jsonk
+
+#if !defined(_JSONK_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _JSONK_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#ifndef _JSONK_TRACE_KINDS
+#define _JSONK_TRACE_KINDS
+
+/* Patch function a jsonk_patch_start/end pair comes from */
+enum jsonk_patch_kind {
+    JSONK_PATCH_KIND_BUFFER,    /* jsonk_apply_patch(), jsonk_apply_patch_alloc() */
+    JSONK_PATCH_KIND_TREE,      /* jsonk_apply_patch_tree() */
+    JSONK_PATCH_KIND_MERGE,     /* jsonk_apply_merge_patch() */
+    JSONK_PATCH_KIND_JSON,      /* jsonk_apply_json_patch(), jsonk_apply_json_patch_ops() */
+    JSONK_PATCH_KIND_PATH,      /* jsonk_path_patch() */
+    JSONK_PATCH_KIND_COW,       /* jsonk_cow_apply_patch() */
+    JSONK_PATCH_KIND_DOC        /* jsonk_doc_apply_patch() */
+};
+
+#endif /* _JSONK_TRACE_KINDS */
+
+TRACE_DEFINE_ENUM(JSONK_PATCH_KIND_BUFFER);
+TRACE_DEFINE_ENUM(JSONK_PATCH_KIND_TREE);
+TRACE_DEFINE_ENUM(JSONK_PATCH_KIND_MERGE);
+TRACE_DEFINE_ENUM(JSONK_PATCH_KIND_JSON);
+TRACE_DEFINE_ENUM(JSONK_PATCH_KIND_PATH);
+TRACE_DEFINE_ENUM(JSONK_PATCH_KIND_COW);
+TRACE_DEFINE_ENUM(JSONK_PATCH_KIND_DOC);
+
+#define show_jsonk_patch_kind(kind)                         \
+    __print_symbolic(kind,                                  \
+                     { JSONK_PATCH_KIND_BUFFER, "buffer" }, \
+                     { JSONK_PATCH_KIND_TREE, "tree" },     \
+                     { JSONK_PATCH_KIND_MERGE, "merge" },   \
+                     { JSONK_PATCH_KIND_JSON, "json" },     \
+                     { JSONK_PATCH_KIND_PATH, "path" },     \
+                     { JSONK_PATCH_KIND_COW, "cow" },       \
+                     { JSONK_PATCH_KIND_DOC, "doc" })
+
+/* Incremental parses report a length of 0 when they start */
+TRACE_EVENT(jsonk_parse_start,
+    TP_PROTO(size_t len, unsigned int flags),
+    TP_ARGS(len, flags),
+    TP_STRUCT__entry(
+        __field(size_t, len)
+        __field(unsigned int, flags)
+    ),
+    TP_fast_assign(
+        __entry->len = len;
+        __entry->flags = flags;
+    ),
+    TP_printk("len=%zu flags=0x%x", __entry->len, __entry->flags)
+);
+
+TRACE_EVENT(jsonk_parse_end,
+    TP_PROTO(size_t len, size_t nodes, bool ok),
+    TP_ARGS(len, nodes, ok),
+    TP_STRUCT__entry(
+        __field(size_t, len)
+        __field(size_t, nodes)
+        __field(bool, ok)
+    ),
+    TP_fast_assign(
+        __entry->len = len;
+        __entry->nodes = nodes;
+        __entry->ok = ok;
+    ),
+    TP_printk("len=%zu nodes=%zu ok=%d", __entry->len, __entry->nodes, __entry->ok)
+);
+
+TRACE_EVENT(jsonk_serialize_start,
+    TP_PROTO(const struct jsonk_value *value),
+    TP_ARGS(value),
+    TP_STRUCT__entry(
+        __field(int, type)
+    ),
+    TP_fast_assign(
+        __entry->type = value ? value->type : -1;
+    ),
+    TP_printk("type=%d", __entry->type)
+);
+
+TRACE_EVENT(jsonk_serialize_end,
+    TP_PROTO(size_t len, int ret),
+    TP_ARGS(len, ret),
+    TP_STRUCT__entry(
+        __field(size_t, len)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        __entry->len = len;
+        __entry->ret = ret;
+    ),
+    TP_printk("len=%zu ret=%d", __entry->len, __entry->ret)
+);
+
+TRACE_EVENT(jsonk_patch_start,
+    TP_PROTO(unsigned int kind),
+    TP_ARGS(kind),
+    TP_STRUCT__entry(
+        __field(unsigned int, kind)
+    ),
+    TP_fast_assign(
+        __entry->kind = kind;
+    ),
+    TP_printk("kind=%s", show_jsonk_patch_kind(__entry->kind))
+);
+
+TRACE_EVENT(jsonk_patch_end,
+    TP_PROTO(unsigned int kind, int result),
+    TP_ARGS(kind, result),
+    TP_STRUCT__entry(
+        __field(unsigned int, kind)
+        __field(int, result)
+    ),
+    TP_fast_assign(
+        __entry->kind = kind;
+        __entry->result = result;
+    ),
+    TP_printk("kind=%s result=%d", show_jsonk_patch_kind(__entry->kind), __entry->result)
+);
+
+#endif /* _JSONK_TRACE_H */
+
+/* Found through -I$(src)/src, see the Makefile */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE jsonk_trace
+#include <trace/define_trace.h>
@@ -15,6 +15,8 @@
 #include <linux/init.h>
 #include <linux/string.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
 #include "../include/jsonk.h"
 
 MODULE_LICENSE("GPL");
@@ -22,6 +24,9 @@ MODULE_AUTHOR("Mehran Toosi");
 MODULE_DESCRIPTION("JSONK Atomic Patching Test");
 MODULE_VERSION("1.0.0");
 
+/* Records in the array parsed with JSONK_PARSE_PARALLEL, about 60KB */
+#define SPLIT_TEST_RECORDS 3000
+
 /**
  * Test successful atomic patch
  */
@@ -209,6 +214,992 @@ static void test_no_change_patch(void)
     }
 }
 
+/**
+ * Test in-place tree patch that fails part way (should roll back)
+ */
+static void test_tree_patch_rollback(void)
+{
+    const char *patch = "{\"k1\":\"changed\",\"k2\":null,\"extra1\":1,\"extra2\":2,\"extra3\":3}";
+    struct jsonk_value *target_json = NULL, *patch_json = NULL;
+    char *target, *before, *after;
+    size_t pos = 0, before_len, after_len;
+    size_t bufsize = JSONK_MAX_OBJECT_MEMBERS * 16;
+    int i, ret;
+    
+    printk(KERN_INFO "=== Testing Tree Patch Rollback ===\n");
+    
+    target = vmalloc(bufsize);
+    before = vmalloc(bufsize);
+    after = vmalloc(bufsize);
+    if (!target || !before || !after) {
+        printk(KERN_ERR "✗ Failed to allocate buffers\n");
+        goto cleanup;
+    }
+    
+    /* One member short of the limit: the last addition has to fail */
+    pos += snprintf(target + pos, bufsize - pos, "{");
+    for (i = 0; i < JSONK_MAX_OBJECT_MEMBERS - 1; i++)
+        pos += snprintf(target + pos, bufsize - pos, "%s\"k%d\":%d", i ? "," : "", i, i);
+    pos += snprintf(target + pos, bufsize - pos, "}");
+    
+    target_json = jsonk_parse(target, pos);
+    patch_json = jsonk_parse(patch, strlen(patch));
+    if (!target_json || !patch_json ||
+        jsonk_serialize(target_json, before, bufsize, &before_len) < 0) {
+        printk(KERN_ERR "✗ Failed to set up test data\n");
+        goto cleanup;
+    }
+    
+    printk(KERN_INFO "Target: object with %d members\n", JSONK_MAX_OBJECT_MEMBERS - 1);
+    printk(KERN_INFO "Patch:  %s\n", patch);
+    
+    ret = jsonk_apply_patch_tree(target_json, patch_json);
+    if (ret == JSONK_PATCH_ERROR_MEMORY) {
+        printk(KERN_INFO "✓ Patch correctly rejected at the member limit\n");
+    } else {
+        printk(KERN_ERR "✗ Patch should have failed, got code: %d\n", ret);
+    }
+    
+    if (jsonk_serialize(target_json, after, bufsize, &after_len) == 0 &&
+        after_len == before_len && memcmp(before, after, before_len) == 0) {
+        printk(KERN_INFO "✓ Target tree rolled back exactly\n");
+    } else {
+        printk(KERN_ERR "✗ Target tree was modified!\n");
+    }
+    
+cleanup:
+    if (target_json)
+        jsonk_value_put(target_json);
+    if (patch_json)
+        jsonk_value_put(patch_json);
+    if (target) vfree(target);
+    if (before) vfree(before);
+    if (after) vfree(after);
+}
+
+/**
+ * Test in-place tree patch
+ */
+static void test_tree_patch(void)
+{
+    const char *target = "{\"user\":{\"name\":\"Mehran\",\"profile\":{\"age\":30}},\"temp\":1}";
+    const char *patch = "{\"user\":{\"profile\":{\"age\":31}},\"temp\":null}";
+    const char *expected = "{\"user\":{\"name\":\"Mehran\",\"profile\":{\"age\":31}}}";
+    struct jsonk_value *target_json, *patch_json;
+    char result[512];
+    size_t result_len;
+    int ret;
+    
+    printk(KERN_INFO "=== Testing In-Place Tree Patch ===\n");
+    printk(KERN_INFO "Target: %s\n", target);
+    printk(KERN_INFO "Patch:  %s\n", patch);
+    
+    target_json = jsonk_parse(target, strlen(target));
+    patch_json = jsonk_parse(patch, strlen(patch));
+    if (!target_json || !patch_json) {
+        printk(KERN_ERR "✗ Failed to parse test data\n");
+        goto cleanup;
+    }
+    
+    ret = jsonk_apply_patch_tree(target_json, patch_json);
+    if (ret == JSONK_PATCH_SUCCESS &&
+        jsonk_serialize(target_json, result, sizeof(result) - 1, &result_len) == 0) {
+        result[result_len] = '\0';
+        if (strcmp(result, expected) == 0)
+            printk(KERN_INFO "✓ Tree patch succeeded: %s\n", result);
+        else
+            printk(KERN_ERR "✗ Unexpected result: %s\n", result);
+    } else {
+        printk(KERN_ERR "✗ Tree patch failed with code: %d\n", ret);
+    }
+    
+cleanup:
+    if (target_json)
+        jsonk_value_put(target_json);
+    if (patch_json)
+        jsonk_value_put(patch_json);
+}
+
+/**
+ * Test patching into an exactly sized allocation
+ */
+static void test_allocated_patch(void)
+{
+    const char *target = "{\"name\":\"Mehran\",\"tags\":[\"a\",\"b\"],\"temp\":1}";
+    const char *patch = "{\"tags\":[\"a\",\"b\",\"c\"],\"temp\":null,\"ratio\":1.05}";
+    const char *expected = "{\"name\":\"Mehran\",\"tags\":[\"a\",\"b\",\"c\"],\"ratio\":1.05}";
+    char *result;
+    size_t result_len;
+    int ret;
+    
+    printk(KERN_INFO "=== Testing Allocated Patch Result ===\n");
+    printk(KERN_INFO "Target: %s\n", target);
+    printk(KERN_INFO "Patch:  %s\n", patch);
+    
+    ret = jsonk_apply_patch_alloc(target, strlen(target), patch, strlen(patch),
+                                  &result, &result_len);
+    if (ret != JSONK_PATCH_SUCCESS) {
+        printk(KERN_ERR "✗ Patch failed with code: %d\n", ret);
+        return;
+    }
+    
+    if (result_len == strlen(expected) && strcmp(result, expected) == 0)
+        printk(KERN_INFO "✓ Patch result allocated to fit: %s\n", result);
+    else
+        printk(KERN_ERR "✗ Unexpected result (%zu bytes): %s\n", result_len, result);
+    jsonk_memory_free(result, result_len + 1);
+}
+
+/**
+ * Build a chain of "depth" objects, the innermost being leaf
+ */
+static size_t build_deep_object(char *buf, int depth, const char *leaf)
+{
+    size_t len = 0;
+    int i;
+    
+    for (i = 0; i < depth - 1; i++)
+        len += sprintf(buf + len, "{\"l%d\":", i);
+    len += sprintf(buf + len, "%s", leaf);
+    for (i = 0; i < depth - 1; i++)
+        buf[len++] = '}';
+    buf[len] = '\0';
+    return len;
+}
+
+/**
+ * Test a patch reaching the deepest level the parser allows
+ */
+static void test_deep_nested_patch(void)
+{
+    char *target, *patch, *expected, *result;
+    size_t target_len, patch_len, expected_len, result_len;
+    int ret;
+    
+    printk(KERN_INFO "=== Testing Deep Nested Patch ===\n");
+    
+    target = kmalloc(3 * 512, GFP_KERNEL);
+    if (!target) {
+        printk(KERN_ERR "✗ Failed to allocate test buffers\n");
+        return;
+    }
+    patch = target + 512;
+    expected = patch + 512;
+    
+    target_len = build_deep_object(target, JSONK_MAX_DEPTH - 1, "{\"v\":1,\"old\":0}");
+    patch_len = build_deep_object(patch, JSONK_MAX_DEPTH - 1, "{\"v\":2,\"old\":null}");
+    expected_len = build_deep_object(expected, JSONK_MAX_DEPTH - 1, "{\"v\":2}");
+    printk(KERN_INFO "Target: %zu bytes, %d objects deep\n", target_len, JSONK_MAX_DEPTH - 1);
+    
+    ret = jsonk_apply_patch_alloc(target, target_len, patch, patch_len,
+                                  &result, &result_len);
+    if (ret != JSONK_PATCH_SUCCESS) {
+        printk(KERN_ERR "✗ Deep patch failed with code: %d\n", ret);
+        goto out;
+    }
+    
+    if (result_len == expected_len && memcmp(result, expected, expected_len) == 0)
+        printk(KERN_INFO "✓ Deepest members updated and removed\n");
+    else
+        printk(KERN_ERR "✗ Unexpected result (%zu bytes): %s\n", result_len, result);
+    jsonk_memory_free(result, result_len + 1);
+    
+    /* One more level is over the limit and must leave nothing behind */
+    target_len = build_deep_object(target, JSONK_MAX_DEPTH, "{\"v\":1}");
+    ret = jsonk_apply_patch_alloc(target, target_len, patch, patch_len,
+                                  &result, &result_len);
+    if (ret == JSONK_PATCH_ERROR_PARSE)
+        printk(KERN_INFO "✓ Target past the depth limit rejected\n");
+    else
+        printk(KERN_ERR "✗ Over-deep target returned: %d\n", ret);
+    
+out:
+    kfree(target);
+}
+
+/**
+ * Test a patch decoded in atomic context from the per-CPU pools
+ */
+static void test_atomic_context_patch(void)
+{
+    const char *target = "{\"link\":{\"state\":\"down\",\"mtu\":1500},\"stale\":true}";
+    const char *message = "{\"link\":{\"state\":\"up\"},\"stale\":null}";
+    const char *expected = "{\"link\":{\"state\":\"up\",\"mtu\":1500}}";
+    static DEFINE_SPINLOCK(rx_lock);
+    struct jsonk_value *target_json, *patch_json;
+    char *oversized, result[256];
+    size_t result_len;
+    unsigned long flags;
+    int ret;
+    
+    printk(KERN_INFO "=== Testing Patch Parsed In Atomic Context ===\n");
+    
+    target_json = jsonk_parse(target, strlen(target));
+    oversized = kmalloc(JSONK_ARENA_CHUNK_SIZE + 2, GFP_KERNEL);
+    if (!target_json || !oversized) {
+        printk(KERN_ERR "✗ Failed to set up test data\n");
+        goto cleanup;
+    }
+    
+    spin_lock_irqsave(&rx_lock, flags);
+    patch_json = jsonk_parse_atomic(message, strlen(message));
+    spin_unlock_irqrestore(&rx_lock, flags);
+    if (!patch_json) {
+        printk(KERN_ERR "✗ Pool parse failed\n");
+        goto cleanup;
+    }
+    
+    ret = jsonk_apply_patch_tree(target_json, patch_json);
+    jsonk_value_put(patch_json);
+    if (ret == JSONK_PATCH_SUCCESS &&
+        jsonk_serialize(target_json, result, sizeof(result) - 1, &result_len) == 0) {
+        result[result_len] = '\0';
+        if (strcmp(result, expected) == 0)
+            printk(KERN_INFO "✓ Pool-parsed patch applied: %s\n", result);
+        else
+            printk(KERN_ERR "✗ Unexpected result: %s\n", result);
+    } else {
+        printk(KERN_ERR "✗ Tree patch failed with code: %d\n", ret);
+    }
+    
+    /* Frames past those on the stack come from the pool as well */
+    ret = build_deep_object(oversized, JSONK_MAX_DEPTH - 1, "{\"v\":1}");
+    spin_lock_irqsave(&rx_lock, flags);
+    patch_json = jsonk_parse_atomic(oversized, ret);
+    spin_unlock_irqrestore(&rx_lock, flags);
+    if (patch_json) {
+        printk(KERN_INFO "✓ Message %d objects deep parsed from the pool\n", JSONK_MAX_DEPTH - 1);
+        jsonk_value_put(patch_json);
+    } else {
+        printk(KERN_ERR "✗ Deep message failed in atomic context\n");
+    }
+    
+    /* A string no chunk can hold fails at once instead of sleeping */
+    oversized[0] = '"';
+    memset(oversized + 1, 'x', JSONK_ARENA_CHUNK_SIZE);
+    oversized[JSONK_ARENA_CHUNK_SIZE + 1] = '"';
+    spin_lock_irqsave(&rx_lock, flags);
+    patch_json = jsonk_parse_atomic(oversized, JSONK_ARENA_CHUNK_SIZE + 2);
+    spin_unlock_irqrestore(&rx_lock, flags);
+    if (!patch_json) {
+        printk(KERN_INFO "✓ Message larger than a pool chunk rejected\n");
+    } else {
+        printk(KERN_ERR "✗ Oversized message parsed from the pool\n");
+        jsonk_value_put(patch_json);
+    }
+    
+cleanup:
+    kfree(oversized);
+    if (target_json)
+        jsonk_value_put(target_json);
+}
+
+/**
+ * Test a patch of an element of a root array parsed on several CPUs
+ */
+static void test_parallel_parsed_patch(void)
+{
+    const struct jsonk_parse_opts opts = { .flags = JSONK_PARSE_PARALLEL | JSONK_PARSE_ARENA };
+    const char *patch = "{\"up\":true,\"mtu\":9000}";
+    const char *expected = "{\"id\":1500,\"up\":true,\"mtu\":9000}";
+    struct jsonk_parse_opts limited = { .flags = JSONK_PARSE_PARALLEL };
+    struct jsonk_value *serial = NULL, *parallel = NULL, *patch_json = NULL, *over_limit;
+    size_t json_len, serial_len, parallel_len, i;
+    char *json, *out;
+    int ret;
+    
+    printk(KERN_INFO "=== Testing Patch On Parallel-Parsed Array ===\n");
+    
+    json = vmalloc(SPLIT_TEST_RECORDS * 32);
+    out = vmalloc(2 * SPLIT_TEST_RECORDS * 32);
+    if (!json || !out) {
+        printk(KERN_ERR "✗ Failed to set up test data\n");
+        goto cleanup;
+    }
+    
+    json_len = sprintf(json, "[");
+    for (i = 0; i < SPLIT_TEST_RECORDS; i++)
+        json_len += sprintf(json + json_len, "%s{\"id\":%zu,\"up\":false}", i ? "," : "", i);
+    json_len += sprintf(json + json_len, "]");
+    
+    serial = jsonk_parse(json, json_len);
+    parallel = jsonk_parse_ex(json, json_len, &opts);
+    if (!serial || !parallel) {
+        printk(KERN_ERR "✗ Record array failed to parse\n");
+        goto cleanup;
+    }
+    
+    if (jsonk_serialize(serial, out, SPLIT_TEST_RECORDS * 32, &serial_len) == 0 &&
+        jsonk_serialize(parallel, out + SPLIT_TEST_RECORDS * 32, SPLIT_TEST_RECORDS * 32,
+                        &parallel_len) == 0 &&
+        serial_len == parallel_len &&
+        memcmp(out, out + SPLIT_TEST_RECORDS * 32, serial_len) == 0)
+        printk(KERN_INFO "✓ Parallel parse matches serial parse (%zu bytes)\n", serial_len);
+    else
+        printk(KERN_ERR "✗ Parallel parse differs from serial parse\n");
+    
+    patch_json = jsonk_parse(patch, strlen(patch));
+    ret = patch_json ? jsonk_apply_patch_tree(parallel->u.array.items[1500], patch_json)
+                     : JSONK_PATCH_ERROR_PARSE;
+    if (ret == JSONK_PATCH_SUCCESS &&
+        jsonk_serialize(parallel->u.array.items[1500], out, 64, &parallel_len) == 0 &&
+        parallel_len == strlen(expected) && memcmp(out, expected, parallel_len) == 0)
+        printk(KERN_INFO "✓ Element patched: %s\n", expected);
+    else
+        printk(KERN_ERR "✗ Element patch failed with code: %d\n", ret);
+    
+    /* A broken element late in the array fails the whole parse */
+    json[json_len - 1] = '}';
+    jsonk_value_put(parallel);
+    parallel = jsonk_parse_ex(json, json_len, &opts);
+    if (!parallel)
+        printk(KERN_INFO "✓ Malformed array rejected\n");
+    else
+        printk(KERN_ERR "✗ Malformed array parsed\n");
+    
+    /* The ranges share one budget: exactly enough strings is enough */
+    json_len = sprintf(json, "[");
+    for (i = 0; i < SPLIT_TEST_RECORDS; i++)
+        json_len += sprintf(json + json_len, "%s\"s%zu\"", i ? "," : "", i);
+    json_len += sprintf(json + json_len, "]");
+    limited.max_strings = SPLIT_TEST_RECORDS;
+    if (parallel)
+        jsonk_value_put(parallel);
+    parallel = jsonk_parse_ex(json, json_len, &limited);
+    limited.max_strings--;
+    over_limit = jsonk_parse_ex(json, json_len, &limited);
+    if (parallel && !over_limit)
+        printk(KERN_INFO "✓ String limit held across ranges\n");
+    else
+        printk(KERN_ERR "✗ String limit of %u not applied to the whole array\n", limited.max_strings);
+    if (over_limit)
+        jsonk_value_put(over_limit);
+    
+cleanup:
+    if (patch_json)
+        jsonk_value_put(patch_json);
+    if (parallel)
+        jsonk_value_put(parallel);
+    if (serial)
+        jsonk_value_put(serial);
+    vfree(out);
+    vfree(json);
+}
+
+/**
+ * Test JSON Pointers to keys that need escaping in JSON text
+ */
+static void test_escaped_key_pointers(void)
+{
+    const char *target = "{\"a\\\"b\":1,\"c\\\\d\":2}";
+    const char *ops = "[{\"op\":\"test\",\"path\":\"/a\\\"b\",\"value\":1},"
+                      "{\"op\":\"add\",\"path\":\"/q\\\"z\",\"value\":3},"
+                      "{\"op\":\"remove\",\"path\":\"/c\\\\d\"}]";
+    const char *expected = "{\"a\\\"b\":1,\"q\\\"z\":3}";
+    struct jsonk_value *target_json, *ops_json = NULL, *reparsed = NULL;
+    char result[128];
+    size_t result_len;
+    int ret;
+    
+    printk(KERN_INFO "=== Testing Pointers To Escaped Keys ===\n");
+    printk(KERN_INFO "Target: %s\n", target);
+    printk(KERN_INFO "Ops:    %s\n", ops);
+    
+    target_json = jsonk_parse(target, strlen(target));
+    ops_json = jsonk_parse(ops, strlen(ops));
+    if (!target_json || !ops_json) {
+        printk(KERN_ERR "✗ Failed to parse test data\n");
+        goto cleanup;
+    }
+    
+    ret = jsonk_apply_json_patch(&target_json, ops_json);
+    if (ret != JSONK_PATCH_SUCCESS ||
+        jsonk_serialize(target_json, result, sizeof(result) - 1, &result_len) != 0) {
+        printk(KERN_ERR "✗ Operations on escaped keys failed with code: %d\n", ret);
+        goto cleanup;
+    }
+    result[result_len] = '\0';
+    
+    if (strcmp(result, expected) == 0)
+        printk(KERN_INFO "✓ Escaped keys tested, added and removed: %s\n", result);
+    else
+        printk(KERN_ERR "✗ Unexpected result: %s\n", result);
+    
+    reparsed = jsonk_parse(result, result_len);
+    if (reparsed)
+        printk(KERN_INFO "✓ Result is valid JSON\n");
+    else
+        printk(KERN_ERR "✗ Result does not parse again\n");
+    
+cleanup:
+    if (reparsed)
+        jsonk_value_put(reparsed);
+    if (ops_json)
+        jsonk_value_put(ops_json);
+    if (target_json)
+        jsonk_value_put(target_json);
+}
+
+/**
+ * Test a patch between documents that share interned keys
+ */
+static void test_interned_key_patch(void)
+{
+    const char *target = "{\"device\":{\"state\":\"down\",\"mtu\":1500},\"stale\":true}";
+    const char *patch = "{\"device\":{\"state\":\"up\",\"description\":\"uplink\"},\"stale\":null}";
+    const char *expected = "{\"device\":{\"state\":\"up\",\"mtu\":1500,\"description\":\"uplink\"}}";
+    struct jsonk_value *target_json, *patch_json, *target_device, *patch_device;
+    struct jsonk_member *added, *source;
+    char result[256];
+    size_t result_len;
+    int ret;
+    
+    printk(KERN_INFO "=== Testing Patch With Interned Keys ===\n");
+    printk(KERN_INFO "Target: %s\n", target);
+    printk(KERN_INFO "Patch:  %s\n", patch);
+    
+    target_json = jsonk_parse_flags(target, strlen(target), JSONK_PARSE_INTERN);
+    patch_json = jsonk_parse_flags(patch, strlen(patch), JSONK_PARSE_INTERN);
+    if (!target_json || !patch_json) {
+        printk(KERN_ERR "✗ Failed to parse test data\n");
+        goto cleanup;
+    }
+    
+    ret = jsonk_apply_patch_tree(target_json, patch_json);
+    if (ret == JSONK_PATCH_SUCCESS &&
+        jsonk_serialize(target_json, result, sizeof(result) - 1, &result_len) == 0) {
+        result[result_len] = '\0';
+        if (strcmp(result, expected) == 0)
+            printk(KERN_INFO "✓ Interned patch applied: %s\n", result);
+        else
+            printk(KERN_ERR "✗ Unexpected result: %s\n", result);
+    } else {
+        printk(KERN_ERR "✗ Tree patch failed with code: %d\n", ret);
+        goto cleanup;
+    }
+    
+    /* The added member shares the patch document's key */
+    target_device = jsonk_get_value_by_path(target_json, "device", 6);
+    patch_device = jsonk_get_value_by_path(patch_json, "device", 6);
+    added = target_device ? jsonk_object_find_member(&target_device->u.object, "description", 11) : NULL;
+    source = patch_device ? jsonk_object_find_member(&patch_device->u.object, "description", 11) : NULL;
+    if (added && source && (added->flags & JSONK_MEMBER_F_INTERNED) && added->key == source->key)
+        printk(KERN_INFO "✓ Added member shares the interned key\n");
+    else
+        printk(KERN_ERR "✗ Added member does not share the interned key\n");
+    
+cleanup:
+    if (target_json)
+        jsonk_value_put(target_json);
+    if (patch_json)
+        jsonk_value_put(patch_json);
+}
+
+static void test_binary_decoded_patch(void)
+{
+    const char *target = "{\"device\":{\"state\":\"down\",\"mtu\":1500},\"stale\":true}";
+    const char *patch = "{\"device\":{\"state\":\"up\"},\"stale\":null}";
+    const char *expected = "{\"device\":{\"state\":\"up\",\"mtu\":1500}}";
+    struct jsonk_value *target_json, *decoded = NULL, *patch_json = NULL, *corrupt;
+    struct jsonk_bin_value root, mtu, state;
+    const char *str;
+    char result[256];
+    u8 *encoded = NULL;
+    size_t size, result_len, str_len, i;
+    s64 value;
+    int ret;
+    
+    printk(KERN_INFO "=== Testing Patch On Binary Decoded Document ===\n");
+    printk(KERN_INFO "Target: %s\n", target);
+    printk(KERN_INFO "Patch:  %s\n", patch);
+    
+    target_json = jsonk_parse(target, strlen(target));
+    patch_json = jsonk_parse(patch, strlen(patch));
+    if (!target_json || !patch_json) {
+        printk(KERN_ERR "✗ Failed to parse test data\n");
+        goto cleanup;
+    }
+    
+    size = jsonk_binary_size(target_json);
+    encoded = kmalloc(size, GFP_KERNEL);
+    if (!encoded || jsonk_encode_binary(target_json, encoded, size, &size) != 0) {
+        printk(KERN_ERR "✗ Failed to encode target\n");
+        goto cleanup;
+    }
+    
+    /* Read from the encoding in place, then patch the decoded tree */
+    if (jsonk_bin_root(encoded, size, &root) == 0 &&
+        jsonk_bin_get_path(&root, "device.mtu", 10, &mtu) == 0 &&
+        jsonk_bin_get_s64(&mtu, &value) == 0 && value == 1500)
+        printk(KERN_INFO "✓ Read device.mtu from the encoding: %lld\n", value);
+    else
+        printk(KERN_ERR "✗ Failed to read device.mtu from the encoding\n");
+    
+    /* Payloads are checked against the extent of the value, not its tag */
+    if (jsonk_bin_get_path(&root, "device.state", 12, &state) == 0) {
+        state.len = 4;
+        mtu.len = 1;
+        if (jsonk_bin_get_string(&state, &str, &str_len) == -EINVAL &&
+            jsonk_bin_get_s64(&mtu, &value) == -EINVAL)
+            printk(KERN_INFO "✓ Payloads past the value's extent rejected\n");
+        else
+            printk(KERN_ERR "✗ Payloads past the value's extent read\n");
+    } else {
+        printk(KERN_ERR "✗ Failed to read device.state from the encoding\n");
+    }
+    
+    decoded = jsonk_decode_binary(encoded, size, NULL);
+    if (!decoded) {
+        printk(KERN_ERR "✗ Failed to decode target\n");
+        goto cleanup;
+    }
+    
+    ret = jsonk_apply_patch_tree(decoded, patch_json);
+    if (ret == JSONK_PATCH_SUCCESS &&
+        jsonk_serialize(decoded, result, sizeof(result) - 1, &result_len) == 0) {
+        result[result_len] = '\0';
+        if (strcmp(result, expected) == 0)
+            printk(KERN_INFO "✓ Decoded document patched: %s\n", result);
+        else
+            printk(KERN_ERR "✗ Unexpected result: %s\n", result);
+    } else {
+        printk(KERN_ERR "✗ Tree patch failed with code: %d\n", ret);
+    }
+    
+    /* A truncated encoding is refused */
+    if (!jsonk_decode_binary(encoded, size - 1, NULL))
+        printk(KERN_INFO "✓ Truncated encoding rejected\n");
+    else
+        printk(KERN_ERR "✗ Truncated encoding accepted\n");
+    
+    /* A key that is no valid JSON text is refused, it would be written out as is */
+    for (i = 0; i + 5 <= size; i++) {
+        if (memcmp(encoded + i, "stale", 5) == 0) {
+            encoded[i + 2] = '"';
+            break;
+        }
+    }
+    corrupt = jsonk_decode_binary(encoded, size, NULL);
+    if (i + 5 <= size && !corrupt) {
+        printk(KERN_INFO "✓ Corrupt key rejected\n");
+    } else {
+        printk(KERN_ERR "✗ Corrupt key accepted\n");
+        if (corrupt)
+            jsonk_value_put(corrupt);
+    }
+    
+cleanup:
+    kfree(encoded);
+    if (decoded)
+        jsonk_value_put(decoded);
+    if (target_json)
+        jsonk_value_put(target_json);
+    if (patch_json)
+        jsonk_value_put(patch_json);
+}
+
+static void test_json_patch_ops(void)
+{
+    const char *target = "{\"ports\":[{\"id\":1,\"up\":false}],\"owner\":\"ops\"}";
+    const char *ops = "[{\"op\":\"test\",\"path\":\"/owner\",\"value\":\"ops\"},"
+                      "{\"op\":\"test\",\"path\":\"/ports/0/id\",\"value\":1.0e0},"
+                      "{\"op\":\"replace\",\"path\":\"/ports/0/up\",\"value\":true},"
+                      "{\"op\":\"add\",\"path\":\"/ports/-\",\"value\":{\"id\":2,\"up\":false}},"
+                      "{\"op\":\"move\",\"from\":\"/owner\",\"path\":\"/meta~1owner\"}]";
+    const char *failing = "[{\"op\":\"remove\",\"path\":\"/ports/0\"},"
+                          "{\"op\":\"test\",\"path\":\"/ports/0/id\",\"value\":1}]";
+    const char *merge = "{\"ports\":null,\"meta/owner\":{\"team\":\"net\"}}";
+    const char *expected = "{\"ports\":[{\"id\":1,\"up\":true},{\"id\":2,\"up\":false}],\"meta/owner\":\"ops\"}";
+    const char *merged = "{\"meta/owner\":{\"team\":\"net\"}}";
+    struct jsonk_value *target_json, *ops_json = NULL, *failing_json = NULL, *merge_json = NULL;
+    char result[256];
+    size_t result_len;
+    int ret;
+    
+    printk(KERN_INFO "=== Testing RFC 6902 Operations And RFC 7386 Merge ===\n");
+    printk(KERN_INFO "Target: %s\n", target);
+    printk(KERN_INFO "Ops:    %s\n", ops);
+    
+    target_json = jsonk_parse(target, strlen(target));
+    ops_json = jsonk_parse(ops, strlen(ops));
+    failing_json = jsonk_parse(failing, strlen(failing));
+    merge_json = jsonk_parse(merge, strlen(merge));
+    if (!target_json || !ops_json || !failing_json || !merge_json) {
+        printk(KERN_ERR "✗ Failed to parse test data\n");
+        goto cleanup;
+    }
+    
+    ret = jsonk_apply_json_patch(&target_json, ops_json);
+    if (ret == JSONK_PATCH_SUCCESS &&
+        jsonk_serialize(target_json, result, sizeof(result) - 1, &result_len) == 0) {
+        result[result_len] = '\0';
+        if (strcmp(result, expected) == 0)
+            printk(KERN_INFO "✓ Operation list applied: %s\n", result);
+        else
+            printk(KERN_ERR "✗ Unexpected result: %s\n", result);
+    } else {
+        printk(KERN_ERR "✗ Operation list failed with code: %d\n", ret);
+    }
+    
+    /* The failing test must undo the removal before it */
+    ret = jsonk_apply_json_patch(&target_json, failing_json);
+    if (ret == JSONK_PATCH_ERROR_TEST &&
+        jsonk_serialize(target_json, result, sizeof(result) - 1, &result_len) == 0) {
+        result[result_len] = '\0';
+        if (strcmp(result, expected) == 0)
+            printk(KERN_INFO "✓ Failed test rolled back the whole list\n");
+        else
+            printk(KERN_ERR "✗ Target modified after failure: %s\n", result);
+    } else {
+        printk(KERN_ERR "✗ Expected a failed test, got code: %d\n", ret);
+    }
+    
+    ret = jsonk_apply_merge_patch(&target_json, merge_json);
+    if (ret == JSONK_PATCH_SUCCESS &&
+        jsonk_serialize(target_json, result, sizeof(result) - 1, &result_len) == 0) {
+        result[result_len] = '\0';
+        if (strcmp(result, merged) == 0)
+            printk(KERN_INFO "✓ RFC 7386 merge applied: %s\n", result);
+        else
+            printk(KERN_ERR "✗ Unexpected merge result: %s\n", result);
+    } else {
+        printk(KERN_ERR "✗ Merge patch failed with code: %d\n", ret);
+    }
+    
+cleanup:
+    if (target_json)
+        jsonk_value_put(target_json);
+    if (ops_json)
+        jsonk_value_put(ops_json);
+    if (failing_json)
+        jsonk_value_put(failing_json);
+    if (merge_json)
+        jsonk_value_put(merge_json);
+}
+
+static void test_diff_change_detection(void)
+{
+    const char *running = "{\"ports\":[1,2,3],\"mtu\":1500,\"name\":\"eth0\"}";
+    const char *reordered = "{\"name\":\"eth0\",\"mtu\":1500,\"ports\":[1,2,3]}";
+    const char *expected = "[{\"op\":\"add\",\"path\":\"/ports/3\",\"value\":7},"
+                           "{\"op\":\"replace\",\"path\":\"/mtu\",\"value\":9000}]";
+    struct jsonk_value *running_json, *desired_json = NULL, *mtu = NULL, *port = NULL, *patch = NULL;
+    char result[256];
+    size_t result_len;
+    int ret;
+    
+    printk(KERN_INFO "=== Testing Content Hashes And Diff ===\n");
+    printk(KERN_INFO "Running: %s\n", running);
+    
+    running_json = jsonk_parse(running, strlen(running));
+    desired_json = jsonk_parse(reordered, strlen(reordered));
+    mtu = jsonk_value_create_s64(9000);
+    port = jsonk_value_create_s64(7);
+    if (!running_json || !desired_json || !mtu || !port) {
+        printk(KERN_ERR "✗ Failed to set up test data\n");
+        goto cleanup;
+    }
+    
+    /* Member order does not count */
+    if (jsonk_value_hash(running_json) == jsonk_value_hash(desired_json))
+        printk(KERN_INFO "✓ Reordered document hashes the same\n");
+    else
+        printk(KERN_ERR "✗ Reordered document hashes differently\n");
+    
+    /* Setting a value clears the hashes along its path */
+    jsonk_set_value_by_path(desired_json, "mtu", 3, mtu);
+    if (jsonk_value_hash(running_json) != jsonk_value_hash(desired_json))
+        printk(KERN_INFO "✓ Changed document hashes differently\n");
+    else
+        printk(KERN_ERR "✗ Change not detected\n");
+    
+    /* Direct changes to nested containers reset the ancestors by hand */
+    ret = jsonk_array_add_element(&jsonk_get_value_by_path(desired_json, "ports", 5)->u.array, port);
+    if (ret == 0)
+        port = NULL;
+    jsonk_value_hash_reset(desired_json);
+    
+    patch = jsonk_diff(running_json, desired_json);
+    if (patch && jsonk_serialize(patch, result, sizeof(result) - 1, &result_len) == 0) {
+        result[result_len] = '\0';
+        if (strcmp(result, expected) == 0)
+            printk(KERN_INFO "✓ Diff: %s\n", result);
+        else
+            printk(KERN_ERR "✗ Unexpected diff: %s\n", result);
+    } else {
+        printk(KERN_ERR "✗ Diff failed\n");
+        goto cleanup;
+    }
+    
+    ret = jsonk_apply_json_patch(&running_json, patch);
+    if (ret == JSONK_PATCH_SUCCESS && jsonk_value_equal(running_json, desired_json) == 1 &&
+        jsonk_value_hash(running_json) == jsonk_value_hash(desired_json))
+        printk(KERN_INFO "✓ Diff applied, documents equal\n");
+    else
+        printk(KERN_ERR "✗ Applying the diff failed with code: %d\n", ret);
+    
+cleanup:
+    if (patch)
+        jsonk_value_put(patch);
+    if (port)
+        jsonk_value_put(port);
+    if (mtu)
+        jsonk_value_put(mtu);
+    if (desired_json)
+        jsonk_value_put(desired_json);
+    if (running_json)
+        jsonk_value_put(running_json);
+}
+
+/**
+ * Test that a diff names escaped keys by their content and survives a round trip as text
+ */
+static void test_diff_escaped_keys(void)
+{
+    const char *from = "{\"a\\\"b\":1,\"x/y~z\":2}";
+    const char *to = "{\"a\\\"b\":2,\"x/y~z\":3,\"q\\\\z\":3}";
+    const char *expected = "[{\"op\":\"replace\",\"path\":\"/a\\\"b\",\"value\":2},"
+                           "{\"op\":\"replace\",\"path\":\"/x~1y~0z\",\"value\":3},"
+                           "{\"op\":\"add\",\"path\":\"/q\\\\z\",\"value\":3}]";
+    struct jsonk_value *from_json, *to_json = NULL, *patch = NULL, *reparsed = NULL;
+    char result[256];
+    size_t result_len;
+    int ret;
+    
+    printk(KERN_INFO "=== Testing Diff Of Escaped Keys ===\n");
+    printk(KERN_INFO "From: %s\n", from);
+    printk(KERN_INFO "To:   %s\n", to);
+    
+    from_json = jsonk_parse(from, strlen(from));
+    to_json = jsonk_parse(to, strlen(to));
+    if (!from_json || !to_json) {
+        printk(KERN_ERR "✗ Failed to parse test data\n");
+        goto cleanup;
+    }
+    
+    patch = jsonk_diff(from_json, to_json);
+    if (!patch || jsonk_serialize(patch, result, sizeof(result) - 1, &result_len) != 0) {
+        printk(KERN_ERR "✗ Diff failed\n");
+        goto cleanup;
+    }
+    result[result_len] = '\0';
+    if (strcmp(result, expected) == 0)
+        printk(KERN_INFO "✓ Diff: %s\n", result);
+    else
+        printk(KERN_ERR "✗ Unexpected diff: %s\n", result);
+    
+    /* The patch as text must lead to the same document */
+    reparsed = jsonk_parse(result, result_len);
+    ret = reparsed ? jsonk_apply_json_patch(&from_json, reparsed) : JSONK_PATCH_ERROR_PARSE;
+    if (ret == JSONK_PATCH_SUCCESS && jsonk_value_equal(from_json, to_json) == 1)
+        printk(KERN_INFO "✓ Re-parsed diff applied, documents equal\n");
+    else
+        printk(KERN_ERR "✗ Applying the re-parsed diff failed with code: %d\n", ret);
+    
+cleanup:
+    if (reparsed)
+        jsonk_value_put(reparsed);
+    if (patch)
+        jsonk_value_put(patch);
+    if (to_json)
+        jsonk_value_put(to_json);
+    if (from_json)
+        jsonk_value_put(from_json);
+}
+
+/**
+ * Test that numbers at the edges of the integer range, and -0, survive a patch unchanged
+ */
+static void test_number_round_trip(void)
+{
+    const char *target = "{\"min\":-9223372036854775808,\"max\":18446744073709551615,\"zero\":0}";
+    const char *patch = "{\"zero\":-0,\"neg\":-0.0,\"exp\":1e2}";
+    const char *expected = "{\"min\":-9223372036854775808,\"max\":18446744073709551615,\"zero\":-0,"
+                           "\"neg\":-0.0,\"exp\":1e2}";
+    struct jsonk_value *target_json, *patch_json = NULL, *zero;
+    char result[128];
+    size_t result_len;
+    s64 value = 1;
+    int ret;
+    
+    printk(KERN_INFO "=== Testing Number Round Trip ===\n");
+    
+    target_json = jsonk_parse(target, strlen(target));
+    patch_json = jsonk_parse(patch, strlen(patch));
+    if (!target_json || !patch_json) {
+        printk(KERN_ERR "✗ Failed to parse test data\n");
+        goto cleanup;
+    }
+    
+    ret = jsonk_apply_patch_tree(target_json, patch_json);
+    if (ret != JSONK_PATCH_SUCCESS ||
+        jsonk_serialize(target_json, result, sizeof(result) - 1, &result_len) != 0) {
+        printk(KERN_ERR "✗ Number patch failed: %d\n", ret);
+        goto cleanup;
+    }
+    result[result_len] = '\0';
+    
+    if (result_len == strlen(expected) && memcmp(result, expected, result_len) == 0)
+        printk(KERN_INFO "✓ Numbers kept exactly: %s\n", result);
+    else
+        printk(KERN_ERR "✗ Numbers changed: %s\n", result);
+    
+    zero = jsonk_get_value_by_path(target_json, "zero", 4);
+    if (zero && jsonk_number_get_s64(zero, &value) == 0 && value == 0)
+        printk(KERN_INFO "✓ -0 reads as the integer 0\n");
+    else
+        printk(KERN_ERR "✗ -0 does not read as 0\n");
+    
+cleanup:
+    if (patch_json)
+        jsonk_value_put(patch_json);
+    if (target_json)
+        jsonk_value_put(target_json);
+}
+
+/**
+ * Test that the memory limit covers the object index without losing members
+ */
+static void test_index_memory_limit(void)
+{
+    struct jsonk_parse_opts opts = { .max_memory = 1 };
+    struct jsonk_value *json = NULL;
+    const int members = 2 * JSONK_OBJECT_INDEX_THRESHOLD + 1;
+    char text[256], key[8];
+    size_t len, key_len;
+    int i, found = 0;
+    
+    printk(KERN_INFO "=== Testing Object Index Memory Limit ===\n");
+    
+    len = sprintf(text, "{");
+    /* The last member outgrows the first index */
+    for (i = 0; i < members; i++)
+        len += sprintf(text + len, "%s\"k%d\":%d", i ? "," : "", i, i);
+    len += sprintf(text + len, "}");
+    
+    /* The smallest budget that parses must still index every member */
+    while (!json && opts.max_memory < 65536) {
+        json = jsonk_parse_ex(text, len, &opts);
+        opts.max_memory++;
+    }
+    if (!json) {
+        printk(KERN_ERR "✗ Object did not parse under any budget\n");
+        return;
+    }
+    
+    for (i = 0; i < members; i++) {
+        key_len = sprintf(key, "k%d", i);
+        if (jsonk_object_find_member(&json->u.object, key, key_len))
+            found++;
+    }
+    if (found == members)
+        printk(KERN_INFO "✓ All %d members found at a %zu byte budget\n", found, opts.max_memory - 1);
+    else
+        printk(KERN_ERR "✗ Only %d members found at a %zu byte budget\n", found, opts.max_memory - 1);
+    
+    jsonk_value_put(json);
+}
+
+static u64 latency_total(const struct jsonk_stats *stats, enum jsonk_stat_op op)
+{
+    u64 total = 0;
+    int i;
+    
+    for (i = 0; i < JSONK_LATENCY_BUCKETS; i++)
+        total += stats->latency[op][i];
+    return total;
+}
+
+static void test_statistics(void)
+{
+    const char *good = "{\"name\":\"eth0\",\"mtu\":1500}";
+    const char *deep = "[[[[\"too deep\"]]]]";
+    const char *long_string = "{\"name\":\"longer than eight\"}";
+    struct jsonk_parse_opts opts = { .max_depth = 3, .max_string_length = 8 };
+    struct jsonk_value *good_json, *patch_json = NULL, *empty = NULL, *bad;
+    struct jsonk_stats *stats;
+    char result[64];
+    size_t result_len = 0;
+    int i;
+    
+    printk(KERN_INFO "=== Testing Statistics ===\n");
+    
+    stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+    if (!stats) {
+        printk(KERN_ERR "✗ Failed to allocate statistics\n");
+        return;
+    }
+    jsonk_stats_reset();
+    
+    good_json = jsonk_parse(good, strlen(good));
+    patch_json = jsonk_parse("{\"mtu\":9000}", 12);
+    empty = jsonk_value_create(JSONK_VALUE_OBJECT);
+    bad = jsonk_parse_ex(deep, strlen(deep), &opts);
+    if (bad)
+        jsonk_value_put(bad);
+    bad = jsonk_parse_ex(long_string, strlen(long_string), &opts);
+    if (bad)
+        jsonk_value_put(bad);
+    if (!good_json || !patch_json || !empty) {
+        printk(KERN_ERR "✗ Failed to set up test data\n");
+        goto cleanup;
+    }
+    
+    jsonk_serialize(good_json, result, sizeof(result), &result_len);
+    jsonk_apply_patch_tree(good_json, patch_json);
+    jsonk_apply_patch_tree(good_json, empty);
+    jsonk_stats_read(stats);
+    
+    if (stats->parses == 4 && stats->parse_errors == 2 &&
+        stats->parse_bytes == strlen(good) + 12 + strlen(deep) + strlen(long_string) &&
+        stats->nodes >= 5 && stats->allocs >= stats->nodes && latency_total(stats, JSONK_STAT_PARSE) <= 4)
+        printk(KERN_INFO "✓ Parses counted: %llu bytes, %llu nodes, %llu allocations\n",
+               stats->parse_bytes, stats->nodes, stats->allocs);
+    else
+        printk(KERN_ERR "✗ Parses miscounted: %llu parses, %llu errors, %llu bytes\n",
+               stats->parses, stats->parse_errors, stats->parse_bytes);
+    
+    if (stats->limits[JSONK_LIMIT_DEPTH] == 1 && stats->limits[JSONK_LIMIT_STRING_LENGTH] == 1)
+        printk(KERN_INFO "✓ Limit rejections counted by limit\n");
+    else
+        printk(KERN_ERR "✗ Limit rejections miscounted: depth %llu, string length %llu\n",
+               stats->limits[JSONK_LIMIT_DEPTH], stats->limits[JSONK_LIMIT_STRING_LENGTH]);
+    
+    if (stats->serializes == 1 && stats->serialize_bytes == result_len &&
+        stats->patches[JSONK_PATCH_SUCCESS] == 1 && stats->patches[JSONK_PATCH_NO_CHANGE] == 1)
+        printk(KERN_INFO "✓ Serializations and patch outcomes counted\n");
+    else
+        printk(KERN_ERR "✗ Serializations or patches miscounted: %llu serializes, %llu/%llu patches\n",
+               stats->serializes, stats->patches[JSONK_PATCH_SUCCESS], stats->patches[JSONK_PATCH_NO_CHANGE]);
+    
+    /* Every CPU that runs JSONK_LATENCY_SAMPLE patches times at least one */
+    for (i = 0; i < 4 * JSONK_LATENCY_SAMPLE; i++)
+        jsonk_apply_patch_tree(good_json, empty);
+    jsonk_stats_read(stats);
+    if (latency_total(stats, JSONK_STAT_PATCH) >= 1 &&
+        latency_total(stats, JSONK_STAT_PATCH) <= stats->patches[JSONK_PATCH_NO_CHANGE])
+        printk(KERN_INFO "✓ Latency sampled: %llu of %llu patches timed\n",
+               latency_total(stats, JSONK_STAT_PATCH), stats->patches[JSONK_PATCH_NO_CHANGE]);
+    else
+        printk(KERN_ERR "✗ Latency not sampled\n");
+    
+    jsonk_stats_reset();
+    jsonk_stats_read(stats);
+    if (!stats->parses && !stats->patches[JSONK_PATCH_SUCCESS] && !latency_total(stats, JSONK_STAT_PARSE))
+        printk(KERN_INFO "✓ Counters reset\n");
+    else
+        printk(KERN_ERR "✗ Counters not reset\n");
+    
+cleanup:
+    kfree(stats);
+    if (empty)
+        jsonk_value_put(empty);
+    if (patch_json)
+        jsonk_value_put(patch_json);
+    if (good_json)
+        jsonk_value_put(good_json);
+}
+
 /**
  * Module initialization
  */
@@ -235,6 +1226,51 @@ static int __init atomic_test_init(void)
     test_no_change_patch();
     printk(KERN_INFO "\n");
     
+    test_tree_patch();
+    printk(KERN_INFO "\n");
+    
+    test_tree_patch_rollback();
+    printk(KERN_INFO "\n");
+    
+    test_allocated_patch();
+    printk(KERN_INFO "\n");
+    
+    test_deep_nested_patch();
+    printk(KERN_INFO "\n");
+    
+    test_atomic_context_patch();
+    printk(KERN_INFO "\n");
+    
+    test_parallel_parsed_patch();
+    printk(KERN_INFO "\n");
+    
+    test_interned_key_patch();
+    printk(KERN_INFO "\n");
+    
+    test_binary_decoded_patch();
+    printk(KERN_INFO "\n");
+    
+    test_json_patch_ops();
+    printk(KERN_INFO "\n");
+    
+    test_escaped_key_pointers();
+    printk(KERN_INFO "\n");
+    
+    test_diff_change_detection();
+    printk(KERN_INFO "\n");
+    
+    test_diff_escaped_keys();
+    printk(KERN_INFO "\n");
+    
+    test_number_round_trip();
+    printk(KERN_INFO "\n");
+    
+    test_index_memory_limit();
+    printk(KERN_INFO "\n");
+    
+    test_statistics();
+    printk(KERN_INFO "\n");
+    
     printk(KERN_INFO "Atomic patching tests completed\n");
     return 0;
 }
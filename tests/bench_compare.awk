@@ -0,0 +1,70 @@
+# bench_compare.awk - Compare a corpus benchmark run with a baseline
+#
+# Usage: awk [-v THRESHOLD=10] -f tests/bench_compare.awk baseline.txt current.txt
+#
+# Both files hold the "jsonk_bench:" lines of one run with the prefix
+# removed, as saved by "make bench". For each corpus and operation the
+# median (p50) and p99 latency are compared. A median slower by more than
+# THRESHOLD percent (default 10), or more allocations per call, counts as
+# a regression; p99 is shown but too noisy to gate on. Exits with 1 if
+# any operation regressed.
+#
+# Copyright (C) 2025 Mehran Toosi
+# Licensed under GPL-2.0
+
+BEGIN {
+    if (THRESHOLD == "")
+        THRESHOLD = 10
+}
+
+function change(old, new) {
+    return old > 0 ? (new - old) * 100 / old : 0
+}
+
+# Operation lines: corpus=... op=... n=... p50_ns=... p99_ns=... [allocs_per_op=...]
+$1 ~ /^corpus=/ && $2 ~ /^op=/ {
+    split("", f)
+    for (i = 1; i <= NF; i++) {
+        eq = index($i, "=")
+        if (eq)
+            f[substr($i, 1, eq - 1)] = substr($i, eq + 1)
+    }
+    key = f["corpus"] " " f["op"]
+
+    if (FNR == NR) {
+        base_p50[key] = f["p50_ns"]
+        base_p99[key] = f["p99_ns"]
+        base_allocs[key] = f["allocs_per_op"]
+        next
+    }
+
+    if (!(key in base_p50)) {
+        printf "%-16s %-10s p50 %10d ns  (not in baseline)\n", f["corpus"], f["op"], f["p50_ns"]
+        next
+    }
+    seen[key] = 1
+
+    d50 = change(base_p50[key], f["p50_ns"])
+    d99 = change(base_p99[key], f["p99_ns"])
+    flag = ""
+    if (d50 > THRESHOLD)
+        flag = "  SLOWER"
+    if (base_allocs[key] != "" && f["allocs_per_op"] != "" && f["allocs_per_op"] + 0 > base_allocs[key] + 0)
+        flag = flag sprintf("  ALLOCS %s -> %s", base_allocs[key], f["allocs_per_op"])
+    if (flag != "")
+        regressions++
+
+    printf "%-16s %-10s p50 %10d -> %10d ns (%+6.1f%%)  p99 %10d -> %10d ns (%+6.1f%%)%s\n",
+           f["corpus"], f["op"], base_p50[key], f["p50_ns"], d50, base_p99[key], f["p99_ns"], d99, flag
+}
+
+END {
+    for (key in base_p50) {
+        if (!(key in seen))
+            printf "%-27s missing from the current run\n", key
+    }
+    if (regressions) {
+        printf "%d regression(s), threshold %s%%\n", regressions, THRESHOLD
+        exit 1
+    }
+}
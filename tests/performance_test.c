@@ -2,11 +2,37 @@
  * performance_test.c - Comprehensive Performance Test for JSONK library
  *
  * This program measures the performance of JSONK operations:
- * - JSON parsing speed (regular vs memory pools)
- * - JSON serialization speed  
- * - JSON patching speed
- * - Memory usage patterns
+ * - JSON parsing speed (regular vs memory pools, copied vs borrowed strings,
+ *   atomic-context parses from the per-CPU chunk pools, and interned keys)
+ * - Validation speed without building a tree
+ * - Parsing with per-node limit checks versus hoisted ones
+ * - JSON serialization speed, output buffer sizing strategies and
+ *   page-by-page streaming
+ * - Number parsing and formatting, with round-trip checks
+ * - String escaping on output, for plain and escape-heavy text
+ * - Parse, serialize, copy and free of deeply nested documents
+ * - JSON patching speed, on buffers and in place on parsed trees
+ * - RFC 6902 operation lists versus one jsonk_apply_patch per edit, and
+ *   RFC 7386 merges
+ * - Copy-on-write snapshots versus deep copies
+ * - Change detection: serialize and memcmp versus cached hashes and diffs
+ * - Memory usage patterns and bytes per node, with and without interned keys
  * - Scalability with different JSON sizes
+ * - Member lookup cost versus object size
+ * - Path lookups on unparsed documents versus parse-then-get
+ * - Compiled path handles versus path strings
+ * - Binary encoding versus text: encode, decode and in-place lookups
+ * - Batch parsing throughput by number of CPUs
+ * - Parsing one large root array on several CPUs
+ * - Corpus benchmarks: parse, free, deep copy, serialize, path get/set and
+ *   patch on twitter-, citm- and canada-style documents, our own record
+ *   schema and any corpus files given, with latency percentiles and
+ *   allocations per call as machine-readable lines
+ *
+ * Module parameters: suite=all|micro|corpus picks the fixed-loop
+ * benchmarks, the corpus benchmarks or both; corpus= lists firmware files
+ * to add as corpora; iterations= and cpu= set the calls per corpus
+ * operation and the CPU they run on.
  *
  * Copyright (C) 2025 Mehran Toosi
  * Licensed under GPL-2.0
@@ -21,6 +47,12 @@
 #include <linux/ktime.h>
 #include <linux/vmalloc.h>
 #include <linux/random.h>
+#include <linux/cpumask.h>
+#include <linux/sched.h>
+#include <linux/sched/clock.h>
+#include <linux/sort.h>
+#include <linux/firmware.h>
+#include <linux/utsname.h>
 #include "../include/jsonk.h"
 
 MODULE_LICENSE("GPL");
@@ -28,11 +60,39 @@ MODULE_AUTHOR("Mehran Toosi");
 MODULE_DESCRIPTION("JSONK Comprehensive Performance Test");
 MODULE_VERSION("1.0.0");
 
+static char *bench_suite = "all";
+module_param_named(suite, bench_suite, charp, 0444);
+MODULE_PARM_DESC(suite, "Benchmarks to run: all, micro or corpus");
+
+static char *bench_corpora;
+module_param_named(corpus, bench_corpora, charp, 0444);
+MODULE_PARM_DESC(corpus, "Comma-separated firmware files to benchmark as corpora, e.g. jsonk/twitter.json");
+
+static unsigned int bench_iterations = 1000;
+module_param_named(iterations, bench_iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "Timed calls per corpus operation");
+
+static int bench_cpu = -1;
+module_param_named(cpu, bench_cpu, int, 0444);
+MODULE_PARM_DESC(cpu, "CPU to run the corpus benchmarks on, -1 for the one loading the module");
+
 /* Performance test constants */
 #define ITERATIONS_SMALL 10000
 #define ITERATIONS_MEDIUM 1000
 #define ITERATIONS_LARGE 100
 #define POOL_ITERATIONS 10000
+#define LOOKUP_ITERATIONS 100000
+#define FOOTPRINT_RECORDS 1000
+#define NUMBER_COUNT 4096
+#define NUMBER_ITERATIONS 100
+#define STRING_COUNT 2000
+#define NEST_CHAINS 64
+#define LOOKUP_KEY_LEN 16
+#define BATCH_DOCS 256
+#define BATCH_DOC_SIZE 8192
+#define BATCH_ITERATIONS 20
+#define SPLIT_RECORDS 50000
+#define SPLIT_ITERATIONS 10
 
 #define SMALL_JSON_SIZE 1024
 #define MEDIUM_JSON_SIZE 65536
@@ -217,59 +277,201 @@ static void test_parsing_performance(void)
     end = get_time_ns();
     print_performance("Large JSON Parsing", start, end, large_size, ITERATIONS_LARGE);
     
+    /* Validation only: same checks, no tree */
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_MEDIUM; i++) {
+        if (jsonk_validate(medium_json_gen, medium_size) < 0)
+            break;
+    }
+    end = get_time_ns();
+    print_performance("Medium JSON Validation", start, end, medium_size, ITERATIONS_MEDIUM);
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        if (jsonk_validate(large_json_gen, large_size) < 0)
+            break;
+    }
+    end = get_time_ns();
+    print_performance("Large JSON Validation", start, end, large_size, ITERATIONS_LARGE);
+    
+    /*
+     * Limits just above what the document needs: the parse can no longer
+     * rule them out from the input length and checks every node.
+     */
+    {
+        struct jsonk_parse_opts opts = {
+            .max_array_size = medium_size / 2 - 1,
+            .max_object_members = medium_size / 2 - 1,
+            .max_strings = medium_size / 2 - 1,
+            .max_string_length = medium_size - 1,
+            .max_memory = medium_size * JSONK_PARSE_EXPANSION - 1,
+        };
+        
+        start = get_time_ns();
+        for (i = 0; i < ITERATIONS_MEDIUM; i++) {
+            parsed = jsonk_parse_ex(medium_json_gen, medium_size, &opts);
+            if (parsed) {
+                jsonk_value_put(parsed);
+            }
+        }
+        end = get_time_ns();
+        print_performance("Medium JSON Parsing (limits checked)", start, end,
+                          medium_size, ITERATIONS_MEDIUM);
+    }
+    
 cleanup:
     if (small_json_gen) vfree(small_json_gen);
     if (medium_json_gen) vfree(medium_json_gen);
     if (large_json_gen) vfree(large_json_gen);
 }
 
-/* Memory pool performance tests */
-static void test_pool_performance(void)
+/* Run one slab vs. arena parse comparison */
+static void compare_pool_parse(const char *name, const char *json, size_t len, int iterations)
 {
+    static const struct {
+        const char *label;
+        unsigned int flags;
+    } modes[] = {
+        { "slab", 0 },
+        { "arena", JSONK_PARSE_ARENA },
+        { "slab, borrowed", JSONK_PARSE_BORROW },
+        { "arena, borrowed", JSONK_PARSE_ARENA | JSONK_PARSE_BORROW },
+        { "per-CPU pool", JSONK_PARSE_POOL },
+        { "slab, interned keys", JSONK_PARSE_INTERN },
+    };
+    struct jsonk_value *parsed, *resident;
+    char label[64];
     u64 start, end;
-    struct jsonk_value *parsed;
-    int i;
+    size_t m;
+    int i, failed;
     
+    for (m = 0; m < ARRAY_SIZE(modes); m++) {
+        /* Interned keys live as long as some document uses them; keep one */
+        resident = NULL;
+        if (modes[m].flags & JSONK_PARSE_INTERN)
+            resident = jsonk_parse_flags(json, len, modes[m].flags);
+        
+        failed = 0;
+        start = get_time_ns();
+        for (i = 0; i < iterations; i++) {
+            parsed = jsonk_parse_flags(json, len, modes[m].flags);
+            if (parsed) {
+                jsonk_value_put(parsed);
+            } else {
+                failed++;
+            }
+        }
+        end = get_time_ns();
+        if (resident)
+            jsonk_value_put(resident);
+        snprintf(label, sizeof(label), "%s (%s)", name, modes[m].label);
+        /* Documents bigger than a CPU's pool cannot be parsed from it */
+        if (failed)
+            printk(KERN_INFO "%s: %d of %d parses failed\n", label, failed, iterations);
+        else
+            print_performance(label, start, end, len, iterations);
+    }
+}
+
+/* Memory pool performance tests */
+static void test_pool_performance(void)
+{
     printk(KERN_INFO "=== Memory Pool Performance Tests ===\n");
     
-    /* Test small JSON with regular allocation */
+    compare_pool_parse("Small JSON", small_json, strlen(small_json), POOL_ITERATIONS);
+    compare_pool_parse("Medium JSON", medium_json, strlen(medium_json), POOL_ITERATIONS);
+    
+    /* Large JSON: slab allocation vs. per-document arena, copied vs. borrowed strings */
+    char *large_json_str = generate_large_json();
+    if (large_json_str) {
+        compare_pool_parse("Large JSON", large_json_str, strlen(large_json_str), ITERATIONS_LARGE);
+        vfree(large_json_str);
+    }
+    
+    printk(KERN_INFO "Memory pool performance test completed\n");
+}
+
+/* Cost of getting a serialized copy with each buffer sizing strategy */
+static void compare_output_sizing(const char *name, struct jsonk_value *json, int iterations)
+{
+    size_t size, cap, written = 0;
+    char *buffer;
+    u64 start, fixed_ns, retry_ns, alloc_ns;
+    int i, ret;
+    
+    /* Worst-case buffer, as sized by callers that cannot predict the output */
     start = get_time_ns();
-    for (i = 0; i < POOL_ITERATIONS; i++) {
-        parsed = jsonk_parse(small_json, strlen(small_json));
-        if (parsed) {
-            jsonk_value_put(parsed);
+    for (i = 0; i < iterations; i++) {
+        buffer = vmalloc(JSONK_LARGE_ALLOC_THRESHOLD);
+        if (!buffer || jsonk_serialize(json, buffer, JSONK_LARGE_ALLOC_THRESHOLD, &written) != 0) {
+            vfree(buffer);
+            return;
         }
+        vfree(buffer);
     }
-    end = get_time_ns();
-    print_performance("Small JSON", start, end, strlen(small_json), POOL_ITERATIONS);
+    fixed_ns = get_time_ns() - start;
     
-    /* Test medium JSON with regular allocation */
+    /* Doubling retry loop starting from a page */
     start = get_time_ns();
-    for (i = 0; i < POOL_ITERATIONS; i++) {
-        parsed = jsonk_parse(medium_json, strlen(medium_json));
-        if (parsed) {
-            jsonk_value_put(parsed);
+    for (i = 0; i < iterations; i++) {
+        for (cap = PAGE_SIZE; ; cap *= 2) {
+            buffer = jsonk_memory_alloc(cap);
+            if (!buffer)
+                return;
+            ret = jsonk_serialize(json, buffer, cap, &written);
+            jsonk_memory_free(buffer, cap);
+            if (ret != -EOVERFLOW)
+                break;
         }
     }
-    end = get_time_ns();
-    print_performance("Medium JSON", start, end, strlen(medium_json), POOL_ITERATIONS);
+    retry_ns = get_time_ns() - start;
     
-    /* Test large JSON with regular allocation */
-    char *large_json_str = generate_large_json();
-    if (large_json_str) {
-        start = get_time_ns();
-        for (i = 0; i < POOL_ITERATIONS; i++) {
-            parsed = jsonk_parse(large_json_str, strlen(large_json_str));
-            if (parsed) {
-                jsonk_value_put(parsed);
-            }
+    start = get_time_ns();
+    for (i = 0; i < iterations; i++) {
+        buffer = jsonk_serialize_alloc(json, &size);
+        if (!buffer)
+            return;
+        jsonk_memory_free(buffer, size + 1);
+    }
+    alloc_ns = get_time_ns() - start;
+    
+    printk(KERN_INFO "%s (%zu bytes): 2MB vmalloc %llu ns, retry loop %llu ns, jsonk_serialize_alloc %llu ns\n",
+           name, written, fixed_ns / iterations, retry_ns / iterations, alloc_ns / iterations);
+}
+
+/* Stream a document through one page, as a read handler would */
+static void measure_streaming(const char *name, struct jsonk_value *json, int iterations)
+{
+    struct jsonk_writer *writer;
+    char *page;
+    size_t total = 0;
+    ssize_t n;
+    u64 start, end;
+    int i;
+    
+    writer = kmalloc(sizeof(*writer), GFP_KERNEL);
+    page = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    if (!writer || !page)
+        goto out;
+    
+    start = get_time_ns();
+    for (i = 0; i < iterations; i++) {
+        total = 0;
+        jsonk_writer_init(writer, json);
+        while ((n = jsonk_writer_read(writer, page, PAGE_SIZE)) > 0)
+            total += n;
+        if (n < 0) {
+            printk(KERN_ERR "Streaming failed: %zd\n", n);
+            goto out;
         }
-        end = get_time_ns();
-        print_performance("Large JSON", start, end, strlen(large_json_str), POOL_ITERATIONS);
-        vfree(large_json_str);
     }
+    end = get_time_ns();
     
-    printk(KERN_INFO "Memory pool performance test completed\n");
+    printk(KERN_INFO "%s: %zu bytes page by page in %llu ns, using one %lu byte buffer\n",
+           name, total, (end - start) / iterations, PAGE_SIZE);
+out:
+    kfree(page);
+    kfree(writer);
 }
 
 static void test_serialization_performance(void)
@@ -308,18 +510,269 @@ static void test_serialization_performance(void)
     
     print_performance("JSON Serialization", start, end, written, ITERATIONS_MEDIUM);
     
+    compare_output_sizing("Medium JSON", json, ITERATIONS_MEDIUM);
+    measure_streaming("Medium JSON", json, ITERATIONS_MEDIUM);
+    
     vfree(buffer);
     jsonk_value_put(json);
+    
+    buffer = generate_large_json();
+    if (buffer) {
+        json = jsonk_parse(buffer, strlen(buffer));
+        if (json) {
+            compare_output_sizing("Large JSON", json, ITERATIONS_LARGE);
+            measure_streaming("Large JSON", json, ITERATIONS_LARGE);
+            jsonk_value_put(json);
+        }
+        vfree(buffer);
+    }
+    printk(KERN_INFO "\n");
+}
+
+/* Parse and serialize an array of numbers, in ns per number */
+static void measure_numbers(const char *name, int kind)
+{
+    struct jsonk_value *json = NULL;
+    char *input, *output;
+    size_t len = 0, written = 0;
+    u64 start, parse_ns, serialize_ns;
+    int i;
+    
+    input = vmalloc(NUMBER_COUNT * 32 + 2);
+    output = vmalloc(NUMBER_COUNT * 32 + 2);
+    if (!input || !output) {
+        printk(KERN_ERR "Failed to allocate number buffers\n");
+        goto out;
+    }
+    
+    input[len++] = '[';
+    for (i = 0; i < NUMBER_COUNT; i++) {
+        if (i)
+            input[len++] = ',';
+        switch (kind) {
+        case 0:     /* Counters and ids */
+            len += sprintf(input + len, "%d", i * 37);
+            break;
+        case 1:     /* Nanosecond timestamps and negative offsets */
+            len += sprintf(input + len, "%lld", (i & 1 ? -1LL : 1LL) * (1700000000000000000LL + i * 7919LL));
+            break;
+        default:    /* Metrics with fractions and exponents */
+            len += sprintf(input + len, i & 1 ? "%d.%02d" : "%d.%03de-%d", i % 100, i % 97, i % 7 + 1);
+            break;
+        }
+    }
+    input[len++] = ']';
+    
+    start = get_time_ns();
+    for (i = 0; i < NUMBER_ITERATIONS; i++) {
+        if (json)
+            jsonk_value_put(json);
+        json = jsonk_parse(input, len);
+        if (!json) {
+            printk(KERN_ERR "Number parse failed at iteration %d\n", i);
+            goto out;
+        }
+    }
+    parse_ns = get_time_ns() - start;
+    
+    start = get_time_ns();
+    for (i = 0; i < NUMBER_ITERATIONS; i++) {
+        if (jsonk_serialize(json, output, NUMBER_COUNT * 32 + 2, &written) != 0) {
+            printk(KERN_ERR "Number serialization failed at iteration %d\n", i);
+            goto out;
+        }
+    }
+    serialize_ns = get_time_ns() - start;
+    
+    printk(KERN_INFO "%s: parse %llu ns, serialize %llu ns per number, round trip %s\n",
+           name, parse_ns / (NUMBER_ITERATIONS * NUMBER_COUNT),
+           serialize_ns / (NUMBER_ITERATIONS * NUMBER_COUNT),
+           written == len && memcmp(input, output, len) == 0 ? "exact" : "CHANGED");
+    
+out:
+    if (json)
+        jsonk_value_put(json);
+    vfree(output);
+    vfree(input);
+}
+
+/* Serialize an array of ~100 byte strings, one escape per `escape_every` bytes */
+static void measure_string_output(const char *name, int escape_every)
+{
+    static const char escapes[] = "\\\"\\n\\t\\u0001";
+    struct jsonk_value *json;
+    char *input, *output;
+    size_t len = 0, written = 0, cap = STRING_COUNT * 160;
+    u64 start, end;
+    int i, j;
+    
+    input = vmalloc(cap);
+    output = vmalloc(cap);
+    if (!input || !output)
+        goto out;
+    
+    input[len++] = '[';
+    for (i = 0; i < STRING_COUNT; i++) {
+        if (i)
+            input[len++] = ',';
+        input[len++] = '"';
+        for (j = 0; j < 100; j++) {
+            if (escape_every && j % escape_every == escape_every - 1) {
+                /* Escapes are 2 bytes for \" \n \t and 6 for \u0001 */
+                int k = (i + j) % 4;
+                const char *e = escapes + (k < 3 ? 2 * k : 6);
+                
+                memcpy(input + len, e, k < 3 ? 2 : 6);
+                len += k < 3 ? 2 : 6;
+            } else {
+                input[len++] = 'a' + (i + j) % 26;
+            }
+        }
+        input[len++] = '"';
+    }
+    input[len++] = ']';
+    
+    json = jsonk_parse(input, len);
+    if (!json) {
+        printk(KERN_ERR "Failed to parse %s\n", name);
+        goto out;
+    }
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        if (jsonk_serialize(json, output, cap, &written) != 0) {
+            printk(KERN_ERR "String serialization failed\n");
+            break;
+        }
+    }
+    end = get_time_ns();
+    
+    printk(KERN_INFO "%s: %zu bytes in %llu ns, %llu MB/s, round trip %s\n",
+           name, written, (end - start) / ITERATIONS_LARGE,
+           end > start ? (u64)written * ITERATIONS_LARGE * 1000000000ULL / ((end - start) * 1024 * 1024) : 0,
+           written == len && memcmp(input, output, len) == 0 ? "exact" : "CHANGED");
+    jsonk_value_put(json);
+out:
+    vfree(output);
+    vfree(input);
+}
+
+static void test_string_output_performance(void)
+{
+    printk(KERN_INFO "=== String Output Tests ===\n");
+    
+    measure_string_output("Plain strings", 0);
+    measure_string_output("One escape per 32 bytes", 32);
+    measure_string_output("One escape per 4 bytes", 4);
+    printk(KERN_INFO "\n");
+}
+
+/* Parse, serialize, deep copy and free chains of `depth` containers inside one array */
+static void measure_nesting(const char *name, int depth)
+{
+    struct jsonk_value *json = NULL, *copy;
+    char *input, *output;
+    size_t len = 0, written = 0, cap = NEST_CHAINS * (depth * 6 + 8) + 2;
+    u64 start, parse_ns, serialize_ns, copy_ns, free_ns;
+    int i, j;
+    
+    input = vmalloc(cap);
+    output = vmalloc(cap);
+    if (!input || !output)
+        goto out;
+    
+    /* The outer array is one level, each chain alternates objects and arrays */
+    input[len++] = '[';
+    for (i = 0; i < NEST_CHAINS; i++) {
+        if (i)
+            input[len++] = ',';
+        for (j = 0; j < depth; j++) {
+            memcpy(input + len, j & 1 ? "[" : "{\"a\":", j & 1 ? 1 : 5);
+            len += j & 1 ? 1 : 5;
+        }
+        input[len++] = '1';
+        for (j = depth - 1; j >= 0; j--)
+            input[len++] = j & 1 ? ']' : '}';
+    }
+    input[len++] = ']';
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_MEDIUM; i++) {
+        if (json)
+            jsonk_value_put(json);
+        json = jsonk_parse(input, len);
+        if (!json) {
+            printk(KERN_ERR "Failed to parse %s\n", name);
+            goto out;
+        }
+    }
+    parse_ns = get_time_ns() - start;
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_MEDIUM; i++) {
+        if (jsonk_serialize(json, output, cap, &written) != 0) {
+            printk(KERN_ERR "Failed to serialize %s\n", name);
+            goto out;
+        }
+    }
+    serialize_ns = get_time_ns() - start;
+    
+    copy_ns = free_ns = 0;
+    for (i = 0; i < ITERATIONS_MEDIUM; i++) {
+        start = get_time_ns();
+        copy = jsonk_value_deep_copy(json, 0);
+        copy_ns += get_time_ns() - start;
+        if (!copy) {
+            printk(KERN_ERR "Failed to copy %s\n", name);
+            goto out;
+        }
+        start = get_time_ns();
+        jsonk_value_put(copy);
+        free_ns += get_time_ns() - start;
+    }
+    
+    printk(KERN_INFO "%s (%zu bytes): parse %llu ns, serialize %llu ns, deep copy %llu ns, free %llu ns, round trip %s\n",
+           name, len, parse_ns / ITERATIONS_MEDIUM, serialize_ns / ITERATIONS_MEDIUM,
+           copy_ns / ITERATIONS_MEDIUM, free_ns / ITERATIONS_MEDIUM,
+           written == len && memcmp(input, output, len) == 0 ? "exact" : "CHANGED");
+    
+out:
+    if (json)
+        jsonk_value_put(json);
+    vfree(output);
+    vfree(input);
+}
+
+static void test_nesting_performance(void)
+{
+    printk(KERN_INFO "=== Deep Nesting Tests ===\n");
+    
+    measure_nesting("4 containers deep", 3);
+    measure_nesting("16 containers deep", 15);
+    measure_nesting("31 containers deep", 30);
+    printk(KERN_INFO "\n");
+}
+
+static void test_number_performance(void)
+{
+    printk(KERN_INFO "=== Number Parsing and Formatting Tests ===\n");
+    
+    measure_numbers("Small integers", 0);
+    measure_numbers("64-bit integers", 1);
+    measure_numbers("Decimals", 2);
+    printk(KERN_INFO "\n");
 }
 
 static void test_patching_performance(void)
 {
     const char *target = "{\"name\":\"Mehran\",\"age\":30,\"city\":\"CPH\",\"country\":\"DK\"}";
     const char *patch = "{\"age\":31,\"salary\":50000,\"city\":null}";
+    struct jsonk_value *target_json = NULL, *patch_json = NULL;
+    char *large_json = NULL;
     char *result;
     size_t result_len;
     u64 start, end;
-    int i;
+    int i, ret;
     
     printk(KERN_INFO "=== JSON Patching Performance Tests ===\n");
     
@@ -344,82 +797,1548 @@ static void test_patching_performance(void)
     print_performance("JSON Patching", start, end, strlen(target), ITERATIONS_MEDIUM);
     
     vfree(result);
-}
-
-static void test_scalability(void)
-{
-    char *json_10, *json_100, *json_1000, *json_5000;
-    size_t size_10, size_100, size_1000, size_5000;
-    struct jsonk_value *parsed;
-    u64 start, end;
     
-    printk(KERN_INFO "=== Scalability Tests ===\n");
+    /* Same patch applied in place to already parsed state */
+    target_json = jsonk_parse(target, strlen(target));
+    patch_json = jsonk_parse(patch, strlen(patch));
+    if (!target_json || !patch_json) {
+        printk(KERN_ERR "Failed to parse patching test data\n");
+        goto cleanup;
+    }
     
-    /* Generate arrays of different sizes */
-    json_10 = generate_simple_json(1024, &size_10);        /* ~10 elements */
-    json_100 = generate_simple_json(8192, &size_100);      /* ~100 elements */
-    json_1000 = generate_simple_json(65536, &size_1000);   /* ~1000 elements */
-    json_5000 = generate_simple_json(262144, &size_5000);  /* ~5000 elements */
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_MEDIUM; i++) {
+        ret = jsonk_apply_patch_tree(target_json, patch_json);
+        if (ret != JSONK_PATCH_SUCCESS && ret != JSONK_PATCH_NO_CHANGE) {
+            printk(KERN_ERR "Tree patching failed at iteration %d\n", i);
+            break;
+        }
+    }
+    end = get_time_ns();
     
-    if (!json_10 || !json_100 || !json_1000 || !json_5000) {
-        printk(KERN_ERR "Failed to generate scalability test data\n");
+    print_performance("JSON Tree Patching", start, end, strlen(target), ITERATIONS_MEDIUM);
+    
+    /* In place, the cost should not depend on the size of the target */
+    jsonk_value_put(target_json);
+    large_json = generate_large_json();
+    target_json = large_json ? jsonk_parse(large_json, strlen(large_json)) : NULL;
+    if (!target_json) {
+        printk(KERN_ERR "Failed to parse large patching target\n");
         goto cleanup;
     }
     
-    /* Test parsing time vs size */
     start = get_time_ns();
-    parsed = jsonk_parse(json_10, size_10);
+    for (i = 0; i < ITERATIONS_MEDIUM; i++)
+        jsonk_apply_patch_tree(target_json, patch_json);
     end = get_time_ns();
-    if (parsed) {
-        printk(KERN_INFO "Array with 10 elements (%zu bytes): %llu ns\n", size_10, end - start);
-        printk(KERN_INFO "  Time per element: %llu ns\n", (end - start) / 10);
-        jsonk_value_put(parsed);
-    }
+    
+    /* Throughput here is measured against the patch */
+    print_performance("Large JSON Tree Patching", start, end, strlen(patch), ITERATIONS_MEDIUM);
+    
+cleanup:
+    if (target_json)
+        jsonk_value_put(target_json);
+    if (patch_json)
+        jsonk_value_put(patch_json);
+    if (large_json)
+        vfree(large_json);
+}
 
+/*
+ * A control plane stream of small edits: one jsonk_apply_patch per edit,
+ * which parses, copies and serializes the whole target each time, versus
+ * one RFC 6902 list over a resident tree, with and without the parse and
+ * serialize around it.
+ */
+static void compare_op_list(const char *target, int count)
+{
+    struct jsonk_value *target_json = NULL, *value_json = NULL, *list_json, *parsed;
+    struct jsonk_patch_op *ops = NULL;
+    char (*paths)[16] = NULL;
+    char *buf[2] = { NULL, NULL }, *patch = NULL, *list = NULL;
+    size_t len, patch_len, list_len = 0, written;
+    u64 start, sequential_ns, resident_ns, onepass_ns;
+    int i, j, cur, ret;
+    
+    ops = kcalloc(count, sizeof(*ops), GFP_KERNEL);
+    paths = kcalloc(count, sizeof(*paths), GFP_KERNEL);
+    buf[0] = vmalloc(PAGE_SIZE);
+    buf[1] = vmalloc(PAGE_SIZE);
+    patch = vmalloc(PAGE_SIZE);
+    list = vmalloc(count * 64 + 2);
+    target_json = jsonk_parse(target, strlen(target));
+    value_json = jsonk_value_create_s64(1);
+    if (!ops || !paths || !buf[0] || !buf[1] || !patch || !list || !target_json || !value_json) {
+        printk(KERN_ERR "Failed to set up the %d operation test\n", count);
+        goto cleanup;
+    }
+    
+    /* Cycle through replacing a member, adding one and removing it again */
+    list[list_len++] = '[';
+    for (i = 0; i < count; i++) {
+        if (i % 3 == 0)
+            snprintf(paths[i], sizeof(paths[i]), "/k%d", i % 16);
+        else
+            snprintf(paths[i], sizeof(paths[i]), "/n%d", i - i % 3);
+        ops[i].op = i % 3 == 0 ? JSONK_PATCH_OP_REPLACE : i % 3 == 1 ? JSONK_PATCH_OP_ADD : JSONK_PATCH_OP_REMOVE;
+        ops[i].path = paths[i];
+        ops[i].path_len = strlen(paths[i]);
+        ops[i].value = ops[i].op == JSONK_PATCH_OP_REMOVE ? NULL : value_json;
+        list_len += sprintf(list + list_len, "%s{\"op\":\"%s\",\"path\":\"%s\"%s}", i ? "," : "",
+                            i % 3 == 0 ? "replace" : i % 3 == 1 ? "add" : "remove", paths[i],
+                            ops[i].value ? ",\"value\":1" : "");
+    }
+    list[list_len++] = ']';
+    
     start = get_time_ns();
-    parsed = jsonk_parse(json_100, size_100);
-    end = get_time_ns();
-    if (parsed) {
-        printk(KERN_INFO "Array with 100 elements (%zu bytes): %llu ns\n", size_100, end - start);
-        printk(KERN_INFO "  Time per element: %llu ns\n", (end - start) / 100);
-        jsonk_value_put(parsed);
+    for (j = 0; j < ITERATIONS_LARGE; j++) {
+        len = strlen(target);
+        memcpy(buf[0], target, len);
+        for (i = 0, cur = 0; i < count; i++, cur ^= 1) {
+            patch_len = snprintf(patch, PAGE_SIZE, "{\"%s\":%s}", paths[i] + 1, ops[i].value ? "1" : "null");
+            if (jsonk_apply_patch(buf[cur], len, patch, patch_len, buf[cur ^ 1], PAGE_SIZE, &len) < 0) {
+                printk(KERN_ERR "Sequential patching failed at operation %d\n", i);
+                goto cleanup;
+            }
+        }
     }
-        
+    sequential_ns = get_time_ns() - start;
+    
     start = get_time_ns();
-    parsed = jsonk_parse(json_1000, size_1000);
-    end = get_time_ns();
-    if (parsed) {
-        printk(KERN_INFO "Array with 1000 elements (%zu bytes): %llu ns\n", size_1000, end - start);
-        printk(KERN_INFO "  Time per element: %llu ns\n", (end - start) / 1000);
-        jsonk_value_put(parsed);
+    for (j = 0; j < ITERATIONS_LARGE; j++) {
+        ret = jsonk_apply_json_patch_ops(&target_json, ops, count);
+        if (ret != JSONK_PATCH_SUCCESS && ret != JSONK_PATCH_NO_CHANGE) {
+            printk(KERN_ERR "Operation list failed with code %d\n", ret);
+            goto cleanup;
+        }
     }
-        
+    resident_ns = get_time_ns() - start;
+    
+    /* Same work end to end: parse target and list, apply, serialize */
     start = get_time_ns();
-    parsed = jsonk_parse(json_5000, size_5000);
-    end = get_time_ns();
-    if (parsed) {
-        printk(KERN_INFO "Array with 5000 elements (%zu bytes): %llu ns\n", size_5000, end - start);
-        printk(KERN_INFO "  Time per element: %llu ns\n", (end - start) / 5000);
-        jsonk_value_put(parsed);
+    for (j = 0; j < ITERATIONS_LARGE; j++) {
+        parsed = jsonk_parse(target, strlen(target));
+        list_json = jsonk_parse(list, list_len);
+        if (!parsed || !list_json)
+            ret = JSONK_PATCH_ERROR_MEMORY;
+        else
+            ret = jsonk_apply_json_patch(&parsed, list_json);
+        if (ret == JSONK_PATCH_SUCCESS || ret == JSONK_PATCH_NO_CHANGE)
+            ret = jsonk_serialize(parsed, buf[0], PAGE_SIZE, &written);
+        if (parsed)
+            jsonk_value_put(parsed);
+        if (list_json)
+            jsonk_value_put(list_json);
+        if (ret) {
+            printk(KERN_ERR "One pass patching failed with code %d\n", ret);
+            goto cleanup;
+        }
     }
-        
+    onepass_ns = get_time_ns() - start;
+    
+    printk(KERN_INFO "%d operations: %d x jsonk_apply_patch %llu ns, one list on a parsed tree %llu ns, "
+           "parse + list + serialize %llu ns\n", count, count, sequential_ns / ITERATIONS_LARGE,
+           resident_ns / ITERATIONS_LARGE, onepass_ns / ITERATIONS_LARGE);
+    
 cleanup:
-    if (json_10) vfree(json_10);
-    if (json_100) vfree(json_100);
-    if (json_1000) vfree(json_1000);
-    if (json_5000) vfree(json_5000);
+    if (target_json)
+        jsonk_value_put(target_json);
+    if (value_json)
+        jsonk_value_put(value_json);
+    vfree(list);
+    vfree(patch);
+    vfree(buf[1]);
+    vfree(buf[0]);
+    kfree(paths);
+    kfree(ops);
 }
 
-static int __init performance_test_init(void)
+static void test_rfc_patch_performance(void)
 {
-    printk(KERN_INFO "JSONK Comprehensive Performance Test loaded\n");
+    const char *target = "{\"name\":\"Mehran\",\"age\":30,\"city\":\"CPH\",\"country\":\"DK\"}";
+    const char *patch = "{\"age\":31,\"salary\":50000,\"city\":null}";
+    const char *settings = "{\"k0\":0,\"k1\":0,\"k2\":0,\"k3\":0,\"k4\":0,\"k5\":0,\"k6\":0,\"k7\":0,"
+                           "\"k8\":0,\"k9\":0,\"k10\":0,\"k11\":0,\"k12\":0,\"k13\":0,\"k14\":0,\"k15\":0}";
+    struct jsonk_value *tree_json, *merge_json, *patch_json;
+    u64 start, tree_ns, merge_ns;
+    int i;
+    
+    printk(KERN_INFO "=== RFC 6902 And RFC 7386 Patching Performance Tests ===\n");
+    
+    compare_op_list(settings, 3);
+    compare_op_list(settings, 24);
+    compare_op_list(settings, 96);
+    
+    /* The patch of the tests above, merged the jsonk way and the RFC 7386 way */
+    tree_json = jsonk_parse(target, strlen(target));
+    merge_json = jsonk_parse(target, strlen(target));
+    patch_json = jsonk_parse(patch, strlen(patch));
+    if (!tree_json || !merge_json || !patch_json) {
+        printk(KERN_ERR "Failed to parse merge test data\n");
+        goto cleanup;
+    }
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_MEDIUM; i++)
+        jsonk_apply_patch_tree(tree_json, patch_json);
+    tree_ns = get_time_ns() - start;
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_MEDIUM; i++)
+        jsonk_apply_merge_patch(&merge_json, patch_json);
+    merge_ns = get_time_ns() - start;
+    
+    printk(KERN_INFO "Merge on a parsed tree: jsonk_apply_patch_tree %llu ns, jsonk_apply_merge_patch %llu ns\n",
+           tree_ns / ITERATIONS_MEDIUM, merge_ns / ITERATIONS_MEDIUM);
+    
+cleanup:
+    if (tree_json)
+        jsonk_value_put(tree_json);
+    if (merge_json)
+        jsonk_value_put(merge_json);
+    if (patch_json)
+        jsonk_value_put(patch_json);
+    printk(KERN_INFO "\n");
+}
+
+/* New versions of a large document: full deep copy versus copy-on-write */
+static void test_snapshot_performance(void)
+{
+    struct jsonk_value *base, *version, *value;
+    char *large_json_str;
+    int i;
+    u64 start, end;
+    
+    printk(KERN_INFO "=== Snapshot Performance Tests ===\n");
+    
+    large_json_str = generate_large_json();
+    base = large_json_str ? jsonk_parse(large_json_str, strlen(large_json_str)) : NULL;
+    value = jsonk_value_create_number("42", 2);
+    if (!base || !value) {
+        printk(KERN_ERR "Failed to set up snapshot test data\n");
+        goto cleanup;
+    }
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        version = jsonk_value_deep_copy(base, 0);
+        if (version) {
+            jsonk_set_value_by_path(version, "data[150].value", 15, value);
+            jsonk_value_put(version);
+        }
+    }
+    end = get_time_ns();
+    print_performance("Deep Copy + Set", start, end, strlen(large_json_str), ITERATIONS_LARGE);
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        version = jsonk_value_snapshot(base);
+        jsonk_cow_set_value_by_path(&version, "data[150].value", 15, value);
+        jsonk_value_put(version);
+    }
+    end = get_time_ns();
+    print_performance("Snapshot + COW Set", start, end, strlen(large_json_str), ITERATIONS_LARGE);
+    
+cleanup:
+    if (value)
+        jsonk_value_put(value);
+    if (base)
+        jsonk_value_put(base);
+    if (large_json_str)
+        vfree(large_json_str);
+}
+
+/*
+ * Change detection on a large document: serialize and memcmp, a full
+ * comparison, and cached hashes and diffs after one value changed, for
+ * a separately parsed tree and for a copy-on-write version.
+ */
+static void test_diff_performance(void)
+{
+    struct jsonk_value *base = NULL, *other = NULL, *version = NULL, *value, *patch;
+    char *large_json_str, *text_a = NULL, *text_b = NULL;
+    size_t len, len_a, len_b;
+    u64 start, memcmp_ns, equal_ns, cold_ns, rehash_ns, diff_ns, cow_diff_ns;
+    int i, same = 0, differ = 0, ops = 0;
+    
+    printk(KERN_INFO "=== Hash And Diff Performance Tests ===\n");
+    
+    large_json_str = generate_large_json();
+    len = large_json_str ? strlen(large_json_str) : 0;
+    base = large_json_str ? jsonk_parse(large_json_str, len) : NULL;
+    other = large_json_str ? jsonk_parse(large_json_str, len) : NULL;
+    text_a = vmalloc(len + 1);
+    text_b = vmalloc(len + 1);
+    if (!base || !other || !text_a || !text_b) {
+        printk(KERN_ERR "Failed to set up diff test data\n");
+        goto cleanup;
+    }
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        if (jsonk_serialize(base, text_a, len + 1, &len_a) == 0 &&
+            jsonk_serialize(other, text_b, len + 1, &len_b) == 0)
+            same += len_a == len_b && memcmp(text_a, text_b, len_a) == 0;
+    }
+    memcmp_ns = get_time_ns() - start;
+    
+    /* No hashes cached yet, so this walks both trees */
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++)
+        same += jsonk_value_equal(base, other) == 1;
+    equal_ns = get_time_ns() - start;
+    
+    start = get_time_ns();
+    jsonk_value_hash(base);
+    cold_ns = get_time_ns() - start;
+    jsonk_value_hash(other);
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        value = jsonk_value_create_s64(i);
+        if (value) {
+            jsonk_set_value_by_path(other, "data[150].value", 15, value);
+            jsonk_value_put(value);
+        }
+        differ += jsonk_value_hash(other) != jsonk_value_hash(base);
+    }
+    rehash_ns = get_time_ns() - start;
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        patch = jsonk_diff(base, other);
+        if (patch) {
+            ops = patch->u.array.size;
+            jsonk_value_put(patch);
+        }
+    }
+    diff_ns = get_time_ns() - start;
+    
+    /* Versions share everything but the changed path */
+    version = jsonk_value_snapshot(base);
+    value = jsonk_value_create_s64(-1);
+    if (value) {
+        jsonk_cow_set_value_by_path(&version, "data[150].value", 15, value);
+        jsonk_value_put(value);
+    }
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        patch = jsonk_diff(base, version);
+        if (patch)
+            jsonk_value_put(patch);
+    }
+    cow_diff_ns = get_time_ns() - start;
+    
+    printk(KERN_INFO "Compare %zu bytes (%d of %d equal): serialize + memcmp %llu ns, jsonk_value_equal %llu ns, "
+           "first jsonk_value_hash %llu ns\n", len, same, 2 * ITERATIONS_LARGE,
+           memcmp_ns / ITERATIONS_LARGE, equal_ns / ITERATIONS_LARGE, cold_ns);
+    printk(KERN_INFO "After one change (%d of %d hashes differ): set + rehash %llu ns, jsonk_diff %llu ns (%d ops), "
+           "jsonk_diff of a COW version %llu ns\n", differ, ITERATIONS_LARGE,
+           rehash_ns / ITERATIONS_LARGE, diff_ns / ITERATIONS_LARGE, ops, cow_diff_ns / ITERATIONS_LARGE);
+    
+cleanup:
+    if (version)
+        jsonk_value_put(version);
+    if (other)
+        jsonk_value_put(other);
+    if (base)
+        jsonk_value_put(base);
+    vfree(text_b);
+    vfree(text_a);
+    if (large_json_str)
+        vfree(large_json_str);
+    printk(KERN_INFO "\n");
+}
+
+static void test_scalability(void)
+{
+    char *json_10, *json_100, *json_1000, *json_5000;
+    size_t size_10, size_100, size_1000, size_5000;
+    struct jsonk_value *parsed;
+    u64 start, end;
+    
+    printk(KERN_INFO "=== Scalability Tests ===\n");
+    
+    /* Generate arrays of different sizes */
+    json_10 = generate_simple_json(1024, &size_10);        /* ~10 elements */
+    json_100 = generate_simple_json(8192, &size_100);      /* ~100 elements */
+    json_1000 = generate_simple_json(65536, &size_1000);   /* ~1000 elements */
+    json_5000 = generate_simple_json(262144, &size_5000);  /* ~5000 elements */
+    
+    if (!json_10 || !json_100 || !json_1000 || !json_5000) {
+        printk(KERN_ERR "Failed to generate scalability test data\n");
+        goto cleanup;
+    }
+    
+    /* Test parsing time vs size */
+    start = get_time_ns();
+    parsed = jsonk_parse(json_10, size_10);
+    end = get_time_ns();
+    if (parsed) {
+        printk(KERN_INFO "Array with 10 elements (%zu bytes): %llu ns\n", size_10, end - start);
+        printk(KERN_INFO "  Time per element: %llu ns\n", (end - start) / 10);
+        jsonk_value_put(parsed);
+    }
+
+    start = get_time_ns();
+    parsed = jsonk_parse(json_100, size_100);
+    end = get_time_ns();
+    if (parsed) {
+        printk(KERN_INFO "Array with 100 elements (%zu bytes): %llu ns\n", size_100, end - start);
+        printk(KERN_INFO "  Time per element: %llu ns\n", (end - start) / 100);
+        jsonk_value_put(parsed);
+    }
+        
+    start = get_time_ns();
+    parsed = jsonk_parse(json_1000, size_1000);
+    end = get_time_ns();
+    if (parsed) {
+        printk(KERN_INFO "Array with 1000 elements (%zu bytes): %llu ns\n", size_1000, end - start);
+        printk(KERN_INFO "  Time per element: %llu ns\n", (end - start) / 1000);
+        jsonk_value_put(parsed);
+    }
+        
+    start = get_time_ns();
+    parsed = jsonk_parse(json_5000, size_5000);
+    end = get_time_ns();
+    if (parsed) {
+        printk(KERN_INFO "Array with 5000 elements (%zu bytes): %llu ns\n", size_5000, end - start);
+        printk(KERN_INFO "  Time per element: %llu ns\n", (end - start) / 5000);
+        jsonk_value_put(parsed);
+    }
+        
+cleanup:
+    if (json_10) vfree(json_10);
+    if (json_100) vfree(json_100);
+    if (json_1000) vfree(json_1000);
+    if (json_5000) vfree(json_5000);
+}
+
+/* Build a flat object with the given number of members and time key lookups */
+static void measure_member_lookup(int members)
+{
+    char *json, *keys;
+    size_t pos = 0, json_size = members * 32 + 16;
+    struct jsonk_value *parsed;
+    struct jsonk_member *found;
+    int *key_lens;
+    int i, hits = 0;
+    u64 start, end;
+    
+    json = vmalloc(json_size);
+    keys = vmalloc(members * LOOKUP_KEY_LEN);
+    key_lens = vmalloc(members * sizeof(int));
+    if (!json || !keys || !key_lens)
+        goto cleanup;
+    
+    pos += snprintf(json + pos, json_size - pos, "{");
+    for (i = 0; i < members; i++) {
+        key_lens[i] = snprintf(keys + i * LOOKUP_KEY_LEN, LOOKUP_KEY_LEN, "key_%d", i);
+        pos += snprintf(json + pos, json_size - pos, "%s\"%s\":%d",
+                        i ? "," : "", keys + i * LOOKUP_KEY_LEN, i);
+    }
+    pos += snprintf(json + pos, json_size - pos, "}");
+    
+    parsed = jsonk_parse(json, pos);
+    if (!parsed) {
+        printk(KERN_ERR "Failed to parse %d-member object\n", members);
+        goto cleanup;
+    }
+    
+    start = get_time_ns();
+    for (i = 0; i < LOOKUP_ITERATIONS; i++) {
+        int k = i % members;
+        found = jsonk_object_find_member(&parsed->u.object, keys + k * LOOKUP_KEY_LEN, key_lens[k]);
+        if (found)
+            hits++;
+    }
+    end = get_time_ns();
+    
+    printk(KERN_INFO "Object with %d members: %llu ns per lookup (%d/%d hits)\n",
+           members, (end - start) / LOOKUP_ITERATIONS, hits, LOOKUP_ITERATIONS);
+    
+    jsonk_value_put(parsed);
+cleanup:
+    if (json) vfree(json);
+    if (keys) vfree(keys);
+    if (key_lens) vfree(key_lens);
+}
+
+static void test_lookup_scalability(void)
+{
+    printk(KERN_INFO "=== Member Lookup Scalability Tests ===\n");
+    
+    /* Lookup cost should stay flat once objects are hash-indexed */
+    measure_member_lookup(4);
+    measure_member_lookup(16);
+    measure_member_lookup(100);
+    measure_member_lookup(1000);
+    printk(KERN_INFO "\n");
+}
+
+/* Fetch one value from the large document with and without building the tree */
+static void compare_path_lookup(const char *json, size_t len, const char *path)
+{
+    struct jsonk_value *parsed, *found;
+    int i, hits = 0;
+    u64 start, end, tree_ns, raw_ns;
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        parsed = jsonk_parse(json, len);
+        if (parsed) {
+            if (jsonk_get_value_by_path(parsed, path, strlen(path)))
+                hits++;
+            jsonk_value_put(parsed);
+        }
+    }
+    end = get_time_ns();
+    tree_ns = (end - start) / ITERATIONS_LARGE;
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        found = jsonk_parse_by_path(json, len, path, strlen(path));
+        if (found) {
+            hits++;
+            jsonk_value_put(found);
+        }
+    }
+    end = get_time_ns();
+    raw_ns = (end - start) / ITERATIONS_LARGE;
+    
+    printk(KERN_INFO "Path %s: parse+get %llu ns, raw lookup %llu ns (%d/%d hits)\n",
+           path, tree_ns, raw_ns, hits, 2 * ITERATIONS_LARGE);
+}
+
+/* Repeated lookups in a parsed tree through a path string and a compiled path */
+static void compare_compiled_path(const char *path)
+{
+    struct jsonk_value *parsed;
+    struct jsonk_path *compiled;
+    int i, hits = 0;
+    u64 start, end, string_ns, compiled_ns;
+    
+    parsed = jsonk_parse(medium_json, strlen(medium_json));
+    compiled = jsonk_path_compile(path, strlen(path));
+    if (!parsed || !compiled) {
+        printk(KERN_ERR "Failed to set up path %s\n", path);
+        goto cleanup;
+    }
+    
+    start = get_time_ns();
+    for (i = 0; i < LOOKUP_ITERATIONS; i++) {
+        if (jsonk_get_value_by_path(parsed, path, strlen(path)))
+            hits++;
+    }
+    end = get_time_ns();
+    string_ns = end - start;
+    
+    start = get_time_ns();
+    for (i = 0; i < LOOKUP_ITERATIONS; i++) {
+        if (jsonk_path_get(parsed, compiled))
+            hits++;
+    }
+    end = get_time_ns();
+    compiled_ns = end - start;
+    
+    printk(KERN_INFO "Path %s: string %llu ns, compiled %llu ns per lookup (%d/%d hits)\n",
+           path, string_ns / LOOKUP_ITERATIONS, compiled_ns / LOOKUP_ITERATIONS,
+           hits, 2 * LOOKUP_ITERATIONS);
+    
+cleanup:
+    jsonk_path_free(compiled);
+    if (parsed)
+        jsonk_value_put(parsed);
+}
+
+static void test_path_lookup_performance(void)
+{
+    char *large_json_str;
+    
+    printk(KERN_INFO "=== Path Lookup Tests ===\n");
+    
+    large_json_str = generate_large_json();
+    if (!large_json_str) {
+        printk(KERN_ERR "Failed to allocate test data\n");
+        return;
+    }
+    
+    compare_path_lookup(large_json_str, strlen(large_json_str), "data[0].id");
+    compare_path_lookup(large_json_str, strlen(large_json_str), "data[150].value");
+    compare_path_lookup(large_json_str, strlen(large_json_str), "metadata.version");
+    vfree(large_json_str);
+    
+    compare_compiled_path("user.name");
+    compare_compiled_path("user.profile.preferences[2]");
+    printk(KERN_INFO "\n");
+}
+
+/* Text against binary encoding: output, decode and lookups without decoding */
+static void compare_binary(const char *name, const char *json, size_t len, const char *path)
+{
+    struct jsonk_value *parsed, *decoded;
+    struct jsonk_bin_value root, found;
+    char *text = NULL;
+    u8 *encoded = NULL;
+    size_t text_len, encoded_len;
+    int i, hits = 0;
+    u64 start, end, serialize_ns, encode_ns, parse_ns, decode_ns, tree_ns, bin_ns;
+    
+    parsed = jsonk_parse(json, len);
+    if (!parsed) {
+        printk(KERN_ERR "Failed to parse %s\n", name);
+        return;
+    }
+    
+    text_len = jsonk_serialized_size(parsed);
+    encoded_len = jsonk_binary_size(parsed);
+    text = vmalloc(text_len + 1);
+    encoded = vmalloc(encoded_len);
+    if (!text || !encoded) {
+        printk(KERN_ERR "Failed to allocate buffers for %s\n", name);
+        goto cleanup;
+    }
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++)
+        jsonk_serialize(parsed, text, text_len + 1, &text_len);
+    end = get_time_ns();
+    serialize_ns = (end - start) / ITERATIONS_LARGE;
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++)
+        jsonk_encode_binary(parsed, encoded, encoded_len, &encoded_len);
+    end = get_time_ns();
+    encode_ns = (end - start) / ITERATIONS_LARGE;
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        decoded = jsonk_parse(text, text_len);
+        if (decoded)
+            jsonk_value_put(decoded);
+    }
+    end = get_time_ns();
+    parse_ns = (end - start) / ITERATIONS_LARGE;
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        decoded = jsonk_decode_binary(encoded, encoded_len, NULL);
+        if (decoded)
+            jsonk_value_put(decoded);
+    }
+    end = get_time_ns();
+    decode_ns = (end - start) / ITERATIONS_LARGE;
+    
+    start = get_time_ns();
+    for (i = 0; i < ITERATIONS_LARGE; i++) {
+        decoded = jsonk_parse(text, text_len);
+        if (decoded) {
+            if (jsonk_get_value_by_path(decoded, path, strlen(path)))
+                hits++;
+            jsonk_value_put(decoded);
+        }
+    }
+    end = get_time_ns();
+    tree_ns = (end - start) / ITERATIONS_LARGE;
+    
+    start = get_time_ns();
+    for (i = 0; i < LOOKUP_ITERATIONS; i++) {
+        if (jsonk_bin_root(encoded, encoded_len, &root) == 0 &&
+            jsonk_bin_get_path(&root, path, strlen(path), &found) == 0)
+            hits++;
+    }
+    end = get_time_ns();
+    bin_ns = (end - start) / LOOKUP_ITERATIONS;
+    
+    printk(KERN_INFO "%s: %zu bytes text, %zu bytes binary\n", name, text_len, encoded_len);
+    printk(KERN_INFO "  serialize %llu ns, encode %llu ns\n", serialize_ns, encode_ns);
+    printk(KERN_INFO "  parse %llu ns, decode %llu ns\n", parse_ns, decode_ns);
+    printk(KERN_INFO "  %s: parse+get %llu ns, in place %llu ns (%d/%d hits)\n",
+           path, tree_ns, bin_ns, hits, ITERATIONS_LARGE + LOOKUP_ITERATIONS);
+    
+cleanup:
+    vfree(text);
+    vfree(encoded);
+    jsonk_value_put(parsed);
+}
+
+static void test_binary_performance(void)
+{
+    char *large_json_str;
+    
+    printk(KERN_INFO "=== Binary Encoding Tests ===\n");
+    
+    compare_binary("Medium document", medium_json, strlen(medium_json), "user.profile.preferences[2]");
+    
+    large_json_str = generate_large_json();
+    if (!large_json_str) {
+        printk(KERN_ERR "Failed to allocate test data\n");
+        return;
+    }
+    compare_binary("Large document", large_json_str, strlen(large_json_str), "data[150].value");
+    vfree(large_json_str);
+    printk(KERN_INFO "\n");
+}
+
+/* Parse a batch BATCH_ITERATIONS times, return the time spent parsing */
+static u64 time_batch_parse(const char *const *bufs, const size_t *lens,
+                            struct jsonk_value **out, unsigned int workers)
+{
+    struct jsonk_parse_opts opts = { .max_workers = workers };
+    u64 start, total = 0;
+    int iter, i;
+    
+    for (iter = 0; iter < BATCH_ITERATIONS; iter++) {
+        start = get_time_ns();
+        if (workers) {
+            jsonk_parse_batch(bufs, lens, BATCH_DOCS, out, &opts);
+        } else {
+            for (i = 0; i < BATCH_DOCS; i++)
+                out[i] = jsonk_parse(bufs[i], lens[i]);
+        }
+        total += get_time_ns() - start;
+        
+        /* Releasing the documents is not part of the measurement */
+        for (i = 0; i < BATCH_DOCS; i++) {
+            if (out[i])
+                jsonk_value_put(out[i]);
+        }
+    }
+    return total;
+}
+
+/* Batch parse throughput as workers are added, against a serial loop */
+static void test_batch_performance(void)
+{
+    unsigned int workers, cpus = num_online_cpus();
+    struct jsonk_value **out = NULL;
+    const char **bufs = NULL;
+    size_t *lens = NULL, doc_size;
+    u64 serial_ns, ns;
+    char *doc;
+    int i;
+    
+    printk(KERN_INFO "=== Batch Parsing Performance Tests ===\n");
+    
+    doc = generate_simple_json(BATCH_DOC_SIZE, &doc_size);
+    bufs = kmalloc_array(BATCH_DOCS, sizeof(*bufs), GFP_KERNEL);
+    lens = kmalloc_array(BATCH_DOCS, sizeof(*lens), GFP_KERNEL);
+    out = kmalloc_array(BATCH_DOCS, sizeof(*out), GFP_KERNEL);
+    if (!doc || !bufs || !lens || !out) {
+        printk(KERN_ERR "Failed to allocate test data\n");
+        goto cleanup;
+    }
+    
+    for (i = 0; i < BATCH_DOCS; i++) {
+        bufs[i] = doc;
+        lens[i] = doc_size;
+    }
+    
+    serial_ns = time_batch_parse(bufs, lens, out, 0) ?: 1;
+    printk(KERN_INFO "Batch of %d x %zu bytes, serial loop: %llu docs/s\n",
+           BATCH_DOCS, doc_size, (u64)BATCH_DOCS * BATCH_ITERATIONS * 1000000000ULL / serial_ns);
+    
+    for (workers = 1; ; workers = min(workers * 2, cpus)) {
+        ns = time_batch_parse(bufs, lens, out, workers) ?: 1;
+        printk(KERN_INFO "Batch of %d x %zu bytes, %u of %u CPUs: %llu docs/s, %llu.%02llux serial\n",
+               BATCH_DOCS, doc_size, workers, cpus,
+               (u64)BATCH_DOCS * BATCH_ITERATIONS * 1000000000ULL / ns,
+               serial_ns / ns, serial_ns * 100 / ns % 100);
+        if (workers == cpus)
+            break;
+    }
+    printk(KERN_INFO "\n");
+    
+cleanup:
+    kfree(out);
+    kfree(lens);
+    kfree(bufs);
+    if (doc)
+        vfree(doc);
+}
+
+/* Parse one document SPLIT_ITERATIONS times, return the time spent parsing */
+static u64 time_split_parse(const char *json, size_t len, const struct jsonk_parse_opts *opts)
+{
+    struct jsonk_value *parsed;
+    u64 start, total = 0;
+    int iter;
+    
+    for (iter = 0; iter < SPLIT_ITERATIONS; iter++) {
+        start = get_time_ns();
+        parsed = jsonk_parse_ex(json, len, opts);
+        total += get_time_ns() - start;
+        if (!parsed)
+            return 0;
+        jsonk_value_put(parsed);
+    }
+    return total;
+}
+
+/* One large root array parsed serially and with JSONK_PARSE_PARALLEL */
+static void test_parallel_parse_performance(void)
+{
+    struct jsonk_parse_opts opts = {
+        .max_array_size = SPLIT_RECORDS,
+        .max_strings = SPLIT_RECORDS * 2,
+    };
+    unsigned int workers, cpus = num_online_cpus();
+    u64 serial_ns, ns;
+    size_t size, i;
+    char *json;
+    
+    printk(KERN_INFO "=== Parallel Array Parsing Performance Tests ===\n");
+    
+    json = vmalloc(SPLIT_RECORDS * 80 + 16);
+    if (!json) {
+        printk(KERN_ERR "Failed to allocate test data\n");
+        return;
+    }
+    
+    size = snprintf(json, 16, "[");
+    for (i = 0; i < SPLIT_RECORDS; i++)
+        size += snprintf(json + size, 80,
+                         "%s{\"id\":%zu,\"name\":\"record_%zu\",\"tags\":[\"t%zu\"],\"ok\":true}",
+                         i ? "," : "", i, i, i % 10);
+    size += snprintf(json + size, 16, "]");
+    
+    serial_ns = time_split_parse(json, size, &opts);
+    if (!serial_ns) {
+        printk(KERN_ERR "Failed to parse record array\n");
+        goto cleanup;
+    }
+    printk(KERN_INFO "Array of %d records (%zu bytes), serial: %llu MB/s\n",
+           SPLIT_RECORDS, size, (u64)size * SPLIT_ITERATIONS * 1000 / serial_ns);
+    
+    opts.flags = JSONK_PARSE_PARALLEL;
+    for (workers = 1; ; workers = min(workers * 2, cpus)) {
+        opts.max_workers = workers;
+        ns = time_split_parse(json, size, &opts);
+        if (!ns) {
+            printk(KERN_ERR "Failed to parse record array on %u CPUs\n", workers);
+            break;
+        }
+        printk(KERN_INFO "Array of %d records, %u of %u CPUs: %llu MB/s, %llu.%02llux serial\n",
+               SPLIT_RECORDS, workers, cpus, (u64)size * SPLIT_ITERATIONS * 1000 / ns,
+               serial_ns / ns, serial_ns * 100 / ns % 100);
+        if (workers == cpus)
+            break;
+    }
+    printk(KERN_INFO "\n");
+    
+cleanup:
+    vfree(json);
+}
+
+/* Memory held per node by parsed documents */
+static void report_footprint(const char *name, const char *json, size_t len, unsigned int flags)
+{
+    struct jsonk_value *parsed;
+    size_t bytes, nodes = 0;
+    
+    parsed = jsonk_parse_flags(json, len, flags);
+    if (!parsed) {
+        printk(KERN_ERR "Failed to parse %s\n", name);
+        return;
+    }
+    
+    bytes = jsonk_value_footprint(parsed, &nodes);
+    printk(KERN_INFO "%s: %zu nodes, %zu bytes, %zu bytes per node (input %zu bytes)\n",
+           name, nodes, bytes, bytes / nodes, len);
+    jsonk_value_put(parsed);
+}
+
+static void test_memory_footprint(void)
+{
+    char *json;
+    size_t size;
+    
+    printk(KERN_INFO "=== Memory Footprint Tests ===\n");
+    printk(KERN_INFO "sizeof(struct jsonk_value) = %zu, sizeof(struct jsonk_member) = %zu\n",
+           sizeof(struct jsonk_value), sizeof(struct jsonk_member));
+    
+    report_footprint("Small JSON", small_json, strlen(small_json), 0);
+    report_footprint("Medium JSON", medium_json, strlen(medium_json), 0);
+    report_footprint("Medium JSON, interned keys", medium_json, strlen(medium_json), JSONK_PARSE_INTERN);
+    
+    json = generate_simple_json(MEDIUM_JSON_SIZE, &size);
+    if (json) {
+        report_footprint("Generated JSON", json, size, 0);
+        vfree(json);
+    }
+    
+    json = generate_large_json();
+    if (json) {
+        report_footprint("Large JSON", json, strlen(json), 0);
+        vfree(json);
+    }
+    
+    /* Structure-heavy: small records with short keys and values */
+    json = vmalloc(FOOTPRINT_RECORDS * 48 + 16);
+    if (json) {
+        int i;
+        
+        size = snprintf(json, 16, "[");
+        for (i = 0; i < FOOTPRINT_RECORDS; i++)
+            size += snprintf(json + size, 48, "%s{\"id\":%d,\"ok\":true,\"tag\":\"t%d\"}",
+                             i ? "," : "", i, i % 10);
+        size += snprintf(json + size, 16, "]");
+        report_footprint("Record array", json, size, 0);
+        report_footprint("Record array, interned keys", json, size, JSONK_PARSE_INTERN);
+        vfree(json);
+    }
+    printk(KERN_INFO "\n");
+}
+
+/*
+ * Corpus benchmarks
+ * 
+ * Every operation is timed call by call on one pinned CPU and reported
+ * as latency percentiles, with the allocations it made, on one
+ * "jsonk_bench:" line of key=value pairs per corpus and operation.
+ * Built-in corpora are generated from a fixed seed; others are loaded
+ * with request_firmware() from the files named by the corpus parameter.
+ */
+#define BENCH_WARMUP 16                 /* Untimed calls before each operation */
+#define BENCH_BATCH 16                  /* Calls between two reads of the counters */
+#define BENCH_BATCH_BYTES (32 << 20)    /* Memory the trees kept by a batch may take */
+#define BENCH_TIME_LIMIT_NS (5 * NSEC_PER_SEC)  /* Per operation, fewer calls are made past it */
+#define BENCH_PATH_LEN 256
+#define BENCH_PATH_DEPTH 8
+#define BENCH_KEY_LEN 24                /* Longest key a benchmark path goes through */
+#define BENCH_CORPUS_SIZE (4 << 20)     /* Room for a generated corpus */
+
+/* Real-world corpora run past the default array and string limits */
+static const struct jsonk_parse_opts bench_opts = {
+    .max_array_size = 1 << 20,
+    .max_object_members = 1 << 20,
+    .max_strings = 1 << 22,
+};
+
+struct bench_corpus {
+    char name[32];
+    const char *json;
+    size_t len;
+    struct jsonk_value *doc;        /* Parsed once, for the operations on a tree */
+    size_t nodes;
+    size_t footprint;
+    unsigned int batch;             /* Calls per batch, bounded by BENCH_BATCH_BYTES */
+    char path[BENCH_PATH_LEN];      /* Dot path to a value deep in doc */
+    char pointer[BENCH_PATH_LEN];   /* The same value as a JSON Pointer */
+    size_t path_len;
+    size_t pointer_len;
+    struct jsonk_value *values[2];  /* Set and patch alternate between them */
+    unsigned int flip;
+    char *out;                      /* Serialization buffer */
+    size_t out_size;
+    size_t out_len;
+    struct jsonk_value *trees[BENCH_BATCH]; /* Trees made or taken by the calls of a batch */
+};
+
+#define BENCH_F_INPUT 0x1           /* Report throughput over the input */
+#define BENCH_F_OUTPUT 0x2          /* Report throughput over the output */
+#define BENCH_F_PATH 0x4            /* Needs a path into the document */
+
+/* One timed call; prepare runs untimed before it */
+struct bench_op {
+    const char *name;
+    unsigned int flags;
+    int (*prepare)(struct bench_corpus *c, unsigned int slot);
+    int (*run)(struct bench_corpus *c, unsigned int slot);
+};
+
+/* State shared by the corpora of a run */
+struct bench_run {
+    u64 *samples;
+    struct jsonk_stats before;
+    struct jsonk_stats after;
+    bool counting;                  /* The stats parameter is on, so allocations are counted */
+};
+
+static int bench_parse(struct bench_corpus *c, unsigned int slot)
+{
+    c->trees[slot] = jsonk_parse_ex(c->json, c->len, &bench_opts);
+    return c->trees[slot] ? 0 : -EINVAL;
+}
+
+static int bench_free(struct bench_corpus *c, unsigned int slot)
+{
+    jsonk_value_put(c->trees[slot]);
+    c->trees[slot] = NULL;
+    return 0;
+}
+
+static int bench_copy(struct bench_corpus *c, unsigned int slot)
+{
+    c->trees[slot] = jsonk_value_deep_copy(c->doc, 0);
+    return c->trees[slot] ? 0 : -ENOMEM;
+}
+
+static int bench_serialize(struct bench_corpus *c, unsigned int slot)
+{
+    return jsonk_serialize(c->doc, c->out, c->out_size, &c->out_len);
+}
+
+static int bench_get(struct bench_corpus *c, unsigned int slot)
+{
+    return jsonk_get_value_by_path(c->doc, c->path, c->path_len) ? 0 : -ENOENT;
+}
+
+static int bench_set(struct bench_corpus *c, unsigned int slot)
+{
+    c->flip ^= 1;
+    return jsonk_set_value_by_path(c->doc, c->path, c->path_len, c->values[c->flip]);
+}
+
+static int bench_patch(struct bench_corpus *c, unsigned int slot)
+{
+    struct jsonk_patch_op op = {
+        .op = JSONK_PATCH_OP_REPLACE,
+        .path = c->pointer,
+        .path_len = c->pointer_len,
+    };
+    
+    c->flip ^= 1;
+    op.value = c->values[c->flip];
+    return jsonk_apply_json_patch_ops(&c->doc, &op, 1) == JSONK_PATCH_SUCCESS ? 0 : -EINVAL;
+}
+
+/* Run in this order: set and patch change the document */
+static const struct bench_op bench_ops[] = {
+    { "parse", BENCH_F_INPUT, NULL, bench_parse },
+    { "free", 0, bench_parse, bench_free },
+    { "copy", 0, NULL, bench_copy },
+    { "serialize", BENCH_F_OUTPUT, NULL, bench_serialize },
+    { "get", BENCH_F_PATH, NULL, bench_get },
+    { "set", BENCH_F_PATH, NULL, bench_set },
+    { "patch", BENCH_F_PATH, NULL, bench_patch },
+};
+
+static void bench_release(struct bench_corpus *c)
+{
+    unsigned int slot;
+    
+    for (slot = 0; slot < BENCH_BATCH; slot++) {
+        jsonk_value_put(c->trees[slot]);
+        c->trees[slot] = NULL;
+    }
+}
+
+static int bench_cmp_ns(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+    
+    return x < y ? -1 : x > y;
+}
+
+/* Sample at a rank given in thousandths, the largest one for short runs */
+static u64 bench_rank(const u64 *sorted, unsigned int n, unsigned int per_mille)
+{
+    return sorted[min_t(u64, (u64)n * per_mille / 1000, n - 1)];
+}
+
+static void bench_run_op(struct bench_run *run, struct bench_corpus *c, const struct bench_op *op)
+{
+    unsigned int i, n = 0, batch, slot;
+    u64 start, deadline, total = 0, allocs = 0, mean;
+    char extra[64];
+    size_t len = 0;
+    int ret = 0;
+    
+    if ((op->flags & BENCH_F_PATH) && !c->path_len)
+        return;
+    
+    /* Warm up the caches and slabs */
+    for (i = 0; i < BENCH_WARMUP && !ret; i++) {
+        ret = op->prepare ? op->prepare(c, 0) : 0;
+        if (!ret)
+            ret = op->run(c, 0);
+        bench_release(c);
+    }
+    
+    deadline = local_clock() + BENCH_TIME_LIMIT_NS;
+    while (!ret && n < bench_iterations && local_clock() < deadline) {
+        batch = min(c->batch, bench_iterations - n);
+        for (slot = 0; slot < batch && !ret; slot++)
+            ret = op->prepare ? op->prepare(c, slot) : 0;
+        
+        /* Untimed work stays outside the counter reads too */
+        jsonk_stats_read(&run->before);
+        for (slot = 0; slot < batch && !ret; slot++) {
+            start = local_clock();
+            ret = op->run(c, slot);
+            run->samples[n + slot] = local_clock() - start;
+        }
+        jsonk_stats_read(&run->after);
+        
+        allocs += run->after.allocs - run->before.allocs;
+        bench_release(c);
+        n += batch;
+        cond_resched();
+    }
+    if (ret) {
+        printk(KERN_ERR "jsonk_bench: corpus=%s op=%s failed (%d)\n", c->name, op->name, ret);
+        return;
+    }
+    
+    for (i = 0; i < n; i++)
+        total += run->samples[i];
+    sort(run->samples, n, sizeof(*run->samples), bench_cmp_ns, NULL);
+    mean = total / n;
+    
+    extra[0] = '\0';
+    if ((op->flags & (BENCH_F_INPUT | BENCH_F_OUTPUT)) && mean)
+        len += scnprintf(extra + len, sizeof(extra) - len, " mb_s=%llu",
+                         ((u64)(op->flags & BENCH_F_INPUT ? c->len : c->out_len) * NSEC_PER_SEC / mean) >> 20);
+    if (run->counting)
+        len += scnprintf(extra + len, sizeof(extra) - len, " allocs_per_op=%llu.%02llu",
+                         allocs / n, allocs * 100 / n % 100);
+    
+    printk(KERN_INFO "jsonk_bench: corpus=%s op=%s n=%u mean_ns=%llu p50_ns=%llu p99_ns=%llu p999_ns=%llu max_ns=%llu%s\n",
+           c->name, op->name, n, mean, bench_rank(run->samples, n, 500), bench_rank(run->samples, n, 990),
+           bench_rank(run->samples, n, 999), run->samples[n - 1], extra);
+}
+
+/* Whether a key reads the same in a dot path, a JSON Pointer and a key=value line */
+static bool bench_plain_key(const struct jsonk_member *member)
+{
+    u16 i;
+    
+    if (!member->key_len || member->key_len > BENCH_KEY_LEN)
+        return false;
+    for (i = 0; i < member->key_len; i++) {
+        if (member->key[i] <= ' ' || strchr(".[]~/=\"", member->key[i]))
+            return false;
+    }
+    return true;
+}
+
+static u32 bench_children(const struct jsonk_value *value)
+{
+    if (value->type == JSONK_VALUE_OBJECT)
+        return value->u.object.size;
+    if (value->type == JSONK_VALUE_ARRAY)
+        return value->u.array.size;
+    return 0;
+}
+
+/*
+ * Pick a value deep in the document: the middle element of arrays, and
+ * the member of objects with the most children, or the middle member of
+ * objects whose values have none
+ */
+static void bench_find_path(struct bench_corpus *c)
+{
+    struct jsonk_value *value = c->doc;
+    struct jsonk_member *member, *found;
+    unsigned int depth, index, middle;
+    u32 children, best;
+    
+    for (depth = 0; depth < BENCH_PATH_DEPTH; depth++) {
+        if (value->type == JSONK_VALUE_ARRAY && value->u.array.size) {
+            index = value->u.array.size / 2;
+            c->path_len += scnprintf(c->path + c->path_len, BENCH_PATH_LEN - c->path_len, "[%u]", index);
+            c->pointer_len += scnprintf(c->pointer + c->pointer_len, BENCH_PATH_LEN - c->pointer_len,
+                                        "/%u", index);
+            value = value->u.array.items[index];
+        } else if (value->type == JSONK_VALUE_OBJECT) {
+            found = NULL;
+            best = 0;
+            index = 0;
+            middle = value->u.object.size / 2;
+            list_for_each_entry(member, &value->u.object.members, list) {
+                children = bench_children(member->value);
+                if (bench_plain_key(member) &&
+                    (!found || children > best || (!best && index <= middle))) {
+                    found = member;
+                    best = children;
+                }
+                index++;
+            }
+            if (!found)
+                break;
+            c->path_len += scnprintf(c->path + c->path_len, BENCH_PATH_LEN - c->path_len, "%s%.*s",
+                                     c->path_len ? "." : "", found->key_len, found->key);
+            c->pointer_len += scnprintf(c->pointer + c->pointer_len, BENCH_PATH_LEN - c->pointer_len,
+                                        "/%.*s", found->key_len, found->key);
+            value = found->value;
+        } else {
+            break;
+        }
+    }
+}
+
+static void bench_corpus(struct bench_run *run, const char *name, const char *json, size_t len)
+{
+    struct bench_corpus *c;
+    unsigned int i;
+    
+    c = kzalloc(sizeof(*c), GFP_KERNEL);
+    if (!c) {
+        printk(KERN_ERR "jsonk_bench: corpus=%s failed to allocate\n", name);
+        return;
+    }
+    strscpy(c->name, name, sizeof(c->name));
+    c->json = json;
+    c->len = len;
+    
+    c->doc = jsonk_parse_ex(json, len, &bench_opts);
+    c->values[0] = jsonk_value_create_s64(1);
+    c->values[1] = jsonk_value_create_s64(2);
+    if (!c->doc || !c->values[0] || !c->values[1]) {
+        printk(KERN_ERR "jsonk_bench: corpus=%s failed to parse\n", c->name);
+        goto cleanup;
+    }
+    
+    c->out_size = jsonk_serialized_size(c->doc) + 1;
+    c->out = vmalloc(c->out_size);
+    if (!c->out) {
+        printk(KERN_ERR "jsonk_bench: corpus=%s failed to allocate\n", c->name);
+        goto cleanup;
+    }
+    
+    c->footprint = jsonk_value_footprint(c->doc, &c->nodes);
+    c->batch = clamp_t(size_t, BENCH_BATCH_BYTES / max_t(size_t, c->footprint, 1), 1, BENCH_BATCH);
+    bench_find_path(c);
+    printk(KERN_INFO "jsonk_bench: corpus=%s bytes=%zu nodes=%zu footprint=%zu path=%s\n",
+           c->name, len, c->nodes, c->footprint, c->path_len ? c->path : "-");
+    
+    for (i = 0; i < ARRAY_SIZE(bench_ops); i++)
+        bench_run_op(run, c, &bench_ops[i]);
+    
+cleanup:
+    vfree(c->out);
+    jsonk_value_put(c->values[0]);
+    jsonk_value_put(c->values[1]);
+    jsonk_value_put(c->doc);
+    kfree(c);
+}
+
+/* Output for a generated corpus; len reaches size when it did not fit */
+struct bench_buf {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+static __printf(2, 3) void bench_emit(struct bench_buf *buf, const char *fmt, ...)
+{
+    va_list args;
+    
+    if (buf->len >= buf->size)
+        return;
+    va_start(args, fmt);
+    buf->len += vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, args);
+    va_end(args);
+}
+
+static u32 bench_seed;
+
+/* Fixed-seed generator, so generated corpora are the same on every run */
+static u32 bench_random(u32 range)
+{
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return (bench_seed >> 8) % range;
+}
+
+static const char *const bench_words[] = {
+    "kernel", "json", "parse", "\\u3053\\u3093\\u306b\\u3061\\u306f", "patch", "\\ud83d\\ude80",
+    "release", "\\\"quoted\\\"", "line\\nbreak", "caf\\u00e9", "network", "\\u6771\\u4eac", "driver",
+};
+
+static void bench_text(struct bench_buf *buf, unsigned int words)
+{
+    unsigned int i;
+    
+    for (i = 0; i < words; i++)
+        bench_emit(buf, "%s%s", i ? " " : "", bench_words[bench_random(ARRAY_SIZE(bench_words))]);
+}
+
+/* Social media timeline: string-heavy, with escapes, non-ASCII text and nested users */
+static void bench_gen_twitter(struct bench_buf *buf)
+{
+    unsigned int i, j, count;
+    u64 id;
+    
+    bench_emit(buf, "{\"statuses\":[");
+    for (i = 0; i < 200; i++) {
+        id = 505874924095815681ULL - (u64)i * 7919;
+        bench_emit(buf, "%s{\"metadata\":{\"result_type\":\"recent\",\"iso_language_code\":\"ja\"},"
+                   "\"created_at\":\"Sun Aug 31 00:%02u:%02u +0000 2014\",\"id\":%llu,\"id_str\":\"%llu\",\"text\":\"",
+                   i ? "," : "", 59 - i % 60, bench_random(60), id, id);
+        bench_text(buf, 6 + bench_random(14));
+        bench_emit(buf, "\",\"source\":\"<a href=\\\"http:\\/\\/twitter.com\\/download\\/iphone\\\" "
+                   "rel=\\\"nofollow\\\">Twitter for iPhone<\\/a>\",\"truncated\":false,"
+                   "\"in_reply_to_status_id\":null,\"in_reply_to_user_id\":null,"
+                   "\"user\":{\"id\":%u,\"id_str\":\"%u\",\"name\":\"",
+                   1186275104 + i, 1186275104 + i);
+        bench_text(buf, 2);
+        bench_emit(buf, "\",\"screen_name\":\"user_%u\",\"location\":\"\",\"description\":\"", i);
+        bench_text(buf, 4 + bench_random(20));
+        bench_emit(buf, "\",\"url\":null,\"protected\":false,\"followers_count\":%u,\"friends_count\":%u,"
+                   "\"listed_count\":%u,\"created_at\":\"Fri Feb 01 07:1%u:23 +0000 2013\","
+                   "\"favourites_count\":%u,\"utc_offset\":null,\"time_zone\":null,\"geo_enabled\":%s,"
+                   "\"verified\":false,\"statuses_count\":%u,\"lang\":\"ja\","
+                   "\"profile_background_color\":\"C0DEED\",\"profile_image_url\":"
+                   "\"http:\\/\\/pbs.twimg.com\\/profile_images\\/%u\\/normal.jpeg\","
+                   "\"default_profile\":%s,\"following\":false},\"geo\":null,\"coordinates\":null,"
+                   "\"place\":null,\"contributors\":null,\"retweet_count\":%u,\"favorite_count\":%u,"
+                   "\"entities\":{\"hashtags\":[",
+                   bench_random(5000), bench_random(2000), bench_random(50), bench_random(10),
+                   bench_random(10000), bench_random(2) ? "true" : "false", bench_random(100000),
+                   bench_random(1000000000), bench_random(2) ? "true" : "false",
+                   bench_random(100), bench_random(100));
+        count = bench_random(3);
+        for (j = 0; j < count; j++)
+            bench_emit(buf, "%s{\"text\":\"tag%u\",\"indices\":[%u,%u]}", j ? "," : "",
+                       bench_random(50), 10 * j, 10 * j + 6);
+        bench_emit(buf, "],\"symbols\":[],\"urls\":[],\"user_mentions\":[");
+        count = bench_random(3);
+        for (j = 0; j < count; j++)
+            bench_emit(buf, "%s{\"screen_name\":\"user_%u\",\"name\":\"mention\",\"id\":%u,"
+                       "\"id_str\":\"%u\",\"indices\":[%u,%u]}", j ? "," : "",
+                       j, 866260188 + j, 866260188 + j, 12 * j, 12 * j + 9);
+        bench_emit(buf, "]},\"favorited\":false,\"retweeted\":false,\"lang\":\"ja\"}");
+    }
+    bench_emit(buf, "],\"search_metadata\":{\"completed_in\":0.087,\"max_id\":505874924095815681,"
+               "\"max_id_str\":\"505874924095815681\",\"query\":\"%%E4%%B8%%80\",\"count\":100,"
+               "\"since_id\":0,\"since_id_str\":\"0\"}}");
+}
+
+/* Event catalog: integer ids, numeric keys, nulls and many small arrays */
+static void bench_gen_citm(struct bench_buf *buf)
+{
+    unsigned int i, j, k, count, areas;
+    
+    bench_emit(buf, "{\"areaNames\":{");
+    for (i = 0; i < 20; i++)
+        bench_emit(buf, "%s\"%u\":\"Area %u\"", i ? "," : "", 205705993 + i, i);
+    bench_emit(buf, "},\"events\":{");
+    for (i = 0; i < 250; i++)
+        bench_emit(buf, "%s\"%u\":{\"description\":null,\"id\":%u,\"logo\":%s,\"name\":\"Event %u\","
+                   "\"subTopicIds\":[%u,%u,%u],\"subjectCode\":null,\"subtitle\":null,\"topicIds\":[%u,%u]}",
+                   i ? "," : "", 138586341 + 13 * i, 138586341 + 13 * i,
+                   i % 3 ? "null" : "\"\\/images\\/UE0AAAAACEKo6QAAAAZDSVRN\"", i,
+                   337184269 + bench_random(100), 337184283 + bench_random(100), 337184262,
+                   324846099 + bench_random(10), 107888604);
+    bench_emit(buf, "},\"performances\":[");
+    for (i = 0; i < 1200; i++) {
+        bench_emit(buf, "%s{\"eventId\":%u,\"id\":%u,\"logo\":null,\"name\":null,\"prices\":[",
+                   i ? "," : "", 138586341 + 13 * (i % 250), 339887544 + i);
+        count = 1 + bench_random(4);
+        for (j = 0; j < count; j++)
+            bench_emit(buf, "%s{\"amount\":%u,\"audienceSubCategoryId\":337100890,\"seatCategoryId\":%u}",
+                       j ? "," : "", 10000 + 250 * bench_random(400), 338937295 + j);
+        bench_emit(buf, "],\"seatCategories\":[");
+        count = 1 + bench_random(3);
+        for (j = 0; j < count; j++) {
+            bench_emit(buf, "%s{\"areas\":[", j ? "," : "");
+            areas = 1 + bench_random(6);
+            for (k = 0; k < areas; k++)
+                bench_emit(buf, "%s{\"areaId\":%u,\"blockIds\":[]}", k ? "," : "", 205705993 + bench_random(20));
+            bench_emit(buf, "],\"seatCategoryId\":%u}", 338937295 + j);
+        }
+        bench_emit(buf, "],\"seatMapImage\":null,\"start\":%llu,\"venueCode\":\"PLEYEL_PLEYEL\"}",
+                   1372701600000ULL + (u64)i * 86400000);
+    }
+    bench_emit(buf, "],\"venueNames\":{\"PLEYEL_PLEYEL\":\"Salle Pleyel\"}}");
+}
+
+/* Geometry: long arrays of coordinate pairs with full-precision decimals */
+static void bench_gen_canada(struct bench_buf *buf)
+{
+    unsigned int ring, i;
+    
+    bench_emit(buf, "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\","
+               "\"properties\":{\"name\":\"Canada\"},\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[");
+    for (ring = 0; ring < 16; ring++) {
+        bench_emit(buf, "%s[", ring ? "," : "");
+        for (i = 0; i < 2000; i++)
+            bench_emit(buf, "%s[-%u.%09u%06u,%u.%09u%06u]", i ? "," : "",
+                       52 + bench_random(90), bench_random(1000000000), bench_random(1000000),
+                       41 + bench_random(40), bench_random(1000000000), bench_random(1000000));
+        bench_emit(buf, "]");
+    }
+    bench_emit(buf, "]}}]}");
+}
+
+/* The user record the other benchmarks use, as a list */
+static void bench_gen_records(struct bench_buf *buf)
+{
+    static const char *const cities[] = { "CPH", "Berlin", "Oslo", "Tehran", "Lisbon" };
+    unsigned int i;
+    
+    bench_emit(buf, "{\"records\":[");
+    for (i = 0; i < 2000; i++)
+        bench_emit(buf, "%s{\"user\":{\"id\":%u,\"name\":\"user_%u\",\"email\":\"user_%u@example.com\","
+                   "\"profile\":{\"age\":%u,\"city\":\"%s\",\"preferences\":[\"coding\",\"music\",\"travel\"]}},"
+                   "\"metadata\":{\"created\":\"2025-01-%02u\",\"updated\":\"2025-02-%02u\",\"version\":%u}}",
+                   i ? "," : "", i, i, i, 18 + bench_random(60), cities[bench_random(ARRAY_SIZE(cities))],
+                   1 + bench_random(28), 1 + bench_random(28), 1 + bench_random(9));
+    bench_emit(buf, "]}");
+}
+
+static const struct {
+    const char *name;
+    void (*generate)(struct bench_buf *buf);
+} bench_generated[] = {
+    { "twitter_like", bench_gen_twitter },
+    { "citm_like", bench_gen_citm },
+    { "canada_like", bench_gen_canada },
+    { "records", bench_gen_records },
+};
+
+/* Corpora from the corpus parameter, named after their files without directory or extension */
+static void bench_firmware_corpora(struct bench_run *run)
+{
+    const struct firmware *fw;
+    char *names, *cursor, *file, *name, *ext;
+    int ret;
+    
+    if (!bench_corpora || !*bench_corpora)
+        return;
+    
+    names = kstrdup(bench_corpora, GFP_KERNEL);
+    if (!names)
+        return;
+    
+    cursor = names;
+    while ((file = strsep(&cursor, ",")) != NULL) {
+        if (!*file)
+            continue;
+        ret = request_firmware(&fw, file, NULL);
+        if (ret) {
+            printk(KERN_ERR "jsonk_bench: corpus=%s failed to load (%d)\n", file, ret);
+            continue;
+        }
+        name = strrchr(file, '/');
+        name = name ? name + 1 : file;
+        ext = strchr(name, '.');
+        if (ext)
+            *ext = '\0';
+        bench_corpus(run, name, (const char *)fw->data, fw->size);
+        release_firmware(fw);
+    }
+    kfree(names);
+}
+
+/* Smallest gap between two clock reads, included in every sample */
+static u64 bench_clock_cost(void)
+{
+    u64 best = U64_MAX, start;
+    int i;
+    
+    for (i = 0; i < 1000; i++) {
+        start = local_clock();
+        best = min(best, local_clock() - start);
+    }
+    return best;
+}
+
+static void test_corpus_benchmarks(void)
+{
+    struct bench_buf buf = { .size = BENCH_CORPUS_SIZE };
+    struct bench_run *run;
+    struct jsonk_value *probe;
+    cpumask_var_t saved;
+    unsigned int i;
+    int cpu, ret;
+    
+    printk(KERN_INFO "=== Corpus Benchmarks ===\n");
+    
+    if (!bench_iterations) {
+        printk(KERN_ERR "jsonk_bench: iterations must be at least 1\n");
+        return;
+    }
+    if (!alloc_cpumask_var(&saved, GFP_KERNEL))
+        return;
+    run = kzalloc(sizeof(*run), GFP_KERNEL);
+    buf.data = vmalloc(buf.size);
+    if (run)
+        run->samples = vmalloc(array_size(bench_iterations, sizeof(*run->samples)));
+    if (!run || !run->samples || !buf.data) {
+        printk(KERN_ERR "jsonk_bench: failed to allocate\n");
+        goto cleanup;
+    }
+    
+    /* One CPU for the whole run: local_clock() stays monotonic, caches stay warm */
+    cpu = bench_cpu < 0 ? raw_smp_processor_id() : bench_cpu;
+    cpumask_copy(saved, current->cpus_ptr);
+    ret = cpu_online(cpu) ? set_cpus_allowed_ptr(current, cpumask_of(cpu)) : -EINVAL;
+    if (ret) {
+        printk(KERN_ERR "jsonk_bench: cannot run on CPU %d (%d)\n", cpu, ret);
+        goto cleanup;
+    }
+    
+    /* The library counts nothing, allocations included, while its stats parameter is off */
+    jsonk_stats_read(&run->before);
+    probe = jsonk_parse("{}", 2);
+    jsonk_value_put(probe);
+    jsonk_stats_read(&run->after);
+    run->counting = run->after.parses != run->before.parses;
+    
+    printk(KERN_INFO "jsonk_bench: begin release=%s cpu=%d iterations=%u warmup=%u clock_ns=%llu allocs=%s\n",
+           utsname()->release, cpu, bench_iterations, BENCH_WARMUP, bench_clock_cost(),
+           run->counting ? "on" : "off");
+    
+    for (i = 0; i < ARRAY_SIZE(bench_generated); i++) {
+        buf.len = 0;
+        bench_seed = 1;
+        bench_generated[i].generate(&buf);
+        if (buf.len >= buf.size) {
+            printk(KERN_ERR "jsonk_bench: corpus=%s too large\n", bench_generated[i].name);
+            continue;
+        }
+        bench_corpus(run, bench_generated[i].name, buf.data, buf.len);
+    }
+    bench_firmware_corpora(run);
+    
+    printk(KERN_INFO "jsonk_bench: end\n");
+    set_cpus_allowed_ptr(current, saved);
+    
+cleanup:
+    if (run)
+        vfree(run->samples);
+    kfree(run);
+    vfree(buf.data);
+    free_cpumask_var(saved);
+    printk(KERN_INFO "\n");
+}
+
+static int __init performance_test_init(void)
+{
+    bool micro = !strcmp(bench_suite, "all") || !strcmp(bench_suite, "micro");
+    bool corpora = !strcmp(bench_suite, "all") || !strcmp(bench_suite, "corpus");
+    
+    if (!micro && !corpora) {
+        printk(KERN_ERR "JSONK Performance Test: unknown suite \"%s\"\n", bench_suite);
+        return -EINVAL;
+    }
+    
+    printk(KERN_INFO "JSONK Comprehensive Performance Test loaded\n");
     printk(KERN_INFO "Starting performance benchmarks...\n\n");
     
-    test_parsing_performance();
-    test_pool_performance();
-    test_serialization_performance();
-    test_patching_performance();
-    test_scalability();
+    if (micro) {
+        test_parsing_performance();
+        test_pool_performance();
+        test_serialization_performance();
+        test_number_performance();
+        test_string_output_performance();
+        test_nesting_performance();
+        test_patching_performance();
+        test_rfc_patch_performance();
+        test_snapshot_performance();
+        test_diff_performance();
+        test_scalability();
+        test_lookup_scalability();
+        test_path_lookup_performance();
+        test_binary_performance();
+        test_batch_performance();
+        test_parallel_parse_performance();
+        test_memory_footprint();
+    }
+    if (corpora)
+        test_corpus_benchmarks();
     
     printk(KERN_INFO "Performance testing completed!\n");
     printk(KERN_INFO "Check dmesg for detailed results\n");